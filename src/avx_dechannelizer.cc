@@ -0,0 +1,464 @@
+// 256 and 512 bit versions of the (working) sse dechannelizers
+// Copyright (C) 2007-2013 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.nl
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <avx_dechannelizer.h>
+#include <sse_dechannelizer.h>
+
+// The wide versions do the largest multiple of 64 bytes of the input block;
+// all the sse routines work on 16 or 32 bytes at a time so they can finish
+// the remainder - including their particular handling of blocks that are
+// not a multiple of that - and the output is identical to what the sse
+// routine would've produced for the whole block.
+static const size_t  avx_chunk = 64;
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || __GNUC__>=5)
+
+// gcc's avx512 headers deliberately use uninitialized values for "don't
+// care" operands, which -Werror turns into a failed build
+#if !defined(__clang__)
+    #pragma GCC diagnostic ignored "-Wuninitialized"
+    #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+#include <immintrin.h>
+
+#define AVX2_FN   __attribute__((target("avx2")))
+#define AVX512_FN __attribute__((target("avx512f,avx512bw")))
+
+bool have_avx2_dechannelizers( void ) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+bool have_avx512_dechannelizers( void ) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+}
+
+typedef unsigned char* uptr;
+
+// Store the low/high 64 bits of an xmm register
+AVX2_FN static inline void storelo(void* dst, __m128i v) {
+    _mm_storel_epi64((__m128i*)dst, v);
+}
+AVX2_FN static inline void storehi(void* dst, __m128i v) {
+    _mm_storeh_pd((double*)dst, _mm_castsi128_pd(v));
+}
+
+/////////////////////////////////////////////////////////////////////////
+//
+//   The byte/word splitters
+//
+//   Within each 16 byte lane a byte shuffle puts the bytes for each output
+//   into consecutive dwords ("lanepattern"), after which a dword
+//   permutation across the whole register makes the data for each output
+//   contiguous.
+//
+/////////////////////////////////////////////////////////////////////////
+
+// 8bitx4, 16bitx4: dword i of each lane has 4 bytes of output i
+static const char lanepattern_8bitx4[16]  = { 0, 4, 8,12,  1, 5, 9,13,  2, 6,10,14,  3, 7,11,15 };
+static const char lanepattern_16bitx4[16] = { 0, 1, 8, 9,  2, 3,10,11,  4, 5,12,13,  6, 7,14,15 };
+// 16bitx2, 32bitx2: qword i of each lane has 8 bytes of output i
+static const char lanepattern_16bitx2[16] = { 0, 1, 4, 5,  8, 9,12,13,  2, 3, 6, 7, 10,11,14,15 };
+static const char lanepattern_32bitx2[16] = { 0, 1, 2, 3,  8, 9,10,11,  4, 5, 6, 7, 12,13,14,15 };
+
+AVX2_FN static void split_by4_avx2(const char* lanepattern, uptr src, size_t len,
+                                   uptr d0, uptr d1, uptr d2, uptr d3) {
+    const __m256i  pat  = _mm256_broadcastsi128_si256( _mm_loadu_si128((const __m128i*)lanepattern) );
+    // dwords: [0 1 2 3 | 0 1 2 3] => qwords [0 1 2 3]
+    const __m256i  perm = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    for(size_t i=0; i<len; i+=avx_chunk, d0+=16, d1+=16, d2+=16, d3+=16) {
+        const __m256i  v0 = _mm256_permutevar8x32_epi32(
+                                _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(src+i)), pat), perm);
+        const __m256i  v1 = _mm256_permutevar8x32_epi32(
+                                _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(src+i+32)), pat), perm);
+        // [0 0 | 2 2] and [1 1 | 3 3]
+        const __m256i  lo = _mm256_unpacklo_epi64(v0, v1);
+        const __m256i  hi = _mm256_unpackhi_epi64(v0, v1);
+
+        _mm_storeu_si128((__m128i*)d0, _mm256_castsi256_si128(lo));
+        _mm_storeu_si128((__m128i*)d1, _mm256_castsi256_si128(hi));
+        _mm_storeu_si128((__m128i*)d2, _mm256_extracti128_si256(lo, 1));
+        _mm_storeu_si128((__m128i*)d3, _mm256_extracti128_si256(hi, 1));
+    }
+}
+
+AVX2_FN static void split_by2_avx2(const char* lanepattern, uptr src, size_t len, uptr d0, uptr d1) {
+    const __m256i  pat  = _mm256_broadcastsi128_si256( _mm_loadu_si128((const __m128i*)lanepattern) );
+    // qwords: [0 1 | 0 1] => [0 0 | 1 1]
+    const __m256i  perm = _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7);
+
+    for(size_t i=0; i<len; i+=32, d0+=16, d1+=16) {
+        const __m256i  v = _mm256_permutevar8x32_epi32(
+                                _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(src+i)), pat), perm);
+
+        _mm_storeu_si128((__m128i*)d0, _mm256_castsi256_si128(v));
+        _mm_storeu_si128((__m128i*)d1, _mm256_extracti128_si256(v, 1));
+    }
+}
+
+AVX512_FN static void split_by4_avx512(const char* lanepattern, uptr src, size_t len,
+                                       uptr d0, uptr d1, uptr d2, uptr d3) {
+    size_t         i    = 0;
+    const __m512i  pat  = _mm512_broadcast_i32x4( _mm_loadu_si128((const __m128i*)lanepattern) );
+    // dword i of lane L => dword 4*i + L
+    const __m512i  perm = _mm512_setr_epi32(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+    // combine the 16 byte pieces of two registers into 32 byte pieces
+    const __m512i  lo   = _mm512_setr_epi64(0, 1, 8, 9, 2, 3, 10, 11);
+    const __m512i  hi   = _mm512_setr_epi64(4, 5, 12, 13, 6, 7, 14, 15);
+
+    // Doing 128 bytes at a time is notably faster than 64
+    for( ; i+2*avx_chunk<=len; i+=2*avx_chunk, d0+=32, d1+=32, d2+=32, d3+=32) {
+        const __m512i  v0 = _mm512_permutexvar_epi32(perm,
+                                _mm512_shuffle_epi8(_mm512_loadu_si512((const void*)(src+i)), pat));
+        const __m512i  v1 = _mm512_permutexvar_epi32(perm,
+                                _mm512_shuffle_epi8(_mm512_loadu_si512((const void*)(src+i+avx_chunk)), pat));
+        const __m512i  r01 = _mm512_permutex2var_epi64(v0, lo, v1);
+        const __m512i  r23 = _mm512_permutex2var_epi64(v0, hi, v1);
+
+        _mm256_storeu_si256((__m256i*)d0, _mm512_extracti64x4_epi64(r01, 0));
+        _mm256_storeu_si256((__m256i*)d1, _mm512_extracti64x4_epi64(r01, 1));
+        _mm256_storeu_si256((__m256i*)d2, _mm512_extracti64x4_epi64(r23, 0));
+        _mm256_storeu_si256((__m256i*)d3, _mm512_extracti64x4_epi64(r23, 1));
+    }
+    if( i<len ) {
+        const __m512i  v = _mm512_permutexvar_epi32(perm,
+                                _mm512_shuffle_epi8(_mm512_loadu_si512((const void*)(src+i)), pat));
+
+        _mm_storeu_si128((__m128i*)d0, _mm512_extracti32x4_epi32(v, 0));
+        _mm_storeu_si128((__m128i*)d1, _mm512_extracti32x4_epi32(v, 1));
+        _mm_storeu_si128((__m128i*)d2, _mm512_extracti32x4_epi32(v, 2));
+        _mm_storeu_si128((__m128i*)d3, _mm512_extracti32x4_epi32(v, 3));
+    }
+}
+
+AVX512_FN static void split_by2_avx512(const char* lanepattern, uptr src, size_t len, uptr d0, uptr d1) {
+    const __m512i  pat  = _mm512_broadcast_i32x4( _mm_loadu_si128((const __m128i*)lanepattern) );
+    // qword i of lane L => qword 4*i + L
+    const __m512i  perm = _mm512_setr_epi32(0, 1, 4, 5, 8, 9, 12, 13, 2, 3, 6, 7, 10, 11, 14, 15);
+
+    for(size_t i=0; i<len; i+=avx_chunk, d0+=32, d1+=32) {
+        const __m512i  v = _mm512_permutexvar_epi32(perm,
+                                _mm512_shuffle_epi8(_mm512_loadu_si512((const void*)(src+i)), pat));
+
+        _mm256_storeu_si256((__m256i*)d0, _mm512_extracti64x4_epi64(v, 0));
+        _mm256_storeu_si256((__m256i*)d1, _mm512_extracti64x4_epi64(v, 1));
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////
+//
+//   swap_sign_mag: swap each pair of bits
+//
+/////////////////////////////////////////////////////////////////////////
+AVX2_FN static void swap_sign_mag_avx2_(uptr src, size_t len, uptr d0) {
+    const __m256i  m = _mm256_set1_epi8( 0x55 );
+
+    for(size_t i=0; i<len; i+=32) {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)(src+i));
+
+        _mm256_storeu_si256((__m256i*)(d0+i),
+                            _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(v, m), 1),
+                                            _mm256_and_si256(_mm256_srli_epi16(v, 1), m)));
+    }
+}
+
+AVX512_FN static void swap_sign_mag_avx512_(uptr src, size_t len, uptr d0) {
+    const __m512i  m = _mm512_set1_epi8( 0x55 );
+
+    for(size_t i=0; i<len; i+=avx_chunk) {
+        const __m512i v = _mm512_loadu_si512((const void*)(src+i));
+
+        _mm512_storeu_si512((void*)(d0+i),
+                            _mm512_or_si512(_mm512_slli_epi16(_mm512_and_si512(v, m), 1),
+                                            _mm512_and_si512(_mm512_srli_epi16(v, 1), m)));
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////
+//
+//   The 8 channel 2 bit extractors
+//
+//   Both work in two phases. First, within each 16 byte lane, the bits are
+//   rearranged such that each byte holds one output byte for one of the
+//   channels; two output bytes per channel per lane. The 'gather' pattern
+//   tells which byte of the lane is output byte 's' of channel 'c'
+//   (gather[2*c+s]).
+//
+//   The second phase is identical for both: collect the bytes of each
+//   channel from all lanes and write them out.
+//
+/////////////////////////////////////////////////////////////////////////
+
+// In 8Ch2bit_hv each 16 bit word has 2 bits for each of the 8 channels.
+// The first phase puts the low and high bytes of four consecutive words
+// in one dword - a 4x4 matrix of 2-bit elements - and transposes it.
+// After that dwords 0 and 1 have one byte for channels 0-3, dwords 2 and 3
+// for channels 4-7.
+static const char bytes_8Ch2bit_hv[16]  = { 0, 2, 4, 6,  8,10,12,14,  1, 3, 5, 7,  9,11,13,15 };
+static const char gather_8Ch2bit_hv[16] = { 0, 4,  1, 5,  2, 6,  3, 7,  8,12,  9,13, 10,14, 11,15 };
+
+// In 8Ch2bit1to2_hv byte 'b' of each 32 bit word has the even bits for
+// channel 2b and the odd bits for channel 2b+1, in funny order. A nibble
+// lookup sorts them out, after which combining two words gives one byte
+// for each channel: the qwords of each lane have the bytes for channels
+// 0 2 4 6 1 3 5 7 in that order.
+static const char lonibble_8Ch2bit1to2_hv[16] = {
+    // input bit 0 => 1, 1 => 5, 2 => 3, 3 => 7
+    0x00, 0x02, 0x20, 0x22, 0x08, 0x0a, 0x28, 0x2a,
+    (char)0x80, (char)0x82, (char)0xa0, (char)0xa2, (char)0x88, (char)0x8a, (char)0xa8, (char)0xaa
+};
+static const char hinibble_8Ch2bit1to2_hv[16] = {
+    // input bit 4 => 0, 5 => 4, 6 => 2, 7 => 6
+    0x00, 0x01, 0x10, 0x11, 0x04, 0x05, 0x14, 0x15,
+    0x40, 0x41, 0x50, 0x51, 0x44, 0x45, 0x54, 0x55
+};
+static const char gather_8Ch2bit1to2_hv[16] = { 0, 8,  4,12,  1, 9,  5,13,  2,10,  6,14,  3,11,  7,15 };
+
+// Delta swaps transposing a 4x4 matrix of 2-bit elements, rows are bytes,
+// followed by swapping the bits of each element (sign/mag => mag/sign)
+#define TRANSPOSE4x4x2(W, v) \
+    do { \
+        __m##W##i t; \
+        t = _mm##W##_and_si##W(_mm##W##_xor_si##W(v, _mm##W##_srli_epi32(v, 6)), m6); \
+        v = _mm##W##_xor_si##W(v, _mm##W##_xor_si##W(t, _mm##W##_slli_epi32(t, 6))); \
+        t = _mm##W##_and_si##W(_mm##W##_xor_si##W(v, _mm##W##_srli_epi32(v, 12)), m12); \
+        v = _mm##W##_xor_si##W(v, _mm##W##_xor_si##W(t, _mm##W##_slli_epi32(t, 12))); \
+        v = _mm##W##_or_si##W(_mm##W##_slli_epi32(_mm##W##_and_si##W(v, m55), 1), \
+                              _mm##W##_and_si##W(_mm##W##_srli_epi32(v, 1), m55)); \
+    } while( 0 )
+
+#define NIBBLELOOKUP(W, v) \
+    do { \
+        __m##W##i ev, od; \
+        v = _mm##W##_or_si##W(_mm##W##_shuffle_epi8(lolut, _mm##W##_and_si##W(v, m0f)), \
+                              _mm##W##_shuffle_epi8(hilut, _mm##W##_and_si##W(_mm##W##_srli_epi16(v, 4), m0f))); \
+        ev = _mm##W##_or_si##W(_mm##W##_and_si##W(v, lo0f), \
+                               _mm##W##_and_si##W(_mm##W##_srli_epi64(v, 28), lof0)); \
+        od = _mm##W##_or_si##W(_mm##W##_and_si##W(_mm##W##_srli_epi64(v, 4), lo0f), \
+                               _mm##W##_and_si##W(_mm##W##_srli_epi64(v, 32), lof0)); \
+        v = _mm##W##_or_si##W(ev, _mm##W##_slli_epi64(od, 32)); \
+    } while( 0 )
+
+// Phase two, 32 bytes of input per register; lane L has words [c0 .. c7],
+// with (s0 s1) for each channel
+AVX2_FN static inline __m256i gather_8Ch_avx2(__m256i v) {
+    // => lane 0: [c0 .. c3] lane 0, [c0 .. c3] lane 1, lane 1: same for c4 .. c7
+    //    and then => dword c: (s0 s1) from lane 0, (s0 s1) from lane 1
+    const __m256i  pat = _mm256_setr_epi8(0, 1, 8, 9,  2, 3,10,11,  4, 5,12,13,  6, 7,14,15,
+                                          0, 1, 8, 9,  2, 3,10,11,  4, 5,12,13,  6, 7,14,15);
+    return _mm256_shuffle_epi8(_mm256_permute4x64_epi64(v, 0xd8), pat);
+}
+
+AVX2_FN static inline void store_8Ch_avx2(__m256i v0, __m256i v1, uptr* d, size_t o) {
+    // v0, v1 have dword c for channels [0 1 2 3 | 4 5 6 7]
+    const __m256i  lo = _mm256_unpacklo_epi32(v0, v1);  // [0 1 | 4 5]
+    const __m256i  hi = _mm256_unpackhi_epi32(v0, v1);  // [2 3 | 6 7]
+
+    storelo(d[0]+o, _mm256_castsi256_si128(lo));
+    storehi(d[1]+o, _mm256_castsi256_si128(lo));
+    storelo(d[2]+o, _mm256_castsi256_si128(hi));
+    storehi(d[3]+o, _mm256_castsi256_si128(hi));
+    storelo(d[4]+o, _mm256_extracti128_si256(lo, 1));
+    storehi(d[5]+o, _mm256_extracti128_si256(lo, 1));
+    storelo(d[6]+o, _mm256_extracti128_si256(hi, 1));
+    storehi(d[7]+o, _mm256_extracti128_si256(hi, 1));
+}
+
+// Phase two, 64 bytes of input, lane L has words [c0 .. c7].
+// Word c of lane L => word 4*c + L, then qword c has all of channel c
+static const unsigned short perm_8Ch_avx512[32] = {
+    0,  8, 16, 24,  1,  9, 17, 25,  2, 10, 18, 26,  3, 11, 19, 27,
+    4, 12, 20, 28,  5, 13, 21, 29,  6, 14, 22, 30,  7, 15, 23, 31
+};
+
+AVX512_FN static inline void store_8Ch_avx512(__m512i v, uptr* d, size_t o) {
+    const __m512i  r = _mm512_permutexvar_epi16(_mm512_loadu_si512((const void*)perm_8Ch_avx512), v);
+
+    storelo(d[0]+o, _mm512_extracti32x4_epi32(r, 0));
+    storehi(d[1]+o, _mm512_extracti32x4_epi32(r, 0));
+    storelo(d[2]+o, _mm512_extracti32x4_epi32(r, 1));
+    storehi(d[3]+o, _mm512_extracti32x4_epi32(r, 1));
+    storelo(d[4]+o, _mm512_extracti32x4_epi32(r, 2));
+    storehi(d[5]+o, _mm512_extracti32x4_epi32(r, 2));
+    storelo(d[6]+o, _mm512_extracti32x4_epi32(r, 3));
+    storehi(d[7]+o, _mm512_extracti32x4_epi32(r, 3));
+}
+
+AVX2_FN static void extract_8Ch2bit_hv_avx2_(uptr src, size_t len, uptr* d) {
+    const __m256i  bytes  = _mm256_broadcastsi128_si256( _mm_loadu_si128((const __m128i*)bytes_8Ch2bit_hv) );
+    const __m256i  gather = _mm256_broadcastsi128_si256( _mm_loadu_si128((const __m128i*)gather_8Ch2bit_hv) );
+    const __m256i  m6     = _mm256_set1_epi32( 0x00cc00cc );
+    const __m256i  m12    = _mm256_set1_epi32( 0x0000f0f0 );
+    const __m256i  m55    = _mm256_set1_epi8( 0x55 );
+
+    for(size_t i=0, o=0; i<len; i+=avx_chunk, o+=8) {
+        __m256i  v0 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(src+i)), bytes);
+        __m256i  v1 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(src+i+32)), bytes);
+
+        TRANSPOSE4x4x2(256, v0);
+        TRANSPOSE4x4x2(256, v1);
+        store_8Ch_avx2(gather_8Ch_avx2(_mm256_shuffle_epi8(v0, gather)),
+                       gather_8Ch_avx2(_mm256_shuffle_epi8(v1, gather)), d, o);
+    }
+}
+
+AVX512_FN static void extract_8Ch2bit_hv_avx512_(uptr src, size_t len, uptr* d) {
+    const __m512i  bytes  = _mm512_broadcast_i32x4( _mm_loadu_si128((const __m128i*)bytes_8Ch2bit_hv) );
+    const __m512i  gather = _mm512_broadcast_i32x4( _mm_loadu_si128((const __m128i*)gather_8Ch2bit_hv) );
+    const __m512i  m6     = _mm512_set1_epi32( 0x00cc00cc );
+    const __m512i  m12    = _mm512_set1_epi32( 0x0000f0f0 );
+    const __m512i  m55    = _mm512_set1_epi8( 0x55 );
+
+    for(size_t i=0, o=0; i<len; i+=avx_chunk, o+=8) {
+        __m512i  v = _mm512_shuffle_epi8(_mm512_loadu_si512((const void*)(src+i)), bytes);
+
+        TRANSPOSE4x4x2(512, v);
+        store_8Ch_avx512(_mm512_shuffle_epi8(v, gather), d, o);
+    }
+}
+
+AVX2_FN static void extract_8Ch2bit1to2_hv_avx2_(uptr src, size_t len, uptr* d) {
+    const __m256i  lolut  = _mm256_broadcastsi128_si256( _mm_loadu_si128((const __m128i*)lonibble_8Ch2bit1to2_hv) );
+    const __m256i  hilut  = _mm256_broadcastsi128_si256( _mm_loadu_si128((const __m128i*)hinibble_8Ch2bit1to2_hv) );
+    const __m256i  gather = _mm256_broadcastsi128_si256( _mm_loadu_si128((const __m128i*)gather_8Ch2bit1to2_hv) );
+    const __m256i  m0f    = _mm256_set1_epi8( 0x0f );
+    const __m256i  lo0f   = _mm256_set1_epi64x( 0x0f0f0f0f );
+    const __m256i  lof0   = _mm256_set1_epi64x( 0xf0f0f0f0 );
+
+    for(size_t i=0, o=0; i<len; i+=avx_chunk, o+=8) {
+        __m256i  v0 = _mm256_loadu_si256((const __m256i*)(src+i));
+        __m256i  v1 = _mm256_loadu_si256((const __m256i*)(src+i+32));
+
+        NIBBLELOOKUP(256, v0);
+        NIBBLELOOKUP(256, v1);
+        store_8Ch_avx2(gather_8Ch_avx2(_mm256_shuffle_epi8(v0, gather)),
+                       gather_8Ch_avx2(_mm256_shuffle_epi8(v1, gather)), d, o);
+    }
+}
+
+AVX512_FN static void extract_8Ch2bit1to2_hv_avx512_(uptr src, size_t len, uptr* d) {
+    const __m512i  lolut  = _mm512_broadcast_i32x4( _mm_loadu_si128((const __m128i*)lonibble_8Ch2bit1to2_hv) );
+    const __m512i  hilut  = _mm512_broadcast_i32x4( _mm_loadu_si128((const __m128i*)hinibble_8Ch2bit1to2_hv) );
+    const __m512i  gather = _mm512_broadcast_i32x4( _mm_loadu_si128((const __m128i*)gather_8Ch2bit1to2_hv) );
+    const __m512i  m0f    = _mm512_set1_epi8( 0x0f );
+    const __m512i  lo0f   = _mm512_set1_epi64( 0x0f0f0f0f );
+    const __m512i  lof0   = _mm512_set1_epi64( 0xf0f0f0f0 );
+
+    for(size_t i=0, o=0; i<len; i+=avx_chunk, o+=8) {
+        __m512i  v = _mm512_loadu_si512((const void*)(src+i));
+
+        NIBBLELOOKUP(512, v);
+        store_8Ch_avx512(_mm512_shuffle_epi8(v, gather), d, o);
+    }
+}
+
+#undef TRANSPOSE4x4x2
+#undef NIBBLELOOKUP
+
+#else // no avx support compiled in
+
+bool have_avx2_dechannelizers( void ) {
+    return false;
+}
+bool have_avx512_dechannelizers( void ) {
+    return false;
+}
+
+// The public functions are there but since the have_*() functions return
+// false they should never be called. If they are, they don't do anything
+// wrong though.
+typedef unsigned char* uptr;
+
+#define NOAVX(fn) \
+    static void fn(...) { }
+NOAVX(split_by4_avx2)
+NOAVX(split_by2_avx2)
+NOAVX(split_by4_avx512)
+NOAVX(split_by2_avx512)
+NOAVX(swap_sign_mag_avx2_)
+NOAVX(swap_sign_mag_avx512_)
+NOAVX(extract_8Ch2bit_hv_avx2_)
+NOAVX(extract_8Ch2bit_hv_avx512_)
+NOAVX(extract_8Ch2bit1to2_hv_avx2_)
+NOAVX(extract_8Ch2bit1to2_hv_avx512_)
+#undef NOAVX
+
+#endif
+
+
+/////////////////////////////////////////////////////////////////////////
+//
+//   The public functions: do the bulk wide, the rest with the sse code
+//
+/////////////////////////////////////////////////////////////////////////
+
+#define SPLIT_BY4(fn, pattern, W) \
+    void fn##_##W(void* src, size_t len, void* d0, void* d1, void* d2, void* d3) { \
+        const size_t  n = len - len%avx_chunk; \
+        split_by4_##W(pattern, (uptr)src, n, (uptr)d0, (uptr)d1, (uptr)d2, (uptr)d3); \
+        if( n<len ) \
+            fn((uptr)src+n, len-n, (uptr)d0+n/4, (uptr)d1+n/4, (uptr)d2+n/4, (uptr)d3+n/4); \
+    }
+#define SPLIT_BY2(fn, pattern, W) \
+    void fn##_##W(void* src, size_t len, void* d0, void* d1) { \
+        const size_t  n = len - len%avx_chunk; \
+        split_by2_##W(pattern, (uptr)src, n, (uptr)d0, (uptr)d1); \
+        if( n<len ) \
+            fn((uptr)src+n, len-n, (uptr)d0+n/2, (uptr)d1+n/2); \
+    }
+#define SWAP_SIGN_MAG(W) \
+    void swap_sign_mag_##W(void* src, size_t len, void* d0) { \
+        const size_t  n = len - len%avx_chunk; \
+        swap_sign_mag_##W##_((uptr)src, n, (uptr)d0); \
+        if( n<len ) \
+            swap_sign_mag((uptr)src+n, len-n, (uptr)d0+n); \
+    }
+#define EXTRACT_8CH(fn, W) \
+    void fn##_##W(void* src, size_t len, void* d0, void* d1, void* d2, void* d3, \
+                                         void* d4, void* d5, void* d6, void* d7) { \
+        const size_t  n = len - len%avx_chunk; \
+        uptr          d[8] = {(uptr)d0, (uptr)d1, (uptr)d2, (uptr)d3, \
+                              (uptr)d4, (uptr)d5, (uptr)d6, (uptr)d7}; \
+        fn##_##W##_((uptr)src, n, d); \
+        if( n<len ) \
+            fn((uptr)src+n, len-n, d[0]+n/8, d[1]+n/8, d[2]+n/8, d[3]+n/8, \
+                                   d[4]+n/8, d[5]+n/8, d[6]+n/8, d[7]+n/8); \
+    }
+
+SPLIT_BY4(split8bitby4,  lanepattern_8bitx4,  avx2)
+SPLIT_BY4(split8bitby4,  lanepattern_8bitx4,  avx512)
+SPLIT_BY4(split16bitby4, lanepattern_16bitx4, avx2)
+SPLIT_BY4(split16bitby4, lanepattern_16bitx4, avx512)
+SPLIT_BY2(split16bitby2, lanepattern_16bitx2, avx2)
+SPLIT_BY2(split16bitby2, lanepattern_16bitx2, avx512)
+SPLIT_BY2(split32bitby2, lanepattern_32bitx2, avx2)
+SPLIT_BY2(split32bitby2, lanepattern_32bitx2, avx512)
+SWAP_SIGN_MAG(avx2)
+SWAP_SIGN_MAG(avx512)
+EXTRACT_8CH(extract_8Ch2bit_hv, avx2)
+EXTRACT_8CH(extract_8Ch2bit_hv, avx512)
+EXTRACT_8CH(extract_8Ch2bit1to2_hv, avx2)
+EXTRACT_8CH(extract_8Ch2bit1to2_hv, avx512)
+
+#undef SPLIT_BY4
+#undef SPLIT_BY2
+#undef SWAP_SIGN_MAG
+#undef EXTRACT_8CH
@@ -0,0 +1,74 @@
+// 256 and 512 bit versions of the (working) sse dechannelizers
+// Copyright (C) 2007-2013 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.nl
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef JIVE5A_AVX_DECHANNELIZER_H
+#define JIVE5A_AVX_DECHANNELIZER_H
+
+// For size_t
+#include <string.h>
+
+// The functions below have exactly the same calling sequence and produce
+// exactly the same output as their counterparts in sse_dechannelizer.h;
+// the bulk of the block is done using 256 (avx2) or 512 (avx512) bit
+// registers, whatever is left over is handed to the sse version.
+//
+// They are compiled with the appropriate 'target' attribute so the rest of
+// the program does not need to be compiled for avx2/avx512 - but it is the
+// caller's responsibility to check the CPU supports them before calling
+// them.
+//
+// Only the dechannelizers that actually do something on this platform
+// have wider versions; the extract_*Ch2bit1to2 (non-_hv) ones are empty
+// stubs in the 64-bit sse code.
+
+// Did we compile the avx2/avx512 versions, and does the CPU we're running on
+// support them?
+bool have_avx2_dechannelizers( void );
+bool have_avx512_dechannelizers( void );
+
+void split8bitby4_avx2(void* src, size_t len, void* dst0, void* dst1, void* dst2, void* dst3);
+void split8bitby4_avx512(void* src, size_t len, void* dst0, void* dst1, void* dst2, void* dst3);
+
+void split16bitby2_avx2(void* src, size_t len, void* dst0, void* dst1);
+void split16bitby2_avx512(void* src, size_t len, void* dst0, void* dst1);
+
+void split16bitby4_avx2(void* src, size_t len, void* dst0, void* dst1, void* dst2, void* dst3);
+void split16bitby4_avx512(void* src, size_t len, void* dst0, void* dst1, void* dst2, void* dst3);
+
+void split32bitby2_avx2(void* src, size_t len, void* dst0, void* dst1);
+void split32bitby2_avx512(void* src, size_t len, void* dst0, void* dst1);
+
+void swap_sign_mag_avx2(void* src, size_t len, void* dst0);
+void swap_sign_mag_avx512(void* src, size_t len, void* dst0);
+
+void extract_8Ch2bit_hv_avx2(void *src, size_t len,
+        void *dst0, void *dst1, void *dst2, void *dst3,
+        void *dst4, void *dst5, void *dst6, void *dst7);
+void extract_8Ch2bit_hv_avx512(void *src, size_t len,
+        void *dst0, void *dst1, void *dst2, void *dst3,
+        void *dst4, void *dst5, void *dst6, void *dst7);
+
+void extract_8Ch2bit1to2_hv_avx2(void *src, size_t len,
+        void *dst0, void *dst1, void *dst2, void *dst3,
+        void *dst4, void *dst5, void *dst6, void *dst7);
+void extract_8Ch2bit1to2_hv_avx512(void *src, size_t len,
+        void *dst0, void *dst1, void *dst2, void *dst3,
+        void *dst4, void *dst5, void *dst6, void *dst7);
+
+#endif
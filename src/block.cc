@@ -18,6 +18,7 @@
 //          P.O. Box 2
 //          7990 AA Dwingeloo
 #include <block.h>
+#include <blockpool.h>
 #include <atomic.h>
 #include <stdlib.h>
 
@@ -32,6 +33,8 @@ refcount_type block::dummy_counter = 1;
     __asm__ __volatile__ ( "movl %0, %%eax; lock; incl (%%eax)" : : "m"(a) : "eax", "memory" );
     #define DEC(a) \
     __asm__ __volatile__ ( "movl %0, %%eax; lock; decl (%%eax)" : : "m"(a) : "eax", "memory" );
+    #define DECTEST(a, z) \
+    __asm__ __volatile__ ( "movl %1, %%eax; lock; decl (%%eax); setz %0" : "=q"(z) : "m"(a) : "eax", "memory" );
 #endif
 
 #if B2B==64
@@ -39,14 +42,17 @@ refcount_type block::dummy_counter = 1;
     __asm__ __volatile__ ( "movq %0, %%rax; lock; incl (%%rax)" : : "m"(a) : "rax", "memory" );
     #define DEC(a) \
     __asm__ __volatile__ ( "movq %0, %%rax; lock; decl (%%rax)" : : "m"(a) : "rax", "memory" );
+    #define DECTEST(a, z) \
+    __asm__ __volatile__ ( "movq %1, %%rax; lock; decl (%%rax); setz %0" : "=q"(z) : "m"(a) : "rax", "memory" );
 #endif
 
 block::block():
-    iov_base( 0 ), iov_len( 0 ), myMemory( false ), refcountptr(&dummy_counter)
+    iov_base( 0 ), iov_len( 0 ), myMemory( false ), poolMemory( false ), ownerMemory( false ),
+    refcountptr(&dummy_counter)
 {}
 
 block::block(size_t sz):
-    iov_len( sz ), myMemory( true ), 
+    iov_len( sz ), myMemory( true ), poolMemory( false ), ownerMemory( false ),
     refcountptr( (refcount_type*)::malloc(sizeof(refcount_type) + iov_len) )
 {
     // malloc space for the block and the refcounter in one go
@@ -55,12 +61,23 @@ block::block(size_t sz):
     *refcountptr = 1;
 }
 
+// The refcount is the first member of the owner so we can get back at the
+// owner from the refcountptr
+block::block(void* base, size_t sz, block_owner_type* owner):
+    iov_base( base ), iov_len( sz ), myMemory( false ), poolMemory( false ), ownerMemory( true ),
+    refcountptr( &owner->refcount )
+{
+    INC(refcountptr);
+}
+
 block::block(const block& other) {
     INC(other.refcountptr);
     iov_base    = other.iov_base;
     iov_len     = other.iov_len;
     refcountptr = other.refcountptr;
     myMemory    = other.myMemory;
+    poolMemory  = other.poolMemory;
+    ownerMemory = other.ownerMemory;
 }
 
 block::iterator block::begin( void ) {
@@ -86,11 +103,11 @@ const block& block::operator=(const block& other) {
     INC(other.refcountptr);
     iov_base  = other.iov_base;
     iov_len   = other.iov_len;
-    DEC(refcountptr);
-    if( myMemory && *refcountptr==0 )
-        ::free( (void*)refcountptr );
+    this->unref();
     refcountptr = other.refcountptr;
     myMemory    = other.myMemory;
+    poolMemory  = other.poolMemory;
+    ownerMemory = other.ownerMemory;
     return *this;
 }
 
@@ -107,19 +124,41 @@ block block::sub(unsigned int offset, unsigned int length) const {
     // going to get an extra reference to whatever we're 
     // referring to
     INC(refcountptr);
-    return block((unsigned char*)iov_base+offset, length, refcountptr, myMemory);
+    return block((unsigned char*)iov_base+offset, length, refcountptr, myMemory, poolMemory, ownerMemory);
 }
 
-block::block(void* base, size_t sz, refcount_type* refcnt, bool myMem):
-    iov_base( base ), iov_len( sz ), myMemory( myMem ), refcountptr(refcnt)
+block::block(void* base, size_t sz, refcount_type* refcnt, bool myMem, bool poolMem, bool ownerMem):
+    iov_base( base ), iov_len( sz ), myMemory( myMem ), poolMemory( poolMem ), ownerMemory( ownerMem ),
+    refcountptr(refcnt)
 {}
 
+// Decrement-and-test must be one atomic operation: if two threads
+// drop the last two references at the same time, exactly one of them
+// sees zero and gets to free the memory.
+void block::unref( void ) {
+    unsigned char   zero;
+
+    if( !(myMemory || poolMemory || ownerMemory) ) {
+        DEC(refcountptr);
+        return;
+    }
+    DECTEST(refcountptr, zero);
+    if( !zero )
+        return;
+    if( myMemory )
+        ::free( (void*)refcountptr );
+    else if( poolMemory )
+        pool_type::release( refcountptr );
+    else {
+        block_owner_type*  owner = reinterpret_cast<block_owner_type*>(refcountptr);
+        owner->release( owner );
+    }
+}
+
 bool block::empty( void ) const {
     return (iov_base==0 && iov_len==0);
 }
 
 block::~block() {
-    DEC(refcountptr);
-    if( myMemory && *refcountptr==0 )
-        ::free( (void*)refcountptr );
+    this->unref();
 }
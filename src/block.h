@@ -59,6 +59,16 @@ DECLARE_EZEXCEPT(block_error)
 // it's just for the friendship stuff
 struct pool_type;
 
+// Memory that is neither the block's own nor from a pool, e.g. a piece of
+// a memory mapped file, is owned by a struct that starts with one of
+// these. The blocks referring to it count their references in 'refcount'
+// and when the last one goes away 'release' is called with the owner,
+// which should then free the memory (and itself, if need be).
+struct block_owner_type {
+    refcount_type  refcount;
+    void         (*release)(block_owner_type*);
+};
+
 struct block {
     friend struct pool_type;
 
@@ -83,6 +93,11 @@ struct block {
         // refcnt   = 1
         block( size_t sz );
 
+        // block of sz bytes starting at base, which is owned by 'owner'.
+        // Adds a reference to the owner so typically the owner's
+        // refcount starts at zero.
+        block( void* base, size_t sz, block_owner_type* owner );
+
         // because we're now reference counting we
         // MUST implement copy + assignment
         block(const block& other);
@@ -110,6 +125,11 @@ struct block {
     private:
         // do we manage the memory?
         bool           myMemory;
+        // or does it come from a pool_type? Then the pool gets it back
+        // when the last reference goes away
+        bool           poolMemory;
+        // or is someone else the owner? (see block_owner_type)
+        bool           ownerMemory;
 
         // The pointer-to-the-refcounter we keep private
         refcount_type* refcountptr;
@@ -123,7 +143,10 @@ struct block {
         //    already set to (at least) 1!!!!
         // initialized block:
         // point at sz bytes starting from base
-        block(void* base, size_t sz, refcount_type* refcnt, bool myMem = false);
+        block(void* base, size_t sz, refcount_type* refcnt, bool myMem = false, bool poolMem = false, bool ownerMem = false);
+
+        // drop a reference and free the memory if it was the last one
+        void unref( void );
 };
 
 // Sometimes it is handy to be able to pass a list of blocks in one go
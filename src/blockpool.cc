@@ -18,59 +18,337 @@
 //          P.O. Box 2
 //          7990 AA Dwingeloo
 #include <blockpool.h>
+#include <ioalign.h>
 #include <stdint.h>
 #include <iostream>
+#include <sstream>
+#include <algorithm>
 #include <atomic.h>
 #include <mutex_locker.h>
+#include <pthreadcall.h>
 #include <evlbidebug.h>
+#include <sciprint.h>
+#include <threadutil.h>
 
+#include <stdlib.h>   // for posix_memalign(3)
 #include <string.h>
-#include <limits.h>   // For UINT_MAX d'oh
-#include <unistd.h>   // for usleep(3)
-
-#define CIRCNEXT(cur, sz)   ((cur+1)%sz)
-#define CIRCPREV(cur, sz)   CIRCNEXT((cur+sz-2), sz)
-#define CIRCDIST(b , e, sz) (((b>e)?(sz-b+e):(e-b))%sz)
+#include <errno.h>
+#include <unistd.h>   // for usleep(3), sysconf(3)
+#include <sys/mman.h>
+#if defined(__linux__)
+    #include <sys/syscall.h>
+#endif
 
 using std::cout;
 using std::endl;
+using std::string;
 
 
 DEFINE_EZEXCEPT(pool_error)
 DEFINE_EZEXCEPT(blockpool_error)
 
+// MPOL_PREFERRED from <linux/mempolicy.h>; we do the mbind(2) system call
+// ourselves such that we don't depend on libnuma
+#if defined(__linux__) && defined(SYS_mbind) && defined(SYS_getcpu)
+    #define HAVE_MBIND   1
+    #define JIVE5AB_MPOL_PREFERRED 1
+#else
+    #define HAVE_MBIND   0
+#endif
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+    #define MAP_ANONYMOUS MAP_ANON
+#endif
+
+
+//////////////////////////////////////////////////////////////
+//     process wide settings and accounting
+//////////////////////////////////////////////////////////////
+
+static volatile unsigned int pool_memory_flags = pool_mem_default;
+
+// all in bytes
+static volatile uint64_t     pool_bytes_allocated = 0;
+static volatile uint64_t     pool_bytes_allocated_hw = 0;
+static volatile uint64_t     pool_bytes_inuse = 0;
+static volatile uint64_t     pool_bytes_inuse_hw = 0;
+
+void set_pool_memory_flags( unsigned int flags ) {
+    pool_memory_flags = flags;
+}
+unsigned int get_pool_memory_flags( void ) {
+    return pool_memory_flags;
+}
+
+// Add 'n' to the counter and update the high water mark if necessary
+static void account_add(volatile uint64_t* counter, volatile uint64_t* hw, uint64_t n) {
+    const uint64_t  now = __sync_add_and_fetch(counter, n);
+    uint64_t        cur;
+
+    while( (cur=*hw)<now && !__sync_bool_compare_and_swap(hw, cur, now) )
+        ;
+}
+
+static void account_sub(volatile uint64_t* counter, uint64_t n) {
+    __sync_sub_and_fetch(counter, n);
+}
+
+string pool_memory_status( void ) {
+    std::ostringstream  oss;
+    oss << "pool memory " << byteprint((double)pool_bytes_allocated, "byte") << " [max " << byteprint((double)pool_bytes_allocated_hw, "byte") << "] : "
+        << "in use " << byteprint((double)pool_bytes_inuse, "byte") << " [max " << byteprint((double)pool_bytes_inuse_hw, "byte") << "] : "
+        << ((pool_memory_flags & pool_mem_hugepage) ? "hugepage" : "")
+        << ((pool_memory_flags==(pool_mem_hugepage|pool_mem_local)) ? "," : "")
+        << ((pool_memory_flags & pool_mem_local) ? "local" : "")
+        << ((pool_memory_flags==pool_mem_default) ? "default" : "");
+    return oss.str();
+}
+
+
+//////////////////////////////////////////////////////////////
+//     getting memory for a pool
+//////////////////////////////////////////////////////////////
+
+static const uint64_t hugepagesize = 2*1024*1024;
+
+// Some of the SSE-assembly (sse_dechannelizer*) routines make a habit of
+// reading sixteen bytes past the end of the block they're processing. If
+// we happen to give the last block in a pool to one of them routines it
+// may or may not crash. So the memory after the last block must be
+// readable for at least this many bytes.
+static const uint64_t overrun = 16;
+
+// Map 'hsz' bytes of explicit huge pages (hsz is a multiple of the huge
+// page size) followed directly by one normal page. Used when the blocks
+// fill the huge pages exactly: the overrun of the last block then lands in
+// the normal page instead of costing a whole extra huge page.
+// Returns MAP_FAILED if this can't be done.
+static void* map_hugetlb_plus_page(uint64_t hsz, uint64_t pgsz) {
+#ifdef MAP_HUGETLB
+    // Reserve enough address space to be able to align to a huge page
+    const uint64_t  len = hsz + pgsz + hugepagesize;
+    void*           r   = ::mmap(0, len, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+
+    if( r==MAP_FAILED )
+        return MAP_FAILED;
+
+    unsigned char*  rb   = (unsigned char*)r;
+    unsigned char*  base = (unsigned char*)((((uintptr_t)rb + hugepagesize - 1)/hugepagesize)*hugepagesize);
+
+    if( ::mmap(base, hsz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|MAP_FIXED, -1, 0)==MAP_FAILED ||
+        ::mmap(base+hsz, pgsz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1, 0)==MAP_FAILED ) {
+        ::munmap(r, len);
+        return MAP_FAILED;
+    }
+    // Give back what we don't need of the reservation
+    if( base>rb )
+        ::munmap(rb, (size_t)(base - rb));
+    if( base+hsz+pgsz < rb+len )
+        ::munmap(base+hsz+pgsz, (size_t)((rb+len) - (base+hsz+pgsz)));
+    return base;
+#else
+    (void)hsz; (void)pgsz;
+    return MAP_FAILED;
+#endif
+}
+
+// Returns memory for a pool of 'sz' bytes plus room for the overrun after
+// the last block. If the memory was mmap(2)'ed (rather than malloc'ed)
+// 'mapped' is set to true and 'sz' is updated to the actual size of the
+// mapping
+static unsigned char* pool_alloc(uint64_t& sz, bool& mapped) {
+    void*              m     = MAP_FAILED;
+    unsigned int       flags = pool_memory_flags;
+    const uint64_t     pgsz  = (uint64_t)::sysconf(_SC_PAGESIZE);
+
+    // Don't waste (most of) a huge page on a small pool
+    if( sz<hugepagesize )
+        flags &= ~((unsigned int)pool_mem_hugepage);
+
+    mapped = false;
+    if( flags==pool_mem_default ) {
+        // Aligned such that blocks can be written with O_DIRECT straight
+        // from the pool, without copying them through directwriter's stage
+        void*  p = 0;
+
+        EZASSERT2(::posix_memalign(&p, io_alignment, sz + overrun)==0, pool_error,
+                  EZINFO("failed to allocate " << sz << " bytes for pool"));
+        return (unsigned char*)p;
+    }
+
+    // For anything non-default we need to mmap() - hugepages and mbind(2)
+    // work on (huge)page aligned memory. The rounding up usually leaves
+    // room for the overrun already; only if the blocks fill the pages
+    // exactly we need more.
+    if( flags & pool_mem_hugepage ) {
+        const uint64_t  hsz = ((sz + hugepagesize - 1)/hugepagesize) * hugepagesize;
+        const bool      pad = (hsz - sz)<overrun;
+#ifdef MAP_HUGETLB
+        if( pad )
+            m = map_hugetlb_plus_page(hsz, pgsz);
+        else
+            m = ::mmap(0, hsz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+        if( m==MAP_FAILED ) {
+            DEBUG(3, "pool_alloc: no explicit huge pages for " << hsz << " bytes (" << evlbi5a::strerror(errno) << ")" << endl);
+        }
+#endif
+        if( m==MAP_FAILED ) {
+            // Try our luck with transparent huge pages. The kernel only
+            // uses huge pages for the aligned 2MB stretches so the extra
+            // normal page doesn't hurt
+            if( (m=::mmap(0, hsz + (pad ? pgsz : 0), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0))!=MAP_FAILED ) {
+#ifdef MADV_HUGEPAGE
+                if( ::madvise(m, hsz, MADV_HUGEPAGE)!=0 )
+                    DEBUG(3, "pool_alloc: madvise(MADV_HUGEPAGE) failed - " << evlbi5a::strerror(errno) << endl);
+#endif
+            }
+        }
+        if( m!=MAP_FAILED )
+            sz = hsz + (pad ? pgsz : 0);
+    } else {
+        sz = ((sz + overrun + pgsz - 1)/pgsz) * pgsz;
+        m  = ::mmap(0, sz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    }
+    EZASSERT2(m!=MAP_FAILED, pool_error, EZINFO("failed to mmap " << sz << " bytes for pool - " << evlbi5a::strerror(errno)));
+    mapped = true;
+
+    if( flags & pool_mem_local ) {
+#if HAVE_MBIND
+        // Which node are we running on?
+        unsigned int    cpu, node;
+        unsigned long   nodemask;
+
+        if( ::syscall(SYS_getcpu, &cpu, &node, (void*)0)==0 && node<8*sizeof(nodemask) ) {
+            nodemask = 1UL << node;
+            if( ::syscall(SYS_mbind, m, (unsigned long)sz, JIVE5AB_MPOL_PREFERRED, &nodemask, 8*sizeof(nodemask), 0)!=0 )
+                DEBUG(3, "pool_alloc: mbind to node " << node << " failed - " << evlbi5a::strerror(errno) << endl);
+        }
+#endif
+        // Fault in the pages now, while we're still on that node (first
+        // touch). Only need to write one byte per page.
+        unsigned char*  p    = (unsigned char*)m;
+        for(uint64_t off=0; off<sz; off+=pgsz)
+            p[off] = 0;
+    }
+    return (unsigned char*)m;
+}
+
+static void pool_free(unsigned char* m, uint64_t sz, bool mapped) {
+    if( mapped )
+        ::munmap(m, sz);
+    else
+        ::free(m);
+}
+
+
+//////////////////////////////////////////////////////////////
+//     lock-free free list
+//////////////////////////////////////////////////////////////
+
+// Each block in a pool has one slot. The block's refcount pointer points
+// at the 'use_cnt' member - which MUST be first - so when the last
+// reference goes away we can find our way back to the free list.
+struct pool_slot_type {
+    refcount_type     use_cnt;
+    uint32_t          next;
+    freelist_type*    freelist;
+};
+
+// The head of the free list is (tag<<32 | index of first free slot). The
+// tag is incremented on each update such that a pop() cannot be fooled by
+// the head having been popped and pushed back in the mean time (ABA).
+struct freelist_type {
+    static const uint32_t  nil = 0xffffffff;
+
+    volatile uint64_t      head;
+    volatile uint32_t      nfree;
+    // only touched by the thread that get()s from the pool
+    uint32_t               high_water;
+    const uint32_t         nblock;
+    const uint32_t         block_size;
+    pool_slot_type*        slots;
+
+    freelist_type(uint32_t nb, uint32_t bs):
+        head( 0 ), nfree( 0 ), high_water( 0 ), nblock( nb ), block_size( bs ),
+        slots( new pool_slot_type[nb] )
+    {
+        // Initially all blocks are free
+        for(uint32_t i=0; i<nblock; i++) {
+            slots[i].use_cnt  = 0;
+            slots[i].next     = (i+1<nblock) ? i+1 : nil;
+            slots[i].freelist = this;
+        }
+        nfree = nblock;
+    }
+
+    // Only release()'ing threads push
+    void push( uint32_t idx ) {
+        uint64_t    old, nw;
+        do {
+            old = head;
+            slots[idx].next = (uint32_t)(old & 0xffffffff);
+            nw = (((old>>32)+1)<<32) | idx;
+        } while( !__sync_bool_compare_and_swap(&head, old, nw) );
+        account_sub(&pool_bytes_inuse, block_size);
+        // This MUST be the last thing we touch: as soon as all blocks are
+        // free a pool in the garbage can may be deleted
+        __sync_add_and_fetch(&nfree, 1);
+    }
+
+    // Returns nil if no block free
+    uint32_t pop( void ) {
+        uint64_t    old, nw;
+        uint32_t    idx;
+        do {
+            old = head;
+            if( (idx=(uint32_t)(old & 0xffffffff))==nil )
+                return nil;
+            nw = (((old>>32)+1)<<32) | slots[idx].next;
+        } while( !__sync_bool_compare_and_swap(&head, old, nw) );
+        __sync_sub_and_fetch(&nfree, 1);
+        account_add(&pool_bytes_inuse, &pool_bytes_inuse_hw, block_size);
+        return idx;
+    }
+
+    ~freelist_type() {
+        delete [] slots;
+    }
+    private:
+        freelist_type();
+        freelist_type(freelist_type const&);
+        freelist_type const& operator=(freelist_type const&);
+};
+
+
 //////////////////////////////////////////////////////////////
 //  pools that are still in use will be sent to the garbagecan
 //////////////////////////////////////////////////////////////
 struct garbage_type {
     uint64_t           sz;
     unsigned int       tryCount;
-    refcount_type*     use_cnt;
+    freelist_type*     freelist;
     unsigned char*     memory;
-    const unsigned int nblock;
+    bool               mapped;
 
     garbage_type(const pool_type& pool):
-        sz( pool.nblock * pool.block_size ), tryCount( 0 ), use_cnt( pool.use_cnt ), 
-        memory( pool.memory ), nblock( pool.nblock )
+        sz( pool.memsize ), tryCount( 0 ), freelist( pool.freelist ), 
+        memory( pool.memory ), mapped( pool.mapped )
     {}
 
     bool try_delete( void ) {
         // if there are still blocks in use, don't delete them
-        unsigned int  usecount = 0;
-
         tryCount++;
 
-        for(unsigned int i=0; i<nblock; i++)
-            usecount += use_cnt[i];
+        if( freelist->nfree!=freelist->nblock )
+            return false;
 
-        if( usecount==0 ) {
-            delete [] use_cnt;
-            delete [] memory;
-            if( tryCount!=1 ) {
-                DEBUG(3, "garbage_type::try_delete/deleted pool sz=" << sz << " after " << tryCount << " attempts" << endl);
-            }
+        pool_free(memory, sz, mapped);
+        delete freelist;
+        account_sub(&pool_bytes_allocated, sz);
+        if( tryCount!=1 ) {
+            DEBUG(3, "garbage_type::try_delete/deleted pool sz=" << sz << " after " << tryCount << " attempts" << endl);
         }
-        return (usecount==0);
+        return true;
     }
     ~garbage_type() {}
 };
@@ -121,74 +399,67 @@ void maybe_add_to_can( garbage_type& gt ) {
 }
 
 // a single pool consists of both memory
-// and an array of counters
-// NOTE: we allocate 16 bytes extra because some of the 
-// SSE-assembly (sse_dechannelizer*) routines make a habit
-// of reading sixteen bytes past the end of the block they're
-// processing. If we happen to give the last block in a pool 
-// to one of them routines it may or may not crash.
-// 16 bytes overhead for a whole pool is acceptable, especially
-// if it prevents crash!
+// and a free list of blocks
+// pool_alloc() adds room for the SSE routines' overrun past the last
+// block.
+// All size computations are done in 64 bits so pools (far) over 4GB are
+// no problem; e.g. a handful of 512MB vlbi_streamer blocks.
+static uint64_t pool_size(unsigned int bs, unsigned int nb) {
+    EZASSERT2(nb>0 && bs>0, pool_error,
+              EZINFO("both block_size (" << bs << ") and nblock (" << nb << ") should be >0") );
+    return (uint64_t)bs * (uint64_t)nb;
+}
+
 pool_type::pool_type(unsigned int bs, unsigned int nb):
-    next_alloc( 0 ), nblock( nb ), block_size( bs )
-#if 0
-    next_alloc(0), use_cnt( new refcount_type[nb] ),
-    memory( new unsigned char [bs * nb + 16] ), nblock(nb),
-    block_size(bs)
-#endif
+    freelist( 0 ), memory( 0 ), memsize( pool_size(bs, nb) ), mapped( false ), nblock( nb ), block_size( bs )
 { 
     // Let's trigger garbage cleanup
     check_garbage();
 
     // Carry on with the construction of this object
-    uint64_t    bs64( bs ), nb64( nb ); 
-    EZASSERT2(nblock>0 && block_size>0,
-              pool_error,
-              EZINFO("both block_size (" << block_size << ") and nblock (" << nblock << ") should be >0") );
-    // Detect overflow of unsigned int 32-bit maximum ...
-    // (at some point someone allocated 16 x 256MB + 16 bytes > 4GB
-    //  thus causing an overflow ...)
-    EZASSERT2(((nb64*bs64)+16)<=(uint64_t)UINT_MAX,
-              pool_error,
-              EZINFO("(nblock x blocksize) + overhead > UINT_MAX! [" << nb << " x " << bs << " > " << UINT_MAX));
-    // *now* we can safely alloc memory
-    memory  = new unsigned char [(block_size * nblock) + 16];
-    use_cnt = new refcount_type[nblock];
-    ::memset(use_cnt, 0x0, nblock * sizeof(refcount_type));
+    memory   = pool_alloc(memsize, mapped);
+    freelist = new freelist_type(nblock, block_size);
+    account_add(&pool_bytes_allocated, &pool_bytes_allocated_hw, memsize);
 }
 
 // return empty/default block if none available here
 block pool_type::get( void ) {
-    // do we have a free blocks?
-    unsigned int    previous_next = next_alloc;
-    refcount_type*  c = 0;
-    unsigned char*  m = 0;
+    const uint32_t  idx = freelist->pop();
 
-    // keep on cycling until we hit either a free block
-    // or the previous "last_alloc" again, then we give up
-    do {
-        // this one available?
-        if( ::atomic_try_set(&use_cnt[next_alloc], 1, 0) ) {
-            c = &use_cnt[next_alloc];
-            m = &memory[next_alloc*block_size];
-        }
-        next_alloc = CIRCNEXT(next_alloc, nblock);
-    } while( !c && next_alloc!=previous_next );
-    // if we were succesfull in allocat0ring a block ...
-#if 0
-    if( c&&m ) {
-        DEBUG(3, "pool[" << (void*)this << "]: allocated block @" << (void*)m << ", cnt @" << (void*)c << " [" << block_size << "]" << endl);
-    } else {
-        DEBUG(3, "pool[" << (void*)this << "]: no free block of size " << block_size << endl);
-    }
-#endif
-    return ((c && m)?block(m, block_size, c):block());
+    if( idx==freelist_type::nil )
+        return block();
+
+    // Keep track of how many blocks were in use at most. We're the only
+    // one popping so this is safe
+    const uint32_t  inuse = nblock - freelist->nfree;
+    if( inuse>freelist->high_water )
+        freelist->high_water = inuse;
+
+    // The block c'tor assumes the refcount is already set
+    freelist->slots[idx].use_cnt = 1;
+    return block(&memory[(uint64_t)idx*block_size], block_size, &freelist->slots[idx].use_cnt, false, true);
+}
+
+void pool_type::release( refcount_type* rc ) {
+    // use_cnt is the first member of the slot
+    pool_slot_type*  slot = (pool_slot_type*)rc;
+    freelist_type*   fl   = slot->freelist;
+
+    fl->push( (uint32_t)(slot - fl->slots) );
+}
+
+unsigned int pool_type::in_use( void ) const {
+    return nblock - freelist->nfree;
+}
+
+unsigned int pool_type::high_water( void ) const {
+    return freelist->high_water;
 }
 
 void pool_type::show_usecnt( void ) const {
     cout << "pool_type[" << (void const*)this << " (" << block_size << ")]/";
     for( unsigned int i=0; i<nblock; i++)
-        cout << use_cnt[i] << " ";
+        cout << freelist->slots[i].use_cnt << " ";
     cout << endl;
     return;
 }
@@ -197,30 +468,6 @@ void pool_type::show_usecnt( void ) const {
 pool_type::~pool_type() {
     garbage_type    gt( *this );
     maybe_add_to_can( gt );
-#if 0
-    // Try to empty the garbagecan. We do that first such that if we fail to
-    // destroy the current pool ('*this'), we can just append it to the
-    // garbage can. If we first try-and-add-if-we-cant-delete, there will be
-    // two attempts to delete the current pool almost immediately after each
-    // other.
-    mutex_locker    scopedLock( garbagecan_lock );
-    deletion_type   deleted;
-
-    for(garbagecan_type::iterator curpool=garbagecan.begin(); curpool!=garbagecan.end(); curpool++)
-        if( curpool->try_delete() )
-            deleted.push_back( curpool );
-    // Now erase the pools that freed their memory
-    for(deletion_type::iterator cur=deleted.begin(); cur!=deleted.end(); cur++)
-        garbagecan.erase( *cur );
-
-    // Create a tmp object that describes a deleter for this object
-    garbage_type    thispool( *this );
-
-    // If we can't delete the data from this pool, append it to the
-    // garbagecollection list
-    if( thispool.try_delete()==false )
-        garbagecan.push_back( thispool );
-#endif
 }
 
 // blockpool preallocates memory in pools of
@@ -229,11 +476,12 @@ pool_type::~pool_type() {
 // It starts with one pool and adds more
 // as necessary
 blockpool_type::blockpool_type(unsigned int bs, unsigned int nb):
-    blocksize(bs), nblock_p_pool(nb)
+    blocksize(bs), nblock_p_pool(nb), high_water( 0 )
 {
     EZASSERT2(blocksize>0 && nblock_p_pool>0, blockpool_error, 
               EZINFO("both blocksize (" << blocksize << ") and nblock_p_pool (" <<
                      nblock_p_pool << ") must be >0") );
+    PTHREAD_CALL( ::pthread_mutex_init(&mutex, 0) );
     // start with one pool
     curpool = pools.insert(pools.end(), new pool_type(blocksize, nblock_p_pool));
 }
@@ -258,20 +506,55 @@ block blockpool_type::get( void ) {
     // we went round the block w/o finding a free block
     // in the pool
     if( rv.empty() ) {
+        pool_type*  newpool = new pool_type(blocksize, nblock_p_pool);
+
         // I guess it's safe to assume allocation from a freshly created
         // pool should always succeed ...
-        curpool = pools.insert(pools.end(), new pool_type(blocksize, nblock_p_pool));
+        // Only the list is modified under the lock: we are the only
+        // thread get()'ing so our own traversal above is safe, status()
+        // from another thread isn't.
+        {
+            mutex_locker  lck( mutex );
+            curpool = pools.insert(pools.end(), newpool);
+        }
         rv      = (*curpool)->get();
     }
+
+    // Only if the current pool sets a new record it makes sense to
+    // add up the usage of all pools
+    if( (*curpool)->in_use()==(*curpool)->high_water() ) {
+        mutex_locker  lck( mutex );
+        unsigned int  inuse = 0;
+        for(const_pool_pointer_pointer p=pools.begin(); p!=pools.end(); p++)
+            inuse += (*p)->in_use();
+        high_water = std::max(high_water, inuse);
+    }
     return rv;
 }
 
 void blockpool_type::show_usecnt( void ) const {
+    mutex_locker  lck( mutex );
     for(const_pool_pointer_pointer p=pools.begin(); p!=pools.end(); p++)
         (*p)->show_usecnt();
 }
 
+// high_water is only written under the lock (in get()). The pools'
+// in_use() counts change under our feet as blocks are released by other
+// threads; they're read atomically so the sum is a valid snapshot.
+string blockpool_type::status( void ) const {
+    unsigned int        inuse = 0;
+    std::ostringstream  oss;
+    mutex_locker        lck( mutex );
+
+    for(const_pool_pointer_pointer p=pools.begin(); p!=pools.end(); p++)
+        inuse += (*p)->in_use();
+    oss << "blockpool " << byteprint((double)blocksize, "byte") << " x " << pools.size() << " x " << nblock_p_pool
+        << " : in use " << inuse << " [max " << high_water << "]";
+    return oss.str();
+}
+
 blockpool_type::~blockpool_type() {
     for(pool_pointer_pointer p=pools.begin(); p!=pools.end(); p++)
         delete (*p);
+    ::pthread_mutex_destroy( &mutex );
 }
@@ -20,17 +20,45 @@
 #ifndef JIVE5A_BLOCKPOOL_H
 #define JIVE5A_BLOCKPOOL_H
 #include <list>
+#include <string>
+#include <stdint.h>
+#include <pthread.h>
 #include <block.h>
 #include <ezexcept.h>
 
 DECLARE_EZEXCEPT(pool_error)
 DECLARE_EZEXCEPT(blockpool_error)
 
+// How the memory for the pools should be allocated. Process wide setting
+// (jive5ab's "-M" command line option), only affects pools created after
+// it was changed.
+//   pool_mem_hugepage  try to back pools with 2MB huge pages (MAP_HUGETLB),
+//                      falling back to transparent huge pages, falling
+//                      back to normal pages
+//   pool_mem_local     bind the pool's memory to the NUMA node of the CPU
+//                      the thread creating the pool is running on and
+//                      fault it in straight away
+enum pool_memory_flag {
+    pool_mem_default = 0x0, pool_mem_hugepage = 0x1, pool_mem_local = 0x2
+};
+void         set_pool_memory_flags( unsigned int flags );
+unsigned int get_pool_memory_flags( void );
+
+// Process wide accounting of all pool memory: how much is allocated and
+// how much of that is handed out in blocks, both current and the
+// high-water marks. Formatted for "memstat?"
+std::string  pool_memory_status( void );
+
+// The bookkeeping of a pool lives in a separate struct (defined in the
+// .cc) because it may have to outlive the pool_type: blocks
+// that are still in flight when the pool is deleted return to it.
+struct freelist_type;
 
 // a single pool consists of both memory
-// and an array of counters
+// and a free list of blocks
 struct pool_type {
     friend struct garbage_type;
+    friend struct block;
     // yes, I know. struct members are public by default.
     // however, this'un has private parts so to make it 
     // obvious which are pub and which are priv ...
@@ -39,20 +67,29 @@ struct pool_type {
         // particular value
         pool_type(unsigned int bs, unsigned int nb);
 
-        // return empty/default block if none available here
+        // return empty/default block if none available here.
+        // O(1): pops the head off the pool's lock-free free list
         block get( void );
 
+        // number of blocks currently handed out + the maximum so far
+        unsigned int in_use( void ) const;
+        unsigned int high_water( void ) const;
+
         void show_usecnt( void ) const;
 
         ~pool_type();
 
     private:
-        unsigned int       next_alloc;
-        refcount_type*     use_cnt;
+        freelist_type*     freelist;
         unsigned char*     memory;
+        uint64_t           memsize;
+        bool               mapped;
         const unsigned int nblock;
         const unsigned int block_size;
 
+        // the last reference to a block from a pool went away
+        static void release( refcount_type* rc );
+
         // do not support default creation
         // nor copy/assignment
         pool_type();
@@ -78,6 +115,9 @@ struct blockpool_type {
 
         void show_usecnt( void ) const;
 
+        // one-line summary: block size, #pools, #blocks, in use, high water
+        std::string status( void ) const;
+
         ~blockpool_type();
 
     private:
@@ -90,6 +130,14 @@ struct blockpool_type {
         const unsigned int    blocksize;
         const unsigned int    nblock_p_pool;
         pool_pointer_pointer  curpool;
+        unsigned int          high_water;
+        // protects the list of pools: get() may add one whilst status()
+        // ("memstat?") walks it from the command thread
+        mutable pthread_mutex_t mutex;
+
+        // no copying/assignment
+        blockpool_type(const blockpool_type&);
+        const blockpool_type& operator=(const blockpool_type&);
 };
 
 #endif
@@ -122,7 +122,7 @@ chain::internalstep::~internalstep() {
 
 
 chain::internalq::internalq(const string& tp):
-    actualqptr(0), elementtype(tp)
+    actualqptr(0), lockfree(false), elementtype(tp)
 {}
 
 chain::internalq::~internalq() {
@@ -183,6 +183,12 @@ void chain::chainimpl::run() {
     for(steps_type::iterator isptrptr=steps.begin(); isptrptr!=steps.end(); isptrptr++)
         (*isptrptr)->haveUD = false;
 
+    // Lock-free queues only support one pusher and one popper. Queue #i
+    // is pushed onto by step #i and popped by step #i+1
+    for(queues_type::size_type q=0; q<queues.size(); q++)
+        EZASSERT2(queues[q]->lockfree==false || (steps[q]->nthread==1 && steps[q+1]->nthread==1), chainexcept,
+                  EZINFO("lock-free queue after step " << q << " but step " << q << " or " << q+1 << " runs >1 thread"));
+
     // Set the thread attributes for our kinda threads
     PTHREAD_CALL( ::pthread_attr_init(&attribs) );
     PTHREAD_CALL( ::pthread_attr_setdetachstate(&attribs, PTHREAD_CREATE_JOINABLE) );
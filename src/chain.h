@@ -26,6 +26,7 @@
 
 #include <thunk.h>
 #include <bqueue.h>
+#include <spscqueue.h>
 #include <ezexcept.h>
 #include <fptrhelper.h>      // for reinterpret_helper<> 
 #include <pthreadcall.h>
@@ -235,24 +236,49 @@ void assign(T* valptr, T val) {
     *valptr = val;
 }
 
+// The queue length argument to chain::add() may be given as a plain
+// number, which will create a bqueue<> of that length between the step
+// and the next one. Passing "lockfree(n)" instead creates a lock-free
+// single-producer/single-consumer queue of length n for that edge (see
+// spscqueue.h). This is only allowed if both the step pushing onto it and
+// the step popping from it run with one thread; the chain checks this
+// when it is run.
+struct qspec_type {
+    unsigned int  qlen;
+    bool          lockfree;
+
+    qspec_type(unsigned int n):
+        qlen( n ), lockfree( false )
+    {}
+    qspec_type(unsigned int n, bool lf):
+        qlen( n ), lockfree( lf )
+    {}
+};
+
+inline qspec_type lockfree(unsigned int n) {
+    return qspec_type(n, true);
+}
+
 // InputQueues only allow popping
 template <typename Element>
 struct inq_type {
     friend class chain;
 
     bool pop(Element& e) {
-        return qptr->pop(e);
+        return sqptr ? sqptr->pop(e) : qptr->pop(e);
     }
 
     pop_result_type pop(Element& e, const struct timespec& absolute_time) {
-        return qptr->pop(e, absolute_time);
+        return sqptr ? sqptr->pop(e, absolute_time) : qptr->pop(e, absolute_time);
     }
 
 //    private:
-        inq_type(bqueue<Element>* q): qptr(q) {}
+        inq_type(bqueue<Element>* q): qptr(q), sqptr(0) {}
+        inq_type(spscqueue<Element>* q): qptr(0), sqptr(q) {}
 
     private:
-        bqueue<Element>*  qptr;
+        bqueue<Element>*     qptr;
+        spscqueue<Element>*  sqptr;
 };
 // OutputQueues allow pushing and delayed_disabling.
 template <typename Element>
@@ -260,14 +286,16 @@ struct outq_type {
     friend class chain;
 
     bool push(const Element& e) {
-        return qptr->push(e);
+        return sqptr ? sqptr->push(e) : qptr->push(e);
     }
 
     //private:
-        outq_type(bqueue<Element>* q): qptr(q) {}
+        outq_type(bqueue<Element>* q): qptr(q), sqptr(0) {}
+        outq_type(spscqueue<Element>* q): qptr(0), sqptr(q) {}
 
     private:
-        bqueue<Element>*  qptr;
+        bqueue<Element>*     qptr;
+        spscqueue<Element>*  sqptr;
 };
 
 
@@ -456,8 +484,12 @@ class chain {
             // Pointer to the actual "queue<SomeType>"
             // We only retain this pointer for a possible
             // next step which may need to re-interpret
-            // this pointer into the correct type
+            // this pointer into the correct type.
+            // If lockfree==true it points at an
+            // "spscqueue<SomeType>", otherwise at a
+            // "bqueue<SomeType>"
             void*              actualqptr;
+            bool               lockfree;
             // typeid().name() of "SomeType"
             const std::string  elementtype; 
 
@@ -596,7 +628,7 @@ class chain {
         // Those with extra data also may pass something 
         // wich builds a new UserData instance
         template <typename Out>
-        stepid add(void (*prodfn)(outq_type<Out>*), unsigned int qlen) {
+        stepid add(void (*prodfn)(outq_type<Out>*), qspec_type qlen) {
             // call the function taking no extra data as one that does
             reinterpret_helper< void(*)(outq_type<Out>*), void(*)(outq_type<Out>*, sync_type<void>*)>  reinterpret( prodfn );
             return add( reinterpret.data.second, qlen );
@@ -612,7 +644,7 @@ class chain {
         stepid add(void (*prodfn)(outq_type<Out>*, sync_type<UD*>*) );
 
         template <typename Out, typename UD>
-        stepid add(void (*prodfn)(outq_type<Out>*, sync_type<UD>*), unsigned int qlen) {
+        stepid add(void (*prodfn)(outq_type<Out>*, sync_type<UD>*), qspec_type qlen) {
             // insert a default maker
             return add(prodfn, qlen, &maker<UD>);
         }
@@ -622,29 +654,29 @@ class chain {
         //    be turned into a thunk first!
         template <typename Out, typename UD>
         stepid add(void (*prodfn)(outq_type<Out>*, sync_type<UD>*),
-                   unsigned int qlen, UD* prototype) {
+                   qspec_type qlen, UD* prototype) {
             return add(prodfn, qlen, makethunk(ptr_duplicator<UD>(prototype)), makethunk(&nodeleter<UD>));
         }
         template <typename Out, typename UD>
         stepid add(void (*prodfn)(outq_type<Out>*, sync_type<UD>*),
-                   unsigned int qlen, UD prototype) {
+                   qspec_type qlen, UD prototype) {
             return add(prodfn, qlen, duplicator<UD>(prototype));
         }
         // extra data + extradata maker "M" (supposed to return "UD*")
         template <typename Out, typename UD, typename M>
         stepid add(void (*prodfn)(outq_type<Out>*, sync_type<UD>*),
-                   unsigned int qlen, M m) {
+                   qspec_type qlen, M m) {
             return add(prodfn, qlen, makethunk(m), makethunk(&deleter<UD>));
         }
         // Id: only take a Maker with an Argument (eg "malloc" and "1024").
         template <typename T, typename UD, typename M, typename A>
         stepid add(void (*prodfn)(outq_type<T>*, sync_type<UD>*),
-                   unsigned int qlen, M m, A a) {
+                   qspec_type qlen, M m, A a) {
             return add(prodfn, qlen, makethunk(m,a), makethunk(&deleter<UD>));
         }
         template <typename T, typename UD, typename M, typename A, typename B>
         stepid add(void (*prodfn)(outq_type<T>*, sync_type<UD>*),
-                   unsigned int qlen, M m, A a, B b) {
+                   qspec_type qlen, M m, A a, B b) {
             return add(prodfn, qlen, makethunk(m,a,b), makethunk(&deleter<UD>));
         }
 #if 0
@@ -697,11 +729,48 @@ class chain {
             return add(prodfn, qlen, makethunk(m,a,b), nthr);
         }
 #endif
+        // Create the queue for an edge as specified by the user and fill
+        // in the queue-type specific details of the internalq
+        template <typename T>
+        static internalq* mkqueue(qspec_type const& qspec) {
+            internalq*  iq = new internalq(TYPE(T));
+
+            if( qspec.lockfree ) {
+                typedef spscqueue<T>  qtype;
+                qtype*  q = new qtype(qspec.qlen);
+
+                iq->actualqptr      = q;
+                iq->lockfree        = true;
+                iq->qdeleter        = makethunk(&deleter<qtype>, q);
+                iq->enable          = makethunk(&qtype::enable, q);
+                iq->disable         = makethunk(&qtype::disable, q);
+                iq->delayed_disable = makethunk(&qtype::delayed_disable, q);
+            } else {
+                typedef bqueue<T>     qtype;
+                qtype*  q = new qtype(qspec.qlen);
+
+                iq->actualqptr      = q;
+                iq->lockfree        = false;
+                iq->qdeleter        = makethunk(&deleter<qtype>, q);
+                iq->enable          = makethunk(&qtype::enable, q);
+                iq->disable         = makethunk(&qtype::disable, q);
+                iq->delayed_disable = makethunk(&qtype::delayed_disable, q);
+            }
+            return iq;
+        }
+        // Wrap an in- or output adaptor around the queue in iq;
+        // the elementtype must already have been verified to be T.
+        template <typename Adaptor, typename T>
+        static Adaptor* mkadaptor(internalq const* iq) {
+            if( iq->lockfree )
+                return new Adaptor( (spscqueue<T>*)iq->actualqptr );
+            return new Adaptor( (bqueue<T>*)iq->actualqptr );
+        }
+
         /////////// The actual step adder function
         template <typename T, typename UD>
         stepid add(void (*prodfn)(outq_type<T>*, sync_type<UD>*), 
-                   unsigned int qlen, thunk_type udmaker, curry_type uddeleter /*, unsigned int nthr=1*/) {
-            typedef bqueue<T>     qtype;
+                   qspec_type qlen, thunk_type udmaker, curry_type uddeleter /*, unsigned int nthr=1*/) {
             typedef outq_type<T>  oqtype;
             typedef sync_type<UD> stype;
 
@@ -735,25 +804,16 @@ class chain {
             // queue. The same process (adapting the real queue) will
             // be used whilst adding subsequent steps)
             // Construct the new step and queue
-            qtype*        q  = new qtype(qlen);
-            internalq*    iq = new internalq(TYPE(T));
-
-            // Fill in the details of the internal Q
-            iq->actualqptr      = q;
-            iq->qdeleter        = makethunk(&deleter<qtype>, q);
-            iq->enable          = makethunk(&qtype::enable, q);
-            iq->disable         = makethunk(&qtype::disable, q);
-            iq->delayed_disable = makethunk(&qtype::delayed_disable, q);
-
+            internalq*    iq = mkqueue<T>(qlen);
 
             // And the internal step. Because this is the
             // producer, it has no input-queue.
             // As a result, the input-queue-disabler will be a no-op
-            oqtype*       oq = new oqtype(q);
+            oqtype*       oq = mkadaptor<oqtype, T>(iq);
             internalstep* is = new internalstep(TYPE(UD*), &iq->delayed_disable, &chain::nop, 0, &(*_chain) /*, nthr*/);
             stype*        s  = new stype(&is->condition, &is->mutex);
 
-            is->qdepth      = qlen;
+            is->qdepth      = qlen.qlen;
             is->actualstptr = s;
             is->iqdeleter   = thunk_type(); 
             is->oqdeleter   = makethunk(&deleter<oqtype>, oq);
@@ -781,7 +841,7 @@ class chain {
         // Only allowed if there is already a chain [namely at least a producer]
         // and it's not yet closed
         template <typename In, typename Out>
-        stepid add(void (*stepfn)(inq_type<In>*, outq_type<Out>*), unsigned int qlen) {
+        stepid add(void (*stepfn)(inq_type<In>*, outq_type<Out>*), qspec_type qlen) {
             // wrap the function taking no extra data into one that does
             // so the rest of the code may assume the function is always
             // called with two arguments
@@ -794,7 +854,7 @@ class chain {
 
         template <typename In, typename Out, typename UD>
         stepid add(void (*stepfn)(inq_type<In>*, outq_type<Out>*, sync_type<UD>*),
-                   unsigned int qlen) {
+                   qspec_type qlen) {
             // insert a default maker
             return add(stepfn, qlen, &maker<UD>);
         }
@@ -802,33 +862,31 @@ class chain {
         // a copy of it
         template <typename In, typename Out, typename UD>
         stepid add(void (*stepfn)(inq_type<In>*, outq_type<Out>*, sync_type<UD>*),
-                   unsigned int qlen, const UD& prototype) {
+                   qspec_type qlen, const UD& prototype) {
             return add(stepfn, qlen, duplicator<UD>(prototype));
         }
         // extra data + extradata maker "M" (supposed to return "UD*")
         template <typename In, typename Out, typename UD, typename M>
         stepid add(void (*stepfn)(inq_type<In>*, outq_type<Out>*, sync_type<UD>*),
-                   unsigned int qlen, M m) {
+                   qspec_type qlen, M m) {
             return add(stepfn, qlen, makethunk(m));
         }
         // Id: only take a Maker with an Argument (eg "malloc" and "1024").
         template <typename In, typename Out, typename UD, typename M, typename A>
         stepid add(void (*stepfn)(inq_type<In>*, outq_type<Out>*, sync_type<UD>*),
-                   unsigned int qlen, M m, A a) {
+                   qspec_type qlen, M m, A a) {
             return add(stepfn, qlen, makethunk(m,a));
         }
         // Id: only take a Maker with an Argument (eg "malloc" and "1024").
         template <typename In, typename Out, typename UD, typename M, typename A, typename B>
         stepid add(void (*stepfn)(inq_type<In>*, outq_type<Out>*, sync_type<UD>*),
-                   unsigned int qlen, M m, A a, B b) {
+                   qspec_type qlen, M m, A a, B b) {
             return add(stepfn, qlen, makethunk(m,a, b));
         }
 
         template <typename In, typename Out, typename UD>
         stepid add(void (*stepfn)(inq_type<In>*, outq_type<Out>*, sync_type<UD>*), 
-                   unsigned int qlen, thunk_type udmaker) {
-            typedef bqueue<In>     prevqtype;
-            typedef bqueue<Out>    qtype;
+                   qspec_type qlen, thunk_type udmaker) {
             typedef inq_type<In>   iqtype;
             typedef outq_type<Out> oqtype;
             typedef sync_type<UD>  stype;
@@ -844,7 +902,7 @@ class chain {
             // Assert that the underlying datatype of the previous 
             // queue is the same as we are taking as input.
             // At least then we know that the "void*" in the internalq
-            // points to an instance of "bqueue<In>"
+            // points to an instance of "bqueue<In>" (or "spscqueue<In>")
             queueid   previousq = (_chain->queues.size()-1);
             EZASSERT2(_chain->queues[previousq]->elementtype==TYPE(In), chainexcept,
                       EZINFO("previous step out '" << _chain->queues[previousq]->elementtype << "'"
@@ -852,15 +910,7 @@ class chain {
 
             // This will be the stepid of the new step
             stepid        sid  = _chain->steps.size();
-            qtype*        newq = new qtype(qlen);
-            internalq*    iq   = new internalq(TYPE(Out));
-
-            // We have created a new queue: bqueue<Out>
-            iq->actualqptr      = newq;
-            iq->enable          = makethunk(&qtype::enable, newq);
-            iq->disable         = makethunk(&qtype::disable, newq);
-            iq->qdeleter        = makethunk(&deleter<qtype>, newq);
-            iq->delayed_disable = makethunk(&qtype::delayed_disable, newq);
+            internalq*    iq   = mkqueue<Out>(qlen);
 
             // Now the internal step.
             // This step created a new queue (its output).
@@ -869,13 +919,13 @@ class chain {
             // in the previous internalq to the correct type - we may
             // do so because the elementtypes did match (see the asserts
             // above) and we KNOW we only stick in pointers to
-            // an instance of 'bqueue<ElementType>']
+            // an instance of 'bqueue<ElementType>' or
+            // 'spscqueue<ElementType>']
             // Also create the "sync_type<UD>" object.
             //
             // The inq-disabler is taken from the previous queue, obviously
-            prevqtype*    prevq = (prevqtype*)_chain->queues[previousq]->actualqptr;
-            iqtype*       iqptr = new iqtype(prevq);
-            oqtype*       oqptr = new oqtype(newq);
+            iqtype*       iqptr = mkadaptor<iqtype, In>(_chain->queues[previousq]);
+            oqtype*       oqptr = mkadaptor<oqtype, Out>(iq);
             internalstep* is    = new internalstep(TYPE(UD*), &iq->delayed_disable,
                                                    &_chain->queues[previousq]->disable,
                                                    sid, &(*_chain));
@@ -883,7 +933,7 @@ class chain {
 
             // Now the step (it holds the adapters, make sure
             // they get type-safe deleted)
-            is->qdepth      = qlen;
+            is->qdepth      = qlen.qlen;
             is->actualstptr = s;
             is->iqdeleter   = makethunk(&deleter<iqtype>, iqptr);
             is->oqdeleter   = makethunk(&deleter<oqtype>, oqptr);
@@ -909,7 +959,7 @@ class chain {
             for(steps_type::iterator curstep=_chain->steps.begin();
                 curstep!=_chain->steps.end();
                 curstep++) 
-                    (*curstep)->qdepth += (qlen+1);
+                    (*curstep)->qdepth += (qlen.qlen+1);
             // Now append
             _chain->queues.push_back(iq);
             _chain->steps.push_back(is);
@@ -1002,7 +1052,6 @@ class chain {
         ////////// The actual consumer adding function
         template <typename In, typename UD>
         stepid add(void (*consfn)(inq_type<In>*, sync_type<UD>*), thunk_type udmaker /*, unsigned int nthr*/) {
-            typedef bqueue<In>    qtype;
             typedef inq_type<In>  iqtype;
             typedef sync_type<UD> stype;
 
@@ -1025,10 +1074,9 @@ class chain {
             // Great. Now we know everything matches up Ok.
             // Time to fill in the details.
             // This one does NOT create a new queue, only a new step.
-            // It just adapts the last queue from a bqueue<> to an inq_type<>.
-            // As a result, it does not have an output queue.
-            qtype*        prevq = (qtype*)_chain->queues[previousq]->actualqptr;
-            iqtype*       iqptr = new iqtype(prevq);
+            // It just adapts the last queue from a bqueue<> (or spscqueue<>)
+            // to an inq_type<>.  As a result, it does not have an output queue.
+            iqtype*       iqptr = mkadaptor<iqtype, In>(_chain->queues[previousq]);
             // This step has no outputqueue so the delayed-disabler is a
             // no-op. The inq-disabler is obviously taken from the 
             // previous queue
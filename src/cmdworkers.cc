@@ -0,0 +1,180 @@
+// execute slow commands in the background so the control loop keeps going
+// Copyright (C) 2007-2013 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.nl
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <cmdworkers.h>
+#include <mk5_exception.h>
+#include <mutex_locker.h>
+#include <dosyscall.h>
+#include <evlbidebug.h>
+#include <pthreadcall.h>
+#include <carrayutil.h>
+#include <threadutil.h>
+#include <algorithm>
+#include <exception>
+
+#include <unistd.h>
+
+using namespace std;
+
+
+// The queries that may take a long time: they read data off the disk pack
+// or out of a (FlexBuff/Mark6) recording, or list directories
+static const string slowQueries[] = {
+    "scan_check", "data_check", "file_check", "track_check",
+    "dir_info", "scandir"
+};
+// scan_set= has to go look for the recording before it can set the scan
+static const string slowCommands[] = {
+    "scan_set"
+};
+// Status queries the field system and monitoring clients poll regularly.
+// They only look at the runtime, so they may overtake a slow command
+static const string fastQueries[] = {
+    "status", "evlbi", "tstat", "error", "dts_id", "os_rev", "ss_rev", "version"
+};
+
+static bool is_one_of(string const& keyword, string const* b, string const* e) {
+    return std::find(b, e, keyword)!=e;
+}
+
+bool cmd_is_slow(string const& keyword, bool qry) {
+    if( qry )
+        return is_one_of(keyword, &slowQueries[0], &slowQueries[array_size(slowQueries)]);
+    return is_one_of(keyword, &slowCommands[0], &slowCommands[array_size(slowCommands)]);
+}
+
+bool cmd_is_fast(string const& keyword, bool qry) {
+    return qry && is_one_of(keyword, &fastQueries[0], &fastQueries[array_size(fastQueries)]);
+}
+
+#define QRY(q)  ((q?"?":"="))
+
+string execute_mk5cmd(mk5cmd cmd, bool qry, vector<string> const& args, runtime& rte) {
+    string  reply;
+
+    try {
+        reply = cmd(qry, args, rte);
+    }
+    catch( const Error_Code_6_Exception& e) {
+        reply = string("!")+args[0]+" " + QRY(qry) + " 6 : " + e.what() + ";";
+    }
+    catch( const Error_Code_8_Exception& e) {
+        reply = string("!")+args[0]+" " + QRY(qry) + " 8 : " + e.what() + ";";
+    }
+    catch( const cmdexception& e ) {
+        reply = string("!")+args[0]+" " + QRY(qry) + " 6 : " + e.what() + ";";
+    }
+    catch( const exception& e ) {
+        reply = string("!")+args[0]+" " + QRY(qry) + " 4 : " + e.what() + ";";
+    }
+    catch( ... ) {
+        reply = string("!")+args[0]+" " + QRY(qry) + " 4 : unknown exception ;";
+    }
+    return reply;
+}
+
+
+void protect_countdown(runtime& rte) {
+    rte.protected_count = max(rte.protected_count, 1u) - 1;
+}
+
+
+cmdjob_type::cmdjob_type(int f, string const& rtn, runtime* rte, mk5cmd c,
+                         bool q, vector<string> const& a):
+    fd( f ), rtname( rtn ), rteptr( rte ), cmd( c ), qry( q ), args( a )
+{}
+
+
+// There is at most one job per runtime in the queue so it doesn't need to
+// be big
+cmdworkers_type::cmdworkers_type(unsigned int n):
+    todo( 128 )
+{
+    EZASSERT2(n>0, cmdexception, EZINFO("need at least one command worker thread"));
+
+    PTHREAD_CALL( ::pthread_mutex_init(&doneMutex, 0) );
+    ASSERT_ZERO( ::pipe(wakeup) );
+
+    // The threads inherit our signal mask so they won't be bothered by
+    // zignalz
+    for(unsigned int i=0; i<n; i++) {
+        pthread_t  tid;
+
+        PTHREAD_CALL( ::pthread_create(&tid, 0, &cmdworkers_type::worker_fn, (void*)this) );
+        workers.push_back( tid );
+    }
+    DEBUG(3, "cmdworkers: started " << n << " threads" << endl);
+}
+
+int cmdworkers_type::fd( void ) const {
+    return wakeup[0];
+}
+
+void cmdworkers_type::submit(cmdjob_type* job) {
+    DEBUG(4, "cmdworkers: fd#" << job->fd << " '" << job->args[0] << QRY(job->qry)
+             << "' in runtime " << job->rtname << " goes to the background" << endl);
+    EZASSERT2(todo.push(job), cmdexception, EZINFO("command workers have been stopped"));
+}
+
+cmdjoblist_type cmdworkers_type::finished( void ) {
+    char            buf[ 64 ];
+    cmdjoblist_type rv;
+
+    // Only called when our fd was readable so this won't block.
+    // Reading the tokens before taking the list guarantees that no finished
+    // job goes unnoticed - any job added after we took the list also
+    // writes a token, which we'll see the next time round
+    ASSERT_COND( ::read(wakeup[0], buf, sizeof(buf))>0 );
+    {
+        mutex_locker  lck( doneMutex );
+        rv.swap( done );
+    }
+    return rv;
+}
+
+void* cmdworkers_type::worker_fn(void* args) {
+    cmdjob_type*     job;
+    cmdworkers_type* self = (cmdworkers_type*)args;
+
+    while( self->todo.pop(job) ) {
+        const char token = 'x';
+
+        job->reply = execute_mk5cmd(job->cmd, job->qry, job->args, *job->rteptr);
+        {
+            mutex_locker  lck( self->doneMutex );
+            self->done.push_back( job );
+        }
+        if( ::write(self->wakeup[1], &token, 1)!=1 )
+            DEBUG(-1, "cmdworkers: failed to wake up main thread - " << evlbi5a::strerror(errno) << endl);
+    }
+    return (void*)0;
+}
+
+cmdworkers_type::~cmdworkers_type() {
+    // Let the queue run empty and wait for the threads to finish
+    todo.delayed_disable();
+    for(vector<pthread_t>::iterator p=workers.begin(); p!=workers.end(); p++)
+        ::pthread_join(*p, 0);
+
+    for(cmdjoblist_type::iterator p=done.begin(); p!=done.end(); p++)
+        delete *p;
+    ::close( wakeup[0] );
+    ::close( wakeup[1] );
+    ::pthread_mutex_destroy( &doneMutex );
+}
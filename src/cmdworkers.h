@@ -0,0 +1,115 @@
+// execute slow commands in the background so the control loop keeps going
+// Copyright (C) 2007-2013 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.nl
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef JIVE5A_CMDWORKERS_H
+#define JIVE5A_CMDWORKERS_H
+
+#include <mk5command.h>
+#include <runtime.h>
+#include <bqueue.h>
+#include <list>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+// The main loop polls all control connections and executes each command
+// it receives in turn. Some queries (scan_check?, data_check?, or anything
+// that needs to list the directories of a FlexBuff) can take seconds and
+// used to hold up everyone else - notably the field system polling
+// "status?".
+//
+// Those commands are now handed off to worker thread(s). The main loop is
+// told through a pipe when one has finished and then sends the reply. The
+// main loop takes care of the ordering: only one command per runtime
+// executes in the background at any time, and commands for a runtime that
+// is busy wait for it - except for a handful of quick status queries,
+// which are always answered immediately.
+//
+// jive5ab runs this with one worker thread: the slow commands are not
+// safe to run concurrently with each other (e.g. data_check? keeps its
+// previous result in static variables shared by all runtimes).
+
+// Should keyword+qry be executed in the background?
+bool cmd_is_slow(std::string const& keyword, bool qry);
+
+// May keyword+qry be executed whilst its runtime is busy executing a slow
+// command?
+bool cmd_is_fast(std::string const& keyword, bool qry);
+
+// Execute the command and return the reply. Exceptions are turned into
+// the appropriate error reply.
+std::string execute_mk5cmd(mk5cmd cmd, bool qry, std::vector<std::string> const& args, runtime& rte);
+
+// The protect=off bookkeeping, to be done after each command. Only the main
+// loop does this - for a background command when it collects the reply -
+// such that protected_count is only ever touched by the main thread, which
+// also executes all commands that look at it (none of those is slow).
+void protect_countdown(runtime& rte);
+
+// One command to be executed in the background.
+struct cmdjob_type {
+    const int                       fd;       // the control connection it came from
+    const std::string               rtname;   // the runtime it executes in
+    runtime* const                  rteptr;
+    const mk5cmd                    cmd;
+    const bool                      qry;
+    const std::vector<std::string>  args;
+    std::string                     reply;    // filled in by the worker
+
+    cmdjob_type(int f, std::string const& rtn, runtime* rte, mk5cmd c,
+                bool q, std::vector<std::string> const& a);
+};
+
+typedef std::list<cmdjob_type*>  cmdjoblist_type;
+
+class cmdworkers_type {
+    public:
+        // Start 'n' worker threads
+        cmdworkers_type(unsigned int n);
+
+        // Add this to the set of fds to poll. It becomes readable if
+        // commands have finished
+        int fd( void ) const;
+
+        // Takes ownership of the job
+        void submit(cmdjob_type* job);
+
+        // Returns the jobs that have finished since the last call, in the
+        // order they finished. The caller owns them now.
+        cmdjoblist_type finished( void );
+
+        // Lets the submitted jobs run to completion before stopping the
+        // threads
+        ~cmdworkers_type();
+
+    private:
+        bqueue<cmdjob_type*>    todo;
+        cmdjoblist_type         done;
+        pthread_mutex_t         doneMutex;
+        int                     wakeup[2];
+        std::vector<pthread_t>  workers;
+
+        static void* worker_fn(void* args);
+
+        // no copying
+        cmdworkers_type(cmdworkers_type const&);
+        cmdworkers_type const& operator=(cmdworkers_type const&);
+};
+
+#endif
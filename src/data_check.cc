@@ -15,6 +15,8 @@
 #include <cstdlib> // for abs
 #include <cmath>
 #include <set>
+#include <algorithm>
+#include <climits>
 #include <time.h>
 
 using namespace std;
@@ -57,6 +59,121 @@ bool check_data_format(const unsigned char* data, size_t len, unsigned int track
                        const headersearch_type& format, bool strict,
                        unsigned int& byte_offset, highrestime_type& time, unsigned int& frame_number); 
 
+// Something that can find the first occurrence of a format's syncword in
+// a piece of data; the return value as boyer_moore's
+struct syncword_locator {
+    virtual unsigned char const* operator()(unsigned char const* data, unsigned int len) = 0;
+    virtual ~syncword_locator() {}
+};
+
+// id. but with a locator for the syncword
+bool check_data_format(const unsigned char* data, size_t len, unsigned int track,
+                       const headersearch_type& format, bool strict, syncword_locator& syncwordsearch,
+                       unsigned int& byte_offset, highrestime_type& time, unsigned int& frame_number); 
+
+// The generic locator: search for the format's syncword
+struct bm_locator: syncword_locator {
+    bm_locator(headersearch_type const& format):
+        bm( format.syncword, format.syncwordsize )
+    {}
+    virtual unsigned char const* operator()(unsigned char const* data, unsigned int len) {
+        return bm(data, len);
+    }
+    boyer_moore bm;
+};
+
+// Looking for the data format means trying a lot of formats, which all
+// must search for their syncword, from the start of the data. But there
+// are only two kinds of syncword in non-straight-through formats: Mark4
+// and VLBA have ntrack * 32 bits of 1, Mark5B has 0xABADDEED.
+// So we go through the data once and remember where we saw stretches of
+// 0xff bytes and Mark5B syncwords; the locators below find the syncwords
+// using that knowledge.
+struct syncword_index_type {
+    // [start, end) of a stretch of 0xff bytes
+    typedef std::pair<unsigned int, unsigned int> run_type;
+    typedef std::vector<run_type>                 runs_type;
+    typedef std::vector<unsigned int>             positions_type;
+
+    // Stretches shorter than minrun bytes are ignored
+    syncword_index_type(unsigned char const* data, unsigned int len, unsigned int minrun):
+        base( data ), longest_run( 0 )
+    {
+        unsigned int  i = 0;
+
+        while( i<len ) {
+            if( data[i]==0xff ) {
+                unsigned int j = i;
+                while( j<len && data[j]==0xff )
+                    j++;
+                if( j-i>=minrun ) {
+                    ffruns.push_back( run_type(i, j) );
+                    longest_run = std::max(longest_run, j-i);
+                }
+                i = j;
+                continue;
+            }
+            // Mark5B syncword is ed de ad ab in memory
+            if( data[i]==0xed && i+4<=len && data[i+1]==0xde && data[i+2]==0xad && data[i+3]==0xab )
+                mk5b.push_back( i );
+            i++;
+        }
+    }
+
+    unsigned char const* const base;
+    runs_type                  ffruns;
+    positions_type             mk5b;
+    unsigned int               longest_run;
+};
+
+// Find <size> bytes of 0xff
+struct ffrun_locator: syncword_locator {
+    ffrun_locator(syncword_index_type const& idx, unsigned int sz):
+        index( idx ), size( sz )
+    {}
+
+    virtual unsigned char const* operator()(unsigned char const* data, unsigned int len) {
+        const unsigned int                           q   = (unsigned int)(data - index.base);
+        const unsigned int                           end = q + len;
+        syncword_index_type::runs_type::const_iterator run;
+
+        // skip runs that end before we start
+        run = std::lower_bound(index.ffruns.begin(), index.ffruns.end(), q, ends_before());
+        for( ; run!=index.ffruns.end() && run->first<end; run++) {
+            const unsigned int start = std::max(run->first, q);
+
+            if( run->second-start>=size && start+size<=end )
+                return index.base + start;
+        }
+        return 0;
+    }
+
+    struct ends_before {
+        bool operator()(syncword_index_type::run_type const& r, unsigned int q) const {
+            return r.second<=q;
+        }
+    };
+    syncword_index_type const& index;
+    const unsigned int         size;
+};
+
+// Find the next Mark5B syncword
+struct mk5b_locator: syncword_locator {
+    mk5b_locator(syncword_index_type const& idx):
+        index( idx )
+    {}
+
+    virtual unsigned char const* operator()(unsigned char const* data, unsigned int len) {
+        const unsigned int q = (unsigned int)(data - index.base);
+        syncword_index_type::positions_type::const_iterator p = std::lower_bound(index.mk5b.begin(), index.mk5b.end(), q);
+
+        if( p==index.mk5b.end() || *p+4>q+len )
+            return 0;
+        return index.base + *p;
+    }
+    syncword_index_type const& index;
+};
+
 countedpointer< vector<uint32_t> > generate_nrzm(const unsigned char* data, size_t len) {
     countedpointer< vector<uint32_t> > nrzm_data (new vector<uint32_t>(len / sizeof(uint32_t)));
     uint32_t const*              data_pointer = (uint32_t const*)data;
@@ -175,23 +292,48 @@ bool find_data_format(const unsigned char* data, size_t len, unsigned int track,
         headersearch_type(fmt_mark5b, 32, 64000000, 0)
     };
 
-    // straight through data is encoded in NRZ-M, undo that encoding
-    countedpointer< vector<uint32_t> > nrzm_data = generate_nrzm(data,len);
+    // The smallest Mark4/VLBA syncword there is in the list
+    unsigned int minrun = UINT_MAX;
+
+    for (unsigned int i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+        if( formats[i].frameformat == fmt_mark4 || formats[i].frameformat == fmt_vlba )
+            minrun = std::min(minrun, formats[i].syncwordsize);
+
+    // One pass over the data to find all possible syncwords
+    const syncword_index_type  index(data, (unsigned int)len, minrun);
+
+    // straight through data is encoded in NRZ-M, undo that encoding - but
+    // only if we get to try those formats
+    countedpointer< vector<uint32_t> > nrzm_data;
     
     for (unsigned int i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
-        const unsigned char* data_to_use;
-        unsigned int len_of_data;
+        bool found;
+
         if (formats[i].frameformat == fmt_mark4_st || formats[i].frameformat == fmt_vlba_st) {
-            data_to_use = (const unsigned char*)&(*nrzm_data)[0];
-            len_of_data = nrzm_data->size() * sizeof(uint32_t);
+            bm_locator  bm( formats[i] );
+
+            if( !nrzm_data )
+                nrzm_data = generate_nrzm(data,len);
+            found = check_data_format((const unsigned char*)&(*nrzm_data)[0], nrzm_data->size() * sizeof(uint32_t),
+                                      track, formats[i], strict, bm,
+                                      result.byte_offset, result.time, result.frame_number);
         }
-        else {
-            data_to_use = data;
-            len_of_data = len;
+        else if (formats[i].frameformat == fmt_mark5b) {
+            mk5b_locator  m5b( index );
+
+            // No syncwords = no need to look
+            found = !index.mk5b.empty() &&
+                    check_data_format(data, len, track, formats[i], strict, m5b,
+                                      result.byte_offset, result.time, result.frame_number);
         }
+        else {
+            ffrun_locator ff( index, formats[i].syncwordsize );
 
-        if ( check_data_format(data_to_use, len_of_data, track, formats[i], strict,
-                               result.byte_offset, result.time, result.frame_number) ) {
+            found = (index.longest_run >= formats[i].syncwordsize) &&
+                    check_data_format(data, len, track, formats[i], strict, ff,
+                                      result.byte_offset, result.time, result.frame_number);
+        }
+        if ( found ) {
             result.format       = formats[i].frameformat;
             result.ntrack       = formats[i].ntrack;
             result.trackbitrate = formats[i].trackbitrate;
@@ -207,8 +349,11 @@ bool find_data_format(const unsigned char* data, size_t len, unsigned int track,
     
     // Mark5B as generated by RDBE and Fila10G doesn't contain subsecond information
     // try this "format" last
-    if ( check_data_format(data, len, track, headersearch_type(fmt_mark5b, 32, headersearch_type::UNKNOWN_TRACKBITRATE, 0),
-                           strict, result.byte_offset, result.time, result.frame_number) ) {
+    mk5b_locator  m5b( index );
+
+    if ( !index.mk5b.empty() &&
+         check_data_format(data, len, track, headersearch_type(fmt_mark5b, 32, headersearch_type::UNKNOWN_TRACKBITRATE, 0),
+                           strict, m5b, result.byte_offset, result.time, result.frame_number) ) {
         result.format            = fmt_mark5b;
         result.ntrack            = 32;
         result.trackbitrate      = headersearch_type::UNKNOWN_TRACKBITRATE;
@@ -267,8 +412,14 @@ bool might_be_dbe( const mk5b_ts& timestamp ) {
 
 bool check_data_format(const unsigned char* data, size_t len, unsigned int track, const headersearch_type& format,
                        bool strict, unsigned int& byte_offset, highrestime_type& time, unsigned int& frame_number) {
+    bm_locator  syncwordsearch( format );
 
-    boyer_moore                syncwordsearch(format.syncword, format.syncwordsize);
+    return check_data_format(data, len, track, format, strict, syncwordsearch, byte_offset, time, frame_number);
+}
+
+bool check_data_format(const unsigned char* data, size_t len, unsigned int track, const headersearch_type& format,
+                       bool strict, syncword_locator& syncwordsearch,
+                       unsigned int& byte_offset, highrestime_type& time, unsigned int& frame_number) {
     unsigned int               next_position;
     headersearch::strict_type  strict_e;
     
@@ -0,0 +1,147 @@
+// Write files with O_DIRECT, bypassing the page cache
+// Copyright (C) 2007-2013 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.nl
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <directwriter.h>
+#include <evlbidebug.h>
+#include <threadutil.h>    // evlbi5a::strerror()
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+DEFINE_EZEXCEPT(directwriter_error)
+
+// Not all systems have O_DIRECT (e.g. OSX) - there we'll just use the
+// staging buffer and write through the cache.
+#ifndef O_DIRECT
+    #define O_DIRECT 0
+#endif
+
+static size_t round_up(size_t n) {
+    return ((n + directwriter_type::alignment - 1)/directwriter_type::alignment) * directwriter_type::alignment;
+}
+
+directwriter_type::directwriter_type(int f, size_t ss):
+    fd( f ), isDirect( false ), stage( 0 ), stageSize( round_up(ss ? ss : defStageSize) ), stageFill( 0 )
+{
+    int   flags;
+    void* mem = 0;
+
+    EZASSERT2(fd>=0, directwriter_error, EZINFO("invalid file descriptor " << fd));
+    EZASSERT2(::posix_memalign(&mem, alignment, stageSize)==0, directwriter_error,
+              EZINFO("failed to allocate " << stageSize << " bytes of aligned staging memory"));
+    stage = (unsigned char*)mem;
+
+    // Attempt to switch on O_DIRECT. Failure to do so is not an error
+    if( O_DIRECT!=0 && (flags=::fcntl(fd, F_GETFL))!=-1 ) {
+        if( ::fcntl(fd, F_SETFL, flags|O_DIRECT)==0 )
+            isDirect = true;
+        else
+            DEBUG(3, "directwriter: cannot set O_DIRECT on fd#" << fd << " - " << evlbi5a::strerror(errno) << endl);
+    }
+}
+
+bool directwriter_type::direct( void ) const {
+    return isDirect;
+}
+
+bool directwriter_type::flush(void const* buf, size_t n) {
+    ssize_t              rv;
+    unsigned char const* p = (unsigned char const*)buf;
+
+    while( n ) {
+        if( (rv=::write(fd, p, n))<=0 ) {
+            if( rv<0 && errno==EINTR )
+                continue;
+            // a short write that returns 0 would make us loop forever
+            if( rv==0 )
+                errno = EIO;
+            return false;
+        }
+        p += rv;
+        n -= (size_t)rv;
+    }
+    return true;
+}
+
+ssize_t directwriter_type::write(void const* buf, size_t n) {
+    const size_t         amask = alignment - 1;
+    unsigned char const* p = (unsigned char const*)buf;
+    size_t               todo = n;
+
+    while( todo ) {
+        // Nothing staged and caller's memory aligned? Then we can write
+        // the aligned part straight from there
+        if( stageFill==0 && todo>=alignment && ((size_t)p & amask)==0 ) {
+            const size_t m = todo & ~amask;
+
+            if( !flush(p, m) )
+                return -1;
+            p    += m;
+            todo -= m;
+            continue;
+        }
+        // Copy as much as we can into the stage and write it if full
+        const size_t c = (todo < (stageSize - stageFill)) ? todo : (stageSize - stageFill);
+
+        ::memcpy(stage + stageFill, p, c);
+        stageFill += c;
+        p         += c;
+        todo      -= c;
+        if( stageFill==stageSize ) {
+            if( !flush(stage, stageSize) )
+                return -1;
+            stageFill = 0;
+        }
+    }
+    return (ssize_t)n;
+}
+
+int directwriter_type::finish( void ) {
+    int       flags;
+
+    if( stageFill==0 )
+        return 0;
+
+    // Write out the whole aligned part with O_DIRECT, the remainder
+    // must go through the cache
+    const size_t aligned = stageFill & ~(alignment - 1);
+
+    if( aligned && !flush(stage, aligned) )
+        return -1;
+    if( isDirect ) {
+        if( (flags=::fcntl(fd, F_GETFL))==-1 || ::fcntl(fd, F_SETFL, flags & ~O_DIRECT)==-1 )
+            return -1;
+        isDirect = false;
+    }
+    if( !flush(stage + aligned, stageFill - aligned) )
+        return -1;
+    stageFill = 0;
+    return 0;
+}
+
+directwriter_type::~directwriter_type() {
+    if( stageFill )
+        DEBUG(-1, "directwriter: fd#" << fd << " destroyed with " << stageFill << " bytes unwritten" << endl);
+    ::free(stage);
+}
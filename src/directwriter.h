@@ -0,0 +1,86 @@
+// Write files with O_DIRECT, bypassing the page cache
+// Copyright (C) 2007-2013 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.nl
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef JIVE5A_DIRECTWRITER_H
+#define JIVE5A_DIRECTWRITER_H
+
+#include <ezexcept.h>
+#include <ioalign.h>
+#include <sys/types.h>
+
+DECLARE_EZEXCEPT(directwriter_error)
+
+// When recording at high data rates the page cache does us no favours:
+// the data is never read back, yet it pushes everything else out of memory
+// and the kernel decides when it gets flushed - causing latency spikes
+// when it does so.
+//
+// With O_DIRECT the data goes straight from our memory to the disk but the
+// kernel requires buffer address, size and file offset to be multiples of
+// the device's logical block size. Our chunks have arbitrary sizes and
+// Mark6 files intersperse small headers, so this writer stages data in an
+// aligned buffer and only ever submits aligned writes. If the caller's
+// memory is aligned and nothing is staged, the aligned part is written
+// from the caller's memory directly. The blockpools allocate their memory
+// on this alignment so a FlexBuff chunk (one file per block) only has its
+// tail copied into the stage.
+//
+// The unaligned tail (if any) is written by finish(), after switching
+// O_DIRECT off for the file descriptor. The on-disk result is byte-for-byte
+// identical to what a series of plain write(2)s would produce.
+//
+// If the file system does not support O_DIRECT the writer just uses the
+// file descriptor as-is (through the page cache).
+struct directwriter_type {
+    static const size_t  alignment   = io_alignment;
+    static const size_t  defStageSize = 4*1024*1024;
+
+    // Takes ownership of neither the file descriptor nor does it close it.
+    // The file offset of fd must be 0 (freshly created file)
+    directwriter_type(int fd, size_t stagesize = defStageSize);
+
+    // Return value as write(2) but will always write all of n or fail
+    ssize_t write(void const* buf, size_t n);
+
+    // Flush what's staged. Must be called before the file descriptor is
+    // closed. Returns 0 on success, -1 on error (errno set).
+    // After this the writer should not be used anymore
+    int     finish( void );
+
+    // Did we manage to switch on O_DIRECT?
+    bool    direct( void ) const;
+
+    ~directwriter_type();
+
+    private:
+        int             fd;
+        bool            isDirect;
+        unsigned char*  stage;
+        const size_t    stageSize;
+        size_t          stageFill;
+
+        // write exactly n bytes; the only place where we write(2)
+        bool            flush(void const* buf, size_t n);
+
+        directwriter_type();
+        directwriter_type(directwriter_type const&);
+        directwriter_type const& operator=(directwriter_type const&);
+};
+
+#endif
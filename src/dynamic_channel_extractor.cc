@@ -25,6 +25,7 @@
 #include <ctype.h>
 #include <stdio.h>  // for ::sscanf()
 #include <stdint.h> // for uint8_t
+#include <string.h> // for ::memcpy()
 
 #include <stringutil.h>
 
@@ -285,9 +286,6 @@ typedef vector<channelstate_type> extractorstate_type;
 // Generate 
 //    void <functionname>(void* src, size_t len, void* d0, ... dN)
 string generate_dynamic_channel_extractor(const extractorconfig_type& config, const string& functionname) {
-    char                           datebuf[64];
-    time_t                         gentime_ux; 
-    struct tm                      gentime_gm;
     const string                   inputname( "input" );
     unsigned int                   bitoffset;
     unsigned int                   inputincrement_bytes;
@@ -327,11 +325,6 @@ string generate_dynamic_channel_extractor(const extractorconfig_type& config, co
     inputincrement_bytes  = bitoffset / 8;
     outputincrement_bytes = extractorstate[0].outputincrement();
 
-    // date + time of generation
-    ::time( &gentime_ux );
-    ::gmtime_r( &gentime_ux, &gentime_gm );
-    ::strftime(datebuf, sizeof(datebuf), "%A %d %B %Y %H:%M:%S", &gentime_gm);
-
     // For each channel, generate an output pointer
     for(size_t i=0; i<extractorstate.size(); i++) {
         ostringstream  tmp;
@@ -341,9 +334,11 @@ string generate_dynamic_channel_extractor(const extractorconfig_type& config, co
 
 
     // Produce the code!
-    // File header
+    // File header. Note: no date/time of generation in here; the code must
+    // only depend on the configuration such that it can be cached (see
+    // jit.h)
     code << "/* this file was generated by dynamic channel extractor v0.2" << endl
-         << " * by jive5ab on " << datebuf << endl
+         << " * by jive5ab" << endl
          << " *" << endl
          << " * config:" << endl
          << " * " << config << endl
@@ -385,3 +380,115 @@ string generate_dynamic_channel_extractor(const extractorconfig_type& config, co
     std::cout << code.str() << endl;
     return code.str();
 }
+
+
+//
+//   The table driven extractor
+//
+dce_table_type::dce_table_type(const extractorconfig_type& config):
+    nChannel( config.channels.size() ), inputIncrement( 0 ), outputIncrement( 0 ), nWord( 0 )
+{
+    typedef map<pair<unsigned int, unsigned int>, lookup_type*> lookupmap_type;
+    unsigned int            bitoffset, nbit;
+    lookupmap_type          lookups;
+    lookuplist_type         tables;
+    const channellist_type& channels( config.channels );
+
+    DCEASSERT2( nChannel<=max_channels, "the table driven extractor supports at most " << max_channels
+                                        << " channels, not " << nChannel );
+
+    // Find the period in exactly the same way as the code generator does;
+    // we must be consuming the input in identical steps
+    nbit      = 0;
+    bitoffset = 0;
+    while( nbit==0 || nbit%8 || (bitoffset>0 && bitoffset%8) ) {
+        nbit      += config.bitsperchannel;
+        bitoffset += config.bitsperinputword;
+    }
+    inputIncrement  = bitoffset / 8;
+    outputIncrement = nbit / 8;
+    nWord           = (nChannel * outputIncrement + 7) / 8;
+
+    // Now visit all bits of all channels in the period and record where
+    // they come from and where they end up.
+    // Output byte 'dst' of the period lives in output word dst/8, at byte
+    // dst%8 *in memory*, such that filling in the tables bytewise keeps us
+    // independent of the host's byte order.
+    for(unsigned int ch=0; ch<nChannel; ch++) {
+        for(unsigned int bitidx=0; bitidx<nbit; bitidx++) {
+            const unsigned int              bitnum  = channels[ch][bitidx % config.bitsperchannel] +
+                                                      (bitidx / config.bitsperchannel) * config.bitsperinputword;
+            const unsigned int              srcbyte = bitnum / 8;
+            const uint8_t                   srcmask = (uint8_t)(0x1 << (bitnum % 8));
+            const unsigned int              dst     = ch * outputIncrement + bitidx / 8;
+            const uint8_t                   dstmask = (uint8_t)(0x1 << (bitidx % 8));
+            const pair<unsigned int, unsigned int> key(srcbyte, dst / 8);
+            lookupmap_type::iterator        curlookup = lookups.find( key );
+
+            if( curlookup==lookups.end() ) {
+                lookup_type* lt = new lookup_type();
+
+                lt->srcbyte = srcbyte;
+                lt->dstword = dst / 8;
+                for(unsigned int v=0; v<256; v++)
+                    lt->table[v] = 0;
+                curlookup = lookups.insert( make_pair(key, lt) ).first;
+            }
+            for(unsigned int v=0; v<256; v++)
+                if( v & srcmask )
+                    ((uint8_t*)&curlookup->second->table[v])[dst % 8] |= dstmask;
+        }
+    }
+
+    // Each output word has at least one contributor; the first one we find
+    // for a word will assign. Keep both lists ordered by output word.
+    vector<bool>  assigned( nWord, false );
+
+    for(unsigned int w=0; w<nWord; w++) {
+        for(lookupmap_type::iterator curlookup=lookups.begin(); curlookup!=lookups.end(); curlookup++) {
+            if( curlookup->second->dstword!=w )
+                continue;
+            if( assigned[w] )
+                merge.push_back( *curlookup->second );
+            else
+                assign.push_back( *curlookup->second );
+            assigned[w] = true;
+        }
+    }
+    for(lookupmap_type::iterator curlookup=lookups.begin(); curlookup!=lookups.end(); curlookup++)
+        delete curlookup->second;
+    DCEASSERT2( assign.size()==nWord, "internal error - not all output words are produced?!" );
+}
+
+void dce_table_type::extract(const void* src, size_t len, unsigned char* const* dst) const {
+    uint64_t                        period[ (max_channels * 64) / 8 ];
+    const unsigned char*            input = (const unsigned char*)src;
+    const unsigned char* const      bytes = (const unsigned char*)&period[0];
+    // Copy everything into locals; the compiler must assume that the byte
+    // stores into the output alias anything that lives in memory
+    const unsigned int              nch    = nChannel;
+    const unsigned int              inc    = inputIncrement;
+    const unsigned int              outinc = outputIncrement;
+    const size_t                    nperiod = len / inc;
+    const lookup_type* const        abegin = &assign[0];
+    const lookup_type* const        aend   = abegin + assign.size();
+    const lookup_type* const        mbegin = merge.empty() ? 0 : &merge[0];
+    const lookup_type* const        mend   = mbegin + merge.size();
+
+    for(size_t n=0; n<nperiod; n++, input+=inc) {
+        for(const lookup_type* l=abegin; l!=aend; l++)
+            period[l->dstword]  = l->table[ input[l->srcbyte] ];
+        for(const lookup_type* l=mbegin; l!=mend; l++)
+            period[l->dstword] |= l->table[ input[l->srcbyte] ];
+
+        // Distribute the period over the channels. One byte per channel
+        // per period is by far the most common case
+        if( outinc==1 ) {
+            for(unsigned int ch=0; ch<nch; ch++)
+                dst[ch][n] = bytes[ch];
+        } else {
+            for(unsigned int ch=0; ch<nch; ch++)
+                ::memcpy(dst[ch] + n*outinc, bytes + ch*outinc, outinc);
+        }
+    }
+}
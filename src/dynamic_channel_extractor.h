@@ -25,6 +25,8 @@
 #include <iostream>
 #include <ezexcept.h>
 
+#include <stdint.h>
+
 // Exceptions of this type may be thrown.
 // Derived from std::exception
 // If your codebase does not have 'ezexcept.h'
@@ -68,4 +70,59 @@ std::string          generate_dynamic_channel_extractor(const extractorconfig_ty
                                                         const std::string& functionname);
 
 
+// The in-process alternative to generating code + having it compiled: a
+// table driven extractor. It processes the input in exactly the same
+// periods as the generated code does (the smallest number of input words
+// after which every channel has produced an integral number of bytes)
+// and produces bit-for-bit identical output.
+//
+// For every byte of the input period and every 64-bit word of the output
+// period that it contributes bits to, a 256-entry table holds the output
+// bits as function of the input byte value. Extracting a period is thus
+// one table lookup + OR per (input byte, output word) pair, no matter
+// how convoluted the bit map.
+//
+// The output period is laid out channel after channel, each channel
+// producing outputincrement() bytes per period, so at most 16 channels are
+// supported (the same as the splitfunctions can output).
+class dce_table_type {
+    public:
+        static const unsigned int max_channels = 16;
+
+        dce_table_type(const extractorconfig_type& config);
+
+        // Like the generated function: process as many whole input periods
+        // from src as fit in len bytes; write the extracted channel data
+        // to dst[0] .. dst[nchannel()-1]
+        void extract(const void* src, size_t len, unsigned char* const* dst) const;
+
+        unsigned int nchannel( void ) const {
+            return nChannel;
+        }
+        unsigned int inputincrement( void ) const {
+            return inputIncrement;
+        }
+        unsigned int outputincrement( void ) const {
+            return outputIncrement;
+        }
+
+    private:
+        struct lookup_type {
+            unsigned int      srcbyte;
+            unsigned int      dstword;
+            uint64_t          table[256];
+        };
+        typedef std::vector<lookup_type> lookuplist_type;
+
+        unsigned int    nChannel;
+        unsigned int    inputIncrement;
+        unsigned int    outputIncrement;
+        unsigned int    nWord;
+        // The first lookup for each output word assigns, the others OR
+        // their bits in. Saves clearing the output before each period.
+        lookuplist_type assign;
+        lookuplist_type merge;
+};
+
+
 #endif
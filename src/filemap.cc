@@ -0,0 +1,139 @@
+// implementation
+// Copyright (C) 2007-2013 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.nl
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <filemap.h>
+#include <evlbidebug.h>
+#include <threadutil.h>  // for evlbi5a::strerror()
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+
+namespace {
+    // One mapped window. The blocks of the window keep it alive
+    struct mapping_type {
+        block_owner_type  owner;     // MUST be first
+        void*             base;
+        size_t            len;
+    };
+
+    void unmap_window(block_owner_type* o) {
+        mapping_type*  m = reinterpret_cast<mapping_type*>(o);
+
+        if( ::munmap(m->base, m->len)!=0 )
+            DEBUG(-1, "filemap: failed to unmap " << m->len << " bytes @" << m->base << " - " << evlbi5a::strerror(errno) << endl);
+        delete m;
+    }
+}
+
+
+filemap_type::filemap_type(int f, unsigned int blocksize):
+    fd( f ), ok( false ), filesize( 0 ), pagesize( (size_t)::sysconf(_SC_PAGESIZE) ),
+    windowsize( std::max((size_t)1, window_size/blocksize) * blocksize ),
+    wstart( 0 ), wend( 0 )
+{
+    void*        p;
+    struct stat  st;
+
+    if( ::fstat(fd, &st)!=0 || !S_ISREG(st.st_mode) ) {
+        DEBUG(3, "filemap: fd#" << fd << " is not a regular file" << endl);
+        return;
+    }
+    filesize = st.st_size;
+
+    // Can it be mapped at all? E.g. if it was opened write-only it can't
+    if( (p=::mmap(0, pagesize, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0))==MAP_FAILED ) {
+        DEBUG(2, "filemap: fd#" << fd << " cannot be mapped - " << evlbi5a::strerror(errno) << endl);
+        return;
+    }
+    ::munmap(p, pagesize);
+    ok = true;
+}
+
+bool filemap_type::usable( void ) const {
+    return ok;
+}
+
+block filemap_type::get(off_t offset, size_t n) {
+    errno = 0;
+    if( !ok ) {
+        errno = EBADF;
+        return block();
+    }
+    // Map a new window if the block isn't (completely) in the current
+    // one, unless the current one runs up to EOF
+    if( offset<wstart || offset>=wend || (offset+(off_t)n>wend && wend<filesize) )
+        if( !this->map_window(offset, n) )
+            return block();
+    return window.sub((unsigned int)(offset - wstart),
+                      (unsigned int)std::min((off_t)n, wend - offset));
+}
+
+bool filemap_type::map_window(off_t offset, size_t n) {
+    void*         p;
+    struct stat   st;
+    mapping_type* m;
+
+    // Drop our reference to the current window first; in case of EOF or
+    // error there is no current window anymore
+    window = block();
+    wstart = wend = 0;
+
+    // The file may have grown since we last looked
+    if( offset+(off_t)n>filesize ) {
+        if( ::fstat(fd, &st)!=0 )
+            return false;
+        filesize = st.st_size;
+    }
+    if( offset>=filesize )
+        return false;
+
+    // mmap(2) wants the file offset to be a multiple of the page size
+    const off_t   aligned = offset - offset % (off_t)pagesize;
+    const off_t   end     = std::min(offset + (off_t)windowsize, filesize);
+    const size_t  len     = (size_t)(end - aligned);
+
+    if( (p=::mmap(0, len, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, aligned))==MAP_FAILED )
+        return false;
+
+    // Read ahead this window and tell the kernel to start on the next one
+    // too. None of these are fatal
+    ::madvise(p, len, MADV_SEQUENTIAL);
+    ::madvise(p, len, MADV_WILLNEED);
+    if( end<filesize )
+        ::posix_fadvise(fd, end, (off_t)windowsize, POSIX_FADV_WILLNEED);
+
+    m                 = new mapping_type;
+    m->owner.refcount = 0;
+    m->owner.release  = &unmap_window;
+    m->base           = p;
+    m->len            = len;
+
+    window = block((unsigned char*)p + (offset - aligned), (size_t)(end - offset), &m->owner);
+    wstart = offset;
+    wend   = end;
+    errno  = 0;
+    return true;
+}
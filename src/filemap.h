@@ -0,0 +1,80 @@
+// hand out blocks that refer directly to a memory mapped file
+// Copyright (C) 2007-2013 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.nl
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef JIVE5A_FILEMAP_H
+#define JIVE5A_FILEMAP_H
+
+#include <block.h>
+#include <sys/types.h>
+
+// Reading a local file into pool blocks means the kernel copies every
+// byte from the page cache into our memory. The blocks handed out by this
+// one refer to the page cache directly.
+//
+// The file is mapped in windows of (about) window_size bytes, in order.
+// Each window is unmapped as soon as the last block referring to it is
+// released, so the amount of address space in use is bounded by how far
+// the consumers lag behind. When a window is mapped the kernel is told
+// it will be read sequentially and it starts reading ahead the window
+// after it.
+//
+// The mappings are private and writable: consumers that modify the data
+// in place get their own copy of the page(s) they touch, the file is
+// never modified.
+//
+// Note: if the file is truncated while blocks of it are still in flight,
+// touching those blocks raises SIGBUS.
+class filemap_type {
+    public:
+        static const size_t window_size = 64*1024*1024;
+
+        // Blocks will be (at most) blocksize bytes, windows are a
+        // multiple of that
+        filemap_type(int fd, unsigned int blocksize);
+
+        // False if the file can't be mapped - not a regular file, not
+        // opened for reading, ...; the caller should fall back to read(2)
+        bool  usable( void ) const;
+
+        // The block of n bytes (n<=blocksize) at offset 'offset' in the
+        // file. Near EOF the block may be shorter. At EOF an empty block is
+        // returned with errno==0, on error errno is set.
+        block get(off_t offset, size_t n);
+
+    private:
+        int          fd;
+        bool         ok;
+        off_t        filesize;
+        size_t       pagesize;
+        size_t       windowsize;
+
+        // The current window: the file's [wstart, wend) is mapped and
+        // 'window' holds our reference to it
+        off_t        wstart;
+        off_t        wend;
+        block        window;
+
+        bool  map_window(off_t offset, size_t n);
+
+        // no copying/assignment
+        filemap_type(const filemap_type&);
+        const filemap_type& operator=(const filemap_type&);
+};
+
+#endif
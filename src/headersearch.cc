@@ -33,6 +33,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <sstream>
+#include <iomanip>
+#include <algorithm>
 #include <utility>    // for make_pair()
 
 #include <arpa/inet.h>
@@ -169,7 +171,8 @@ decoderstate_type::decoderstate_type( unsigned int ntrack, const samplerate_type
     // framerate is numerator() frames per denominator() seconds. Only
     // need to compute the offset lookup table if denominator()!=1
     offset_lut( (VALID_SAMPLERATE(frametime) && VALID_SAMPLERATE(framerate) && framerate.denominator()!=1) ?
-                ::compute_offset_lut(frametime) : offset_lut_type() )
+                ::compute_offset_lut(frametime) : offset_lut_type() ),
+    framesubsecond( frametime )
 {
     ::memset(&user[0], 0, sizeof(user));
 }
@@ -609,17 +612,23 @@ highrestime_type decode_vlba_timestamp(Header const* ts, const headersearch::str
 #endif
 
     // We've set the date to the "tm_mday'th of Jan, 1970".
-    // Let the normalization work out the year/day-of-year from that.
-    // This only works correctly if the timezone environment variable has been set to empty or "UTC"
-    // (see ctime(3), tzset(3))
-    rv.tv_sec  = ::mktime(&vlba_time);
+    // ::mktime() would work out the year/day-of-year from that, which only
+    // works correctly if the timezone environment variable has been set to
+    // empty or "UTC" (see ctime(3), tzset(3)). In UTC a day is exactly
+    // 86400 seconds so we can do what mktime() would do ourselves,
+    // at a fraction of the cost - this is called for each frame.
+    rv.tv_sec  = (time_t)(vlba_time.tm_mday - 1) * 86400 +
+                 (time_t)(vlba_time.tm_hour * 3600 + vlba_time.tm_min * 60 + vlba_time.tm_sec);
 
 #ifdef GDBDEBUG
     char buf[32];
+    ::gmtime_r(&rv.tv_sec, &vlba_time);
     ::strftime(buf, sizeof(buf), "%d-%b-%Y (%j) %Hh%Mm%Ss", &vlba_time);
     DEBUG(4, "vlba_ts: after normalization " << buf << " +" << (((double)rv.tv_nsec)*1.0e-9) << "s" << endl);
 #endif
-    return rv;
+    // The subsecond field is in units of 10^-4 seconds; constructing the
+    // rational from that is cheaper than from nanoseconds
+    return highrestime_type(rv.tv_sec, subsecond_type(rv.tv_nsec/100000, 10000));
 }
 
 
@@ -1116,6 +1125,13 @@ template<bool strip_parity> highrestime_type vlba_frame_timestamp(
     return decode_vlba_timestamp<vlba_tape_ts>((vlba_tape_ts const*)&timecode[0], strict);
 }
 
+// floor( ss * precision ) for 0 <= ss < 1
+static unsigned int subsecond_floor(const subsecond_type& ss, const unsigned int precision) {
+    if( (ss.denominator() >> 32)==0 )
+        return (unsigned int)((ss.numerator() * precision) / ss.denominator());
+    return boost::rational_cast<unsigned int>(ss * precision);
+}
+
 highrestime_type mk5b_frame_timestamp(unsigned char const* framedata, 
                               const unsigned int /*track*/,
                               const unsigned int /*ntrack*/, 
@@ -1124,7 +1140,7 @@ highrestime_type mk5b_frame_timestamp(unsigned char const* framedata,
                               const headersearch::strict_type strict) {
     struct m5b_state {
         time_t          second;
-        samplerate_type frameno;
+        uint64_t        frameno;
         bool            wrap;
     };
     // In Mk5B there is no per-track header. Only one header (4 32bit words) for all data
@@ -1137,8 +1153,9 @@ highrestime_type mk5b_frame_timestamp(unsigned char const* framedata,
     m5b_state*          m5b_s  = (m5b_state*)((void*)&state->user[0]); // gcc won't allow direct cast to pointer to struct
                                                                        // on account of strict aliasing rules
     m5b_header const*   m5b_h  = (m5b_header const*)framedata;
-    samplerate_type     frameno(m5b_h->frameno);
+    uint64_t            frameno(m5b_h->frameno);
     subsecond_type      prevnsec = 0;
+    bool                frameno_out_of_range;
 
     // Use the frame#-within-seconds to enhance accuracy
     // If we detect a wrap in the framenumber within the same integer
@@ -1150,24 +1167,27 @@ highrestime_type mk5b_frame_timestamp(unsigned char const* framedata,
     if( m5b_s->wrap )
         frameno += 0x8000; // 15 bits is maximum framenumber so we must add 0x8000
 
+    // frameno >= framerate, without rational arithmetic
+    frameno_out_of_range = (frameno * state->framerate.denominator() >= state->framerate.numerator());
+
     if ( trackbitrate != headersearch_type::UNKNOWN_TRACKBITRATE ) {
         // Differentiate between strict Mk5 and non-strict Mk5B 
         // time stamp decoding
-        if( frameno>=state->framerate ) {
+        if( frameno_out_of_range ) {
             if( (strict & headersearch::chk_strict) ||
                 (strict & headersearch::chk_consistent) ) {
                 if( strict & headersearch::chk_verbose )
                     std::cerr << "MARK5B FRAMENUMBER " << frameno << " OUT OF RANGE! Max " << state->framerate << std::endl;
                 if( strict & headersearch::chk_nothrow )
                     return highrestime_type();                    
-                EZASSERT2( frameno<state->framerate, headersearch_exception,
+                EZASSERT2( !frameno_out_of_range, headersearch_exception,
                            EZINFO("MARK5B FRAMENUMBER " << frameno << " OUT OF RANGE! Max " << state->framerate) );
             }
         } else {
             // replace the subsecond timestamp with one computed from the 
             // frametime
             prevnsec          = vlba.tv_subsecond;
-            vlba.tv_subsecond = (state->frametime * frameno);
+            vlba.tv_subsecond = state->framesubsecond(frameno);
 
             // Two problems with the original assert:
             //   * strict==false ALWAYS made the assert fail
@@ -1197,9 +1217,11 @@ highrestime_type mk5b_frame_timestamp(unsigned char const* framedata,
 
             if( strict & headersearch::chk_consistent ) {
                 const unsigned int  vlba_precision( 10000 ); // 1 in 10^4 precision for VLBA time stamp
-                const unsigned int  ss_from_vlba    = boost::rational_cast<unsigned int>(prevnsec * vlba_precision);
-                const unsigned int  ss_from_frameno = (unsigned int)::floor(
-                                                                boost::rational_cast<double>(vlba.tv_subsecond * vlba_precision));
+                // Both subsecond values are < 1 so the numerators are
+                // smaller than the denominators. floor(x * 10^4) can be
+                // done in 64-bit integer arithmetic for any sensible rate
+                const unsigned int  ss_from_vlba    = subsecond_floor(prevnsec, vlba_precision);
+                const unsigned int  ss_from_frameno = subsecond_floor(vlba.tv_subsecond, vlba_precision);
                 const bool          errcond         = (ss_from_vlba!=ss_from_frameno);
 
 #ifdef GDBDEBUG
@@ -1243,26 +1265,39 @@ highrestime_type  vdif_frame_timestamp(unsigned char const* framedata,
                                        const samplerate_type& trackbitrate,
                                        decoderstate_type* decoder,
                                        const headersearch::strict_type /*strict*/) {
-    struct tm                 tm;
+    // Remember the start of the last seen reference epoch; ::mktime() is
+    // expensive and the epoch changes only every six months
+    struct vdif_state {
+        uint32_t        ref_epoch_p1;  // ref_epoch + 1, 0 = nothing seen yet
+        time_t          epoch_start;
+    };
     struct vdif_header const* hdr = (struct vdif_header const*)framedata;
+    vdif_state*               vdif_s = (vdif_state*)((void*)&decoder->user[0]);
 
     EZASSERT2(trackbitrate>0, headersearch_exception, EZINFO("Cannot do VDIF timedecoding when bitrate == 0"));
 
     // Get integer part of the time
-    tm.tm_wday   = 0;
-    tm.tm_isdst  = 0;
-    tm.tm_yday   = 0;
-    tm.tm_mday   = 1;
-    tm.tm_hour   = 0;
-    tm.tm_min    = 0;
-    tm.tm_sec    = (int)hdr->epoch_seconds;
-    tm.tm_year   = 100 + (hdr->ref_epoch/2);
-    tm.tm_mon    = 6   * (hdr->ref_epoch%2);
-
-    return highrestime_type( ::mktime(&tm), 
+    if( vdif_s->ref_epoch_p1!=(uint32_t)hdr->ref_epoch+1 ) {
+        struct tm   tm;
+
+        tm.tm_wday   = 0;
+        tm.tm_isdst  = 0;
+        tm.tm_yday   = 0;
+        tm.tm_mday   = 1;
+        tm.tm_hour   = 0;
+        tm.tm_min    = 0;
+        tm.tm_sec    = 0;
+        tm.tm_year   = 100 + (hdr->ref_epoch/2);
+        tm.tm_mon    = 6   * (hdr->ref_epoch%2);
+
+        vdif_s->epoch_start  = ::mktime(&tm);
+        vdif_s->ref_epoch_p1 = (uint32_t)hdr->ref_epoch+1;
+    }
+
+    return highrestime_type( vdif_s->epoch_start + (time_t)hdr->epoch_seconds,
                              (trackbitrate==headersearch_type::UNKNOWN_TRACKBITRATE) ? 
                                  highrestime_type::UNKNOWN_SUBSECOND :
-                                 hdr->data_frame_num * decoder->frametime );
+                                 decoder->framesubsecond(hdr->data_frame_num) );
 }
 
 
@@ -1823,6 +1858,97 @@ headersearch_type* text2headersearch( const string& s ) {
     return 0;
 }
 
+
+//
+//  Time stamp decoding benchmark
+//
+static double now( void ) {
+    struct timeval  tv;
+    ::gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec/1.0e6;
+}
+
+// One format: encode the time stamps of a couple of seconds worth of
+// consecutive frames (only the headers), then decode them like the framer
+// (non-strict) would
+static bool test_timedecoder(const string& fmt, ostream& os) {
+    typedef std::vector<highrestime_type>  timestamps_type;
+    headersearch_type* const                hsptr = text2headersearch(fmt);
+
+    os << "   " << std::setw(24) << std::left << fmt << std::right << " ";
+    if( hsptr==0 ) {
+        os << "unrecognized format" << endl;
+        return false;
+    }
+    const headersearch_type          header( *hsptr );
+    delete hsptr;
+
+    // At most ~a million frames, but at least a few seconds' worth
+    const samplerate_type&           framerate( header.get_state().framerate );
+    const highresdelta_type          frametime( (int64_t)framerate.denominator(), (int64_t)framerate.numerator() );
+    const size_t                     nframe = std::min((uint64_t)1000000, 4*framerate.numerator()/framerate.denominator() + 1);
+    const size_t                     stride = header.headersize;
+    const headersearch::strict_type  chk = headersearch::strict_type() | headersearch::chk_consistent |
+                                           headersearch::chk_allow_dbe | headersearch::chk_nothrow;
+    std::vector<unsigned char>       headers( nframe*stride, 0 );
+    timestamps_type                  expect;
+    highrestime_type                 ts( 1767225600 ); // 2026-01-01T00:00:00
+
+    for(size_t i=0; i<nframe; i++, ts+=frametime) {
+        header.encode_timestamp(&headers[i*stride], ts);
+        expect.push_back( ts );
+    }
+
+    // Decode them in the order they were encoded, repeat until we've
+    // spent long enough to get a decent number
+    size_t        nbad = 0, ndecoded = 0;
+    double        dt;
+    const double  t0 = now();
+
+    do {
+        for(size_t i=0; i<nframe; i++)
+            if( header.decode_timestamp(&headers[i*stride], chk).tv_sec==0 )
+                nbad++;
+        ndecoded += nframe;
+    } while( (dt=now()-t0)<0.5 );
+
+    // And check they came out right
+    for(size_t i=0; i<nframe; i++)
+        if( header.decode_timestamp(&headers[i*stride], chk)!=expect[i] )
+            nbad++;
+
+    os << std::fixed << std::setprecision(2) << std::setw(8) << (ndecoded/dt)/1.0e6 << " Mframes/s";
+    if( nbad )
+        os << " " << nbad << " TIME STAMPS WRONG";
+    os << endl;
+    return nbad==0;
+}
+
+bool test_timedecoders(const string& formats, ostream& os) {
+    bool                      ok = true;
+    std::vector<std::string>  fmts( ::split(formats, ',', true) );
+
+    // Mark5B, VDIF with integer and with non-integer number of frames
+    // per second and Mark4
+    if( fmts.empty() ) {
+        fmts.push_back( "Mark5B-2048-16-2" );
+        fmts.push_back( "VDIF_8000-4096-16-2" );
+        fmts.push_back( "VDIF_8192-4096-16-2" );
+        fmts.push_back( "MKIV1_2-1024-16-2" );
+    }
+    os << "time stamp decoding" << endl;
+    for(std::vector<std::string>::const_iterator f=fmts.begin(); f!=fmts.end(); f++) {
+        try {
+            ok = test_timedecoder(*f, os) && ok;
+        }
+        catch( const std::exception& e ) {
+            os << "FAIL " << e.what() << endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
 // CRC business
 //typedef unsigned short CRCtype;
 
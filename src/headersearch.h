@@ -242,6 +242,8 @@ struct decoderstate_type {
     const samplerate_type    frametime; // seconds
     const offset_lut_type    offset_lut;
     uint32_t                 user[16];
+    // frame number within second -> subsecond, see highrestime.h
+    subsecond_lut_type       framesubsecond;
 
     decoderstate_type();
     decoderstate_type( unsigned int ntrack, const samplerate_type& trackbitrate, unsigned int payloadsz );
@@ -472,6 +474,16 @@ std::ostream& operator<<(std::ostream& os, const headersearch_type& h);
 headersearch_type* text2headersearch(const std::string& s);
 
 
+// Encode the time stamps of a number of consecutive frames in a few
+// formats, decode them the way the framer and timedecoder do, show the
+// number of frames per second that can be decoded and check that the
+// decoded time stamps are the ones that were encoded.
+// Returns false if any time stamp did not survive.
+// If 'formats' is not empty it is a comma separated list of format
+// strings (see text2headersearch()) to test instead of the default set.
+bool test_timedecoders(const std::string& formats, std::ostream& os);
+
+
 
 // The different byte-layouts of the VLBA-tape-on-harddisk and Mark5B format
 struct vlba_tape_ts {
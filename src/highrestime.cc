@@ -234,6 +234,61 @@ bool operator<(const highrestime_type& l, const highrestime_type& r) {
     return l.tv_sec<r.tv_sec;
 }
 
+///////////////////////////////////////////////////
+//
+//  Fixed-point fast paths
+//
+///////////////////////////////////////////////////
+const uint64_t subsecond_lut_type::max_entries;
+
+subsecond_lut_type::subsecond_lut_type():
+    framelength( 0 )
+{}
+
+subsecond_lut_type::subsecond_lut_type(const subsecond_type& fl):
+    framelength( fl )
+{}
+
+subsecond_lut_type::subsecond_lut_type(const subsecond_lut_type& other):
+    framelength( other.framelength )
+{}
+
+subsecond_type subsecond_lut_type::compute(const uint64_t n) {
+    const subsecond_type  ss( framelength * n );
+
+    if( n<max_entries ) {
+        if( n>=lut.size() )
+            lut.resize(n+1, highrestime_type::UNKNOWN_SUBSECOND);
+        lut[n] = ss;
+    }
+    return ss;
+}
+
+bool subsecond2framenumber(const subsecond_type& ss, const subsecond_type& framelength, uint64_t& n) {
+    // ss / framelength = (ss.num * fl.den) / (ss.den * fl.num)
+    // which is an integer iff the denominator divides the numerator.
+    // Both products are exact if all four factors fit in 32 bits.
+    const uint64_t  a = ss.numerator(), b = ss.denominator();
+    const uint64_t  c = framelength.numerator(), d = framelength.denominator();
+
+    if( c==0 )
+        return false;
+    if( ((a | b | c | d) >> 32)==0 ) {
+        const uint64_t  num = a * d, den = b * c;
+
+        if( num % den )
+            return false;
+        n = num / den;
+        return true;
+    }
+    const subsecond_type  fn( ss / framelength );
+
+    if( fn.denominator()!=1 )
+        return false;
+    n = fn.numerator();
+    return true;
+}
+
 // Assume 'dt' is the result of "highrestime_type(a) - highrestime_type(b)",
 // i.e. a high time resolution time difference.
 // 'frameduration' is fractional seconds.
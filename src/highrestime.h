@@ -4,6 +4,7 @@
 #define EVLBI5A_HIGHRESTIME_H
 
 #include <iostream>
+#include <vector>
 #include <time.h>
 #include <sys/time.h>          // for time_t
 #include <inttypes.h>          // for int64_t
@@ -73,6 +74,51 @@ bool isModulo(const highrestime_type& dt, const subsecond_type& frameduration);
 
 std::ostream& operator<<(std::ostream& os, const highrestime_type& hrt);
 
+
+// Fixed-point fast paths for per-frame time stamp computations.
+//
+// Most per-frame time stamps are "frame #n since the start of the second"
+// for a known frame length. Computing n * framelength as a rational costs
+// a couple of gcd's per frame, which is more than all the rest of decoding
+// a VDIF time stamp.
+// subsecond_lut_type remembers the exact (rational) result for each frame
+// number it's asked for, so that after the first second it's just an
+// index operation. At most max_entries frame numbers are remembered; frame
+// numbers above that are computed each time.
+// Copies do not share nor copy the remembered values: each copy (e.g. one
+// per thread) fills its own, so no locking is needed.
+class subsecond_lut_type {
+    public:
+        static const uint64_t max_entries = 1<<18;
+
+        subsecond_lut_type();
+        subsecond_lut_type(const subsecond_type& framelength);
+        subsecond_lut_type(const subsecond_lut_type& other);
+
+        // n * framelength
+        inline subsecond_type operator()(const uint64_t n) {
+            if( n<lut.size() && lut[n]!=highrestime_type::UNKNOWN_SUBSECOND )
+                return lut[n];
+            return this->compute(n);
+        }
+
+    private:
+        typedef std::vector<subsecond_type> lut_type;
+
+        subsecond_type  framelength;
+        lut_type        lut;
+
+        subsecond_type compute(const uint64_t n);
+
+        // decoderstate_type (the user) is not assignable either
+        const subsecond_lut_type& operator=(const subsecond_lut_type&);
+};
+
+// Is 'ss' an integer number of 'framelength's? If so, return true and that
+// number in 'n'. Uses 64-bit integer arithmetic unless the numbers are too
+// big for that, then it falls back to rational arithmetic.
+bool subsecond2framenumber(const subsecond_type& ss, const subsecond_type& framelength, uint64_t& n);
+
 std::string tm2vex(const highrestime_type& hrt);
 
 
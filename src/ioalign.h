@@ -0,0 +1,32 @@
+// memory/file alignment required for direct (O_DIRECT) disk I/O
+// Copyright (C) 2007-2013 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.nl
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef JIVE5A_IOALIGN_H
+#define JIVE5A_IOALIGN_H
+
+#include <sys/types.h>
+
+// Buffer addresses, sizes and file offsets for O_DIRECT I/O must be a
+// multiple of this. It satisfies all current disks (512 byte and 4k
+// sector size). The directwriter only submits writes aligned like this
+// and the blockpools align their memory on it, such that blocks can be
+// written to disk straight from the pool.
+static const size_t  io_alignment = 4096;
+
+#endif
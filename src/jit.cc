@@ -21,7 +21,12 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <fstream>
+#include <iomanip>
 #include <dosyscall.h>
 #include <evlbidebug.h>
 #include <threadutil.h>
@@ -30,7 +35,191 @@ using namespace std;
 
 DEFINE_EZEXCEPT(jit_error)
 
+// The compile and link commands, without file names
+static string compile_command( void ) {
+    ostringstream compile;
+    compile << "gcc" << BOPT << " -fPIC -g -c -Wall -O3 -x c";
+    return compile.str();
+}
+static string link_command( void ) {
+    ostringstream link;
+    link << "gcc" << BOPT << LOPT << " -fPIC";
+    return link.str();
+}
+
+
+//
+//  The on-disk cache
+//
+static string   cachedir;
+// Everything other than the code that determines what the compiled code
+// looks like: compiler version, options and machine
+static string   cachesignature;
+
+// 64-bit FNV-1a hash. We don't have to rely on it being collision free:
+// the cache compares the actual code before using an entry
+static uint64_t fnv1a(const string& s) {
+    const uint64_t prime = ((uint64_t)0x100 << 32) + 0x1b3;
+    uint64_t       h     = ((uint64_t)0xcbf29ce4 << 32) + 0x84222325;
+
+    for(string::const_iterator p=s.begin(); p!=s.end(); p++) {
+        h ^= (uint64_t)(unsigned char)*p;
+        h *= prime;
+    }
+    return h;
+}
+
+static bool read_file(const string& fn, string& content) {
+    ifstream      f(fn.c_str(), ios::in | ios::binary);
+    ostringstream oss;
+
+    if( !f )
+        return false;
+    oss << f.rdbuf();
+    content = oss.str();
+    return !f.bad();
+}
+
+// Write the file under a temporary name and rename it when it's complete;
+// readers see either nothing or the whole file
+static bool write_file(const string& fn, const string& content) {
+    int     fd;
+    string  tmp( fn + ".XXXXXX" );
+    bool    ok;
+
+    if( (fd=::mkstemp(&tmp[0]))==-1 )
+        return false;
+    ok = (::write(fd, content.data(), content.size())==(ssize_t)content.size());
+    ok = (::close(fd)==0) && ok;
+    ok = ok && (::rename(tmp.c_str(), fn.c_str())==0);
+    if( !ok )
+        ::unlink(tmp.c_str());
+    return ok;
+}
+
+// We're going to load code from the cache so it had better be ours: the
+// path itself (not what it may point to) must be of the expected type,
+// owned by us and not writable by group or others. A private directory
+// guarantees nobody can swap the files in it between checking and using.
+static bool is_private(const string& path, bool isdir, string& why) {
+    struct stat   st;
+
+    if( ::lstat(path.c_str(), &st)!=0 ) {
+        why = evlbi5a::strerror(errno);
+        return false;
+    }
+    if( isdir ? !S_ISDIR(st.st_mode) : !S_ISREG(st.st_mode) ) {
+        why = (isdir ? "not a directory" : "not a regular file");
+        return false;
+    }
+    if( st.st_uid!=::geteuid() ) {
+        why = "not owned by us";
+        return false;
+    }
+    if( (st.st_mode & (S_IWGRP|S_IWOTH))!=0 ) {
+        why = "writable by group or others";
+        return false;
+    }
+    return true;
+}
+
+void jit_set_cachedir(const string& dir) {
+    FILE*          fptr;
+    char           line[256];
+    string         why;
+    struct utsname un;
+    ostringstream  signature;
+    ostringstream  version;
+
+    if( dir.empty() ) {
+        cachedir.clear();
+        return;
+    }
+    EZASSERT2( ::mkdir(dir.c_str(), 0700)==0 || errno==EEXIST, jit_error,
+               EZINFO("failed to create JIT cache directory " << dir << " - " << evlbi5a::strerror(errno)) );
+    EZASSERT2( is_private(dir, true, why), jit_error,
+               EZINFO("refusing to use JIT cache " << dir << " - " << why) );
+
+    // Which compiler are we running?
+    version << "gcc" << BOPT << " --version 2>/dev/null";
+    EZASSERT2_NZERO( (fptr=::popen(version.str().c_str(), "r")), jit_error,
+                     EZINFO("popen('" << version.str() << "') fails - " << evlbi5a::strerror(errno)) );
+    line[0] = '\0';
+    if( ::fgets(line, sizeof(line), fptr)==0 )
+        line[0] = '\0';
+    ::pclose(fptr);
+    EZASSERT2( line[0]!='\0', jit_error, EZINFO("could not determine compiler version, not caching") );
+
+    EZASSERT2( ::uname(&un)==0, jit_error, EZINFO("uname() fails - " << evlbi5a::strerror(errno)) );
+
+    signature << line
+              << compile_command() << endl
+              << link_command() << endl
+              << un.sysname << " " << un.machine << endl;
+
+    cachedir       = dir;
+    cachesignature = signature.str();
+    DEBUG(1, "jit: caching compiled code in " << cachedir << endl);
+}
+
+const string& jit_cachedir( void ) {
+    return cachedir;
+}
+
+// Returns the base name (without extension) for 'code' in the cache
+static string cache_entry(const string& code) {
+    ostringstream  base;
+    base << cachedir << "/jit-" << hex << setw(16) << setfill('0') << fnv1a(cachesignature + code);
+    return base.str();
+}
+
+static bool cache_lookup(const string& code, jit_handle& handle) {
+    void*        h;
+    string       cached_code;
+    const string base( cache_entry(code) );
+    const string lib( base + SOEXT );
+    string       why;
+
+    if( !read_file(base + ".c", cached_code) )
+        return false;
+    if( cached_code!=code ) {
+        DEBUG(1, "jit: cache entry " << base << " is for different code, ignoring it" << endl);
+        return false;
+    }
+    if( !is_private(lib, false, why) ) {
+        DEBUG(-1, "jit: not loading cached " << lib << " - " << why << endl);
+        return false;
+    }
+    if( (h=::dlopen(lib.c_str(), RTLD_GLOBAL|RTLD_NOW))==0 ) {
+        DEBUG(1, "jit: failed to load cached " << lib << " - " << ::dlerror() << endl);
+        return false;
+    }
+    DEBUG(3, "jit: loaded cached " << lib << endl);
+    handle = jit_handle(h, lib, false);
+    return true;
+}
+
+// Failure to store something in the cache is not fatal
+static void cache_store(const string& code, const string& compiled_lib) {
+    string       lib;
+    const string base( cache_entry(code) );
+
+    // The library first, such that the code (which makes the entry
+    // valid) only appears when the library is complete
+    if( !read_file(compiled_lib, lib) || !write_file(base + SOEXT, lib) || !write_file(base + ".c", code) ) {
+        DEBUG(-1, "jit: failed to store " << base << " in cache - " << evlbi5a::strerror(errno) << endl);
+        return;
+    }
+    DEBUG(3, "jit: stored " << base << SOEXT << " in cache" << endl);
+}
+
+
 jit_handle jit_c_compile(const string& code) {
+    jit_handle  cached;
+
+    if( !cachedir.empty() && cache_lookup(code, cached) )
+        return cached;
+
     // Good. Now let's open the compiler and feed sum generated code to it!
     int    tmpfd; 
     char   name[L_tmpnam];
@@ -57,7 +246,7 @@ jit_handle jit_c_compile(const string& code) {
     ostringstream link;
 
     // Let the compiler read from stdin ...
-    compile << "gcc" << BOPT << " -fPIC -g -c -Wall -O3 -x c -o " << obj << " -";
+    compile << compile_command() << " -o " << obj << " -";
     DEBUG(3, "jit_c_compile: " << compile.str() << endl);
     ASSERT2_NZERO( (fptr=::popen(compile.str().c_str(), "w")),
                    SCINFO("popen('" << compile.str() << "' fails - " 
@@ -68,13 +257,16 @@ jit_handle jit_c_compile(const string& code) {
     ASSERT_COND( ::pclose(fptr)==0 );
 
     // Now produce a loadable thingamabob from the objectcode
-    link << "gcc" << BOPT << LOPT << " -fPIC -o " << lib << " " << obj;
+    link << link_command() << " -o " << lib << " " << obj;
     DEBUG(3, "jit_c_compile: " << link.str() << endl);
     ASSERT_ZERO( ::system(link.str().c_str()) );
 
     // Now delete the tmp object file
     ASSERT_ZERO( ::unlink(obj.c_str()) );
 
+    if( !cachedir.empty() )
+        cache_store(code, lib);
+
     // Huzzah! Compil0red and Link0red.
     // Now all that's needed is loading
     EZASSERT2_NZERO( (tmphandle=::dlopen(lib.c_str(), RTLD_GLOBAL|RTLD_NOW)),
@@ -87,25 +279,25 @@ jit_handle::jit_handle():
     impl( new jit_handle_impl() )
 {}
 
-jit_handle::jit_handle(void* h, const string& f):
-    impl( new jit_handle_impl(h, f) )
+jit_handle::jit_handle(void* h, const string& f, bool tmp):
+    impl( new jit_handle_impl(h, f, tmp) )
 {}
 
 
 
 jit_handle::jit_handle_impl::jit_handle_impl():
-    handle( 0 )
+    handle( 0 ), temporary( false )
 {}
 
-jit_handle::jit_handle_impl::jit_handle_impl(void* h, const string& f):
-    handle( h ), dllname( f )
+jit_handle::jit_handle_impl::jit_handle_impl(void* h, const string& f, bool tmp):
+    handle( h ), dllname( f ), temporary( tmp )
 { EZASSERT_NZERO(handle, jit_error); EZASSERT(dllname.empty()==false, jit_error); }
 
 jit_handle::jit_handle_impl::~jit_handle_impl() {
     if( handle && ::dlclose(handle)==-1 )
         DEBUG(-1, "Failed to close DLL '" << dllname << "' - " << ::dlerror() << endl);
 
-    if( !dllname.empty() )
+    if( temporary && !dllname.empty() )
         if( ::unlink(dllname.c_str())==-1 )
             DEBUG(-1, "Failed to remove tmp DLL '" << dllname << "' - " << evlbi5a::strerror(errno) << endl);
 }
@@ -93,6 +93,18 @@ struct jit_handle;
 // see below
 jit_handle   jit_c_compile(const std::string& code);
 
+// Compiled code can be cached on disk, such that identical code need not
+// be compiled again - not even after a restart. Entries are addressed by a
+// hash of the code, the compiler + its options and the machine. The code
+// is stored next to the shared library and compared before the library
+// is loaded, a mismatch is treated as if the entry was not there.
+// Caching is off until a directory is set (it will be created if it does
+// not exist). Whatever is found in there gets loaded into jive5ab so use
+// a directory only you can write to.
+// Not thread safe: set it at start-up, before compiling anything.
+void               jit_set_cachedir(const std::string& dir);
+const std::string& jit_cachedir( void );
+
 // Once you've jit compiled, you can lookup symbols
 // as data or as function. The templates ensure it
 // will be proper typecast.
@@ -111,8 +123,9 @@ struct jit_handle {
         jit_handle();
 
         // construct a filled in jit handle.
-        // Will throw on nullpointer or empty filename
-        jit_handle(void* h, const std::string& f);
+        // Will throw on nullpointer or empty filename.
+        // Temporary files are removed when the last handle goes away.
+        jit_handle(void* h, const std::string& f, bool tmp = true);
 
         inline operator bool(void) const {
             return (impl->handle==0);
@@ -156,10 +169,11 @@ struct jit_handle {
     private:
         struct jit_handle_impl {
             jit_handle_impl();
-            jit_handle_impl(void* h, const std::string& f);
+            jit_handle_impl(void* h, const std::string& f, bool tmp);
 
             void*       handle;
             std::string dllname;
+            bool        temporary;
 
             ~jit_handle_impl();
         };
@@ -7,9 +7,11 @@
 #include <mutex_locker.h>
 #include <directory_helper_templates.h>
 #include <mk6info.h>
+#include <recording_catalog.h>
 #include <ezexcept.h>
 #include <hex.h>
 #include <threadutil.h>
+#include <zerocopy.h>
 
 // Standardized C++ headers
 #include <iostream>
@@ -80,6 +82,13 @@ struct filechunk_type {
         chunkNumber = (unsigned int)::strtoul(fnm.substr(dot+1).c_str(), 0, 10);
     }
 
+    // Construct from what the recording catalog knows about a FlexBuff
+    // chunk: no need to go and look at the file
+    filechunk_type(string const& fnm, unsigned int chunk, off_t sz):
+        pathToChunk( fnm ), chunkSize( sz ), chunkPos( 0 ), chunkFd( invalidFileDescriptor ),
+        chunkOffset( 0 ), chunkNumber( chunk )
+    {}
+
     // Constructor for a Mark6 format chunk. It has a number, a size, a location
     // within a file and the file descriptor whence it came
     filechunk_type(unsigned int chunk, off_t fpos, off_t sz, int fd):
@@ -161,8 +170,6 @@ typedef set<filechunk_type>             filechunks_type;
 
 // These look for VBS recordings
 void scanRecording(string const& recname, direntries_type const& mountpoints, filechunks_type& fcs);
-void scanRecordingMountpoint(string const& recname, string const& mp, filechunks_type& fcs);
-void scanRecordingDirectory(string const& recname, string const& dir, filechunks_type& fcs);
 
 // These for Mark6
 void scanMk6Recording(string const& recname, direntries_type const& mountpoints, filechunks_type& fcs);
@@ -205,6 +212,235 @@ struct isMountpoint {
 
 
 
+
+///////////////////////////////////////////////////////////
+//
+//  Read-ahead engine
+//
+//  Recordings are striped over many disks, one chunk at a
+//  time, so consecutive chunks normally live on different
+//  mountpoints. With read-ahead enabled (vbs_readahead())
+//  a set of worker threads reads the next 'depth' chunks
+//  concurrently into pooled buffers whilst vbs_read()
+//  copies out of the buffer of the current chunk.
+//
+// ////////////////////////////////////////////////////////
+struct prefetch_type {
+    // What to read; copied from the filechunk_type such that the workers
+    // never have to look at the set of chunks. For Mark6 chunks 'fd' is
+    // the (shared) file descriptor, for FlexBuff chunks it's
+    // invalidFileDescriptor and the worker opens 'path' itself
+    unsigned int    chunkNumber;
+    string          path;
+    int             fd;
+    off_t           pos;
+    off_t           size;
+
+    // Result
+    enum state_type { queued, reading, done, failed };
+    state_type      state;
+    int             error;
+    unsigned char*  buffer;
+    size_t          bufsize;
+    // Set when the consumer has lost interest whilst a worker was still
+    // reading; the worker will clean up
+    bool            orphan;
+
+    prefetch_type(filechunk_type const& fc):
+        chunkNumber( fc.chunkNumber ), path( fc.pathToChunk ),
+        fd( (fc.chunkFd<0) ? -fc.chunkFd : invalidFileDescriptor ),
+        pos( fc.chunkPos ), size( fc.chunkSize ),
+        state( queued ), error( 0 ), buffer( 0 ), bufsize( 0 ), orphan( false )
+    {}
+};
+
+struct readahead_type {
+    // Read in pieces of this size such that a stop request is honoured
+    // in reasonable time, even with huge chunks
+    static const size_t  readSize = 8*1024*1024;
+
+    readahead_type(unsigned int d):
+        depth( d ), stop( false )
+    {
+        PTHREAD_CALL( ::pthread_mutex_init(&mutex, 0) );
+        PTHREAD_CALL( ::pthread_cond_init(&condition, 0) );
+        for(unsigned int i=0; i<depth; i++) {
+            pthread_t   tid;
+            PTHREAD_CALL( ::pthread_create(&tid, 0, &readahead_type::worker_thrd, (void*)this) );
+            workers.push_back( tid );
+        }
+    }
+
+    // Make sure the chunk 'cur' and the 'depth' chunks following it
+    // are being read and wait for 'cur' to become available.
+    // Returns 0 if the read-ahead failed; the caller should read the
+    // chunk directly (and find out what's wrong with it).
+    prefetch_type const* get(filechunks_type::const_iterator cur, filechunks_type::const_iterator end) {
+        mutex_locker                     locker( mutex );
+        window_type::iterator            pf;
+        filechunks_type::const_iterator  fc = cur;
+
+        // Drop everything before 'cur' - the consumer has moved on (or
+        // seeked backwards, then everything is dropped)
+        while( !window.empty() && window.front()->chunkNumber!=cur->chunkNumber ) {
+            drop( window.front() );
+            window.pop_front();
+        }
+
+        // Top up the window; skip the chunks we already have
+        for(pf=window.begin(); pf!=window.end() && fc!=end; pf++, fc++)
+            ;
+        for( ; window.size()<=depth && fc!=end; fc++)
+            window.push_back( new prefetch_type(*fc) );
+        PTHREAD_CALL( ::pthread_cond_broadcast(&condition) );
+
+        prefetch_type*   rv = window.front();
+        while( rv->state==prefetch_type::queued || rv->state==prefetch_type::reading )
+            PTHREAD_CALL( ::pthread_cond_wait(&condition, &mutex) );
+        if( rv->state==prefetch_type::failed ) {
+            DEBUG(2, "vbs readahead: chunk " << rv->chunkNumber << " failed - " << evlbi5a::strerror(rv->error) << endl);
+            return 0;
+        }
+        return rv;
+    }
+
+    ~readahead_type() {
+        PTHREAD_CALL( ::pthread_mutex_lock(&mutex) );
+        stop = true;
+        PTHREAD_CALL( ::pthread_cond_broadcast(&condition) );
+        PTHREAD_CALL( ::pthread_mutex_unlock(&mutex) );
+
+        for(list<pthread_t>::iterator p=workers.begin(); p!=workers.end(); p++)
+            ::pthread_join(*p, 0);
+        // No-one is reading anymore so we can delete everything
+        for(window_type::iterator p=window.begin(); p!=window.end(); p++)
+            release_buffer(*p), delete *p;
+        for(bufpool_type::iterator p=bufpool.begin(); p!=bufpool.end(); p++)
+            delete [] p->first;
+        ::pthread_cond_destroy(&condition);
+        ::pthread_mutex_destroy(&mutex);
+    }
+
+    private:
+        typedef list<prefetch_type*>                   window_type;
+        typedef list<pair<unsigned char*, size_t> >    bufpool_type;
+
+        const unsigned int  depth;
+        bool                stop;
+        window_type         window;
+        bufpool_type        bufpool;
+        list<pthread_t>     workers;
+        pthread_mutex_t     mutex;
+        pthread_cond_t      condition;
+
+        // The following are called with the mutex held
+        void drop( prefetch_type* pf ) {
+            if( pf->state==prefetch_type::reading ) {
+                pf->orphan = true;
+                return;
+            }
+            release_buffer( pf );
+            delete pf;
+        }
+
+        void get_buffer( prefetch_type* pf ) {
+            bufpool_type::iterator  p = bufpool.begin();
+            while( p!=bufpool.end() && p->second<(size_t)pf->size )
+                p++;
+            if( p==bufpool.end() ) {
+                pf->buffer  = new unsigned char[ pf->size ];
+                pf->bufsize = (size_t)pf->size;
+            } else {
+                pf->buffer  = p->first;
+                pf->bufsize = p->second;
+                bufpool.erase( p );
+            }
+        }
+
+        void release_buffer( prefetch_type* pf ) {
+            if( pf->buffer==0 )
+                return;
+            // Keep at most one buffer per slot in the window
+            if( bufpool.size()<=depth )
+                bufpool.push_back( make_pair(pf->buffer, pf->bufsize) );
+            else
+                delete [] pf->buffer;
+            pf->buffer = 0;
+        }
+
+        static void* worker_thrd(void* self) {
+            ((readahead_type*)self)->worker();
+            return (void*)0;
+        }
+
+        void worker( void ) {
+            PTHREAD_CALL( ::pthread_mutex_lock(&mutex) );
+            while( true ) {
+                window_type::iterator  p;
+
+                // Take the first chunk from the window that no-one's
+                // reading yet
+                for(p=window.begin(); !stop && p!=window.end() && (*p)->state!=prefetch_type::queued; p++)
+                    ;
+                if( stop )
+                    break;
+                if( p==window.end() ) {
+                    PTHREAD_CALL( ::pthread_cond_wait(&condition, &mutex) );
+                    continue;
+                }
+                prefetch_type*  pf = *p;
+
+                pf->state = prefetch_type::reading;
+                get_buffer( pf );
+                PTHREAD_CALL( ::pthread_mutex_unlock(&mutex) );
+
+                const int   error = read_chunk( pf );
+
+                PTHREAD_CALL( ::pthread_mutex_lock(&mutex) );
+                pf->error = error;
+                pf->state = (error ? prefetch_type::failed : prefetch_type::done);
+                if( pf->orphan ) {
+                    release_buffer( pf );
+                    delete pf;
+                }
+                PTHREAD_CALL( ::pthread_cond_broadcast(&condition) );
+            }
+            PTHREAD_CALL( ::pthread_mutex_unlock(&mutex) );
+        }
+
+        // Runs without the lock. Returns 0 or errno
+        int read_chunk( prefetch_type* pf ) {
+            int      fd = pf->fd, rv = 0;
+            off_t    done = 0;
+
+            if( fd==invalidFileDescriptor && (fd=::open(pf->path.c_str(), O_RDONLY))<0 )
+                return errno;
+            while( rv==0 && done<pf->size ) {
+                const size_t   n2r = (size_t)std::min((off_t)readSize, pf->size - done);
+                const ssize_t  r   = ::pread(fd, pf->buffer + done, n2r, pf->pos + done);
+
+                if( r<0 && errno==EINTR )
+                    continue;
+                if( r<=0 )
+                    rv = (r<0 ? errno : EIO);
+                else
+                    done += r;
+                // Give up early if we're shutting down. Reading 'stop'
+                // without the lock is harmless; worst case we do one
+                // more read
+                if( stop )
+                    rv = ECANCELED;
+            }
+            if( pf->fd==invalidFileDescriptor )
+                ::close( fd );
+            return rv;
+        }
+
+        readahead_type();
+        readahead_type(readahead_type const&);
+        readahead_type const& operator=(readahead_type const&);
+};
+
 ///////////////////////////////////////////////////////////
 //
 //      Mapping of filedescriptor to open file
@@ -216,18 +452,20 @@ struct openfile_type {
     off_t                           fileSize;
     filechunks_type                 fileChunks;
     filechunks_type::iterator       chunkPtr;
+    // non-zero if read-ahead enabled
+    readahead_type*                 readAhead;
 
     // A fake Mk6/VBS scan - emulates /dev/null ...
     // albeit with a maximum size
     openfile_type( off_t maxsize ):
-        filePointer( 0 ), fileSize( maxsize )
+        filePointer( 0 ), fileSize( maxsize ), readAhead( 0 )
     {
         chunkPtr = fileChunks.begin();
     }
 
     // No default c'tor!
     openfile_type(filechunks_type const& fcs):
-        filePointer( 0 ), fileSize( 0 ), fileChunks( fcs )
+        filePointer( 0 ), fileSize( 0 ), fileChunks( fcs ), readAhead( 0 )
     {
         for(chunkPtr=fileChunks.begin(); chunkPtr!=fileChunks.end(); chunkPtr++) {
             // Offset is recording size counted so far
@@ -241,13 +479,18 @@ struct openfile_type {
     }
 
     // The copy c'tor must take care of initializing the filechunk iterator
-    // to point it its own filechunks, not at the other guys'
+    // to point it its own filechunks, not at the other guys'.
+    // Read-ahead is not copied; it is only ever enabled on the copy that
+    // lives in the map of opened files.
     openfile_type(openfile_type const& other):
         filePointer( 0 ), fileSize( other.fileSize ),
-        fileChunks( other.fileChunks ), chunkPtr( fileChunks.begin() )
+        fileChunks( other.fileChunks ), chunkPtr( fileChunks.begin() ),
+        readAhead( 0 )
     {}
 
     ~openfile_type() {
+        // stop reading ahead before we close anything
+        delete readAhead;
         // unobserve all chunks
         for( chunkPtr=fileChunks.begin(); chunkPtr!=fileChunks.end(); chunkPtr++)
             chunkPtr->close_chunk();
@@ -521,6 +764,17 @@ ssize_t vbs_read(int fd, void* buf, size_t count) {
             continue;
         }
 
+        // Is the chunk being read ahead?
+        prefetch_type const*  pf = (of.readAhead ? of.readAhead->get(of.chunkPtr, chunks.end()) : 0);
+
+        if( pf ) {
+            ::memcpy(bufc, pf->buffer + (of.filePointer - chunk.chunkOffset), (size_t)n2r);
+            bufc           += n2r;
+            nr             -= n2r;
+            of.filePointer += n2r;
+            continue;
+        }
+
         // If we cannot open the current chunk
         if( (realfd=chunk.open_chunk())==invalidFileDescriptor )
             break;
@@ -544,6 +798,97 @@ ssize_t vbs_read(int fd, void* buf, size_t count) {
     return (ssize_t)(count-nr);
 }
 
+//////////////////////////////////////////////////
+//
+//  ssize_t vbs_sendfile(int out_fd, int fd, size_t count)
+//
+//  send bytes from a previously opened recording
+//  to a socket, chunk by chunk, without copying
+//  them through user space
+//
+//////////////////////////////////////////////////
+
+ssize_t vbs_sendfile(int out_fd, int fd, size_t count) {
+    // we need read-only access to the int -> openfile_type mapping
+    rw_read_locker             lockert( openedFilesLock );
+    openedfiles_type::iterator fptr = openedFiles.find(fd) ;
+
+    if( fptr==openedFiles.end() ) {
+        errno = EBADF;
+        return -1;
+    }
+    if( count==0 )
+        return 0;
+
+    int              realfd;
+    bool             failed = false;
+    size_t           nr = count;
+    openfile_type&   of = fptr->second;
+    filechunks_type& chunks = of.fileChunks;
+
+    // There are no bytes on disk for the null recording
+    if( chunks.size()==0 ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Same logic as vbs_read(); the difference is in how the bytes get
+    // out of the chunk
+    while( nr ) {
+        if( of.chunkPtr==chunks.end() )
+            break;
+
+        const filechunk_type& chunk = *of.chunkPtr;
+        off_t   n2r = min((off_t)nr, chunk.chunkOffset+chunk.chunkSize - of.filePointer);
+        ssize_t actualsent;
+
+        if( n2r<=0 ) {
+            chunk.close_chunk();
+            if( of.chunkPtr!=chunks.end() )
+                of.chunkPtr++;
+            continue;
+        }
+
+        // If the chunk was read ahead, it's in memory already
+        prefetch_type const*  pf = (of.readAhead ? of.readAhead->get(of.chunkPtr, chunks.end()) : 0);
+
+        if( pf ) {
+            if( (actualsent=::write(out_fd, pf->buffer + (of.filePointer - chunk.chunkOffset), (size_t)n2r))<=0 ) {
+                failed = (actualsent<0);
+                break;
+            }
+            nr             -= actualsent;
+            of.filePointer += actualsent;
+            continue;
+        }
+
+        if( (realfd=chunk.open_chunk())==invalidFileDescriptor ) {
+            failed = true;
+            break;
+        }
+
+        off_t   pos = of.filePointer - chunk.chunkOffset + chunk.chunkPos;
+
+        if( (actualsent=::sendfile_range(out_fd, realfd, &pos, (size_t)n2r))<=0 ) {
+            failed = (actualsent<0);
+            break;
+        }
+
+        nr             -= actualsent;
+        of.filePointer += actualsent;
+
+        // A short send means EOF on the chunk or an interrupted/failed
+        // send. Don't try to guess, let the caller decide
+        if( actualsent<n2r )
+            break;
+    }
+    // Only report an error if nothing got sent at all; errno is still
+    // set from the failing call
+    if( failed && nr==count )
+        return -1;
+    return (ssize_t)(count-nr);
+}
+
 //////////////////////////////////////////////////
 //
 //  int vbs_lseek(int fd, off_t offset, int whence)
@@ -606,6 +951,34 @@ off_t vbs_lseek(int fd, off_t offset, int whence) {
     return of.filePointer;
 }
 
+//////////////////////////////////////////////////
+//
+//  int vbs_readahead(int fd, unsigned int depth)
+//
+//  enable/disable reading ahead 'depth' chunks
+//
+/////////////////////////////////////////////////
+
+int vbs_readahead(int fd, unsigned int depth) {
+    // we modify the openfile_type so we need exclusive access
+    rw_write_locker            lockert( openedFilesLock );
+    openedfiles_type::iterator fptr = openedFiles.find(fd);
+
+    if( fptr==openedFiles.end() ) {
+        errno = EBADF;
+        return -1;
+    }
+    openfile_type&  of = fptr->second;
+
+    delete of.readAhead;
+    of.readAhead = 0;
+    // The null recording has no chunks to read
+    if( depth>0 && of.fileChunks.size()>0 )
+        of.readAhead = new readahead_type( depth );
+    DEBUG(3, "vbs_readahead: fd#" << fd << " reading ahead " << depth << " chunks" << endl);
+    return 0;
+}
+
 //////////////////////////////////
 //
 //  int vbs_close(int fd)
@@ -672,89 +1045,19 @@ int vbs_setdbg(int newlevel) {
 //
 /////////////////////////////////////////
 
+// The recording catalog knows which chunks there are and, mostly, how big
+// they are. It compares names literally so recording names with regex
+// majik characters (".", "+" et.al.) in them are no problem.
 void scanRecording(string const& recname, direntries_type const& mountpoints, filechunks_type& fcs) {
-    // Loop over all mountpoints and check if there are file chunks for this
-    // recording
-    for(direntries_type::const_iterator curmp=mountpoints.begin(); curmp!=mountpoints.end(); curmp++)
-        scanRecordingMountpoint(recname, *curmp, fcs);
-}
-
-void scanRecordingMountpoint(string const& recname, string const& mp, filechunks_type& fcs) {
-    struct stat     dirstat;
-    const string    dir(mp+"/"+recname);
-
-    if( ::lstat(dir.c_str(), &dirstat)<0 ) {
-        if( errno!=ENOENT )
-            DEBUG(4, "scanRecordingMountpoint(" << recname << ", " << mp << ")/::lstat() fails - " << evlbi5a::strerror(errno) << endl);
-        return;
-    }
-    // OK, we got the status. If it's not a directory ...
-    if( !S_ISDIR(dirstat.st_mode) )
-        return;
-
-    // Go ahead and scan the directory for chunks
-    scanRecordingDirectory(recname, dir, fcs);
-}
-
-// Complaint by users: jive5ab, m5copy, vbs_ls, vbs_rm and vbs_fs don't seem to pick up
-// FlexBuff recordings with regex majik characters (".", "+" et.al.) in
-// them. Now, creating recordings with those characters in their names might
-// be capital offence in the first place ... but since no-one's stopping
-// them it might be considered polite to suck it up and make the s/w operate
-// correctly just the same.
-// In vbs_ls/vbs_rm the issue was fixed by escaping the recording name
-// before making a regex pattern out of it for the VBS shrapnel:
-//      https://docs.python.org/2/library/re.html#re.escape
-//
-// I've looked up the implementation of re.escape:
-//      https://github.com/python/cpython/blob/master/Lib/re.py#L249
-//      (status as on 09 Feb 2017)
-//
-// and I think it's easy enough to emulate that here in C++
-static const string alphanum_str("_abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ01234567890");
-
-string escape(string const& s) {
-    string                       rv;
-    back_insert_iterator<string> output(rv);
-
-    for(string::const_iterator p=s.begin(); p!=s.end(); *output++ = *p++)
-        if( alphanum_str.find(*p)==string::npos )
-            *output++ = '\\';
-    return rv;
-}
-
-struct isRecordingChunk {
-    isRecordingChunk(string const& recname):
-        __m_regex( string("^")+escape(recname)+"\\.[0-9]{8}$" )
-    {}
-
-    bool operator()(string const& entry) const {
-        DEBUG(5, "checking entry " << entry << " against " << __m_regex.pattern() << endl);
-        return __m_regex.matches(entry);
-    }
+    const catalog_chunklist_type  chunks = catalog_find_chunks(recname, mountpoints);
 
-    Regular_Expression  __m_regex;
+    for(catalog_chunklist_type::const_iterator p=chunks.begin(); p!=chunks.end(); p++) {
+        // If the catalog doesn't know the size we look ourselves
+        const filechunk_type  fc = (p->size<0 ? filechunk_type(p->path) : filechunk_type(p->path, p->seqno, p->size));
 
-    private:
-        isRecordingChunk();
-        isRecordingChunk( isRecordingChunk const& );
-};
-
-void scanRecordingDirectory(string const& recname, string const& dir, filechunks_type& rv) {
-    DIR*             dirp;
-    direntries_type  chunks;
-    isRecordingChunk predicate( recname );
-
-    if( (dirp=::opendir(dir.c_str()))==0 ) {
-        DEBUG(4, "scanRecordingDirectory(" << recname << ", " << dir << ")/ ::opendir fails - " << evlbi5a::strerror(errno) << endl);
-        return;
+        // If we find duplicates, now *that* is a reason to throw up
+        EZASSERT2(fcs.insert(fc).second, vbs_except, EZINFO(" duplicate insert for chunk " << p->path));
     }
-    chunks = dir_filter(dirp, predicate);
-    ::closedir(dirp);
-
-    // If we find duplicates, now *that* is a reason to throw up
-    for(direntries_type::const_iterator p=chunks.begin(); p!=chunks.end(); p++)
-        EZASSERT2((rv.insert(filechunk_type(dir+"/"+*p))).second, vbs_except, EZINFO(" duplicate insert for chunk " << *p));
 }
 
 ////////////////////////////////////////
@@ -811,10 +1114,12 @@ void scanMk6Recording(string const& recname, direntries_type const& mountpoints,
     // Loop over all mountpoints and check if there are file chunks for this
     // recording
     // HV: 04 Nov 2015 Do the scan multithreaded - one thread per mountpoint
-    threadlist_type threads;
-    pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+    // Only where the recording catalog says there is such a file
+    threadlist_type           threads;
+    pthread_mutex_t           mtx = PTHREAD_MUTEX_INITIALIZER;
+    const mountpointlist_type withfile = catalog_find_recording(recname, mountpoints);
 
-    for(direntries_type::const_iterator curmp=mountpoints.begin(); curmp!=mountpoints.end(); curmp++) {
+    for(mountpointlist_type::const_iterator curmp=withfile.begin(); curmp!=withfile.end(); curmp++) {
         int         create_error = 0;
         pthread_t*  tidptr = new pthread_t;
         sm6mp_args* sm6mp  = new sm6mp_args(recname, *curmp, &fcs, &mtx);
@@ -867,6 +1172,21 @@ void scanMk6RecordingFile(string const& /*recname*/, string const& file, filechu
         ::close(fd);
         return;
     }
+    // If jive5ab recorded this file there may be an index next to it,
+    // which saves us from reading all the write block headers. It's only
+    // used if it was made for exactly this version of the file
+    struct stat     st;
+    mk6_index_type  idx;
+
+    if( ::fstat(fd, &st)==0 && read_mk6_index(file, st, idx) ) {
+        DEBUG(4, "scanMk6RecordingFile[" << file << "]: using index, " << idx.size() << " blocks" << endl);
+        for(mk6_index_type::const_iterator p=idx.begin(); p!=idx.end(); p++)
+            EZASSERT2(rv.insert(filechunk_type((unsigned int)p->blocknum, (off_t)(p->offset+wb_size),
+                                               p->wb_size-wb_size, fd)).second, vbs_except,
+                      EZINFO(" duplicate insert for chunk " << p->blocknum); ::close(fd) );
+        return;
+    }
+
     DEBUG(4, "scanMk6RecordingFile[" << file << "]: starting" << endl);
     // Ok. Now we should just read all the blocks in this file!
     fpos = fh_size;
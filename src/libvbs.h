@@ -60,6 +60,24 @@ ssize_t vbs_read(int fd, void* buf, size_t count);
 off_t   vbs_lseek(int fd, off_t offset, int whence);
 int     vbs_close(int fd);
 
+/* As vbs_read() but the bytes are not returned; they are sent to
+ * (stream) socket 'out_fd' instead. Within each chunk the kernel moves the
+ * data from the file to the socket (sendfile(2)), they are not copied
+ * through user space. The null recording cannot be sent this way (EINVAL).
+ * Returns the number of bytes sent, 0 at end of recording, or -1 and sets
+ * errno if nothing could be sent.
+ */
+ssize_t vbs_sendfile(int out_fd, int fd, size_t count);
+
+/* Enable reading ahead of 'depth' chunks on a recording opened with
+ * vbs_open() or mk6_open(). As chunks are striped over the mountpoints,
+ * the chunks following the one currently being vbs_read() from are read
+ * concurrently from different disks, by 'depth' threads, into buffers of
+ * the chunk size. depth==0 disables read-ahead (the default).
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int     vbs_readahead(int fd, unsigned int depth);
+
 #if 0
 /* Set library debug level. Higher, positive, numbers produce more output. Returns
  * previous level, default is "0", no output. */
@@ -157,6 +157,7 @@ const mk5commandmap_type& make_mk5a_commandmap( bool buffering ) {
     ASSERT_COND( mk5.insert(make_pair("ack", ackperiod_fn)).second );
     ASSERT_COND( mk5.insert(make_pair("trackmask", trackmask_fn)).second );
     ASSERT_COND( mk5.insert(make_pair("itcp_id", itcp_id_fn)).second );
+    ASSERT_COND( mk5.insert(make_pair("net_zerocopy", net_zerocopy_fn)).second );
 
     // Dechannelizing/cornerturning to the network or file
     ASSERT_COND( mk5.insert(make_pair("spill2net", &spill2net_fn<mark5a>)).second );
@@ -306,6 +307,7 @@ const mk5commandmap_type& make_dim_commandmap( bool buffering ) {
     ASSERT_COND( mk5.insert(make_pair("ack", ackperiod_fn)).second );
     ASSERT_COND( mk5.insert(make_pair("trackmask", trackmask_fn)).second );
     ASSERT_COND( mk5.insert(make_pair("itcp_id", itcp_id_fn)).second );
+    ASSERT_COND( mk5.insert(make_pair("net_zerocopy", net_zerocopy_fn)).second );
 
     // Dechannelizing/cornerturning to the network or file
     ASSERT_COND( mk5.insert(make_pair("spill2net", &spill2net_fn<mark5b>)).second );
@@ -394,6 +396,7 @@ const mk5commandmap_type& make_dom_commandmap( bool ) {
     ASSERT_COND( mk5.insert(make_pair("ack", ackperiod_fn)).second );
     ASSERT_COND( mk5.insert(make_pair("trackmask", trackmask_fn)).second );
     ASSERT_COND( mk5.insert(make_pair("itcp_id", itcp_id_fn)).second );
+    ASSERT_COND( mk5.insert(make_pair("net_zerocopy", net_zerocopy_fn)).second );
 
     // disk2*
     ASSERT_COND( mk5.insert(make_pair("disk2net", disk2net_fn)).second );
@@ -514,6 +517,7 @@ const mk5commandmap_type& make_mk5c_commandmap( bool buffering, bool have_daught
     ASSERT_COND( mk5.insert(make_pair("ack", ackperiod_fn)).second );
     ASSERT_COND( mk5.insert(make_pair("trackmask", trackmask_fn)).second );
     ASSERT_COND( mk5.insert(make_pair("itcp_id", itcp_id_fn)).second );
+    ASSERT_COND( mk5.insert(make_pair("net_zerocopy", net_zerocopy_fn)).second );
 
     // disk2*
     ASSERT_COND( mk5.insert(make_pair("disk2net", disk2net_fn)).second );
@@ -635,6 +639,7 @@ const mk5commandmap_type& make_generic_commandmap( bool buffering ) {
     ASSERT_COND( mk5.insert(make_pair("ack", ackperiod_fn)).second );
     ASSERT_COND( mk5.insert(make_pair("trackmask", trackmask_fn)).second );
     ASSERT_COND( mk5.insert(make_pair("itcp_id", itcp_id_fn)).second );
+    ASSERT_COND( mk5.insert(make_pair("net_zerocopy", net_zerocopy_fn)).second );
 
     // fill2*
     ASSERT_COND( mk5.insert(make_pair("fill2net", disk2net_fn)).second );
@@ -680,6 +685,9 @@ const mk5commandmap_type& make_generic_commandmap( bool buffering ) {
     // Mark6-like
     ASSERT_COND( mk5.insert(make_pair("group_def",  group_def_fn)).second );
     ASSERT_COND( mk5.insert(make_pair("set_disks",  set_disks_fn)).second );
+    ASSERT_COND( mk5.insert(make_pair("vbs_readahead",  vbs_readahead_fn)).second );
+    ASSERT_COND( mk5.insert(make_pair("disk_stats",  disk_stats_fn)).second );
+    ASSERT_COND( mk5.insert(make_pair("conn_stats",  conn_stats_fn)).second );
 
     ASSERT_COND( mk5.insert(make_pair("transfermode", transfermode_fn)).second );
 
@@ -0,0 +1,71 @@
+// Copyright (C) 2007-2014 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// 
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+// 
+// Author:  Harro Verkouter - verkouter@jive.nl
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <mk5_exception.h>
+#include <mk5command/mk5.h>
+#include <iostream>
+#include <iomanip>
+
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////
+//
+//  conn_stats?
+//  conn_stats = reset
+//
+//  Report per connection of the parallel sender (vbs2net) or the
+//  parallel network reader (net2vbs) how much went over it:
+//      !conn_stats? 0 [ : <peer> : <#chunks> : <#bytes> :
+//                         <seconds> : <average rate Mbps> ]* ;
+//  <seconds> is the time from making the connection to the last chunk.
+//  The statistics are kept until the next vbs2net/net2vbs transfer.
+//  "reset" forgets them (only when idle).
+//
+////////////////////////////////////////////////////////////////////
+string conn_stats_fn(bool q, const vector<string>& args, runtime& rte ) {
+    ostringstream           reply;
+    connstatsmap_type       connstats;
+
+    reply << "!" << args[0] << (q?('?'):('=')) << " ";
+
+    // Query is always possible, command only if idle
+    INPROGRESS(rte, reply, !(q || rte.transfermode==no_transfer));
+
+    if( q ) {
+        // The sender/reader threads update these
+        RTEEXEC(rte, connstats = rte.connstats);
+
+        reply << " 0";
+        for(connstatsmap_type::const_iterator p=connstats.begin(); p!=connstats.end(); p++) {
+            const double dt = p->second.seconds();
+
+            reply << " : " << p->second.peer << " : " << p->second.nChunk << " : " << p->second.nByte
+                  << " : " << fixed << setprecision(3) << dt
+                  << " : " << setprecision(1) << ((dt>0.0) ? (double)p->second.nByte*8/dt/1.0e6 : 0.0);
+        }
+        reply << " ;";
+        return reply.str();
+    }
+
+    EZASSERT2(args.size()>1 && args[1]=="reset", Error_Code_6_Exception, EZINFO(" - only 'reset' is supported"));
+
+    RTEEXEC(rte, rte.connstats.clear());
+    reply << " 0 ;";
+    return reply.str();
+}
@@ -153,6 +153,7 @@ string disk2net_fn( bool qry, const vector<string>& args, runtime& rte) {
             chain                   c;
             chain::stepid           fdstep = chain::invalid_stepid; // after .run() be able to set 'allow variable block size'
             chain::stepid           netstep = chain::invalid_stepid;
+            bool                    zerocopy = false;
             const string            protocol( rte.netparms.get_protocol() );
             const string            host( OPTARG(2, args) );
             const headersearch_type dataformat(rte.trackformat(), rte.ntrack(),
@@ -206,8 +207,14 @@ string disk2net_fn( bool qry, const vector<string>& args, runtime& rte) {
                 EZASSERT2((f_stat.st_mode&S_IFREG)==S_IFREG, cmdexception, EZINFO(file_name[&rte] << " not a regular file"));
 
                 // do remember the step-id of the reader such that
-                // later on we can communicate with it (see below)
-                fdstep = c.add(&fdreader, 32, &open_file, filename + ",r", &rte);
+                // later on we can communicate with it (see below).
+                // If the file goes out unaltered we let the kernel send
+                // it; the reader only hands ranges of the file to the
+                // writer so a short queue is enough
+                if( (zerocopy=zerocopy_transfer(rte))==true )
+                    fdstep = c.add(&fdrangereader, 4, &open_file, filename + ",r", &rte);
+                else
+                    fdstep = c.add(&fdreader, 32, &open_file, filename + ",r", &rte);
                 c.register_cancel(fdstep, &close_filedescriptor);
             }
             else {
@@ -251,7 +258,10 @@ string disk2net_fn( bool qry, const vector<string>& args, runtime& rte) {
             // register the cancellationfunction for the networkstep
             // which we will first add ;)
             // it will be called at the appropriate moment
-            netstep = c.add(&netwriter<block>, &net_client, networkargs(&rte));
+            if( zerocopy )
+                netstep = c.add(&netsendfile, &net_client, networkargs(&rte));
+            else
+                netstep = c.add(&netwriter<block>, &net_client, networkargs(&rte));
             c.register_cancel(netstep, &close_filedescriptor);
 
             // Register a finalizer which automatically clears the transfer when done for
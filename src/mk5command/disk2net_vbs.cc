@@ -190,7 +190,14 @@ string disk2net_vbs_fn( bool qry, const vector<string>& args, runtime& rte) {
             d2n_ptr->disk_args->set_variable_block_size( !(dataformat.valid() && rte.solution) );
             d2n_ptr->disk_args->set_run( false );
 
-            d2n_ptr->vbsstep = c.add(&vbsreader_c, 10, d2n_ptr->disk_args);
+            // If the recording goes out unaltered, the kernel can send
+            // it chunk by chunk
+            const bool      zerocopy = zerocopy_transfer(rte);
+
+            if( zerocopy )
+                d2n_ptr->vbsstep = c.add(&vbsrangereader_c, 4, d2n_ptr->disk_args);
+            else
+                d2n_ptr->vbsstep = c.add(&vbsreader_c, 10, d2n_ptr->disk_args);
             c.register_cancel(d2n_ptr->vbsstep, &close_vbs_c);
 
             // if the trackmask is set insert a blockcompressor 
@@ -200,7 +207,10 @@ string disk2net_vbs_fn( bool qry, const vector<string>& args, runtime& rte) {
             // register the cancellationfunction for the networkstep
             // which we will first add ;)
             // it will be called at the appropriate moment
-            d2n_ptr->netstep = c.add(&netwriter<block>, &net_client, networkargs(&rte));
+            if( zerocopy )
+                d2n_ptr->netstep = c.add(&netsendfile, &net_client, networkargs(&rte));
+            else
+                d2n_ptr->netstep = c.add(&netwriter<block>, &net_client, networkargs(&rte));
             c.register_cancel(d2n_ptr->netstep, &close_filedescriptor);
 
             // register a finalizer which automatically clears the transfer when done
@@ -0,0 +1,70 @@
+// Copyright (C) 2007-2014 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// 
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+// 
+// Author:  Harro Verkouter - verkouter@jive.nl
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <mk5_exception.h>
+#include <mk5command/mk5.h>
+#include <iostream>
+#include <iomanip>
+
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////
+//
+//  disk_stats?
+//  disk_stats = reset
+//
+//  Report per mountpoint how well it did whilst recording:
+//      !disk_stats? 0 [ : <mountpoint> : <#chunks> : <#bytes> :
+//                         <average rate MB/s> : <last latency s> :
+//                         <ok|demoted> : <#times demoted> ]* ;
+//  Mountpoints that are much slower than the others get demoted:
+//  they only get data if no other mountpoint is free, or now and again
+//  to see if they've recovered. Each recording starts measuring afresh.
+//  "reset" forgets everything that was measured (only when idle).
+//
+////////////////////////////////////////////////////////////////////
+string disk_stats_fn(bool q, const vector<string>& args, runtime& rte ) {
+    ostringstream           reply;
+    mountpointstats_type    diskstats;
+
+    reply << "!" << args[0] << (q?('?'):('=')) << " ";
+
+    // Query is always possible, command only if idle
+    INPROGRESS(rte, reply, !(q || rte.transfermode==no_transfer));
+
+    if( q ) {
+        // Recording threads update these
+        RTEEXEC(rte, diskstats = rte.mk6info.diskstats);
+
+        reply << " 0";
+        for(mountpointstats_type::const_iterator p=diskstats.begin(); p!=diskstats.end(); p++)
+            reply << " : " << p->first << " : " << p->second.nChunk << " : " << p->second.nByte
+                  << " : " << fixed << setprecision(1) << p->second.avgRate/1.0e6
+                  << " : " << setprecision(3) << p->second.lastLatency
+                  << " : " << (p->second.demoted ? "demoted" : "ok") << " : " << p->second.nDemoted;
+        reply << " ;";
+        return reply.str();
+    }
+
+    EZASSERT2(args.size()>1 && args[1]=="reset", Error_Code_6_Exception, EZINFO(" - only 'reset' is supported"));
+
+    RTEEXEC(rte, rte.mk6info.diskstats.clear());
+    reply << " 0 ;";
+    return reply.str();
+}
@@ -22,6 +22,7 @@
 #include <dotzooi.h>
 #include <timezooi.h>
 #include <jive5a_bcd.h>
+#include <zerocopy.h>
 
 using namespace std;
 
@@ -234,3 +235,11 @@ void throw_on_insane_netprotocol(runtime& rte) {
               EZINFO("Check net_protocol - more than 128MB requested"));
 }
 
+bool zerocopy_transfer(runtime const& rte) {
+    const string  proto( rte.netparms.get_protocol() );
+
+    // Without sendfile(2) the bytes are copied anyway; then the normal
+    // chain is just as good
+    return !rte.solution && (proto=="tcp" || proto=="itcp") && sendfile_in_kernel();
+}
+
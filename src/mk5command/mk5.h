@@ -95,4 +95,10 @@ unsigned int                register2track( mk5areg::regtype::base_type reg );
 //       a constrain() before calling this one!
 void throw_on_insane_netprotocol(runtime& rte);
 
+// Can file2net/disk2net(vbs) use the zero-copy chain (a filerange reader
+// plus netsendfile) in stead of reader + netwriter? Only if nothing is done
+// to the data on the way (no channel dropping/compression) and the bytes
+// go out over a tcp connection that we make ourselves.
+bool zerocopy_transfer(runtime const& rte);
+
 #endif
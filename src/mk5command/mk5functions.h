@@ -116,6 +116,7 @@ std::string rtime_5c_fn(bool q, const std::vector<std::string>& args, runtime& r
 std::string track_set_fn(bool q, const std::vector<std::string>& args, runtime& rte);
 std::string tvr_fn(bool q, const std::vector<std::string>& args, runtime& rte);
 std::string itcp_id_fn(bool q,  const std::vector<std::string>& args, runtime& rte);
+std::string net_zerocopy_fn(bool q,  const std::vector<std::string>& args, runtime& rte);
 std::string layout_fn(bool q,  const std::vector<std::string>& args, runtime& rte);
 std::string nop_fn(bool q, const std::vector<std::string>& args, runtime&);
 std::string personality_fn(bool q, const std::vector<std::string>& args, runtime&);
@@ -128,6 +129,9 @@ std::string datastream_fn(bool q, const std::vector<std::string>& args, runtime&
 
 std::string group_def_fn(bool q, const std::vector<std::string>& args, runtime& rte);
 std::string set_disks_fn(bool q, const std::vector<std::string>& args, runtime& rte);
+std::string vbs_readahead_fn(bool q, const std::vector<std::string>& args, runtime& rte);
+std::string disk_stats_fn(bool q, const std::vector<std::string>& args, runtime& rte);
+std::string conn_stats_fn(bool q, const std::vector<std::string>& args, runtime& rte);
 std::string scan_check_vbs_fn(bool q, const std::vector<std::string>& args, runtime& rte);
 std::string scan_set_vbs_fn(bool q, const std::vector<std::string>& args, runtime& rte);
 std::string disk2file_vbs_fn(bool qry, const std::vector<std::string>& args, runtime& rte );
@@ -187,7 +187,9 @@ string net2file_fn(bool qry, const vector<string>& args, runtime& rte ) {
 
             // start with a network reader
             // HV: 06-Jun-2014 Tell it to accept partial blocks
-            rdstep = c.add(&netreader, 32, &net_server, networkargs(&rte, true));
+            // One reader feeding one consumer so the queue in between can
+            // be lock-free
+            rdstep = c.add(&netreader, lockfree(32), &net_server, networkargs(&rte, true));
             c.register_cancel(rdstep, &close_filedescriptor);
             fdsteps.push_back( rdstep );
             readstep[&rte] = rdstep;
@@ -22,10 +22,9 @@
 #include <threadutil.h>
 #include <threadfns/multisend.h>
 #include <headersearch.h>
-#include <directory_helper_templates.h>
-#include <regular_expression.h>
 #include <interchainfns.h>
-#include <mountpoint.h>   // for mp_thread_create
+#include <mountpoint.h>
+#include <recording_catalog.h>
 #include <sciprint.h>
 
 #include <inttypes.h>     // For SCNu64 and friends
@@ -64,149 +63,32 @@ static if2addr_type if2addr = mk_if2addr();
 // appending a suffix 'a'-'z', then 'A'-'Z' and restarts at 'a' after 52
 // recordings of the same scan name."
 
-// Given a path, return the matchresult of matching it against the regex
-struct regex_predicate {
-    typedef matchresult value_type;
-
-    regex_predicate(Regular_Expression const* reptr):
-        __m_regular_expression_ptr(reptr)
-    { }
-
-    matchresult operator()(string const& path) const {
-        return __m_regular_expression_ptr->matches(path);
-    }
-
-    Regular_Expression const*    __m_regular_expression_ptr;
-};
-
-// This typedef allows us to map the regex_predicate over a directory and
-// return a list of match objects. The match objects will
-//   1.) tell us if any of the entries matched
-//   2.) it could capture useful parts out of the match, 
-//       in our case an existing suffix, if any
-typedef dir_mapper<regex_predicate>  regex_matcher_type;
-
-
-// For each suffix we count how often it occurs
-struct duplicate_counter_data {
-    duplicate_counter_data():
-        duplicate_detected( false )
-    {}
-    bool                     duplicate_detected;
+// The recording catalog tells us which of those exist
+string mk_scan_name(string const& scanname, mountpointlist_type const& mps, const bool /*mk6*/) {
+    string                   rv( scanname );
+    bool                     duplicate_detected = false;
     map<char, unsigned int>  duplicate_count;
-};
-
-// Wrap the duplicate_counter_data in an output iterator. That way we can
-// just copy the results from the directory-mapper directly into the counter
-// data!
-struct duplicate_counter: public std::iterator<std::output_iterator_tag, duplicate_counter> {
-    // Implement output iterator interface
-    duplicate_counter(duplicate_counter_data* p):
-        __m_data_ptr( p )
-    {}
-    
-    // Implement output iterator interface
-    duplicate_counter& operator*( void )  { return *this; }
-    duplicate_counter& operator++( void ) { return *this; }
-    duplicate_counter& operator++( int  ) { return *this; }
-
-    // assignment is the only one that actually does something ;-)
-    duplicate_counter& operator=( regex_matcher_type::value_type::value_type const& kvref ) {
-        matchresult const& mo = kvref.second;
-
-        // No match? Nothing to do!
-        if( !mo )
-            return *this;
-        // do we have a group? [it could be the empty group (ie no
-        // suffix) - in which case it would be the exact scan name]
-        if( mo[1] )
-            __m_data_ptr->duplicate_count[ mo.group(1)[0] ]++;
-        else 
-            __m_data_ptr->duplicate_detected = true;
-        return *this;
-    }
-    duplicate_counter_data*  __m_data_ptr;
-
-    private:
-        duplicate_counter();
-};
-
-struct nameScannerArgs {
-    nameScannerArgs(string const& mp, string const& scanname, pthread_mutex_t* mtx,
-                    duplicate_counter_data* dupcntrptr, const bool /*mk6*/):
-        mountPoint( mp ), mutexPointer( mtx ),
-        dupCounterDataPtr( dupcntrptr ),
-        //rxScanName( string("^")+mp+"/"+scanname+"([a-zA-Z])?"+(mk6?"\\.mk6":"")+"$" )
-        rxScanName( string("^")+mp+"/"+scanname+"([a-zA-Z])?$" )
-    {}
-
-    const string              mountPoint;
-    pthread_mutex_t*          mutexPointer;
-    duplicate_counter_data*   dupCounterDataPtr;
-    const Regular_Expression  rxScanName;
-
-    private:
-        nameScannerArgs();
-};
-
-///////// The thread function
-void* nameScanner(void* args) {
-    nameScannerArgs*    nsa = (nameScannerArgs*)args;
-
-    // Don't let exceptions escape
-    try {
-        // Find directories in mountpoint having a name like requested scan.
-        const regex_matcher_type::value_type  matchresults = regex_matcher_type( regex_predicate(&nsa->rxScanName) )( nsa->mountPoint );
-
-        // 'copy' them all into the duplicate counter
-        ::pthread_mutex_lock( nsa->mutexPointer );
-        copy(matchresults.begin(), matchresults.end(), duplicate_counter(nsa->dupCounterDataPtr));
-        ::pthread_mutex_unlock( nsa->mutexPointer );
-    }
-    catch( const exception& e ) {
-        DEBUG(-1, "nameScanner[" << nsa->mountPoint << "]: caught exception - " << e.what() << endl);
-    }
-    catch( ... ) {
-        DEBUG(-1, "nameScanner[" << nsa->mountPoint << "]: caught unknown exception" << endl);
-    }
-
-    // we don't need the nameScannerArgs anymore
-    delete nsa;
-    return (void*)0;
-}
-
-typedef std::list<pthread_t*>   threadidlist_type;
-
-string mk_scan_name(string const& scanname, mountpointlist_type const& mps, const bool mk6) {
-    int                    create_error;
-    string                 rv( scanname );
-    pthread_mutex_t        mtx = PTHREAD_MUTEX_INITIALIZER;
-    threadidlist_type      threads;
-    duplicate_counter_data cnt;
 
     // Nothing given or the null disk set ("set_disks=null")? Nothing to do!
     if( rv.empty() || is_null_diskset(mps) )
         return rv;
 
-    // loop over all mountpoints
-    create_error = 0;
-    for(mountpointlist_type::const_iterator mp=mps.begin(); mp!=mps.end(); mp++) {
-        pthread_t*   tid = new pthread_t();
+    // For each suffix we count how often it occurs
+    const set<string>  names = catalog_find_names(scanname, mps);
 
-        if( (create_error=mp_pthread_create(tid, &nameScanner, new nameScannerArgs(*mp, scanname, &mtx, &cnt, mk6)))!=0 )
-            break;
-        threads.push_back( tid );
-    }
-
-    // Join all threads we created, discarding the return value
-    for( threadidlist_type::iterator thrdptrptr=threads.begin(); thrdptrptr!=threads.end(); thrdptrptr++ )
-        ::pthread_join( **thrdptrptr, 0 );
+    for(set<string>::const_iterator n=names.begin(); n!=names.end(); n++) {
+        if( *n==scanname ) {
+            duplicate_detected = true;
+            continue;
+        }
+        const char  suffix = (*n)[scanname.size()];
 
-    // If create_error != 0, something went wrong starting all the threads
-    EZASSERT2(create_error==0, cmdexception, EZINFO(" - failed to create one or more threads: " << evlbi5a::strerror(create_error)));
+        if( n->size()==scanname.size()+1 && ((suffix>='a' && suffix<='z') || (suffix>='A' && suffix<='Z')) )
+            duplicate_count[ suffix ]++;
+    }
 
     // Now we can get to analyzing the result
-    if( cnt.duplicate_detected==false )
+    if( duplicate_detected==false )
         return rv;
 
     // Duplicates found!
@@ -216,8 +98,8 @@ string mk_scan_name(string const& scanname, mountpointlist_type const& mps, cons
     for( char extension_candidate='a'; 
               extension_candidate!= ('Z' + 1);
               extension_candidate = (extension_candidate=='z'?'A':extension_candidate+1) ) {
-        if( cnt.duplicate_count[extension_candidate]<suffix_use_count ) {
-            suffix_use_count = cnt.duplicate_count[extension_candidate];
+        if( duplicate_count[extension_candidate]<suffix_use_count ) {
+            suffix_use_count = duplicate_count[extension_candidate];
             extension        = extension_candidate;
         }
     }
@@ -248,7 +130,7 @@ void net2vbsguard_fn(runtime* rteptr) {
 }
 
 // Per runtime we keep the settings of how many parallel network readers
-// (only with "net2vbs", not used when used as "record") + how many
+// (with "net2vbs", or when recording UDP data streams, see below) + how many
 // parallel file writers are started.
 // The default c'tor assumes 1 each - the absolute minimum
 struct nthread_type {
@@ -277,6 +159,7 @@ string net2vbs_fn( bool qry, const vector<string>& args, runtime& rte, bool fork
     const transfer_type               ctm( rte.transfermode ); // current transfer mode
     static per_runtime<nthread_type>  nthread;
     static per_runtime<chain::stepid> use_closefd;
+    static per_runtime<chain::stepid> use_multirdclose;
 
     // Assert that the requested transfermode is one that we support
     EZASSERT2(rtm==net2vbs || rtm==fill2vbs || rtm==vbsrecord || rtm==mem2vbs, cmdexception,
@@ -304,6 +187,8 @@ string net2vbs_fn( bool qry, const vector<string>& args, runtime& rte, bool fork
             reply << nthread[&rte].nParallelReader << " : " << nthread[&rte].nParallelWriter;
         } else if( what=="mk6" ) {
             reply << rte.mk6info.mk6;
+        } else if( what=="direct" ) {
+            reply << rte.mk6info.directio;
         } else {
             if( ctm==no_transfer || rtm!=ctm ) {
                 // GiuseppeM suggests to return "on/off" for record?
@@ -461,16 +346,40 @@ string net2vbs_fn( bool qry, const vector<string>& args, runtime& rte, bool fork
                     // hoping to minimize loss of partially filled block(s)
                     chain::stepid  readstep = chain::invalid_stepid;
 
+                    // Forget about any read step of a previous run
+                    if( use_closefd.find(&rte)!=use_closefd.end() )
+                        use_closefd.erase( use_closefd.find(&rte) );
+                    if( use_multirdclose.find(&rte)!=use_multirdclose.end() )
+                        use_multirdclose.erase( use_multirdclose.find(&rte) );
+
                     // VGOS request: can we record threads by themselves?
                     //      answer:  maybe! let's see what we can do. This
                     //      only works for VDIF
                     if( is_vdif(rte.trackformat()) && !mk6info.datastreams.empty() ) {
-                        // The netreaders now output tagged blocks
-                        readstep = c.add(&netreader_stream, 4, &net_server, networkargs(&rte, true));
-
-                        c.register_cancel( readstep, &close_filedescriptor);
-                        if( protocol=="udps" )
-                            c.register_cancel( readstep, &wait_for_udps_finish );
+                        // The netreaders now output tagged blocks.
+                        // For UDP we can scale the receive side over >1
+                        // core: as many sockets as readers are bound to
+                        // the same port (SO_REUSEPORT) and the kernel
+                        // spreads the senders over them
+                        unsigned int const nRd = SAFE_UINT_CAST(nthreadref.nParallelReader);
+
+                        if( nRd>1 && (protocol=="udp" || protocol=="udps" || protocol=="udpsnor") ) {
+                            readstep = c.add(&multifdreader_stream, 4*nRd, &multinetopener, &rte, nRd);
+                            c.register_cancel( readstep, &multirdcloser );
+                            c.nthread( readstep, nRd );
+                            // Different userdata so we must remember to
+                            // use a different close function
+                            use_multirdclose[ &rte ] = readstep;
+                            readstep = chain::invalid_stepid;
+                        } else {
+                            // Single reader, single consumer: no need
+                            // for locking on the queue between them
+                            readstep = c.add(&netreader_stream, lockfree(4), &net_server, networkargs(&rte, true));
+
+                            c.register_cancel( readstep, &close_filedescriptor);
+                            if( protocol=="udps" )
+                                c.register_cancel( readstep, &wait_for_udps_finish );
+                        }
 
                         // If forking requested, splice off the raw data here,
                         // before we make FlexBuff/Mark6 chunks of them
@@ -480,7 +389,9 @@ string net2vbs_fn( bool qry, const vector<string>& args, runtime& rte, bool fork
                         // chunkmakers that know how to handle tagged blocks
                         useStreams = true;
                     } else {
-                        readstep = c.add(&netreader, 4, &net_server, networkargs(&rte, true));
+                        // Single reader, single consumer: no need for
+                        // locking on the queue between them
+                        readstep = c.add(&netreader, lockfree(4), &net_server, networkargs(&rte, true));
 
                         // Cancellations are processed in the order they are
                         // registered. Which is good ... in case of UDPS protocol we
@@ -541,6 +452,7 @@ string net2vbs_fn( bool qry, const vector<string>& args, runtime& rte, bool fork
 
             // reset statistics counters
             rte.statistics.clear();
+            rte.connstats.clear();
 
             // install the chain in the rte and run it
             rte.processingchain = c;
@@ -593,6 +505,13 @@ string net2vbs_fn( bool qry, const vector<string>& args, runtime& rte, bool fork
                         // parallel disk writer) 
                         evlbi5a::usleep( 500000 );
                     }
+                    // Id. for the parallel network readers
+                    if( (p=use_multirdclose.find(&rte))!=use_multirdclose.end() ) {
+                        chain::stepid s = p->second;
+                        use_multirdclose.erase( p );
+                        rte.processingchain.communicate(s, &multirdcloser);
+                        evlbi5a::usleep( 500000 );
+                    }
                     // let the runtime stop the threads
                     rte.processingchain.gentle_stop();
                     
@@ -687,6 +606,28 @@ string net2vbs_fn( bool qry, const vector<string>& args, runtime& rte, bool fork
             rte.mk6info.mk6 = (m6!=0);
         }
     }
+    // record = direct : [0|1]
+    //   write the recording using O_DIRECT (bypass the page cache)
+    if( args[1]=="direct" ) {
+        char*             eocptr;
+        const string      direct_s( OPTARG(2, args) );
+
+        // Same as "mk6" - no argument = no-op
+        recognized = true;
+        reply << " 0 ;";
+
+        if( direct_s.empty()==false ) {
+            long int d;
+
+            errno = 0;
+            d     = ::strtol(direct_s.c_str(), &eocptr, 0);
+
+            EZASSERT2(eocptr!=direct_s.c_str() && *eocptr=='\0' && errno!=ERANGE,
+                      cmdexception,
+                      EZINFO("direct '" << direct_s << "' is not a number") );
+            rte.mk6info.directio = (d!=0);
+        }
+    }
     if( !recognized )
         reply << " 2 : " << args[1] << " does not apply to " << args[0] << " ;";
 
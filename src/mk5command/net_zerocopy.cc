@@ -0,0 +1,57 @@
+// Copyright (C) 2007-2013 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// 
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+// 
+// Author:  Harro Verkouter - verkouter@jive.nl
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <mk5_exception.h>
+#include <mk5command/mk5.h>
+#include <iostream>
+
+using namespace std;
+
+
+// net_zerocopy = on | off
+//   Transfers writing to tcp send straight from the data blocks
+//   (MSG_ZEROCOPY), in stead of having the kernel copy the data into
+//   the socket buffer first. Only pays off for large blocks; not all
+//   systems support it, then the data is sent normally.
+string net_zerocopy_fn(bool q, const vector<string>& args, runtime& rte) {
+    ostringstream  oss;
+    netparms_type& np( rte.netparms );
+
+    oss << "!" << args[0] << (q?('?'):('='));
+
+    // Query is possible always, command only when nothing is happening
+    INPROGRESS(rte, oss, !(q || rte.transfermode==no_transfer))
+
+    if( q ) {
+        oss << " 0 : " << (np.zerocopy ? "on" : "off") << " ;";
+        return oss.str();
+    }
+
+    const string  onoff( OPTARG(1, args) );
+
+    if( onoff=="on" )
+        np.zerocopy = true;
+    else if( onoff=="off" )
+        np.zerocopy = false;
+    else {
+        oss << " 8 : expect 'on' or 'off' ;";
+        return oss.str();
+    }
+    oss << " 0 ;";
+    return oss.str();
+}
@@ -17,6 +17,7 @@
 //          P.O. Box 2
 //          7990 AA Dwingeloo
 #include <mk6info.h>
+#include <recording_catalog.h>
 #include <mk5_exception.h>
 #include <mk5command/mk5.h>
 #include <iostream>
@@ -73,6 +74,9 @@ string set_disks_fn(bool q, const vector<string>& args, runtime& rte ) {
     // mountpoints matching the pattern(s)
     mk6info.mountpoints = find_mountpoints( resolvePatterns(pl, mk6info.groupdefs) );
 
+    // Start indexing new ones straight away
+    catalog_index(mk6info.mountpoints);
+
     if( mk6info.mountpoints.empty() )
         reply << " 8 : 0 : no mountpoints matched your selection criteria";
     else
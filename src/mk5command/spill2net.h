@@ -42,6 +42,9 @@ struct splitsettings_type {
     unsigned int     bitsperchannel;
     unsigned int     bitspersample;
     unsigned int     qdepth;
+    unsigned int     nthread;     // number of threads per splitter step
+    bool             fuse;        // attempt to fuse chained splitters
+    dce_engine_type  extractor;   // how to build "[..]" extractors
     netparms_type    netparms;
     chain::stepid    framerstep;
     tagremapper_type tagremapper;
@@ -49,7 +52,8 @@ struct splitsettings_type {
     splitsettings_type():
         strict( false ), station( 0 ),
         vdifsize( (unsigned int)-1 ),
-        bitsperchannel(0), bitspersample(0), qdepth( 32 )
+        bitsperchannel(0), bitspersample(0), qdepth( 32 ), nthread( 1 ), fuse( true ),
+        extractor( dce_table )
     {}
 };
 
@@ -254,6 +258,12 @@ std::string spill2net_fn(bool qry, const std::vector<std::string>& args, runtime
             reply << settings[&rte].bitspersample;
         } else if( what=="qdepth" ) {
             reply << settings[&rte].qdepth;
+        } else if( what=="nthread" ) {
+            reply << settings[&rte].nthread;
+        } else if( what=="fuse" ) {
+            reply << settings[&rte].fuse;
+        } else if( what=="extractor" ) {
+            reply << (settings[&rte].extractor==dce_compiled ? "compiled" : "table");
         } else if( what=="tagmap" ) {
             tagremapper_type::const_iterator p; 
             tagremapper_type::const_iterator start = settings[&rte].tagremapper.begin();
@@ -543,8 +553,12 @@ std::string spill2net_fn(bool qry, const std::vector<std::string>& args, runtime
                 // information the framefilterthread needs yet ...
                 c.add( &framefilter, 4, &framefilterargs );
 
-                // The following steps accept tagged frames as input and produce
-                // tagged frames as output
+                // First look up all splitters and see what they'd produce
+                std::vector<splitproperties_type> splitpropslist;
+                std::vector<unsigned int>         n2clist;
+                bool                              natural = true;
+                const headersearch_type           inhdr( *curhdr );
+
                 for(std::vector<std::string>::const_iterator cursplit=splitters.begin();
                     cursplit!=splitters.end(); cursplit++) {
                     unsigned int             n2c = -1;
@@ -567,7 +581,7 @@ std::string spill2net_fn(bool qry, const std::vector<std::string>& args, runtime
                     }
 
                     // Look up the splitter
-                    EZASSERT2( (splitprops = find_splitfunction(splittersetup[0])).fnptr(),
+                    EZASSERT2( (splitprops = find_splitfunction(splittersetup[0], settings[&rte].extractor)).nchunk()>0,
                                cmdexception,
                                EZINFO("the splitfunction '" << splittersetup[0] << "' cannot be found") );
 
@@ -586,10 +600,39 @@ std::string spill2net_fn(bool qry, const std::vector<std::string>& args, runtime
                     newhdr = new headersearch_type( splitargs.outputhdr );
                     delete curhdr;
                     curhdr = newhdr;
-                    c.add( &coalescing_splitter, qdepth, splitargs );
+
+                    splitpropslist.push_back( splitprops );
+                    n2clist.push_back( n2c );
+                    natural = natural && (n2c==splitproperties_type::natural_accumulation);
+                }
+
+                // >1 splitter: try to do it in one go, in stead of
+                // passing the data through memory for each stage
+                if( settings[&rte].fuse && natural && splitpropslist.size()>1 ) {
+                    splitproperties_type  fused = fuse_splitfunctions(splitmethod, splitpropslist, inhdr, settings[&rte].extractor);
+
+                    if( fused.nchunk()>0 ) {
+                        splitpropslist = std::vector<splitproperties_type>(1, fused);
+                        n2clist.resize( 1 );
+                    }
+                }
+
+                // The following steps accept tagged frames as input and produce
+                // tagged frames as output
+                headersearch_type*  stagehdr = new headersearch_type( inhdr );
+
+                for(unsigned int i=0; i<splitpropslist.size(); i++) {
+                    splitterargs  splitargs(&rte, splitpropslist[i], *stagehdr, n2clist[i]);
+
+                    delete stagehdr;
+                    stagehdr = new headersearch_type( splitargs.outputhdr );
+                    splitargs.nthread = settings[&rte].nthread;
+                    c.nthread( c.add( &coalescing_splitter, qdepth, splitargs ),
+                               settings[&rte].nthread );
 
                     framefilterargs.naccumulate *= splitargs.naccumulate;
                 }
+                delete stagehdr;
             } else {
                 // no splitter given, then we must strip the header
                 c.add( &header_stripper, qdepth, *((const headersearch_type*)curhdr) );
@@ -881,6 +924,56 @@ std::string spill2net_fn(bool qry, const std::vector<std::string>& args, runtime
         settings[&rte].qdepth = qd;
         reply << " 0 ;";
     //
+    // Corner turning is CPU bound; each splitter step can be run
+    // by more than one thread. Each output tag keeps its frame order.
+    //
+    } else if( args[1]=="nthread" ) {
+        char*             eocptr;
+        const std::string ntstr( OPTARG(2, args) );
+        unsigned long int nt;
+
+        NOTWHILSTTRANSFER;
+
+        recognized = true;
+        EZASSERT2(ntstr.empty()==false, cmdexception, EZINFO("nthread needs a parameter"));
+
+        errno = 0;
+        nt    = ::strtoul(ntstr.c_str(), &eocptr, 0);
+
+        EZASSERT2( eocptr!=ntstr.c_str() && *eocptr=='\0' && errno!=ERANGE && nt>0 && nt<=64,
+                cmdexception,
+                EZINFO("nthread '" << ntstr << "' NaN/out of range (range: [1,64])") );
+        settings[&rte].nthread = (unsigned int)nt;
+        reply << " 0 ;";
+    //
+    // Chained splitters ("a+b+...") are fused into one, if possible.
+    // Can be switched off, e.g. to compare results
+    //
+    } else if( args[1]=="fuse" ) {
+        const std::string fusestr( OPTARG(2, args) );
+
+        NOTWHILSTTRANSFER;
+
+        recognized = true;
+        EZASSERT2(fusestr=="0" || fusestr=="1", cmdexception, EZINFO("fuse needs a parameter 0 or 1"));
+        settings[&rte].fuse = (fusestr=="1");
+        reply << " 0 ;";
+    //
+    // Dynamic channel extractors ("[..]" splitters) are table driven by
+    // default. "compiled" generates C code and compiles it, which needs a
+    // compiler on the system and takes a while but may run faster.
+    //
+    } else if( args[1]=="extractor" ) {
+        const std::string extractorstr( OPTARG(2, args) );
+
+        NOTWHILSTTRANSFER;
+
+        recognized = true;
+        EZASSERT2(extractorstr=="table" || extractorstr=="compiled", cmdexception,
+                  EZINFO("extractor needs a parameter 'table' or 'compiled'"));
+        settings[&rte].extractor = (extractorstr=="compiled" ? dce_compiled : dce_table);
+        reply << " 0 ;";
+    //
     // "spill2*" can be made to go as fast as it can or
     // sort of realtime
     //
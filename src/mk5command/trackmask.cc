@@ -86,7 +86,8 @@ string trackmask_fn(bool q, const vector<string>& args, runtime& rte) {
 
     // good, check if query
     if( q ) {
-        reply << " 0 : " << hex_t(computeargs.trackmask) << " : " << rte.signmagdistance << " ;";
+        reply << " 0 : " << hex_t(computeargs.trackmask) << " : " << rte.signmagdistance
+              << " : " << (rte.solution.packed() ? "packed" : "compiled") << " ;";
         return reply.str();
     }
 
@@ -109,13 +110,28 @@ string trackmask_fn(bool q, const vector<string>& args, runtime& rte) {
                       SCINFO("Failed to parse sign-magnitude distance") );
     }
 
+    // The compression engine is optional, default "compiled": solve the
+    // compression steps (in a thread, see below) and generate code from them
+    // when the transfer starts. "packed" gathers the bits to keep using
+    // PEXT/PDEP which can be used immediately, but the data is laid out
+    // differently so the other side must use "packed" as well.
+    bool packed = false;
+    if( args.size()>3 && !args[3].empty() ) {
+        ASSERT2_COND( args[3]=="compiled" || args[3]=="packed",
+                      SCINFO("Compression engine must be 'compiled' or 'packed'") );
+        packed = (args[3]=="packed");
+    }
+
     // no tracks are dropped
     if( computeargs.trackmask==((uint64_t)0xffffffff << 32) + 0xffffffff ) 
         computeargs.trackmask=0;
 
     // Right - if no trackmask, clear it also from the runtime environment.
     // If yes trackmask, start a thread to compute the solution
-    if( computeargs.trackmask ) {
+    if( computeargs.trackmask && packed ) {
+        rte.solution = solution_type::packed_solution(computeargs.trackmask);
+        reply << " 0 : " << hex_t(computeargs.trackmask) << " : " << rte.signmagdistance << " : packed ;";
+    } else if( computeargs.trackmask ) {
         computer           = new pthread_t;
         computeargs.rteptr = &rte;
 
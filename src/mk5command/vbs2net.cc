@@ -45,14 +45,17 @@ void vbs2netguard_fun(runtime* rteptr) {
 
 
 // Per runtime we keep the settings of how many parallel readers +
-// senders are started.
-// The default c'tor assumes 1 each - the absolute minimum
+// senders are started and whether the senders use one connection per chunk
+// or keep their connection open.
+// The default c'tor assumes 1 each - the absolute minimum - and a
+// connection per chunk, which every receiver understands
 struct nthread_type {
     unsigned int    nParallelReader;
     unsigned int    nParallelSender;
+    bool            persistent;
 
     nthread_type() :
-        nParallelReader( 1 ), nParallelSender( 1 )
+        nParallelReader( 1 ), nParallelSender( 1 ), persistent( false )
     {}
 };
 
@@ -73,8 +76,9 @@ string vbs2net_fn( bool qry, const vector<string>& args, runtime& rte) {
     // Good. See what the usr wants
     if( qry ) {
         // may query 'nthread' rather than vbs2net status
-        //    vbs2net?         => vbs2net status
-        //    vbs2net? nthread => query how many threads configured
+        //    vbs2net?            => vbs2net status
+        //    vbs2net? nthread    => query how many threads configured
+        //    vbs2net? persistent => query connection-per-sender setting
         const string    what( OPTARG(1, args) );
 
         // Queries always work
@@ -82,6 +86,8 @@ string vbs2net_fn( bool qry, const vector<string>& args, runtime& rte) {
 
         if( what=="nthread" ) {
             reply << nthread[&rte].nParallelReader << " : " << nthread[&rte].nParallelSender;
+        } else if( what=="persistent" ) {
+            reply << (nthread[&rte].persistent ? "on" : "off");
         } else {
             if( ctm==no_transfer ) {
                 reply << "inactive";
@@ -143,7 +149,7 @@ string vbs2net_fn( bool qry, const vector<string>& args, runtime& rte) {
             // add the steps to the chain. 
             s0 = c.add(&rsyncinitiator, nthreadref.nParallelReader+1, rsyncinitargs(scan, networkargs(&rte, rte.netparms)));
             s1 = c.add( &parallelreader2, 4, multireadargs() );
-            s2 = c.add( &parallelsender, networkargs(&rte) );
+            s2 = c.add( &parallelsender, parallelsenderargs(networkargs(&rte), nthreadref.persistent) );
 
             // Cancellation functions, if any
             c.register_cancel(s0, &rsyncinit_close);
@@ -161,6 +167,7 @@ string vbs2net_fn( bool qry, const vector<string>& args, runtime& rte) {
 
             // reset statistics counters
             rte.statistics.clear();
+            rte.connstats.clear();
 
             // install the chain in the rte and run it
             rte.processingchain = c;
@@ -244,6 +251,19 @@ string vbs2net_fn( bool qry, const vector<string>& args, runtime& rte) {
             nthreadref.nParallelSender = (unsigned int)nSnd;
         }
     }
+    // vbs2net = persistent : on|off
+    //   on:  each sender opens one connection and sends all its chunks
+    //        over it. The receiving jive5ab must support this!
+    //   off: a new connection per chunk (default)
+    if( args[1]=="persistent" ) {
+        const string      onoff( OPTARG(2, args) );
+
+        recognized = true;
+        EZASSERT2( onoff=="on" || onoff=="off", cmdexception,
+                   EZINFO("persistent must be 'on' or 'off'") );
+        nthread[&rte].persistent = (onoff=="on");
+        reply << " 0 ;";
+    }
     if( !recognized )
         reply << " 2 : " << args[1] << " does not apply to " << args[0] << " ;";
 
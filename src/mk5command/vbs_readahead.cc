@@ -0,0 +1,65 @@
+// Copyright (C) 2007-2014 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// 
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+// 
+// Author:  Harro Verkouter - verkouter@jive.nl
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <mk5_exception.h>
+#include <mk5command/mk5.h>
+#include <iostream>
+#include <limits.h>
+
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////
+//
+//  vbs_readahead = <depth>
+//  vbs_readahead?
+//
+//  When playing back FlexBuff/Mark6 recordings read <depth> chunks
+//  ahead, concurrently, from the mountpoints they're on. 0 = off.
+//  Each chunk in flight costs a buffer of the chunk size.
+//  Takes effect on the next recording that is opened.
+//
+////////////////////////////////////////////////////////////////////
+string vbs_readahead_fn(bool q, const vector<string>& args, runtime& rte ) {
+    ostringstream           reply;
+
+    reply << "!" << args[0] << (q?('?'):('=')) << " ";
+
+    // Query is always possible, command only if idle
+    INPROGRESS(rte, reply, !(q || rte.transfermode==no_transfer));
+
+    if( q ) {
+        reply << " 0 : " << rte.mk6info.readahead << " ;";
+        return reply.str();
+    }
+
+    // Must be command. Better have an argument then!
+    EZASSERT2(args.size()>1 && !args[1].empty(), Error_Code_6_Exception, EZINFO(" - requires the read-ahead depth"));
+
+    char*               eptr;
+    unsigned long int   depth;
+
+    errno = 0;
+    depth = ::strtoul(args[1].c_str(), &eptr, 0);
+    EZASSERT2(*eptr=='\0' && errno==0 && depth<=UINT_MAX, Error_Code_6_Exception,
+              EZINFO(" - invalid read-ahead depth '" << args[1] << "'"));
+
+    rte.mk6info.readahead = (unsigned int)depth;
+    reply << " 0 ;";
+    return reply.str();
+}
@@ -19,9 +19,11 @@
 #include <getsok.h>     // resolve_host()
 #include <mk6info.h>
 #include <mountpoint.h>
+#include <recording_catalog.h>
 #include <evlbidebug.h>
 #include <stringutil.h>
 #include <regular_expression.h>
+#include <threadutil.h>    // evlbi5a::strerror()
 
 #include <string>
 #include <limits>
@@ -32,6 +34,8 @@
 
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <cstdio>      // for rename()
 #include <cstring>     // for strlen()
 #include <ctype.h>     // for isprint()
 #include <arpa/inet.h> // for inet_ntoa()
@@ -268,6 +272,67 @@ std::ostream& operator<<(std::ostream& os, vdif_key const& vk) {
     return os;
 }
 
+const datastream_id vdif_demux_type::noStream;
+const unsigned int  vdif_demux_type::nThread;
+
+vdif_demux_type::entry_type::entry_type():
+    used( false ), station_id( 0 ), port( 0 ), addr( 0 ), offset( 0 )
+{}
+
+vdif_demux_type::vdif_demux_type():
+    mask( 0 ), nUsed( 0 )
+{
+    this->clear();
+}
+
+void vdif_demux_type::clear( void ) {
+    // Start with room for a handful of senders/stations
+    entries_type( 16 ).swap( entries );
+    threads_type().swap( threads );
+    mask  = entries.size() - 1;
+    nUsed = 0;
+}
+
+// Find the entry for the key or the empty slot where it should go
+vdif_demux_type::entry_type& vdif_demux_type::lookup(entries_type& e, size_t m, uint16_t station_id, uint16_t port, uint32_t addr) {
+    size_t  i;
+    for(i=hash(station_id, port, addr) & m; e[i].used; i=(i+1) & m)
+        if( e[i].station_id==station_id && e[i].port==port && e[i].addr==addr )
+            break;
+    return e[i];
+}
+
+void vdif_demux_type::insert(vdif_key const& key, datastream_id dsid) {
+    if( key.thread_id>=nThread )
+        return;
+
+    // Keep the load factor <= 0.5 such that probe sequences stay short
+    // (and there always is an empty slot)
+    if( 2*(nUsed+1) > entries.size() ) {
+        entries_type  bigger( 2*entries.size() );
+
+        for(entries_type::const_iterator p=entries.begin(); p!=entries.end(); p++)
+            if( p->used )
+                lookup(bigger, bigger.size()-1, p->station_id, p->port, p->addr) = *p;
+        entries.swap( bigger );
+        mask = entries.size() - 1;
+    }
+
+    entry_type&  e( lookup(entries, mask, key.station_id, key.origin.sin_port, key.origin.sin_addr.s_addr) );
+
+    if( !e.used ) {
+        e.used       = true;
+        e.station_id = key.station_id;
+        e.port       = key.origin.sin_port;
+        e.addr       = key.origin.sin_addr.s_addr;
+        e.offset     = threads.size();
+        threads.resize( threads.size() + nThread, noStream );
+        nUsed++;
+    }
+    threads[e.offset + key.thread_id] = dsid;
+}
+
+
 // datastream management is encapsulated in one class
 void datastream_mgmt_type::add(std::string const& nm, filterlist_type const& mc) {
     // check if not already defined
@@ -289,6 +354,7 @@ void datastream_mgmt_type::remove(std::string const& nm) {
 }
 
 void datastream_mgmt_type::reset( void ) {
+    demux.clear();
     vdif2tag.clear();
     tag2name.clear();
     name2tag.clear();
@@ -332,19 +398,22 @@ datastream_id datastream_mgmt_type::vdif2stream_id(uint16_t station_id, uint16_t
     return this->vdif2stream_id(station_id, thread_id, noSender);
 }
 
-datastream_id datastream_mgmt_type::vdif2stream_id(uint16_t station_id, uint16_t thread_id, struct sockaddr_in const& sender) {
+// The slow path of vdif2stream_id(): the key is not in the demux table yet
+datastream_id datastream_mgmt_type::new_vdif2stream_id(uint16_t station_id, uint16_t thread_id, struct sockaddr_in const& sender) {
     size_t                        n;
     vdif_key const                key(station_id, thread_id, sender);
     vdif2tagmap_type::iterator    ptr = vdif2tag.find( key );
     datastreamlist_type::iterator dsptr;
 
-    if( ptr!=vdif2tag.end() )
+    if( ptr!=vdif2tag.end() ) {
+        demux.insert(key, ptr->second);
         return ptr->second;
+    }
 
     // Crap, haven't seen this one before. Go find which datastream this'un
     // belongs to
     for( dsptr=defined_datastreams.begin(); dsptr!=defined_datastreams.end(); dsptr++ ) {
-        datastream_type const      ds( dsptr->second );
+        datastream_type const&     ds( dsptr->second );
         match_criteria_type const& match( ds.match_criteria );
         // Brute force loop - simplest nd (hopefully) fastest
         // note: we don't call member functions here - so 
@@ -382,6 +451,7 @@ datastream_id datastream_mgmt_type::vdif2stream_id(uint16_t station_id, uint16_t
     // all that's left is to add an entry in the  vdif->data_stream map
     if( vdif2tag.insert(std::make_pair(key, p->second)).second==false )
         THROW_EZEXCEPT(datastreamexception_type, "Failed to insert mapping for " << key << " to data stream #" << p->second);
+    demux.insert(key, p->second);
     return p->second;
 }
 
@@ -392,9 +462,14 @@ std::string const& datastream_mgmt_type::streamid2name( datastream_id dsid ) con
     return (curName == tag2name.end()) ? noName : curName->second;
 }
 
+mountpoint_stats_type::mountpoint_stats_type():
+    nChunk( 0 ), nByte( 0 ), tWrite( 0.0 ), lastLatency( 0.0 ), avgRate( 0.0 ),
+    nDemoted( 0 ), demoted( false )
+{}
+
 // Keep track of Mark6/FlexBuff properties
 mk6info_type::mk6info_type():
-    mk6( mk6info_type::defaultMk6Format ), fpStart( 0 ), fpEnd( 0 )
+    mk6( mk6info_type::defaultMk6Format ), readahead( 0 ), directio( false ), fpStart( 0 ), fpEnd( 0 )
 {
     const string                  mpString      = (mk6info_type::defaultMk6Disks ? "mk6" : "flexbuf");
     groupdef_type::const_iterator fbMountPoints = builtin_groupdefs.find(mpString);
@@ -409,6 +484,9 @@ mk6info_type::mk6info_type():
     string  lst;
     copy(mountpoints.begin(), mountpoints.end(), ostringiterator(lst, ", "));
     DEBUG(4, "mk6info - " << lst << endl);
+
+    // Get the recording catalog going in the background
+    catalog_index(mountpoints);
 }
 
 mk6info_type::~mk6info_type() {}
@@ -445,6 +523,128 @@ mk6_wb_header_v2::mk6_wb_header_v2(int32_t bn, int32_t ws):
 }
 
 
+/////////////////////////////////////////////////////////////////////
+//
+//                  Mark6 write block index files
+//
+/////////////////////////////////////////////////////////////////////
+
+// On-disk layout (native byte order, it's a cache, not an exchange format):
+//    mk6_index_header
+//    nEntry * mk6_index_entry
+struct mk6_index_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint64_t file_size;
+    int64_t  mtime_sec;
+    int64_t  mtime_nsec;
+    uint64_t nEntry;
+};
+static const char     mk6_index_magic[8] = {'J', '5', 'M', 'K', '6', 'I', 'D', 'X'};
+static const uint32_t mk6_index_version  = 1;
+
+static void fill_mtime(struct stat const& st, int64_t& sec, int64_t& nsec) {
+    sec  = (int64_t)st.st_mtime;
+#if defined(__linux__)
+    nsec = (int64_t)st.st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+    nsec = (int64_t)st.st_mtimespec.tv_nsec;
+#else
+    nsec = 0;
+#endif
+}
+
+string mk6_index_path(string const& mk6file) {
+    const string::size_type slash = mk6file.rfind('/');
+
+    if( slash==string::npos )
+        return "." + mk6file + ".j5idx";
+    return mk6file.substr(0, slash+1) + "." + mk6file.substr(slash+1) + ".j5idx";
+}
+
+bool write_mk6_index(string const& mk6file, struct stat const& st, mk6_index_type const& idx) {
+    int              fd;
+    bool             ok;
+    const string     path( mk6_index_path(mk6file) );
+    const string     tmp( path + ".tmp" );
+    mk6_index_header hdr;
+
+    ::memset(&hdr, 0, sizeof(hdr));
+    ::memcpy(hdr.magic, mk6_index_magic, sizeof(hdr.magic));
+    hdr.version    = mk6_index_version;
+    hdr.entry_size = (uint32_t)sizeof(mk6_index_entry);
+    hdr.file_size  = (uint64_t)st.st_size;
+    hdr.nEntry     = (uint64_t)idx.size();
+    fill_mtime(st, hdr.mtime_sec, hdr.mtime_nsec);
+
+    // Write to temporary file + rename such that a reader never sees a
+    // half-written index
+    if( (fd=::open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644))<0 ) {
+        DEBUG(2, "write_mk6_index: cannot create " << tmp << " - " << evlbi5a::strerror(errno) << endl);
+        return false;
+    }
+    ok = (::write(fd, &hdr, sizeof(hdr))==(ssize_t)sizeof(hdr));
+    if( ok && !idx.empty() ) {
+        const size_t n = idx.size() * sizeof(mk6_index_entry);
+        ok = (::write(fd, &idx[0], n)==(ssize_t)n);
+    }
+    ok = (::close(fd)==0) && ok;
+    if( ok )
+        ok = (::rename(tmp.c_str(), path.c_str())==0);
+    if( !ok ) {
+        DEBUG(2, "write_mk6_index: failed to write " << path << " - " << evlbi5a::strerror(errno) << endl);
+        ::unlink(tmp.c_str());
+    }
+    return ok;
+}
+
+bool read_mk6_index(string const& mk6file, struct stat const& st, mk6_index_type& idx) {
+    int              fd;
+    int64_t          sec, nsec;
+    const string     path( mk6_index_path(mk6file) );
+    mk6_index_header hdr;
+
+    idx.clear();
+    if( (fd=::open(path.c_str(), O_RDONLY))<0 )
+        return false;
+
+    fill_mtime(st, sec, nsec);
+    if( ::read(fd, &hdr, sizeof(hdr))!=(ssize_t)sizeof(hdr) ||
+        ::memcmp(hdr.magic, mk6_index_magic, sizeof(hdr.magic))!=0 ||
+        hdr.version!=mk6_index_version || hdr.entry_size!=sizeof(mk6_index_entry) ||
+        hdr.file_size!=(uint64_t)st.st_size || hdr.mtime_sec!=sec || hdr.mtime_nsec!=nsec ||
+        hdr.nEntry>(uint64_t)st.st_size/sizeof(mk6_wb_header_v2) ) {
+        DEBUG(4, "read_mk6_index: " << path << " is stale or not an index" << endl);
+        ::close(fd);
+        return false;
+    }
+
+    const size_t n = (size_t)hdr.nEntry * sizeof(mk6_index_entry);
+
+    idx.resize( (size_t)hdr.nEntry );
+    if( n && ::read(fd, &idx[0], n)!=(ssize_t)n ) {
+        ::close(fd);
+        idx.clear();
+        return false;
+    }
+    ::close(fd);
+
+    // Paranoia: each write block must be within the file, after the file
+    // header
+    for(mk6_index_type::const_iterator p=idx.begin(); p!=idx.end(); p++) {
+        if( p->blocknum<0 || p->wb_size<(int32_t)sizeof(mk6_wb_header_v2) ||
+            p->offset<(int64_t)sizeof(mk6_file_header) ||
+            p->offset+p->wb_size>(int64_t)st.st_size ) {
+            DEBUG(2, "read_mk6_index: " << path << " has invalid entry for block #" << p->blocknum << endl);
+            idx.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+
 /////////////////////////////////////////////////////////////////////
 //
 //                    User functions / the API
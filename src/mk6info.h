@@ -11,6 +11,7 @@
 
 #include <inttypes.h>
 #include <sys/types.h>  // for off_t
+#include <sys/stat.h>   // struct stat
 #include <netinet/in.h> // struct sockaddr_in
 
 
@@ -215,6 +216,65 @@ typedef std::map<vdif_key, datastream_id>    vdif2tagmap_type;
 typedef std::map<datastream_id, std::string> tag2namemap_type;
 typedef std::map<std::string, datastream_id> name2tagmap_type;
 
+// The vdif2tagmap_type is the authoritative VDIF key -> data stream
+// mapping but looking up every received VDIF frame in a std::map is too
+// slow for multi-thread VDIF. This is a flat copy of it: a small open
+// addressing hash on (sender, station) where each entry has a direct
+// indexed table for all 1024 possible VDIF thread ids.
+// Looking up a known VDIF key is a hash + (typically) one compare + one
+// index operation.
+class vdif_demux_type {
+    public:
+        static const datastream_id noStream = (datastream_id)-1;
+        static const unsigned int  nThread  = 1024;
+
+        vdif_demux_type();
+
+        inline datastream_id find(uint16_t station_id, uint16_t thread_id, struct sockaddr_in const& sender) const {
+            if( thread_id>=nThread )
+                return noStream;
+            for(size_t i=hash(station_id, sender.sin_port, sender.sin_addr.s_addr) & mask; ; i=(i+1) & mask) {
+                entry_type const&  e( entries[i] );
+
+                if( !e.used )
+                    return noStream;
+                if( e.station_id==station_id && e.port==sender.sin_port && e.addr==sender.sin_addr.s_addr )
+                    return threads[e.offset + thread_id];
+            }
+        }
+
+        // Silently ignores thread ids that do not fit in the table
+        void insert(vdif_key const& key, datastream_id dsid);
+        void clear( void );
+
+    private:
+        struct entry_type {
+            bool      used;
+            uint16_t  station_id;
+            uint16_t  port;
+            uint32_t  addr;
+            size_t    offset;  // of this entry's thread table in 'threads'
+
+            entry_type();
+        };
+        typedef std::vector<entry_type>    entries_type;
+        typedef std::vector<datastream_id> threads_type;
+
+        size_t        mask;    // entries.size() - 1, size is a power of 2
+        size_t        nUsed;
+        entries_type  entries;
+        threads_type  threads;
+
+        static inline size_t hash(uint16_t station_id, uint16_t port, uint32_t addr) {
+            uint32_t h = addr * 2654435761u;
+
+            h ^= ((uint32_t)station_id << 16) | (uint32_t)port;
+            h *= 2654435761u;
+            return (size_t)(h ^ (h >> 16));
+        }
+        entry_type& lookup(entries_type& e, size_t m, uint16_t station_id, uint16_t port, uint32_t addr);
+};
+
 class datastream_mgmt_type {
 
     public:
@@ -243,9 +303,14 @@ class datastream_mgmt_type {
         }
 
         // given a vdif frame this returns the datastream_id it is
-        // associated with
+        // associated with. VDIF keys seen before are looked up in the
+        // flat demux table, only new ones take the slow path
         datastream_id vdif2stream_id(uint16_t station_id, uint16_t thread_id);
-        datastream_id vdif2stream_id(uint16_t station_id, uint16_t thread_id, struct sockaddr_in const& sender);
+        inline datastream_id vdif2stream_id(uint16_t station_id, uint16_t thread_id, struct sockaddr_in const& sender) {
+            datastream_id const dsid = demux.find(station_id, thread_id, sender);
+
+            return (dsid!=vdif_demux_type::noStream) ? dsid : this->new_vdif2stream_id(station_id, thread_id, sender);
+        }
 
         // given a tag (datastream_id) return its name.
         // empty string implies no datastream associated with the tag
@@ -257,6 +322,9 @@ class datastream_mgmt_type {
         vdif2tagmap_type     vdif2tag;
         tag2namemap_type     tag2name;
         name2tagmap_type     name2tag;
+        vdif_demux_type      demux;
+
+        datastream_id new_vdif2stream_id(uint16_t station_id, uint16_t thread_id, struct sockaddr_in const& sender);
 };
 
 
@@ -265,6 +333,21 @@ class datastream_mgmt_type {
 //              that we can change those defaults from the commandline
 typedef std::map<bool, unsigned int> size_map_type;
 
+// parallelwriter keeps track of how well each mountpoint performs such
+// that it can avoid disks that fall behind (see "disk_stats?")
+struct mountpoint_stats_type {
+    uint64_t    nChunk;         // chunks written
+    uint64_t    nByte;          // bytes written
+    double      tWrite;         // total time spent writing [s]
+    double      lastLatency;    // time it took to write the last chunk [s]
+    double      avgRate;        // moving average of the write rate [bytes/s]
+    uint64_t    nDemoted;       // how often it was demoted
+    bool        demoted;        // only used if nothing else is free, or to probe it
+
+    mountpoint_stats_type();
+};
+typedef std::map<std::string, mountpoint_stats_type> mountpointstats_type;
+
 struct mk6info_type {
     // We should discriminate between default disk location and
     // default recording format. This allows the user to fine tune
@@ -306,6 +389,17 @@ struct mk6info_type {
     // Keep a mapping of group-id to list-of-patterns
     groupdef_type           groupdefs;
 
+    // How many chunks to read ahead when playing back a recording
+    // ("vbs_readahead="). 0 = read chunks one at a time
+    unsigned int            readahead;
+
+    // Write recordings bypassing the page cache ("record=direct:1")
+    bool                    directio;
+
+    // Per-mountpoint write performance, kept up to date by the
+    // recording threads (under the runtime lock)
+    mountpointstats_type    diskstats;
+
     // Last recording or value(s) from "scan_set=..."
     std::string             scanName;
     off_t                   fpStart, fpEnd;
@@ -432,5 +526,34 @@ struct mk6_wb_header_v2 {           // write block header - version 2
 };
 
 
+// Opening a Mark6 scan means finding all write block headers in all the
+// files that make up the scan. Without help that is one read + seek per
+// block, per file; for a long scan that's ten- to hundreds of thousands
+// of small, random, reads per disk.
+// So whilst recording we keep track of where we wrote each block and when
+// the file is closed, this index is written next to the file as
+//      <dir>/.<scanname>.j5idx
+// (hidden, such that it doesn't show up as a scan or confuse d-plane).
+//
+// The index records size + modification time of the Mark6 file it was
+// made for; if those don't match anymore the index is stale and the
+// reader must fall back to scanning the file.
+struct mk6_index_entry {
+    int32_t blocknum;               // as in mk6_wb_header_v2
+    int32_t wb_size;                // id., i.e. including the header
+    int64_t offset;                 // file offset of the write block header
+};
+typedef std::vector<mk6_index_entry> mk6_index_type;
+
+// Name of the index file that goes with this Mark6 file
+std::string mk6_index_path(std::string const& mk6file);
+
+// 'st' is the stat(2) of the Mark6 file. Both return false if it didn't
+// work - the index is only an optimization so failure is not an exception.
+// read_mk6_index() also verifies that the entries actually fit in the file.
+bool write_mk6_index(std::string const& mk6file, struct stat const& st, mk6_index_type const& idx);
+bool read_mk6_index(std::string const& mk6file, struct stat const& st, mk6_index_type& idx);
+
+
 
 #endif
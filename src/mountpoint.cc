@@ -1,5 +1,6 @@
 // Implementations
 #include <mountpoint.h>
+#include <recording_catalog.h>
 #include <stringutil.h>
 #include <mutex_locker.h>
 #include <regular_expression.h>
@@ -435,94 +436,6 @@ int match_dirname(const char* path, const struct stat* , int flag, struct FTW* f
     return 0;
 }
 
-// Functor for directory-helper-template which checks if
-// a given file name matches "/path/to/SCAN/SCAN.[0-9]{8}"
-struct isScanChunk {
-    isScanChunk(const string& scan):
-        __m_regex(string("^.*/")+scan+"/"+scan+"\\.[0-9]{8}$")
-    {}
-
-    bool operator()(const string& path) const {
-        //DEBUG(4, "isScanChunk(" << path << ") - re:" << __m_regex.matches(path) << " file:" << isRegularFile(path) << endl);
-        return __m_regex.matches(path) && isRegularFile(path);
-    }
-
-    bool isRegularFile(const string& path) const {
-        struct stat  st;
-        if( ::stat(path.c_str(), &st)!=0 ) {
-            DEBUG(-1, "isScanChunkPredicate: stat(" << path << ") - " << evlbi5a::strerror(errno) << endl);
-            return false;
-        }
-        return (st.st_mode & S_IFREG)==S_IFREG;
-    }
-    const Regular_Expression  __m_regex;
-};
-
-// For multithreaded chunk finders - we must pass a couple of arguments to
-// each thread:
-//     * the directory it's supposed to scan
-//     * an ouputiterator; we will use this one to append our findings to
-//       whatever others have found
-//     * pointer to mutex for locking said accumulator
-template <typename OutputIter>
-struct scanChunkFinderArgs {
-
-    scanChunkFinderArgs(const string& mountpoint, const string& scan, OutputIter acc, pthread_mutex_t* mtx):
-        __m_accumulator(acc), __m_path(mountpoint+"/"+scan), __m_mutex(mtx), __m_predicate(scan)
-    {}
-
-    OutputIter         __m_accumulator;
-    const string       __m_path;
-    pthread_mutex_t*   __m_mutex;
-    const isScanChunk  __m_predicate;
-};
-
-// The thread function will delete the storage for the
-// scanChunkFinderArgs
-template <typename OutputIter>
-void* scanChunkFinder(void* args) {
-    scanChunkFinderArgs<OutputIter>* scfa = (scanChunkFinderArgs<OutputIter>*)args;
-
-    // we execute inside a thread - don't let exceptions escape
-    try {
-        // Check if the directory we want to inspect actually exists!
-        int         statres;
-        struct stat di;
-       
-        // If stat fails, we care about _why_ it failed; some things
-        // are a reportable error, some things aren't. ::stat(2) may
-        // only legitimately fail if the path does not exist.
-        statres = ::stat(scfa->__m_path.c_str(), &di);
-        ASSERT2_COND(statres==0 || (statres==-1 && errno==ENOENT),
-                     SCINFO(" failed to stat " << scfa->__m_path));
-
-        // Ok, we passed the "stat()", now, before checking the entries,
-        // make sure it is a directory that we have access to.
-        // If the path isn't, then ignore it silently
-        if( S_ISDIR(di.st_mode) ) {
-            // Filter the directory entries
-            direntries_type  de = dir_filter(scfa->__m_path, scfa->__m_predicate);
-
-            ::pthread_mutex_lock(scfa->__m_mutex);
-            std::copy(de.begin(), de.end(), scfa->__m_accumulator);
-            ::pthread_mutex_unlock(scfa->__m_mutex);
-        }
-    }
-    catch( const exception& ex ) {
-        DEBUG(-1, "scanChunkFinder[" << scfa->__m_path << "]: " << ex.what() << endl);
-    }
-    catch( int e ) {
-        DEBUG(-1, "scanChunkFinder[" << scfa->__m_path << "]: caught errno=" << e << " - " << evlbi5a::strerror(e) << endl);
-    }
-    catch( ... ) {
-        DEBUG(-1, "scanChunkFinder[" << scfa->__m_path << "]: caught unknown exception" << endl);
-    }
-    // Ok, delete the storage
-    delete scfa;
-    return (void*)0;
-}
-
-
 ///////////////////////////////////////////////////////////////////
 //
 //           These are the actual user functions
@@ -634,41 +547,13 @@ bool is_null_diskset(const mountpointlist_type& mpl) {
 //  with xxxxxxxx an eight-digit sequence number
 ///////////////////////////////////////////////////////////////////
 
-typedef std::list<pthread_t*>               threadlist_type;
-typedef back_insert_iterator<filelist_type> appender_type;
-
+// The recording catalog knows where they are
 filelist_type find_recordingchunks(const string& scan, const mountpointlist_type& mountpoints) {
-    int                 create_error;
-    filelist_type       rv;
-    appender_type       appender(rv);
-    threadlist_type     threads;
-    pthread_mutex_t     mtx = PTHREAD_MUTEX_INITIALIZER;
-
-    // For each mountpoint, start a thread
-    // We remember the pthread_create() return value of the last created
-    // thread; if we did not succeed in creating all threads, it will be
-    // non-zero
-    create_error = 0;
-    for(mountpointlist_type::const_iterator mp=mountpoints.begin(); mp!=mountpoints.end(); mp++) {
-        pthread_t*                          tidptr = new pthread_t;
-        scanChunkFinderArgs<appender_type>* scfa = new scanChunkFinderArgs<appender_type>(*mp, scan, appender, &mtx);
-
-        if( (create_error=mp_pthread_create(tidptr, &scanChunkFinder<appender_type>, scfa))!=0 ) {
-            DEBUG(-1, "find_recordingchunks: failed to create thread [" << *mp << "] - " << evlbi5a::strerror(create_error) << endl);
-            delete tidptr;
-            delete scfa;
-            break;
-        }
-        threads.push_back( tidptr );
-    }
-    // Wait for completion of threads that have succesfully started
-    for(threadlist_type::iterator tidptrptr=threads.begin(); tidptrptr!=threads.end(); tidptrptr++) {
-        ::pthread_join( **tidptrptr, 0 );
-        delete *tidptrptr;
-    }
+    filelist_type                 rv;
+    const catalog_chunklist_type  chunks = catalog_find_chunks(scan, mountpoints);
 
-    // If we did not create a thread for all mountpoints - give up
-    EZASSERT2(create_error==0, mountpoint_exception, EZINFO("Failed to create a thread - " << evlbi5a::strerror(errno)));
+    for(catalog_chunklist_type::const_iterator p=chunks.begin(); p!=chunks.end(); p++)
+        rv.push_back( p->path );
     return rv;
 }
 
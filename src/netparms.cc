@@ -34,6 +34,7 @@ netparms_type::netparms_type():
     , theoretical_ipd_ns( netparms_type::defIPD )
     , ackPeriod( netparms_type::defACK )
     , nblock( netparms_type::defNBlock )
+    , zerocopy( false )
     , protocol( defProtocol ), mtu( netparms_type::defMTU )
     , blocksize( netparms_type::defBlockSize )
     , port( netparms_type::defPort )
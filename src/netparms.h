@@ -69,6 +69,9 @@ struct netparms_type {
     int                theoretical_ipd_ns;
     int                ackPeriod;
     unsigned int       nblock;
+    // send over tcp with MSG_ZEROCOPY (if the system supports it);
+    // see zerocopy_writer_type
+    bool               zerocopy;
 
     // 
     // various parts in "the system" know about the following set of
@@ -100,6 +103,18 @@ struct netparms_type {
     //              The statistics of the sequence numbers will, however, still
     //              be kept up-to-date; i.e. the "evlbi?" query will still be
     //              informative.
+    //   udpsmm   - receive-side variant of udpsnor: same packet format and
+    //              no-reordering semantics, but datagrams are pulled in
+    //              batches using recvmmsg(2), straight into their
+    //              destination blocks. Only available on systems that
+    //              have recvmmsg(2), otherwise falls back to udpsnor.
+    //              Batch fill statistics are available through the
+    //              "evlbi?" query (%b, %B).
+    //   udpsring - receive-side variant of udpsnor: datagrams are captured
+    //              through a memory mapped kernel packet ring (Linux
+    //              AF_PACKET/TPACKET_V3, needs CAP_NET_RAW) instead of
+    //              being read from the socket one at a time. Datagrams of
+    //              unexpected size are counted as discarded.
     //
     //  Some protocol names get translated to a different protocol internally.
     //  The table below lists the affected protocols. Strings not listed in the
@@ -0,0 +1,259 @@
+// implementation
+// Copyright (C) 2007-2013 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.nl
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <pacer.h>
+#include <dosyscall.h>
+#include <evlbidebug.h>
+#include <threadutil.h>  // for evlbi5a::strerror()
+
+#include <algorithm>
+#include <errno.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+
+// sendmmsg(2) was added at about the same time as recvmmsg(2), for which
+// the MSG_WAITFORONE flag was introduced
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+    #define PACER_SENDMMSG 1
+#endif
+// Kernel side pacing: each datagram carries the time it's due
+#if defined(__linux__) && defined(SO_TXTIME) && defined(SCM_TXTIME)
+    #include <linux/net_tstamp.h>
+    #define PACER_TXTIME 1
+#endif
+
+using namespace std;
+
+
+uint64_t monotonic_ns( void ) {
+    struct timespec  ts;
+
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+
+//
+//   The pacer
+//
+pacer_type::pacer_type():
+    ipd_ns( 0 ), bucket( max_burst ), first( 0 ), next( 0 )
+{}
+
+void pacer_type::set_ipd(int n) {
+    ipd_ns = (n>0 ? n : 0);
+    // No pacing => no need to limit the burst size other than by the
+    // maximum
+    if( ipd_ns )
+        bucket = (unsigned int)std::max((int64_t)1, std::min((int64_t)max_burst, (int64_t)burst_window_ns/ipd_ns));
+    else
+        bucket = max_burst;
+}
+
+int pacer_type::ipd( void ) const {
+    return (int)ipd_ns;
+}
+
+unsigned int pacer_type::depth( void ) const {
+    return bucket;
+}
+
+unsigned int pacer_type::wait(unsigned int n) {
+    uint64_t      now;
+    unsigned int  k;
+
+    n = std::min(n, bucket);
+    if( ipd_ns==0 ) {
+        first = next = 0;
+        return n;
+    }
+
+    // Spin until the next datagram is due. At sub-microsecond ipd's there
+    // is nothing to be gained from sleeping
+    while( (now=monotonic_ns())<next ) { };
+
+    // Don't let more credit build up than fits in the bucket; if we've
+    // been idle for a while (or this is the first datagram ever) the
+    // first datagram is due 'now' with at most depth()-1 following it
+    // immediately
+    const uint64_t  window = (uint64_t)(bucket - 1) * (uint64_t)ipd_ns;
+
+    if( now - next > window )
+        next = now - window;
+
+    k     = std::min(n, (unsigned int)((now - next)/(uint64_t)ipd_ns) + 1);
+    first = next;
+    next += (uint64_t)k * (uint64_t)ipd_ns;
+    return k;
+}
+
+uint64_t pacer_type::due(unsigned int i) const {
+    return first + (uint64_t)i * (uint64_t)ipd_ns;
+}
+
+
+//
+//   The batching sender
+//
+struct udp_sender_type::impl_type {
+    unsigned char  hdr[pacer_type::max_burst][udp_sender_type::max_header];
+    struct iovec   iov[pacer_type::max_burst][2];
+#ifdef PACER_SENDMMSG
+    struct mmsghdr msg[pacer_type::max_burst];
+
+    struct msghdr& hdr_at(unsigned int i) {
+        return msg[i].msg_hdr;
+    }
+#else
+    struct msghdr  msg[pacer_type::max_burst];
+
+    struct msghdr& hdr_at(unsigned int i) {
+        return msg[i];
+    }
+#endif
+#ifdef PACER_TXTIME
+    // make sure the control message buffer is properly aligned
+    union {
+        size_t          align;   // what cmsghdr needs
+        unsigned char   buf[CMSG_SPACE(sizeof(uint64_t))];
+    }              ctl[pacer_type::max_burst];
+#endif
+};
+
+udp_sender_type::udp_sender_type(int f, const string& w):
+    fd( f ), who( w ), txtime( false ), nqueued( 0 ), impl( new impl_type() )
+{
+    for(unsigned int i=0; i<pacer_type::max_burst; i++)
+        impl->hdr_at(i).msg_iov = &impl->iov[i][0];
+
+#ifdef PACER_TXTIME
+    struct sock_txtime  st;
+
+    st.clockid = CLOCK_MONOTONIC;
+    st.flags   = 0;
+    if( ::setsockopt(fd, SOL_SOCKET, SO_TXTIME, &st, sizeof(st))==0 ) {
+        txtime = true;
+        DEBUG(2, who << ": datagrams carry their transmit time (SO_TXTIME)" << endl);
+    } else {
+        DEBUG(3, who << ": no SO_TXTIME - " << evlbi5a::strerror(errno) << endl);
+    }
+#endif
+#ifndef PACER_SENDMMSG
+    DEBUG(2, who << ": sendmmsg(2) not available on this system, sending one datagram per call" << endl);
+#endif
+}
+
+bool udp_sender_type::set_ipd(int n) {
+    bool  ok = true;
+
+    if( n==pacer.ipd() )
+        return ok;
+    // Send what was queued under the old regime
+    if( nqueued )
+        ok = this->flush();
+    pacer.set_ipd(n);
+    return ok;
+}
+
+int udp_sender_type::ipd( void ) const {
+    return pacer.ipd();
+}
+
+bool udp_sender_type::send(const void* hdr, size_t hdrlen, void* data, size_t len) {
+    const unsigned int  i = nqueued;
+    struct msghdr&      m( impl->hdr_at(i) );
+
+    ASSERT2_COND( hdrlen<=max_header, SCINFO(who << ": datagram header of " << hdrlen << " bytes too large") );
+
+    ::memcpy(&impl->hdr[i][0], hdr, hdrlen);
+    impl->iov[i][0].iov_base = &impl->hdr[i][0];
+    impl->iov[i][0].iov_len  = hdrlen;
+    impl->iov[i][1].iov_base = data;
+    impl->iov[i][1].iov_len  = len;
+    m.msg_iov    = (hdrlen ? &impl->iov[i][0] : &impl->iov[i][1]);
+    m.msg_iovlen = (hdrlen ? 2 : 1);
+
+    if( ++nqueued<pacer.depth() )
+        return true;
+    return this->flush();
+}
+
+bool udp_sender_type::flush( void ) {
+    unsigned int  done = 0;
+
+    while( done<nqueued ) {
+        const unsigned int  n = pacer.wait(nqueued - done);
+
+        if( !this->send_queued(done, n) ) {
+            nqueued = 0;
+            return false;
+        }
+        done += n;
+    }
+    nqueued = 0;
+    return true;
+}
+
+// Send datagrams [offset, offset+n), pacer.wait() says they're due
+bool udp_sender_type::send_queued(unsigned int offset, unsigned int n) {
+#ifdef PACER_TXTIME
+    const bool  tx = (txtime && pacer.ipd()>0);
+
+    for(unsigned int i=0; i<n; i++) {
+        struct msghdr&  m( impl->hdr_at(offset+i) );
+
+        if( !tx ) {
+            m.msg_control    = 0;
+            m.msg_controllen = 0;
+            continue;
+        }
+        const uint64_t   t = pacer.due(i);
+        struct cmsghdr*  cm;
+
+        m.msg_control    = &impl->ctl[offset+i].buf[0];
+        m.msg_controllen = sizeof(impl->ctl[offset+i].buf);
+        cm               = CMSG_FIRSTHDR(&m);
+        cm->cmsg_level   = SOL_SOCKET;
+        cm->cmsg_type    = SCM_TXTIME;
+        cm->cmsg_len     = CMSG_LEN(sizeof(t));
+        ::memcpy(CMSG_DATA(cm), &t, sizeof(t));
+    }
+#endif
+
+#ifdef PACER_SENDMMSG
+    while( n ) {
+        int  r;
+
+        if( (r=::sendmmsg(fd, &impl->msg[offset], n, MSG_EOR))<=0 )
+            return false;
+        offset += (unsigned int)r;
+        n      -= (unsigned int)r;
+    }
+#else
+    for( ; n; offset++, n--)
+        if( ::sendmsg(fd, &impl->hdr_at(offset), MSG_EOR)<0 )
+            return false;
+#endif
+    return true;
+}
+
+udp_sender_type::~udp_sender_type() {
+    delete impl;
+}
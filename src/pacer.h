@@ -0,0 +1,123 @@
+// pace and batch the sending of datagrams
+// Copyright (C) 2007-2013 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.nl
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef JIVE5A_PACER_H
+#define JIVE5A_PACER_H
+
+#include <string>
+#include <stdint.h>
+#include <string.h>   // for size_t
+
+// Nanoseconds on the monotonic clock. Unlike gettimeofday(2) this one does
+// not jump when the system time is adjusted.
+uint64_t monotonic_ns( void );
+
+
+// Token bucket pacing of datagrams at a nanosecond resolution inter-packet
+// delay (ipd).
+//
+// Datagram #n is due at t0 + n * ipd. If the sender falls behind, it may
+// catch up by sending the datagrams that are overdue in one burst, but
+// never more than "depth" of them: the bucket only fills up to that
+// many. The depth is chosen such that a burst spans at most
+// burst_window_ns, so at high packet rates the system call overhead can be
+// spread over a number of datagrams while the receiver still sees a
+// smooth stream.
+class pacer_type {
+    public:
+        // Never release more than this many datagrams in one go
+        static const unsigned int max_burst       = 32;
+        static const unsigned int burst_window_ns = 20000;
+
+        pacer_type();
+
+        // ipd<=0 switches pacing off
+        void         set_ipd(int n);
+        int          ipd( void ) const;
+
+        // Max number of datagrams wait() will release at once
+        unsigned int depth( void ) const;
+
+        // Block until it is time to send the next datagram, then return
+        // how many of the 'n' waiting may be sent now: at least one and
+        // at most depth()
+        unsigned int wait(unsigned int n);
+
+        // After wait(): the monotonic_ns() time at which datagram #i
+        // (0 <= i < return value of wait()) is due
+        uint64_t     due(unsigned int i) const;
+
+    private:
+        int64_t      ipd_ns;
+        unsigned int bucket;
+        uint64_t     first;
+        uint64_t     next;
+};
+
+
+// Sends datagrams over a connected socket, paced by a pacer_type.
+//
+// Datagrams are queued and sent in batches using sendmmsg(2), if the
+// system has it. Each datagram can have a small header (at most
+// max_header bytes, e.g. a sequence number), which is copied, followed by
+// the data, which is NOT copied: it must stay valid until the next
+// flush().
+// If the kernel supports SO_TXTIME, each datagram is handed to the kernel
+// with the time it is due, so if a pacing capable queueing discipline
+// ("fq") is installed on the interface, the datagrams within a burst are
+// spaced by the kernel as well.
+class udp_sender_type {
+    public:
+        static const unsigned int max_header = 16;
+
+        // 'who' is used for logging
+        udp_sender_type(int fd, const std::string& who);
+
+        // Datagrams already queued are sent using the previous ipd;
+        // returns false if that failed
+        bool         set_ipd(int n);
+        int          ipd( void ) const;
+
+        // Queue a datagram; once enough datagrams are queued they are
+        // sent. Returns false if sending failed, errno is set
+        bool         send(const void* hdr, size_t hdrlen, void* data, size_t len);
+
+        // Send what's queued
+        bool         flush( void );
+
+        ~udp_sender_type();
+
+    private:
+        struct impl_type;
+
+        int          fd;
+        std::string  who;
+        pacer_type   pacer;
+        bool         txtime;
+        unsigned int nqueued;
+        impl_type*   impl;
+
+        bool         send_queued(unsigned int offset, unsigned int n);
+
+        // no copying/assignment
+        udp_sender_type(const udp_sender_type&);
+        const udp_sender_type& operator=(const udp_sender_type&);
+};
+
+#endif
@@ -68,11 +68,23 @@ struct per_runtime {
                 throw std::runtime_error( std::string("Failed to initialize mutex: ")+repr(errno)+" "+evlbi5a::strerror(errno) );
         }
 
+        // The map is shared between all runtimes, which may execute
+        // commands in different threads (see cmdworkers.h), so every
+        // accessor that looks at the tree takes our lock. A returned
+        // iterator stays usable afterwards: std::map does not invalidate
+        // iterators on insert/erase of other entries, and the entry for a
+        // runtime is only touched by the (one) command executing in that
+        // runtime. Walking the whole map from begin() to end() is NOT safe
+        // while other runtimes execute commands.
+
         // begin()/end()
+        //  (end() is the map's fixed sentinel, no need to lock for that)
         iterator       begin( void ) {
+            mutex_locker   sml( __my_mutex );
             return __my_map.begin();
         }
         const_iterator begin( void ) const {
+            mutex_locker   sml( __my_mutex );
             return __my_map.begin();
         }
         iterator       end( void ) {
@@ -84,9 +96,11 @@ struct per_runtime {
 
         // find()
         iterator       find(runtime const* rteptr) {
+            mutex_locker   sml( __my_mutex );
             return __my_map.find(rteptr);
         }
         const_iterator find(runtime const* rteptr) const {
+            mutex_locker   sml( __my_mutex );
             return __my_map.find(rteptr);
         }
 
@@ -94,9 +108,11 @@ struct per_runtime {
         // adds a new entry to the map. We must lock the runtime
         // because we don't want other 'per_runtime<>' thingies
         // clobbering with the '.key_deleters' member at the 
-        // same time that we're doing it
+        // same time that we're doing it.
+        // Then our own lock for the map (always runtime first, then ours).
         T& operator[]( runtime const* rteptr ) {
             scopedrtelock  srtl( *const_cast<runtime*>(rteptr) );
+            mutex_locker   sml( __my_mutex );
 
             if( rteptr->key_deleters.find((void*)this) == rteptr->key_deleters.end() )
                 rteptr->key_deleters[ (void*)this ] = &per_runtime<T>::key_deleter;
@@ -109,6 +125,7 @@ struct per_runtime {
             // value_type == pair<Key, Value>
             runtime const*  rteptr = val.first;
             scopedrtelock   srtl( *const_cast<runtime*>(rteptr) );
+            mutex_locker    sml( __my_mutex );
 
             if( rteptr->key_deleters.find((void*)this) == rteptr->key_deleters.end() )
                 rteptr->key_deleters[ (void*)this ] = &per_runtime<T>::key_deleter;
@@ -122,6 +139,7 @@ struct per_runtime {
             // because the entry's already being erased
             runtime const*  rteptr = p->first;
             scopedrtelock   srtl( *const_cast<runtime*>(rteptr) );
+            mutex_locker    sml( __my_mutex );
 
             rteptr->key_deleters.erase( (void*)this );
             __my_map.erase( p );
@@ -131,6 +149,7 @@ struct per_runtime {
         size_type erase( runtime const* rteptr ) {
             // See above ".erase( iterator )"
             scopedrtelock   srtl( *const_cast<runtime*>(rteptr) );
+            mutex_locker    sml( __my_mutex );
 
             rteptr->key_deleters.erase( (void*)this );
             return __my_map.erase( rteptr );
@@ -148,8 +167,8 @@ struct per_runtime {
         }
 
     private:
-        __my_map_type   __my_map;
-        pthread_mutex_t __my_mutex;
+        __my_map_type           __my_map;
+        mutable pthread_mutex_t __my_mutex;
 
         // This is a static member function taking two void*.
         // Because it is a member function of this templated object and we
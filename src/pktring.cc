@@ -0,0 +1,289 @@
+// Memory mapped kernel packet ring (AF_PACKET, TPACKET_V3) for capturing UDP
+// Copyright (C) 2007-2013 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.nl
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <pktring.h>
+#include <dosyscall.h>
+#include <evlbidebug.h>
+
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#if HAVE_PKTRING
+#include <sys/mman.h>
+#include <net/if.h>
+#include <ifaddrs.h>
+#include <net/ethernet.h>
+#include <linux/filter.h>
+#endif
+
+using namespace std;
+
+DEFINE_EZEXCEPT(pktring_error)
+
+pktring_udp_type::pktring_udp_type():
+    payload( 0 ), len( 0 )
+{ ::memset(&sender, 0x0, sizeof(sender)); }
+
+
+#if HAVE_PKTRING
+
+// Find the interface index of the interface that has IPv4 address <local>.
+// Returns 0 (= all interfaces) for INADDR_ANY or multicast addresses.
+static int local2ifindex(struct in_addr local) {
+    int             ifindex = 0;
+    struct ifaddrs* ifap;
+
+    if( local.s_addr==INADDR_ANY || IN_MULTICAST(ntohl(local.s_addr)) )
+        return 0;
+
+    ASSERT_ZERO( ::getifaddrs(&ifap) );
+    for(struct ifaddrs* ifa=ifap; ifa!=0 && ifindex==0; ifa=ifa->ifa_next) {
+        struct sockaddr_in const* sin = (struct sockaddr_in const*)ifa->ifa_addr;
+        if( sin==0 || sin->sin_family!=AF_INET || sin->sin_addr.s_addr!=local.s_addr )
+            continue;
+        ifindex = (int)::if_nametoindex(ifa->ifa_name);
+    }
+    ::freeifaddrs(ifap);
+
+    EZASSERT2(ifindex>0, pktring_error, EZINFO("no interface has local address " << inet_ntoa(local)));
+    return ifindex;
+}
+
+pktring_type::pktring_type(unsigned short p, struct in_addr local, unsigned int bs, unsigned int nb):
+    fd( -1 ), port( p ), ring( 0 ), ringsize( (size_t)bs * nb ),
+    blocksize( bs ), nblock( nb ),
+    inblock( false ), curblock( 0 ), npkt_left( 0 ), curpkt( 0 ), nBlock( 0 ),
+    nDrop( 0 ), nPacket( 0 )
+{
+    const int            version = TPACKET_V3;
+    struct tpacket_req3  req;
+    struct sockaddr_ll   sll;
+    // Let the kernel only put IPv4/UDP datagrams for our destination port
+    // in the ring; fragments are rejected. On an SOCK_DGRAM packet socket
+    // offset 0 is the start of the IP header
+    struct sock_filter   code[] = {
+        { BPF_LD  | BPF_B   | BPF_ABS, 0, 0, 9 },           // A = ip protocol
+        { BPF_JMP | BPF_JEQ | BPF_K,   0, 6, IPPROTO_UDP },
+        { BPF_LD  | BPF_H   | BPF_ABS, 0, 0, 6 },           // A = flags + fragment offset
+        { BPF_JMP | BPF_JSET| BPF_K,   4, 0, 0x1fff },
+        { BPF_LDX | BPF_B   | BPF_MSH, 0, 0, 0 },           // X = ip header length
+        { BPF_LD  | BPF_H   | BPF_IND, 0, 0, 2 },           // A = udp destination port
+        { BPF_JMP | BPF_JEQ | BPF_K,   0, 1, port },
+        { BPF_RET | BPF_K,             0, 0, 0x40000 },
+        { BPF_RET | BPF_K,             0, 0, 0 }
+    };
+    struct sock_fprog    bpf;
+
+    EZASSERT2(blocksize>0 && nblock>0 && (blocksize % ::getpagesize())==0, pktring_error,
+              EZINFO("ring blocksize " << blocksize << " must be >0 and a multiple of the page size, nblock " << nblock << " >0"));
+
+    bpf.len    = sizeof(code)/sizeof(code[0]);
+    bpf.filter = &code[0];
+
+    ::memset(&req, 0x0, sizeof(req));
+    req.tp_block_size      = blocksize;
+    req.tp_block_nr        = nblock;
+    req.tp_frame_size      = TPACKET_ALIGNMENT << 7;
+    req.tp_frame_nr        = (unsigned int)(ringsize / req.tp_frame_size);
+    req.tp_retire_blk_tov  = defRetireMs;
+
+    ::memset(&sll, 0x0, sizeof(sll));
+    sll.sll_family   = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_IP);
+    sll.sll_ifindex  = local2ifindex(local);
+
+    // Attach the filter before binding such that no foreign packets make
+    // it into the ring
+    ASSERT_POS( fd=::socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP)) );
+    ASSERT2_ZERO( ::setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &bpf, sizeof(bpf)), ::close(fd) );
+    ASSERT2_ZERO( ::setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)), ::close(fd) );
+    ASSERT2_ZERO( ::setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)), ::close(fd) );
+
+    ring = (unsigned char*)::mmap(0, ringsize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    ASSERT2_COND( ring!=(unsigned char*)MAP_FAILED, ::close(fd) );
+
+    ASSERT2_ZERO( ::bind(fd, (struct sockaddr const*)&sll, sizeof(sll)), ::munmap(ring, ringsize); ::close(fd) );
+
+    DEBUG(2, "pktring_type: capturing UDP port " << port << " on ifindex " << sll.sll_ifindex
+             << " ring " << nblock << " x " << blocksize << endl);
+}
+
+// Hand the current block back to the kernel and move on to the next one
+void pktring_type::release_block( void ) {
+    struct tpacket_block_desc* desc = (struct tpacket_block_desc*)(ring + (size_t)curblock*blocksize);
+
+    __sync_synchronize();
+    desc->hdr.bh1.block_status = TP_STATUS_KERNEL;
+    curblock  = (curblock + 1) % nblock;
+    inblock   = false;
+    npkt_left = 0;
+    curpkt    = 0;
+    nBlock++;
+}
+
+bool pktring_type::next( pktring_udp_type& udp ) {
+    while( true ) {
+        if( npkt_left==0 ) {
+            struct tpacket_block_desc* desc;
+
+            // Done with the current block?
+            if( inblock )
+                release_block();
+
+            desc = (struct tpacket_block_desc*)(ring + (size_t)curblock*blocksize);
+            if( (desc->hdr.bh1.block_status & TP_STATUS_USER)==0 )
+                return false;
+            __sync_synchronize();
+
+            inblock   = true;
+            npkt_left = desc->hdr.bh1.num_pkts;
+            curpkt    = (unsigned char*)desc + desc->hdr.bh1.offset_to_first_pkt;
+            // Blocks may be retired empty because of the time out
+            continue;
+        }
+
+        struct tpacket3_hdr const* hdr = (struct tpacket3_hdr const*)curpkt;
+        struct sockaddr_ll const*  sll = (struct sockaddr_ll const*)(curpkt + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+        unsigned char const*       ip  = curpkt + hdr->tp_net;
+        unsigned int               ihl, iplen, udplen;
+        uint16_t                   tmp;
+
+        npkt_left--;
+        curpkt += hdr->tp_next_offset;
+
+        // On the loopback interface we see our own outgoing packets too
+        if( sll->sll_pkttype==PACKET_OUTGOING )
+            continue;
+
+        // The filter should've taken care of it but let's make sure we
+        // have a complete UDP datagram for our port
+        ihl = (unsigned int)(ip[0] & 0xf) * 4;
+        if( hdr->tp_snaplen<ihl+8 || ip[9]!=IPPROTO_UDP )
+            continue;
+        ::memcpy(&tmp, ip+2, sizeof(tmp));
+        iplen = ntohs(tmp);
+        ::memcpy(&tmp, ip+ihl+2, sizeof(tmp));
+        if( ntohs(tmp)!=port )
+            continue;
+        ::memcpy(&tmp, ip+ihl+4, sizeof(tmp));
+        udplen = ntohs(tmp);
+        if( udplen<8 || ihl+udplen>iplen || ihl+udplen>hdr->tp_snaplen )
+            continue;
+
+        udp.sender.sin_family = AF_INET;
+        ::memcpy(&udp.sender.sin_addr.s_addr, ip+12, sizeof(udp.sender.sin_addr.s_addr));
+        ::memcpy(&udp.sender.sin_port, ip+ihl, sizeof(udp.sender.sin_port));
+        udp.payload = ip + ihl + 8;
+        udp.len     = udplen - 8;
+        return true;
+    }
+}
+
+int pktring_type::wait( int timeout_ms ) {
+    struct pollfd   pfd;
+
+    pfd.fd      = fd;
+    pfd.events  = POLLIN | POLLERR;
+    pfd.revents = 0;
+    // We only get here if we ran out of datagrams, i.e. not too often, so
+    // we can afford to collect the kernel's statistics before its
+    // (32 bit) counters can overflow
+    this->update_stats();
+    return ::poll(&pfd, 1, timeout_ms);
+}
+
+// Reading the statistics resets them to zero so what we read is the
+// increment since the previous read
+void pktring_type::update_stats( void ) {
+    struct tpacket_stats_v3  st;
+    socklen_t                len = sizeof(st);
+
+    if( ::getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &st, &len)!=0 )
+        return;
+    nDrop   += st.tp_drops;
+    nPacket += st.tp_packets;
+}
+
+uint64_t pktring_type::drops( void ) {
+    this->update_stats();
+    return nDrop;
+}
+
+uint64_t pktring_type::packets( void ) {
+    this->update_stats();
+    return nPacket;
+}
+
+uint64_t pktring_type::blocks( void ) const {
+    return nBlock;
+}
+
+pktring_type::~pktring_type() {
+    if( ring )
+        ::munmap(ring, ringsize);
+    if( fd>=0 )
+        ::close(fd);
+}
+
+#else // !HAVE_PKTRING
+
+pktring_type::pktring_type(unsigned short p, struct in_addr, unsigned int bs, unsigned int nb):
+    fd( -1 ), port( p ), ring( 0 ), ringsize( 0 ), blocksize( bs ), nblock( nb ),
+    inblock( false ), curblock( 0 ), npkt_left( 0 ), curpkt( 0 ), nBlock( 0 ),
+    nDrop( 0 ), nPacket( 0 )
+{
+    THROW_EZEXCEPT(pktring_error, "kernel packet ring (TPACKET_V3) not supported on this system");
+}
+
+bool pktring_type::next( pktring_udp_type& ) {
+    return false;
+}
+
+int pktring_type::wait( int ) {
+    errno = ENOSYS;
+    return -1;
+}
+
+uint64_t pktring_type::drops( void ) {
+    return 0;
+}
+
+uint64_t pktring_type::packets( void ) {
+    return 0;
+}
+
+uint64_t pktring_type::blocks( void ) const {
+    return nBlock;
+}
+
+void pktring_type::release_block( void ) {
+}
+
+void pktring_type::update_stats( void ) {
+}
+
+pktring_type::~pktring_type() {
+}
+
+#endif
@@ -0,0 +1,117 @@
+// Memory mapped kernel packet ring (AF_PACKET, TPACKET_V3) for capturing UDP
+// Copyright (C) 2007-2013 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.nl
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef JIVE5A_PKTRING_H
+#define JIVE5A_PKTRING_H
+
+#include <ezexcept.h>
+#include <netinet/in.h>
+#include <stdint.h>
+
+// The packet ring is a Linux-only feature
+#if defined(__linux__)
+    #include <linux/if_packet.h>
+#endif
+#if defined(__linux__) && defined(TPACKET3_HDRLEN)
+    #define HAVE_PKTRING 1
+#else
+    #define HAVE_PKTRING 0
+#endif
+
+DECLARE_EZEXCEPT(pktring_error)
+
+// One UDP datagram as found in the ring. The payload pointer points
+// directly into the ring memory and is valid until the next call to
+// pktring_type::next().
+struct pktring_udp_type {
+    struct sockaddr_in   sender;
+    unsigned char const* payload;
+    unsigned int         len;
+
+    pktring_udp_type();
+};
+
+// Capture UDP datagrams addressed to a specific port through a memory
+// mapped TPACKET_V3 ring. The kernel fills whole ring blocks with
+// datagrams (a BPF filter makes sure only the ones we're interested in end
+// up there) and we iterate over them without a system call per datagram.
+// Note: requires CAP_NET_RAW.
+struct pktring_type {
+    // Default ring geometry: nblock x blocksize bytes of shared memory.
+    // A block is handed to us when it's full or after retire_ms,
+    // whichever comes first
+    static const unsigned int defBlockSize = 4*1024*1024;
+    static const unsigned int defNBlock    = 64;
+    static const unsigned int defRetireMs  = 10;
+
+    // Capture UDP datagrams for destination <port> on the interface
+    // that has local address <local>. INADDR_ANY (or a multicast address)
+    // means capture on all interfaces
+    pktring_type(unsigned short port, struct in_addr local,
+                 unsigned int blocksize = defBlockSize, unsigned int nblock = defNBlock);
+
+    // Fill in the next datagram. Returns false if there are no more
+    // datagrams available in the ring at the moment; use wait() to
+    // wait for the kernel to hand us more.
+    bool next( pktring_udp_type& udp );
+
+    // Wait at most timeout_ms for the kernel to release a block to us.
+    // Return value as poll(2)
+    int  wait( int timeout_ms );
+
+    // Packets the kernel dropped because the ring was full and the
+    // total number of packets it saw for us, since the ring was created.
+    // The kernel zeroes its counters each time they're read so we keep
+    // the running totals; they're updated in wait() and here.
+    uint64_t drops( void );
+    uint64_t packets( void );
+
+    // Number of ring blocks handed back to the kernel so far. Readers use
+    // it to do their per-block housekeeping (e.g. checking for
+    // cancellation) without having to count datagrams.
+    uint64_t blocks( void ) const;
+
+    ~pktring_type();
+
+    private:
+        int                 fd;
+        unsigned short      port;
+        unsigned char*      ring;
+        size_t              ringsize;
+        const unsigned int  blocksize;
+        const unsigned int  nblock;
+        // iteration state
+        bool                inblock;
+        unsigned int        curblock;
+        unsigned int        npkt_left;
+        unsigned char*      curpkt;
+        uint64_t            nBlock;
+        // running totals of the kernel's PACKET_STATISTICS
+        uint64_t            nDrop;
+        uint64_t            nPacket;
+
+        void release_block( void );
+        void update_stats( void );
+
+        pktring_type();
+        pktring_type(pktring_type const&);
+        pktring_type const& operator=(pktring_type const&);
+};
+
+#endif
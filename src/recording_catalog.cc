@@ -0,0 +1,582 @@
+// implementation
+// Copyright (C) 2007-2014 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.nl
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <recording_catalog.h>
+#include <mutex_locker.h>
+#include <evlbidebug.h>
+#include <threadutil.h>   // for evlbi5a::strerror()
+
+#include <map>
+#include <errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+    #include <sys/inotify.h>
+    #define CATALOG_INOTIFY 1
+#endif
+
+using namespace std;
+
+
+catalog_chunk_type::catalog_chunk_type(string const& mp, string const& p, unsigned int n, off_t sz):
+    mountpoint( mp ), path( p ), seqno( n ), size( sz )
+{}
+
+
+namespace {
+    // The chunks of a FlexBuff recording on one mountpoint:
+    // sequence number => size
+    typedef map<unsigned int, off_t>  chunkmap_type;
+
+    struct recording_type {
+        bool           isdir;     // FlexBuff recording, otherwise a (Mark6) file
+        chunkmap_type  chunks;
+
+        recording_type():
+            isdir( false )
+        {}
+    };
+    typedef map<string, recording_type>  recordingmap_type;
+
+    struct mpindex_type {
+        bool               ready;     // initial listing is done
+        bool               watched;   // inotify tells us about all changes
+        bool               again;     // changes were lost while indexing
+        recordingmap_type  recordings;
+        // Paths (relative to the mountpoint) that changed while it was
+        // being indexed. They're looked at once the index is in place
+        list<string>       pending;
+
+        mpindex_type():
+            ready( false ), watched( false ), again( false )
+        {}
+    };
+    typedef map<string, mpindex_type>  mpindexmap_type;
+
+    // What an inotify watch descriptor is watching: the mountpoint
+    // itself (empty recording) or a recording directory on it
+    struct watch_type {
+        string   mountpoint;
+        string   recording;
+
+        watch_type(string const& mp, string const& rec):
+            mountpoint( mp ), recording( rec )
+        {}
+    };
+    typedef map<int, watch_type>  watchmap_type;
+
+    pthread_mutex_t   catalogLock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t    catalogCond = PTHREAD_COND_INITIALIZER;
+    mpindexmap_type   catalog;
+    watchmap_type     watches;
+    bool              notifyInit  = false;
+    int               notifyFd    = -1;
+
+
+    // Is 'name' "<rec>.xxxxxxxx", with eight digits?
+    bool is_chunk(string const& rec, string const& name, unsigned int& seqno) {
+        if( name.size()!=rec.size()+9 || name.compare(0, rec.size(), rec)!=0 || name[rec.size()]!='.' )
+            return false;
+        seqno = 0;
+        for(string::size_type i=rec.size()+1; i<name.size(); i++) {
+            if( name[i]<'0' || name[i]>'9' )
+                return false;
+            seqno = seqno*10 + (unsigned int)(name[i]-'0');
+        }
+        return true;
+    }
+
+    string chunk_path(string const& mp, string const& rec, unsigned int seqno) {
+        char  num[16];
+
+        ::snprintf(num, sizeof(num), "%08u", seqno);
+        return mp + "/" + rec + "/" + rec + "." + num;
+    }
+
+    // The entries of directory 'dir', except "." and ".."
+    bool list_directory(string const& dir, list<string>& names) {
+        DIR*            dirp;
+        struct dirent*  entry;
+
+        if( (dirp=::opendir(dir.c_str()))==0 )
+            return false;
+        while( (entry=::readdir(dirp))!=0 ) {
+            const string  name( entry->d_name );
+
+            if( name!="." && name!=".." )
+                names.push_back( name );
+        }
+        ::closedir(dirp);
+        return true;
+    }
+
+    // Note: here and below stat(2), not lstat(2): chunks and recordings
+    // that are symlinks to elsewhere count, as they always did
+    void scan_chunks(string const& mp, string const& rec, chunkmap_type& chunks) {
+        unsigned int  seqno;
+        struct stat   st;
+        list<string>  names;
+        const string  dir( mp + "/" + rec );
+
+        if( !list_directory(dir, names) ) {
+            if( errno!=ENOENT )
+                DEBUG(4, "catalog: failed to list " << dir << " - " << evlbi5a::strerror(errno) << endl);
+            return;
+        }
+        for(list<string>::const_iterator p=names.begin(); p!=names.end(); p++)
+            if( is_chunk(rec, *p, seqno) && ::stat((dir + "/" + *p).c_str(), &st)==0 && S_ISREG(st.st_mode) )
+                chunks[seqno] = st.st_size;
+    }
+
+    // Must be called with the catalogLock held, such that the watcher
+    // doesn't see events for watch descriptors it doesn't know about yet.
+    // Returns false if the path can't be watched
+    bool add_watch(string const& path, string const& mp, string const& rec) {
+#ifdef CATALOG_INOTIFY
+        int              wd;
+        const uint32_t   mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ONLYDIR;
+
+        if( notifyFd<0 )
+            return false;
+        if( (wd=::inotify_add_watch(notifyFd, path.c_str(), mask))<0 ) {
+            DEBUG((errno==ENOSPC ? -1 : 3), "catalog: cannot watch " << path << " - " << evlbi5a::strerror(errno) << endl);
+            return false;
+        }
+        watches.erase( wd );
+        watches.insert( make_pair(wd, watch_type(mp, rec)) );
+        return true;
+#else
+        (void)path; (void)mp; (void)rec;
+        return false;
+#endif
+    }
+
+    // Look at what 'relpath' below 'mp' is now and update the catalog.
+    // Because it only looks at the current state it doesn't matter how
+    // often, or late, this is done for a path.
+    void refresh(string const& mp, string const& relpath) {
+        struct stat              st;
+        const string             path( mp + "/" + relpath );
+        const string::size_type  slash = relpath.find('/');
+        const bool               exists = (::stat(path.c_str(), &st)==0);
+
+        if( slash==string::npos ) {
+            // An entry in the mountpoint itself
+            bool           watched = true;
+            chunkmap_type  chunks;
+            const bool     isdir  = exists && S_ISDIR(st.st_mode);
+            const bool     isfile = exists && S_ISREG(st.st_mode);
+
+            if( isdir ) {
+                // watch before listing: no chunk can slip through
+                {
+                    mutex_locker  lck( catalogLock );
+                    watched = add_watch(path, mp, relpath);
+                }
+                scan_chunks(mp, relpath, chunks);
+            }
+            mutex_locker                lck( catalogLock );
+            mpindexmap_type::iterator   mpi = catalog.find( mp );
+
+            if( mpi==catalog.end() )
+                return;
+            if( isdir || isfile ) {
+                recording_type&  rec = mpi->second.recordings[ relpath ];
+
+                rec.isdir = isdir;
+                rec.chunks.swap( chunks );
+                mpi->second.watched = mpi->second.watched && watched;
+            } else {
+                mpi->second.recordings.erase( relpath );
+            }
+            return;
+        }
+
+        // A chunk of a recording
+        unsigned int  seqno;
+        const string  recname( relpath.substr(0, slash) );
+
+        if( !is_chunk(recname, relpath.substr(slash+1), seqno) )
+            return;
+
+        mutex_locker                lck( catalogLock );
+        mpindexmap_type::iterator   mpi = catalog.find( mp );
+
+        if( mpi==catalog.end() )
+            return;
+        if( exists && S_ISREG(st.st_mode) ) {
+            recording_type&  rec = mpi->second.recordings[ recname ];
+
+            rec.isdir         = true;
+            rec.chunks[seqno] = st.st_size;
+        } else {
+            recordingmap_type::iterator  rec = mpi->second.recordings.find( recname );
+
+            if( rec!=mpi->second.recordings.end() )
+                rec->second.chunks.erase( seqno );
+        }
+    }
+
+    void* indexer(void* arg);
+
+    // Must be called with the catalogLock held
+    void start_indexer(string const& mp) {
+        int         create_error;
+        pthread_t   tid;
+
+        catalog[mp] = mpindex_type();
+        if( (create_error=mp_pthread_create(&tid, &indexer, new string(mp)))!=0 ) {
+            // Then we'll have to list the mountpoint every time
+            DEBUG(-1, "catalog: failed to start indexing " << mp << " - " << evlbi5a::strerror(create_error) << endl);
+            catalog[mp].ready = true;
+            return;
+        }
+        ::pthread_detach(tid);
+    }
+
+    void* indexer(void* arg) {
+        const string  mp( *(string*)arg );
+
+        delete (string*)arg;
+
+        while( true ) {
+            bool               watched;
+            struct stat        st;
+            list<string>       names, pending;
+            recordingmap_type  found;
+
+            // Watch before listing: anything that changes after this is
+            // seen
+            {
+                mutex_locker  lck( catalogLock );
+                watched = add_watch(mp, mp, string());
+            }
+
+            if( !list_directory(mp, names) )
+                DEBUG(-1, "catalog: failed to list " << mp << " - " << evlbi5a::strerror(errno) << endl);
+
+            for(list<string>::const_iterator p=names.begin(); p!=names.end(); p++) {
+                const string  path( mp + "/" + *p );
+
+                if( ::stat(path.c_str(), &st)!=0 || !(S_ISDIR(st.st_mode) || S_ISREG(st.st_mode)) )
+                    continue;
+
+                recording_type&  rec = found[ *p ];
+
+                if( (rec.isdir=S_ISDIR(st.st_mode))==true ) {
+                    {
+                        mutex_locker  lck( catalogLock );
+                        watched = add_watch(path, mp, *p) && watched;
+                    }
+                    scan_chunks(mp, *p, rec.chunks);
+                }
+            }
+
+            // Publish the index
+            bool      again;
+            {
+                mutex_locker               lck( catalogLock );
+                mpindex_type&              mpi = catalog[ mp ];
+
+                mpi.recordings.swap( found );
+                mpi.watched = watched;
+                mpi.ready   = true;
+                pending.swap( mpi.pending );
+                again       = mpi.again;
+                mpi.again   = false;
+                ::pthread_cond_broadcast(&catalogCond);
+            }
+            DEBUG(2, "catalog: indexed " << mp << ", " << names.size() << " entries" <<
+                     (watched ? "" : " (not watched for changes)") << endl);
+
+            for(list<string>::const_iterator p=pending.begin(); p!=pending.end(); p++)
+                refresh(mp, *p);
+            if( !again )
+                break;
+            DEBUG(2, "catalog: lost track of changes to " << mp << ", indexing again" << endl);
+        }
+        return (void*)0;
+    }
+
+#ifdef CATALOG_INOTIFY
+    void* watcher(void*) {
+        ssize_t  n;
+        // inotify_event requires alignment
+        union {
+            struct inotify_event  align;
+            char                  buf[64*1024];
+        } events;
+
+        while( true ) {
+            if( (n=::read(notifyFd, events.buf, sizeof(events.buf)))<0 ) {
+                if( errno==EINTR )
+                    continue;
+                DEBUG(-1, "catalog: failed to read inotify events - " << evlbi5a::strerror(errno) << endl);
+                break;
+            }
+            for(char* p=events.buf; p<events.buf+n; p+=sizeof(struct inotify_event)+((struct inotify_event*)p)->len) {
+                struct inotify_event const*  ev = (struct inotify_event const*)p;
+
+                if( ev->mask & IN_Q_OVERFLOW ) {
+                    // Events were dropped; the only way to be sure is to
+                    // index everything again
+                    mutex_locker  lck( catalogLock );
+
+                    DEBUG(-1, "catalog: inotify event queue overflowed, indexing all mountpoints again" << endl);
+                    for(mpindexmap_type::iterator mpi=catalog.begin(); mpi!=catalog.end(); mpi++) {
+                        if( mpi->second.ready )
+                            start_indexer( mpi->first );
+                        else
+                            mpi->second.again = true;
+                    }
+                    continue;
+                }
+
+                string                     mp, relpath;
+                {
+                    mutex_locker               lck( catalogLock );
+                    watchmap_type::iterator    w = watches.find( ev->wd );
+                    mpindexmap_type::iterator  mpi;
+
+                    if( w==watches.end() )
+                        continue;
+                    if( ev->mask & IN_IGNORED ) {
+                        // The mountpoint itself went away (unmounted,
+                        // removed)? Then forget about it; it will be
+                        // indexed again when needed
+                        if( w->second.recording.empty() ) {
+                            DEBUG(2, "catalog: " << w->second.mountpoint << " disappeared" << endl);
+                            catalog.erase( w->second.mountpoint );
+                        }
+                        watches.erase( w );
+                        continue;
+                    }
+                    if( ev->len==0 )
+                        continue;
+                    mp      = w->second.mountpoint;
+                    relpath = (w->second.recording.empty() ? string(ev->name) : w->second.recording + "/" + ev->name);
+
+                    if( (mpi=catalog.find(mp))==catalog.end() )
+                        continue;
+                    if( !mpi->second.ready ) {
+                        mpi->second.pending.push_back( relpath );
+                        continue;
+                    }
+                }
+                refresh(mp, relpath);
+            }
+        }
+        return (void*)0;
+    }
+#endif
+
+    // Must be called with the catalogLock held
+    void init_notify( void ) {
+        if( notifyInit )
+            return;
+        notifyInit = true;
+#ifdef CATALOG_INOTIFY
+        int        create_error;
+        pthread_t  tid;
+
+        if( (notifyFd=::inotify_init())<0 ) {
+            DEBUG(-1, "catalog: no inotify - " << evlbi5a::strerror(errno) << endl);
+            return;
+        }
+        ::fcntl(notifyFd, F_SETFD, FD_CLOEXEC);
+        if( (create_error=mp_pthread_create(&tid, &watcher, 0))!=0 ) {
+            DEBUG(-1, "catalog: failed to start watching for changes - " << evlbi5a::strerror(create_error) << endl);
+            ::close(notifyFd);
+            notifyFd = -1;
+            return;
+        }
+        ::pthread_detach(tid);
+#endif
+    }
+
+    // Must be called with the catalogLock held
+    void wait_for(mountpointlist_type const& mps) {
+        init_notify();
+        while( true ) {
+            bool  ready = true;
+
+            for(mountpointlist_type::const_iterator mp=mps.begin(); mp!=mps.end(); mp++) {
+                if( *mp==noMountpoint )
+                    continue;
+
+                mpindexmap_type::const_iterator  mpi = catalog.find( *mp );
+
+                if( mpi==catalog.end() )
+                    start_indexer( *mp );
+                ready = ready && catalog[*mp].ready;
+            }
+            if( ready )
+                break;
+            ::pthread_cond_wait(&catalogCond, &catalogLock);
+        }
+    }
+}
+
+
+void catalog_index(mountpointlist_type const& mps) {
+    mutex_locker  lck( catalogLock );
+
+    init_notify();
+    for(mountpointlist_type::const_iterator mp=mps.begin(); mp!=mps.end(); mp++)
+        if( *mp!=noMountpoint && catalog.find(*mp)==catalog.end() )
+            start_indexer( *mp );
+}
+
+catalog_chunklist_type catalog_find_chunks(string const& rec, mountpointlist_type const& mps) {
+    list<string>            unwatched;
+    catalog_chunklist_type  rv;
+
+    {
+        mutex_locker  lck( catalogLock );
+
+        wait_for( mps );
+        for(mountpointlist_type::const_iterator mp=mps.begin(); mp!=mps.end(); mp++) {
+            if( *mp==noMountpoint )
+                continue;
+
+            mpindex_type const&                 mpi = catalog[ *mp ];
+            recordingmap_type::const_iterator   r;
+
+            if( !mpi.watched ) {
+                unwatched.push_back( *mp );
+                continue;
+            }
+            if( (r=mpi.recordings.find(rec))==mpi.recordings.end() || !r->second.isdir )
+                continue;
+            for(chunkmap_type::const_iterator c=r->second.chunks.begin(); c!=r->second.chunks.end(); c++)
+                rv.push_back( catalog_chunk_type(*mp, chunk_path(*mp, rec, c->first), c->first, c->second) );
+        }
+    }
+
+    // The ones that we can't trust to be up to date we must look at now
+    for(list<string>::const_iterator mp=unwatched.begin(); mp!=unwatched.end(); mp++) {
+        chunkmap_type  chunks;
+
+        scan_chunks(*mp, rec, chunks);
+        for(chunkmap_type::const_iterator c=chunks.begin(); c!=chunks.end(); c++)
+            rv.push_back( catalog_chunk_type(*mp, chunk_path(*mp, rec, c->first), c->first, c->second) );
+    }
+    return rv;
+}
+
+mountpointlist_type catalog_find_recording(string const& rec, mountpointlist_type const& mps) {
+    struct stat          st;
+    list<string>         unwatched;
+    mountpointlist_type  rv;
+
+    {
+        mutex_locker  lck( catalogLock );
+
+        wait_for( mps );
+        for(mountpointlist_type::const_iterator mp=mps.begin(); mp!=mps.end(); mp++) {
+            if( *mp==noMountpoint )
+                continue;
+
+            mpindex_type const&  mpi = catalog[ *mp ];
+
+            if( !mpi.watched )
+                unwatched.push_back( *mp );
+            else if( mpi.recordings.find(rec)!=mpi.recordings.end() )
+                rv.insert( *mp );
+        }
+    }
+
+    for(list<string>::const_iterator mp=unwatched.begin(); mp!=unwatched.end(); mp++)
+        if( ::stat((*mp + "/" + rec).c_str(), &st)==0 )
+            rv.insert( *mp );
+    return rv;
+}
+
+set<string> catalog_find_names(string const& prefix, mountpointlist_type const& mps) {
+    set<string>   rv;
+    list<string>  unwatched;
+
+    {
+        mutex_locker  lck( catalogLock );
+
+        wait_for( mps );
+        for(mountpointlist_type::const_iterator mp=mps.begin(); mp!=mps.end(); mp++) {
+            if( *mp==noMountpoint )
+                continue;
+
+            mpindex_type const&  mpi = catalog[ *mp ];
+
+            if( !mpi.watched ) {
+                unwatched.push_back( *mp );
+                continue;
+            }
+            // The names are sorted so the ones with the prefix are
+            // consecutive
+            for(recordingmap_type::const_iterator r=mpi.recordings.lower_bound(prefix);
+                r!=mpi.recordings.end() && r->first.compare(0, prefix.size(), prefix)==0; r++)
+                    rv.insert( r->first );
+        }
+    }
+
+    for(list<string>::const_iterator mp=unwatched.begin(); mp!=unwatched.end(); mp++) {
+        list<string>  names;
+
+        list_directory(*mp, names);
+        for(list<string>::const_iterator n=names.begin(); n!=names.end(); n++)
+            if( n->compare(0, prefix.size(), prefix)==0 )
+                rv.insert( *n );
+    }
+    return rv;
+}
+
+void catalog_add(string const& mp, string const& relpath, off_t size) {
+    mutex_locker               lck( catalogLock );
+    mpindexmap_type::iterator  mpi = catalog.find( mp );
+
+    // Not indexed (yet)? It'll be found when it is
+    if( mpi==catalog.end() )
+        return;
+    if( !mpi->second.ready ) {
+        mpi->second.pending.push_back( relpath );
+        return;
+    }
+
+    unsigned int             seqno;
+    const string::size_type  slash = relpath.find('/');
+
+    if( slash==string::npos ) {
+        mpi->second.recordings[ relpath ].isdir = false;
+        return;
+    }
+
+    const string  recname( relpath.substr(0, slash) );
+
+    if( !is_chunk(recname, relpath.substr(slash+1), seqno) )
+        return;
+
+    recording_type&  rec = mpi->second.recordings[ recname ];
+
+    rec.isdir         = true;
+    rec.chunks[seqno] = size;
+}
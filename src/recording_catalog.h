@@ -0,0 +1,81 @@
+// keep track of which FlexBuff/Mark6 recordings live where
+// Copyright (C) 2007-2014 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.nl
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef EVLBI5A_RECORDING_CATALOG_H
+#define EVLBI5A_RECORDING_CATALOG_H
+
+#include <mountpoint.h>
+#include <set>
+#include <list>
+#include <string>
+#include <sys/types.h>
+
+// Finding out which recordings exist and where their chunks are used to
+// mean listing the directories on all mountpoints, every time. With tens
+// of disks holding thousands of recordings that takes seconds and keeps
+// the disks busy doing metadata I/O.
+//
+// The catalog keeps, per mountpoint, the names of all entries in it
+// (FlexBuff recordings are directories, Mark6 recordings are files) and,
+// for the FlexBuff recordings, the chunks in them:
+//       <mountpoint>/<recording>/<recording>.<8 digit sequence number>
+//
+// A mountpoint is indexed once, by a thread of its own, the first time it
+// is asked for (all mountpoints found at start up are indexed straight
+// away). After that the catalog is kept up to date by the recording code
+// telling it which chunks were written and, on Linux, by inotify(7) for
+// changes made by anything else. Mountpoints for which that isn't possible
+// (no inotify, or out of watches - see /proc/sys/fs/inotify/max_user_watches)
+// are listed again each time they are looked at, like before.
+//
+// All lookups wait for the indexing of the mountpoints they're asked
+// about to finish.
+
+// Start indexing those of the mountpoints that aren't (being) indexed yet.
+// Does not wait for that to finish.
+void  catalog_index(mountpointlist_type const& mps);
+
+// Chunk #seqno of a FlexBuff recording. The size is -1 if it wasn't known
+// (yet)
+struct catalog_chunk_type {
+    std::string   mountpoint;
+    std::string   path;       // full path to the chunk
+    unsigned int  seqno;
+    off_t         size;
+
+    catalog_chunk_type(std::string const& mp, std::string const& p, unsigned int n, off_t sz);
+};
+typedef std::list<catalog_chunk_type>   catalog_chunklist_type;
+
+// All chunks of FlexBuff recording 'rec' on the mountpoints
+catalog_chunklist_type  catalog_find_chunks(std::string const& rec, mountpointlist_type const& mps);
+
+// Those mountpoints that have an entry called 'rec' - a FlexBuff recording
+// or a Mark6 file
+mountpointlist_type     catalog_find_recording(std::string const& rec, mountpointlist_type const& mps);
+
+// The names of all entries on the mountpoints that start with 'prefix'
+std::set<std::string>   catalog_find_names(std::string const& prefix, mountpointlist_type const& mps);
+
+// The recording code tells the catalog it has written 'relpath' below
+// mountpoint 'mp', which is either a chunk ("<rec>/<rec>.xxxxxxxx") or a
+// Mark6 file ("<rec>")
+void  catalog_add(std::string const& mp, std::string const& relpath, off_t size);
+
+#endif
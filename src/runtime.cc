@@ -31,6 +31,8 @@
 #include <dotzooi.h>
 #include <headersearch.h>
 #include <ezexcept.h>
+#include <blockpool.h>
+#include <pacer.h>     // for monotonic_ns()
 
 // c++
 #include <set>
@@ -51,10 +53,34 @@ DEFINE_EZEXCEPT(rte_error)
 evlbi_stats_type::evlbi_stats_type():
     ooosum(0), pkt_in( 0 ), pkt_lost( 0 ), pkt_ooo( 0 ),
     pkt_disc( 0 ), gap_sum( 0 ),
-    discont( 0 ), discont_sz( 0 )
+    discont( 0 ), discont_sz( 0 ),
+    mmsg_batch( 0 ), mmsg_pkt( 0 )
 {}
 
 
+connstats_type::connstats_type():
+    nChunk( 0 ), nByte( 0 ), tOpen( 0.0 ), tLast( 0.0 )
+{}
+
+connstats_type::connstats_type(const string& p):
+    peer( p ), nChunk( 0 ), nByte( 0 ), tOpen( (double)monotonic_ns()/1.0e9 ), tLast( tOpen )
+{}
+
+double connstats_type::seconds( void ) const {
+    return tLast - tOpen;
+}
+
+ostream& operator<<(ostream& os, const connstats_type& cs) {
+    const double dt = cs.seconds();
+
+    os << cs.nChunk << " chunks, " << byteprint((double)cs.nByte, "byte") << " in "
+       << dt << "s";
+    if( dt>0.0 )
+        os << " = " << byteprint((double)cs.nByte*8/dt, "bps");
+    return os;
+}
+
+
 string fmt_evlbistats(const evlbi_stats_type& es) {
     return fmt_evlbistats(es, "total:%t:ooo:%o:disc:%d:lost:%l:extent:%R");
 }
@@ -67,6 +93,7 @@ string fmt_evlbistats(const evlbi_stats_type& es, char const* const fmt) {
     double              avg_extent( 0 );
     double              avg_gap( 0 );
     double              avg_discsz( 0 );
+    double              avg_batch( 0 );
     char const*         cur;
     ostringstream       output;
     pcint::timeval_type now = pcint::timeval_type::now();
@@ -85,6 +112,8 @@ string fmt_evlbistats(const evlbi_stats_type& es, char const* const fmt) {
     }
     if( es.discont )
         avg_discsz = (double)es.discont_sz/(double)es.discont;
+    if( es.mmsg_batch )
+        avg_batch = (double)es.mmsg_pkt/(double)es.mmsg_batch;
 
     // check what the format looks like
     for( cur=fmt; *cur; cur++ ) {
@@ -147,6 +176,15 @@ string fmt_evlbistats(const evlbi_stats_type& es, char const* const fmt) {
                         output << avg_discsz << "seqnr/discontinuity";
                         break;
 
+                    // batched receive (udpsmm): number of batches or
+                    // average number of datagrams per batch
+                    case 'b':
+                        output << es.mmsg_batch;
+                        break;
+                    case 'B':
+                        output << avg_batch << "pkt/batch";
+                        break;
+
                     // timestamp. raw unixtimestamp (+millisecond fraction
                     // or human readable timeformat
                     case 'u':
@@ -308,8 +346,10 @@ unsigned int constant( chain*, unsigned int n ) {
     return n;
 }
 
+// No transfer-specific memory status? Then at least report the process
+// wide pool memory usage
 std::string no_memstat( void ) {
-    return std::string("no memstat available");
+    return pool_memory_status();
 }
 
 //
@@ -89,12 +89,35 @@ struct evlbi_stats_type {
                                        // was
     ucounter_type      discont;    // number of discontinuities (seqnr > expect)
     ucounter_type      discont_sz; // discontinuity size
+    ucounter_type      mmsg_batch; // number of batched receives (udpsmm)
+    ucounter_type      mmsg_pkt;   // datagrams received through those,
+                                   //  mmsg_pkt/mmsg_batch = avg. batch fill
 
     evlbi_stats_type();
 };
 
 std::string   fmt_evlbistats(const evlbi_stats_type& stats, char const*const fmt);
 
+// Throughput of the individual connections of the parallel sender
+// (vbs2net) and the parallel network reader (net2vbs), see "conn_stats?"
+struct connstats_type {
+    std::string   peer;       // where the connection goes to/comes from
+    uint64_t      nChunk;     // chunks sent/received over it
+    uint64_t      nByte;      // bytes id.
+    double        tOpen;      // monotonic time of opening [s]
+    double        tLast;      // monotonic time of the last chunk [s]
+
+    connstats_type();
+    connstats_type(const std::string& p);
+
+    // time from opening the connection to the last chunk
+    double seconds( void ) const;
+};
+// Numbered in the order in which the connections were made
+typedef std::map<unsigned int, connstats_type>  connstatsmap_type;
+
+std::ostream& operator<<(std::ostream& os, const connstats_type& cs);
+
 
 // Uniquely link codes -> number of tracks
 struct codemapentry {
@@ -468,6 +491,9 @@ struct runtime {
     // udp is chosen as network transport
     evlbi_stats_type            evlbi_stats;
 
+    // Per connection statistics of the vbs2net/net2vbs transfers
+    connstatsmap_type           connstats;
+
     // keep a mapping of jobid => rot-to-systemtime mapping
     // taskid == -1 => invalid/unknown taskid
     unsigned int                current_taskid;
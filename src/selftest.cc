@@ -0,0 +1,259 @@
+// self tests, benchmarks and JIT cache prewarming, kept out of the daemon
+// Copyright (C) 2007-2008 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.nl
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+// c++ headers
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <exception>
+#include <locale>
+
+// own stuff
+#include <evlbidebug.h>
+#include <mk5_exception.h>
+#include <ezexcept.h>
+#include <splitstuff.h>
+#include <trackmask.h>
+#include <headersearch.h>
+#include <zerocopy.h>
+#include <spscqueue.h>
+#include <jit.h>
+
+// c headers
+#include <getopt.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <libgen.h>
+#include <errno.h>
+#include <time.h>
+
+using namespace std;
+
+
+// Beware of basename(3) returning NULL (if it ever does that)
+static char const* get_basename( char* const argv0 ) {
+    char const*const   bn = ::basename( argv0 );
+    return (bn == 0 ? argv0 : bn);
+}
+
+// Compile (or, when the JIT cache already has them, load) the code for the
+// trackmasks and/or dynamic channel extractors listed in the file, one per
+// line:
+//     trackmask <mask> <numwords> [<signmagdistance>]
+//     extractor <dynamic channel extractor config>
+// Empty lines and lines starting with '#' are ignored. Failures are
+// reported; returns wether all of them succeeded.
+static bool prewarm_jit_cache( const string& fn ) {
+    string        line;
+    ifstream      file( fn.c_str() );
+    unsigned int  lineno = 0, nok = 0, nfail = 0;
+
+    if( !file ) {
+        DEBUG(-1, "prewarm: cannot open " << fn << endl);
+        return false;
+    }
+    while( getline(file, line) ) {
+        string             what;
+        istringstream      fields( line );
+
+        lineno++;
+        if( !(fields >> what) || what[0]=='#' )
+            continue;
+        try {
+            if( what=="trackmask" ) {
+                char*        endptr;
+                string       mask_s, numwords_s, smd_s;
+                data_type    mask;
+                unsigned int numwords;
+                int          smd = 0;
+
+                fields >> mask_s >> numwords_s >> smd_s;
+
+                errno = 0;
+                mask  = (data_type)::strtoull(mask_s.c_str(), &endptr, 0);
+                EZASSERT2( !mask_s.empty() && *endptr=='\0' && errno!=ERANGE &&
+                           mask!=trackmask_empty && mask!=trackmask_full, cmdexception,
+                           EZINFO("invalid trackmask '" << mask_s << "'") );
+                numwords = (unsigned int)::strtoul(numwords_s.c_str(), &endptr, 0);
+                EZASSERT2( !numwords_s.empty() && *endptr=='\0' && numwords>0, cmdexception,
+                           EZINFO("invalid number of words '" << numwords_s << "'") );
+                if( !smd_s.empty() ) {
+                    smd = (int)::strtol(smd_s.c_str(), &endptr, 0);
+                    EZASSERT2( *endptr=='\0', cmdexception,
+                               EZINFO("invalid sign-magnitude distance '" << smd_s << "'") );
+                }
+                const solution_type  solution( solve(mask) );
+                EZASSERT2( solution, cmdexception, EZINFO("no solution for trackmask " << mask_s) );
+
+                compressor_type( solution, numwords, false, smd );
+            } else if( what=="extractor" ) {
+                string  config;
+
+                EZASSERT2( getline(fields >> ws, config) && !config.empty(), cmdexception,
+                           EZINFO("missing extractor configuration") );
+                find_splitfunction( config, dce_compiled );
+            } else {
+                EZASSERT2( false, cmdexception, EZINFO("unknown keyword '" << what << "'") );
+            }
+            nok++;
+        }
+        catch( const exception& e ) {
+            DEBUG(-1, "prewarm: " << fn << ":" << lineno << " - " << e.what() << endl);
+            nfail++;
+        }
+    }
+    DEBUG(0, "prewarm: " << nok << " kernels from " << fn << " ready, " << nfail << " failed" << endl);
+    return nfail==0;
+}
+
+static void Usage( const char* name ) {
+    cout <<
+"Usage: " << name << " [-h] [-m <level>] [-j <dir>]\n"
+"              -T | -K <mask> | -t [<formats>] | -Z [<spec>] |\n"
+"              -Q [<spec>] | -J <file>\n\n"
+"Self tests and benchmarks of jive5ab's data handling code, and prewarming\n"
+"of the JIT cache used by jive5ab's '-j' option. Exit status is zero if the\n"
+"test succeeded.\n\n"
+"   -h, --help this message\n"
+"   -m, --message-level <level>\n"
+"              message level (default " << dbglev_fn() << ")\n"
+"   -j, --jit-cache <dir>\n"
+"              keep compiled code in <dir>, as jive5ab's '-j' option\n"
+"   -T, --test-splitters\n"
+"              check that the avx2/avx512 versions of the dechannelizers\n"
+"              produce the same output as the sse versions, show their\n"
+"              throughput\n"
+"   -K, --test-trackmask <mask>\n"
+"              compress and decompress random data using the 'compiled'\n"
+"              and 'packed' compression engines for the trackmask\n"
+"              (e.g. 0xaaaaaaaaaaaaaaaa), show their setup time and\n"
+"              throughput\n"
+"   -t, --test-timedecoder [<formats>]\n"
+"              decode the time stamps of generated frames, show the\n"
+"              number of frames per second that can be decoded.\n"
+"              <formats> is a comma separated list of data formats\n"
+"              like 'VDIF_8000-4096-16-2,Mark5B-2048-16-2'; default:\n"
+"              a number of Mark5B, VDIF and Mark4 formats\n"
+"   -Z, --test-zerocopy [<blocksize>[,<megabytes>]]\n"
+"              send data over a loopback tcp connection with and without\n"
+"              MSG_ZEROCOPY (see 'net_zerocopy='), show throughput and\n"
+"              sender CPU usage and check the data.\n"
+"              Default: 2048 MB in 1048576 byte blocks\n"
+"   -Q, --test-queues [<qlen>[,<million blocks>[,<blocksize>[,<cpu>:<cpu>]]]]\n"
+"              pass blocks from one thread to another through a locking\n"
+"              and a lock-free queue of length <qlen>, show the number\n"
+"              of blocks per second and check the order. The number of\n"
+"              cpus online is reported; the producer and consumer are\n"
+"              pinned to the given cpus, if any.\n"
+"              Default: 10 million 8192 byte blocks, queue length 32,\n"
+"              not pinned\n"
+"   -J, --jit-prewarm <file>\n"
+"              compile (or load from the cache) the code listed in <file>\n"
+"              such that a jive5ab using the same '-j <dir>' finds it\n"
+"              there. Lines of <file> are\n"
+"                 trackmask <mask> <numwords> [<signmagdistance>]\n"
+"                 extractor <dynamic channel extractor config>\n"
+"              '#' starts a comment line\n";
+    return;
+}
+
+int main(int argc, char** argv) {
+    int     option;
+    long    v;
+    string  jit_cache;
+
+    // Same environment as the daemon: UTC, POSIX locale
+    ::setenv("TZ", "", 1);
+    ::tzset();
+    std::locale::global( std::locale("POSIX") );
+    ::srandom( (unsigned int)::time(0) );
+    ::srand48( (long)::time(0) );
+
+    struct option  longopts[] = {
+        { "help",            no_argument,       NULL, 'h' },
+        { "message-level",   required_argument, NULL, 'm' },
+        { "jit-cache",       required_argument, NULL, 'j' },
+        { "test-splitters",  no_argument,       NULL, 'T' },
+        { "test-trackmask",  required_argument, NULL, 'K' },
+        { "test-timedecoder",optional_argument, NULL, 't' },
+        { "test-zerocopy",   optional_argument, NULL, 'Z' },
+        { "test-queues",     optional_argument, NULL, 'Q' },
+        { "jit-prewarm",     required_argument, NULL, 'J' },
+        // Leave this one as last
+        { NULL,              0,                 NULL, 0   }
+    };
+
+    try {
+        while( (option=::getopt_long(argc, argv, "hm:j:TK:t::Z::Q::J:", longopts, NULL))>=0 ) {
+            switch( option ) {
+                case 'h':
+                    Usage( get_basename(argv[0]) );
+                    return 0;
+                case 'm':
+                    v = ::strtol(optarg, 0, 0);
+                    if( v<INT_MIN || v>INT_MAX ) {
+                        cerr << "Value for messagelevel out-of-range.\n"
+                            << "Useful range is: [" << INT_MIN << ", "
+                            << INT_MAX << "]" << endl;
+                        return -1;
+                    }
+                    dbglev_fn((int)v);
+                    break;
+                case 'j':
+                    jit_cache = optarg;
+                    jit_set_cachedir( jit_cache );
+                    break;
+                case 'T':
+                    return test_splitfunctions(cout) ? 0 : 1;
+                case 'K': {
+                        char*     endptr;
+                        data_type tm;
+
+                        errno = 0;
+                        tm    = (data_type)::strtoull(optarg, &endptr, 0);
+                        if( endptr==optarg || *endptr!='\0' || errno==ERANGE || tm==trackmask_empty || tm==trackmask_full ) {
+                            cerr << "Invalid trackmask '" << optarg << "'" << endl;
+                            return -1;
+                        }
+                        return test_compressors(tm, cout) ? 0 : 1;
+                    }
+                case 't':
+                    return test_timedecoders(optarg ? optarg : "", cout) ? 0 : 1;
+                case 'Z':
+                    return test_zerocopy(optarg ? optarg : "", cout) ? 0 : 1;
+                case 'Q':
+                    return test_spscqueue(optarg ? optarg : "", cout) ? 0 : 1;
+                case 'J':
+                    if( jit_cache.empty() )
+                        DEBUG(-1, "prewarm: warning - no '-j <dir>' given before '-J'; nothing will be cached" << endl);
+                    return prewarm_jit_cache( optarg ) ? 0 : 1;
+                default:
+                   cerr << "Unknown option '" << option << "'" << endl;
+                   return -1;
+            }
+        }
+    }
+    catch( const exception& e ) {
+        cerr << get_basename(argv[0]) << ": " << e.what() << endl;
+        return 1;
+    }
+    Usage( get_basename(argv[0]) );
+    return -1;
+}
@@ -19,13 +19,19 @@
 //          7990 AA Dwingeloo
 #include <splitstuff.h>
 #include <map>
+#include <vector>
+#include <algorithm>
+#include <iomanip>
 #include <time.h>
 #include <strings.h>
+#include <sys/time.h>
 
 #include <evlbidebug.h>
 #include <stringutil.h>
 #include <fptrhelper.h>
+#include <mutex_locker.h>
 #include <sse_dechannelizer.h>
+#include <avx_dechannelizer.h>
 
 using namespace std;
 
@@ -55,6 +61,59 @@ functionmap_type mk_functionmap(void);
 
 static functionmap_type functionmap = mk_functionmap();
 
+// A number of splitters fused into one: the input block goes through
+// stage 0, each of its outputs through stage 1, etcetera. All but the
+// last stage write into scratch memory, the last stage writes the final
+// outputs. Final output n*nchunk(k) + m is output m of stage k applied to
+// output n of stage k-1, which is how coalescing_splitter would have
+// tagged them had the stages been separate steps.
+struct splitcascade_type {
+    struct stage_type {
+        splitproperties_type  splitprops;
+        unsigned int          blocksize;    // what each invocation splits
+        unsigned int          ch_len;       // what it produces, per chunk
+        unsigned int          ninput;       // how many invocations
+        size_t                scratchoffset;
+
+        stage_type(const splitproperties_type& sp, unsigned int bs, unsigned int cl,
+                   unsigned int ni, size_t so):
+            splitprops( sp ), blocksize( bs ), ch_len( cl ), ninput( ni ), scratchoffset( so )
+        {}
+    };
+    typedef std::vector<stage_type> stages_type;
+
+    // Each scratch chunk is padded; Mark K's sse-dechannelizing routines
+    // access 16 bytes past the end
+    static const unsigned int padding = 64;
+
+    stages_type   stages;
+    size_t        scratchsize;
+
+    splitcascade_type():
+        scratchsize( 0 )
+    {}
+
+    void split(void* block, unsigned char* const* out, unsigned char* scratch) const {
+        unsigned char* in[16] = {(unsigned char*)block};
+
+        for(stages_type::const_iterator s=stages.begin(); s!=stages.end(); s++) {
+            const bool         last = (s+1==stages.end());
+            const unsigned int n    = s->splitprops.nchunk();
+            unsigned char*     o[16];
+
+            for(unsigned int i=0; i<s->ninput*n; i++)
+                o[i] = (last ? out[i] : scratch + s->scratchoffset + i*(s->ch_len + padding));
+            for(unsigned int i=0; i<s->ninput; i++) {
+                unsigned char* dst[16] = {0};
+
+                std::copy(&o[i*n], &o[(i+1)*n], &dst[0]);
+                s->splitprops.split(in[i], s->blocksize, dst, 0);
+            }
+            std::copy(&o[0], &o[s->ninput*n], &in[0]);
+        }
+    }
+};
+
 splitproperties_type::splitproperties_type():
     impl( new spimpl_type() )
 {}
@@ -69,6 +128,48 @@ splitproperties_type::splitproperties_type(const string& nm, splitfunction f,
     impl( new spimpl_type(nm, f, e, h) )
 {}
 
+splitproperties_type::splitproperties_type(const string& nm, const dce_table_type* t,
+                                           const extractorconfig_type& e):
+    impl( new spimpl_type(nm, t, e) )
+{ SPLITASSERT2(t!=0, "Cannot create table driven extractor without table"); }
+
+// The cascade was built for a specific input; tell outheader() what the
+// last stage produces
+static complex<unsigned int> cascade_nchunk(const splitcascade_type* c, const headersearch_type& inheader) {
+    SPLITASSERT2(c && c->stages.size()>0, "Cannot create splitter from empty cascade");
+
+    const splitcascade_type::stage_type& last( c->stages.back() );
+
+    return complex<unsigned int>(last.ninput * last.splitprops.nchunk(),
+                                 (inheader.ntrack * last.ch_len)/inheader.payloadsize);
+}
+
+splitproperties_type::splitproperties_type(const string& nm, const splitcascade_type* c,
+                                           const headersearch_type& inheader):
+    impl( new spimpl_type(nm, c, cascade_nchunk(c, inheader)) )
+{}
+
+size_t splitproperties_type::scratchsize( void ) const {
+    return (impl->cascade ? impl->cascade->scratchsize : 0);
+}
+
+void splitproperties_type::split(void* block, unsigned int blocksize,
+                                 unsigned char* const* out, unsigned char* scratch) const {
+    if( impl->cascade ) {
+        impl->cascade->split(block, out, scratch);
+        return;
+    }
+    if( impl->table ) {
+        impl->table->extract(block, blocksize, out);
+        return;
+    }
+    impl->fnptr(block, blocksize,
+                out[0], out[1], out[2], out[3],
+                out[4], out[5], out[6], out[7],
+                out[8], out[9], out[10], out[11],
+                out[12], out[13], out[14], out[15]);
+}
+
 // natural accumulation is the number of input frames that need to be 
 // accumulated to have an outputsize in the each chunk equal to the 
 // number of bytes in an inputframe.
@@ -100,39 +201,69 @@ headersearch_type splitproperties_type::outheader( const headersearch_type& inhe
 }
 
 splitproperties_type::spimpl_type::spimpl_type():
-    config(0), nchunk(0), fnptr((splitfunction)0)
+    config(0), table(0), cascade(0), nchunk(0), fnptr((splitfunction)0)
 {}
 
 splitproperties_type::spimpl_type::spimpl_type(const string& nm, splitfunction f,
                                                complex<unsigned int> c, jit_handle h):
-    jit(h), name(nm), config(0), nchunk(c), fnptr(f)
+    jit(h), name(nm), config(0), table(0), cascade(0), nchunk(c), fnptr(f)
 {}
 
 splitproperties_type::spimpl_type::spimpl_type(const string& nm, splitfunction f,
                                                const extractorconfig_type& e, jit_handle h):
-    jit(h), name(nm), config(new extractorconfig_type(e)), fnptr(f)
+    jit(h), name(nm), config(new extractorconfig_type(e)), table(0), cascade(0), fnptr(f)
+{}
+
+splitproperties_type::spimpl_type::spimpl_type(const string& nm, const dce_table_type* t,
+                                               const extractorconfig_type& e):
+    name(nm), config(new extractorconfig_type(e)), table(t), cascade(0), fnptr((splitfunction)0)
+{}
+
+splitproperties_type::spimpl_type::spimpl_type(const string& nm, const splitcascade_type* c,
+                                               complex<unsigned int> n):
+    name(nm), config(0), table(0), cascade(c), nchunk(n), fnptr((splitfunction)0)
 {}
 
 splitproperties_type::spimpl_type::~spimpl_type() {
     delete config;
+    delete table;
+    delete cascade;
 }
 
 
-splitproperties_type find_splitfunction(const std::string& nm) {
-    splitproperties_type             rv;
-    functionmap_type::const_iterator sf = functionmap.find(nm);
+// Building a dynamic channel extractor is not free - certainly not when
+// compiling one - so keep the ones we built. Keyed by engine + the
+// canonical form of the extractor definition, such that differently
+// formatted definitions of the same extractor map to the same entry.
+// Holding on to the splitproperties also keeps compiled code loaded.
+typedef std::map<std::string, splitproperties_type> dcecache_type;
 
-    if( sf!=functionmap.end() ) {
-        rv = sf->second;
-    } else {
-        // see if we can parse the name as a channeldefinition
+static dcecache_type    dcecache;
+static pthread_mutex_t  dcecache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static splitproperties_type dynamic_channel_extractor(const extractorconfig_type& extractorconfig,
+                                                      dce_engine_type engine) {
+    ostringstream                oss;
+    ostringstream                key;
+    dcecache_type::iterator      cached;
+    mutex_locker                 locker( dcecache_lock );
+
+    oss << extractorconfig;
+    key << (engine==dce_compiled ? "compiled:" : "table:") << oss.str();
+
+    if( (cached=dcecache.find(key.str()))!=dcecache.end() ) {
+        DEBUG(4, "dynamic_channel_extractor: found " << key.str() << " in cache" << endl);
+        return cached->second;
+    }
+
+    splitproperties_type  rv;
+
+    if( engine==dce_compiled ) {
         string               dynamic_channel_extractor_code;
         jit_handle           jit;
-        ostringstream        oss;
         splitfunction        dce_fn;
-        extractorconfig_type extractorconfig( parse_dynamic_channel_extractor(nm) );
 
-        // The parsing went ok, now generate the code
+        // Generate the code
         dynamic_channel_extractor_code = generate_dynamic_channel_extractor(extractorconfig, "jive5ab_dce");
         DEBUG(4, "splitproperties_type: generated DynamicChannelExtractor code:" << endl <<
                  dynamic_channel_extractor_code << endl);
@@ -146,13 +277,305 @@ splitproperties_type find_splitfunction(const std::string& nm) {
         dce_fn = jit.jit_handle::function<splitfunction>("jive5ab_dce");
         SPLITASSERT2(dce_fn!=0, "could not extract symbol from dynamically loaded code?!");
 
-        // Now we can generate the actual splitproperties_type!
-        oss << extractorconfig;
         rv = splitproperties_type(oss.str(), dce_fn, extractorconfig, jit);
+    } else {
+        rv = splitproperties_type(oss.str(), new dce_table_type(extractorconfig), extractorconfig);
     }
+    dcecache.insert( make_pair(key.str(), rv) );
     return rv;
 }
 
+splitproperties_type find_splitfunction(const std::string& nm, dce_engine_type engine) {
+    functionmap_type::const_iterator sf = functionmap.find(nm);
+
+    if( sf!=functionmap.end() )
+        return sf->second;
+    // see if we can parse the name as a channeldefinition
+    return dynamic_channel_extractor(parse_dynamic_channel_extractor(nm), engine);
+}
+
+//
+//  Fusing chained splitters
+//
+// A splitter which only moves bits around is fully described by, for each
+// output channel, the input bit number each output bit came from. Bit
+// numbers count from the least significant bit of byte 0, which is also
+// how the dynamic channel extractor numbers them.
+typedef std::vector<unsigned int>  bitsource_type;    // output bit => input bit
+typedef std::vector<bitsource_type> gathermap_type;   // one per output channel
+
+typedef std::vector<unsigned char>  bytes_type;
+
+static inline bool getbit(const bytes_type& b, unsigned int bit) {
+    return (b[bit/8] & (0x1 << (bit%8)))!=0;
+}
+static inline void setbit(bytes_type& b, unsigned int bit) {
+    b[bit/8] = (unsigned char)(b[bit/8] | (0x1 << (bit%8)));
+}
+
+// Keeps the memory for running a splitter on one block
+struct splitterbench_type {
+    splitterbench_type(const splitproperties_type& s, unsigned int bs, unsigned int cl):
+        sp( s ), blocksize( bs ), ch_len( cl ),
+        in( bs + splitcascade_type::padding ), scratch( sp.scratchsize() + 1 ),
+        out( 16, bytes_type(cl + splitcascade_type::padding) )
+    {
+        for(unsigned int i=0; i<16; i++)
+            outptr[i] = &out[i][0];
+    }
+
+    void run( void ) {
+        for(unsigned int i=0; i<out.size(); i++)
+            std::fill(out[i].begin(), out[i].end(), 0);
+        sp.split(&in[0], blocksize, outptr, &scratch[0]);
+    }
+
+    const splitproperties_type sp;
+    const unsigned int         blocksize;
+    const unsigned int         ch_len;
+    bytes_type                 in;
+    bytes_type                 scratch;
+    std::vector<bytes_type>    out;
+    unsigned char*             outptr[16];
+};
+
+// Find out where each output bit of the splitter comes from when splitting
+// blocks of 'blocksize' bytes into chunks of 'ch_len' bytes.
+// Returns false if the splitter does something other than copying bits.
+static bool probe_splitter(const splitproperties_type& sp, unsigned int blocksize,
+                           unsigned int ch_len, gathermap_type& rv) {
+    const unsigned int  nch  = sp.nchunk();
+    const unsigned int  nin  = 8 * blocksize;
+    const unsigned int  nout = 8 * ch_len;
+    splitterbench_type  bench(sp, blocksize, ch_len);
+
+    SPLITASSERT2(nch>0 && nch<=16 && nout>0, "cannot probe splitter with " << nch << " channels of " << ch_len << " bytes");
+    rv = gathermap_type(nch, bitsource_type(nout, 0));
+
+    // Zeroes in must mean zeroes out, ones in must mean ones out -
+    // then each output bit is a copy of an input bit
+    bench.run();
+    for(unsigned int c=0; c<nch; c++)
+        for(unsigned int q=0; q<nout; q++)
+            if( getbit(bench.out[c], q) )
+                return false;
+    std::fill(bench.in.begin(), bench.in.begin()+blocksize, 0xff);
+    bench.run();
+    for(unsigned int c=0; c<nch; c++)
+        for(unsigned int q=0; q<nout; q++)
+            if( !getbit(bench.out[c], q) )
+                return false;
+
+    // Set all input bits that have bit 'b' set in their bit number; the
+    // output bits that light up have that bit set in their source bit number
+    for(unsigned int b=0; (nin-1)>>b; b++) {
+        std::fill(bench.in.begin(), bench.in.end(), 0);
+        for(unsigned int k=0; k<nin; k++)
+            if( (k>>b) & 0x1 )
+                setbit(bench.in, k);
+        bench.run();
+        for(unsigned int c=0; c<nch; c++)
+            for(unsigned int q=0; q<nout; q++)
+                if( getbit(bench.out[c], q) )
+                    rv[c][q] |= (0x1 << b);
+    }
+
+    // If it only copies bits, the map predicts the output for any input
+    uint32_t  lcg = 0x6a5d39e9;
+    for(unsigned int trial=0; trial<2; trial++) {
+        for(unsigned int i=0; i<blocksize; i++) {
+            lcg          = lcg*1664525 + 1013904223;
+            bench.in[i]  = (unsigned char)(lcg >> 24);
+        }
+        bench.run();
+        for(unsigned int c=0; c<nch; c++)
+            for(unsigned int q=0; q<nout; q++)
+                if( rv[c][q]>=nin || getbit(bench.out[c], q)!=getbit(bench.in, rv[c][q]) )
+                    return false;
+    }
+    return true;
+}
+
+// Seconds per block
+static double time_splitter(const splitproperties_type& sp, unsigned int blocksize, unsigned int ch_len) {
+    unsigned int        n = 0;
+    struct timeval      start, now;
+    splitterbench_type  bench(sp, blocksize, ch_len);
+
+    ::gettimeofday(&start, 0);
+    do {
+        for(unsigned int i=0; i<16; i++, n++)
+            sp.split(&bench.in[0], blocksize, bench.outptr, &bench.scratch[0]);
+        ::gettimeofday(&now, 0);
+    } while( (now.tv_sec - start.tv_sec)*1000000 + (now.tv_usec - start.tv_usec) < 20000 );
+    return ((now.tv_sec - start.tv_sec) + (now.tv_usec - start.tv_usec)/1.0e6) / n;
+}
+
+// Apply 'second' to each channel of 'first'. 'second' was probed for
+// blocks of 'blocksize' bytes, 'first' for a single input frame. Output
+// channel c of first + channel j of second becomes channel c*nchunk2 + j
+// (that is how coalescing_splitter tags them).
+static bool compose_gathermap(const gathermap_type& first, const gathermap_type& second,
+                              unsigned int blocksize, gathermap_type& rv) {
+    rv.clear();
+    for(unsigned int c=0; c<first.size(); c++) {
+        for(unsigned int j=0; j<second.size(); j++) {
+            const size_t   n1 = first[c].size(), n2 = second[j].size();
+            bitsource_type composed;
+
+            // how many of second's output bits come from one frame's worth
+            // of first's output
+            if( (n1 * n2) % (8 * blocksize) )
+                return false;
+            for(size_t q=0; q<(n1 * n2)/(8 * blocksize); q++) {
+                if( second[j][q]>=n1 )
+                    return false;
+                composed.push_back( first[c][ second[j][q] ] );
+            }
+            rv.push_back( composed );
+        }
+    }
+    return true;
+}
+
+// See if the map repeats itself every <=64 input bits; that is what the
+// dynamic channel extractor can do
+static bool gathermap_to_channellist(const gathermap_type& m, unsigned int nin,
+                                     unsigned int& bitsperinput, channellist_type& channels) {
+    const size_t nout = m[0].size();
+
+    for(unsigned int w=1; w<=64; w++) {
+        bool         ok = true;
+        const size_t b  = (nout * w) / nin;
+
+        if( (nin % w) || ((nout * w) % nin) || b==0 )
+            continue;
+        for(unsigned int c=0; ok && c<m.size(); c++) {
+            ok = (m[c].size()==nout);
+            for(size_t q=0; ok && q<nout; q++)
+                ok = (m[c][q%b]<w && m[c][q]==m[c][q%b] + (q/b)*w);
+        }
+        if( !ok )
+            continue;
+        bitsperinput = w;
+        channels.clear();
+        for(unsigned int c=0; c<m.size(); c++)
+            channels.push_back( channelbitlist_type(m[c].begin(), m[c].begin()+b) );
+        return true;
+    }
+    return false;
+}
+
+static bool same_format(const headersearch_type& l, const headersearch_type& r) {
+    return l.frameformat==r.frameformat && l.ntrack==r.ntrack &&
+           l.trackbitrate==r.trackbitrate && l.payloadsize==r.payloadsize;
+}
+
+// Verify that the fused splitter produces what the chain would
+static bool verify_fused(const splitproperties_type& fused, const headersearch_type& inheader,
+                         const headersearch_type& chainheader, const gathermap_type& chainmap) {
+    gathermap_type           fusedmap;
+    const headersearch_type  fusedhdr( fused.outheader(inheader) );
+
+    return same_format(fusedhdr, chainheader) &&
+           probe_splitter(fused, inheader.payloadsize, inheader.payloadsize*fusedhdr.ntrack/inheader.ntrack, fusedmap) &&
+           fusedmap==chainmap;
+}
+
+splitproperties_type fuse_splitfunctions(const string& nm, const vector<splitproperties_type>& stages,
+                                         const headersearch_type& inheader, dce_engine_type engine) {
+    try {
+        gathermap_type                     composite;
+        splitcascade_type                  cascade;
+        splitproperties_type               cascaded, dce;
+        countedpointer<headersearch_type>  curhdr( new headersearch_type(inheader) );
+
+        SPLITASSERT2(stages.size()>1, "need at least two splitters to fuse");
+
+        for(unsigned int i=0, ninput=1, blocksize=inheader.payloadsize; i<stages.size(); i++) {
+            const splitproperties_type&  sp( stages[i] );
+            gathermap_type               stagemap, newcomposite;
+            const headersearch_type      outhdr( sp.outheader(*curhdr) );
+            // as computed by splitterargs; in the chain the stage gets
+            // accumulated frames, in the cascade one frame's worth
+            const unsigned int           ch_len( curhdr->payloadsize*outhdr.ntrack / curhdr->ntrack );
+            const unsigned int           cascade_ch_len( blocksize*outhdr.ntrack / curhdr->ntrack );
+
+            if( !probe_splitter(sp, curhdr->payloadsize, ch_len, stagemap) ) {
+                DEBUG(2, "fuse_splitfunctions: " << sp.name() << " does not just copy bits, cannot fuse" << endl);
+                return splitproperties_type();
+            }
+            if( i==0 )
+                composite = stagemap;
+            else if( compose_gathermap(composite, stagemap, curhdr->payloadsize, newcomposite) )
+                composite = newcomposite;
+            else {
+                DEBUG(2, "fuse_splitfunctions: cannot compose " << sp.name() << " with previous stages" << endl);
+                return splitproperties_type();
+            }
+            curhdr = countedpointer<headersearch_type>( new headersearch_type(outhdr) );
+
+            cascade.stages.push_back( splitcascade_type::stage_type(sp, blocksize, cascade_ch_len, ninput, cascade.scratchsize) );
+            if( i+1<stages.size() )
+                cascade.scratchsize += ninput * sp.nchunk() * (cascade_ch_len + splitcascade_type::padding);
+            ninput   *= sp.nchunk();
+            blocksize = cascade_ch_len;
+        }
+        if( composite.size()>16 ) {
+            DEBUG(2, "fuse_splitfunctions: " << nm << " produces " << composite.size() << " chunks, max is 16" << endl);
+            return splitproperties_type();
+        }
+        // Now that the cascade is complete we can create the real thing
+        cascaded = splitproperties_type(nm, new splitcascade_type(cascade), inheader);
+
+        if( !verify_fused(cascaded, inheader, *curhdr, composite) ) {
+            // e.g. Mark K's routines need the block to be a multiple of
+            // 16 bytes, the chain gets accumulated blocks, we get one frame
+            DEBUG(2, "fuse_splitfunctions: cascaded splitter for " << nm << " does not reproduce the chain" << endl);
+            cascaded = splitproperties_type();
+        }
+
+        // See if it can be done by a dynamic channel extractor
+        unsigned int      bitsperinput;
+        channellist_type  channels;
+
+        if( gathermap_to_channellist(composite, 8*inheader.payloadsize, bitsperinput, channels) ) {
+            dce = dynamic_channel_extractor(extractorconfig_type(bitsperinput, channels), engine);
+            if( !verify_fused(dce, inheader, *curhdr, composite) ) {
+                DEBUG(-1, "fuse_splitfunctions: dynamic channel extractor for " << nm << " does not reproduce the chain!" << endl);
+                dce = splitproperties_type();
+            }
+        }
+
+        // Pick the fastest
+        const unsigned int ch_len( composite[0].size()/8 );
+
+        if( cascaded.nchunk() && dce.nchunk() ) {
+            const double  tc = time_splitter(cascaded, inheader.payloadsize, ch_len);
+            const double  td = time_splitter(dce, inheader.payloadsize, ch_len);
+
+            DEBUG(2, "fuse_splitfunctions: " << nm << " cascaded " << tc*1.0e6 << "us, dynamic channel extractor " <<
+                     td*1.0e6 << "us per frame" << endl);
+            if( td<tc )
+                cascaded = splitproperties_type();
+            else
+                dce = splitproperties_type();
+        }
+        if( dce.nchunk() ) {
+            DEBUG(1, "fuse_splitfunctions: " << nm << " fused into " << bitsperinput << " > ... (" << dce.nchunk() << " channels)" << endl);
+            return dce;
+        }
+        if( cascaded.nchunk() ) {
+            DEBUG(1, "fuse_splitfunctions: " << nm << " fused into cascade of " << stages.size() << " splitters" << endl);
+            return cascaded;
+        }
+    }
+    catch( const std::exception& e ) {
+        DEBUG(-1, "fuse_splitfunctions: failed to fuse " << nm << " - " << e.what() << endl);
+    }
+    return splitproperties_type();
+}
+
 // Mark K's dechannelization routines have a different calling sequence than
 // we do, fix that in here
 void marks_2Ch2bit1to2(void* block, unsigned int blocksize, void* d0, void* d1) {
@@ -188,6 +611,116 @@ void harros_16Ch2bit1to2(void* block, unsigned int blocksize, void* d0, void* d1
                                                  d8, d9, d10, d11, d12, d13, d14, d15);
 }
 
+// The sse dechannelizers which have avx2 and avx512 counterparts. At
+// start-up the widest one the CPU supports is selected - provided it
+// produces exactly the same output as the sse version.
+struct widesplitter_type {
+    const char*    name;
+    unsigned int   nchunk;
+    splitfunction  variant[3];
+};
+typedef std::vector<widesplitter_type> widesplitters_type;
+
+static const char* const   variant_name[] = { "sse", "avx2", "avx512" };
+static const unsigned int  nvariant = sizeof(variant_name)/sizeof(variant_name[0]);
+
+static widesplitters_type mk_widesplitters( void ) {
+    widesplitters_type             rv;
+    function_caster<splitfunction> caster;
+#define WIDESPLITTER(fn, n) \
+    do { \
+        const widesplitter_type  w = { #fn, n, {caster(&fn), caster(&fn##_avx2), caster(&fn##_avx512)} }; \
+        rv.push_back( w ); \
+    } while( 0 )
+    WIDESPLITTER(extract_8Ch2bit1to2_hv, 8);
+    WIDESPLITTER(extract_8Ch2bit_hv, 8);
+    WIDESPLITTER(split16bitby2, 2);
+    WIDESPLITTER(split16bitby4, 4);
+    WIDESPLITTER(split8bitby4, 4);
+    WIDESPLITTER(split32bitby2, 2);
+    WIDESPLITTER(swap_sign_mag, 1);
+#undef WIDESPLITTER
+    return rv;
+}
+
+static bool have_variant(unsigned int v) {
+    switch( v ) {
+        case 0:  return true;
+        case 1:  return have_avx2_dechannelizers();
+        case 2:  return have_avx512_dechannelizers();
+        default: break;
+    }
+    return false;
+}
+
+// Compare the output of variant 'v' to the sse version on random data,
+// using block sizes that also exercise the leftover handling
+static bool verify_variant(const widesplitter_type& w, unsigned int v) {
+    const unsigned int  blocksizes[] = { 64, 100, 1000, 8000, 10000, 10016 };
+    uint32_t            lcg = 0x2545f491;
+
+    for(unsigned int b=0; b<sizeof(blocksizes)/sizeof(blocksizes[0]); b++) {
+        const unsigned int  bs( blocksizes[b] );
+        splitterbench_type  ref(splitproperties_type(w.name, w.variant[0], w.nchunk), bs, bs/w.nchunk);
+        splitterbench_type  wide(splitproperties_type(w.name, w.variant[v], w.nchunk), bs, bs/w.nchunk);
+
+        for(unsigned int i=0; i<bs; i++) {
+            lcg           = lcg*1664525 + 1013904223;
+            ref.in[i]     = wide.in[i] = (unsigned char)(lcg >> 24);
+        }
+        ref.run();
+        wide.run();
+        for(unsigned int c=0; c<w.nchunk; c++)
+            if( !std::equal(ref.out[c].begin(), ref.out[c].begin()+bs/w.nchunk, wide.out[c].begin()) )
+                return false;
+    }
+    return true;
+}
+
+static splitfunction select_splitfunction(splitfunction f) {
+    static const widesplitters_type  widesplitters = mk_widesplitters();
+
+    for(widesplitters_type::const_iterator w=widesplitters.begin(); w!=widesplitters.end(); w++) {
+        if( w->variant[0]!=f )
+            continue;
+        for(unsigned int v=nvariant-1; v>0; v--)
+            if( have_variant(v) && verify_variant(*w, v) )
+                return w->variant[v];
+        break;
+    }
+    return f;
+}
+
+bool test_splitfunctions(std::ostream& os) {
+    bool                      ok = true;
+    // Mark5B frames' payload; not a multiple of 64
+    const unsigned int        bs = 10000;
+    const widesplitters_type  widesplitters = mk_widesplitters();
+
+    for(widesplitters_type::const_iterator w=widesplitters.begin(); w!=widesplitters.end(); w++) {
+        const splitfunction  selected = select_splitfunction(w->variant[0]);
+
+        os << w->name << ":" << endl;
+        for(unsigned int v=0; v<nvariant; v++) {
+            os << "   " << variant_name[v] << ": ";
+            if( !have_variant(v) ) {
+                os << "not supported" << endl;
+                continue;
+            }
+            if( v>0 && !verify_variant(*w, v) ) {
+                os << "DIFFERENT OUTPUT" << endl;
+                ok = false;
+                continue;
+            }
+            const double t = time_splitter(splitproperties_type(w->name, w->variant[v], w->nchunk), bs, bs/w->nchunk);
+
+            os << (v>0 ? "bit-exact, " : "") << std::fixed << std::setprecision(0) << (bs/t)/1.0e6 << " MB/s"
+               << (w->variant[v]==selected ? " [selected]" : "") << endl;
+        }
+    }
+    return ok;
+}
+
 // All available splitfunctions go here
 functionmap_type mk_functionmap( void ) {
     functionmap_type               rv;
@@ -207,7 +740,7 @@ functionmap_type mk_functionmap( void ) {
                                                           8))).second );
     SPLITASSERT( rv.insert(make_pair("8Ch2bit1to2_hv",
                                      splitproperties_type("extract_8Ch2bit1to2_hv",
-                                                          caster(&extract_8Ch2bit1to2_hv)/*harros_8Ch2bit1to2*/,
+                                                          select_splitfunction(caster(&extract_8Ch2bit1to2_hv))/*harros_8Ch2bit1to2*/,
                                                           8))).second );
     SPLITASSERT( rv.insert(make_pair("8Ch2bit",
                                      splitproperties_type("extract_8Ch2bit",
@@ -215,7 +748,7 @@ functionmap_type mk_functionmap( void ) {
                                                           8))).second );
     SPLITASSERT( rv.insert(make_pair("8Ch2bit_hv",
                                      splitproperties_type("extract_8Ch2bit_hv",
-                                                          caster(&extract_8Ch2bit_hv),
+                                                          select_splitfunction(caster(&extract_8Ch2bit_hv)),
                                                           8))).second );
     SPLITASSERT( rv.insert(make_pair("16Ch2bit1to2",
                                      splitproperties_type("extract_16Ch2bit1to2",
@@ -227,23 +760,23 @@ functionmap_type mk_functionmap( void ) {
                                                           16))).second );
     SPLITASSERT( rv.insert(make_pair("16bitx2",
                                      splitproperties_type("split16bitby2",
-                                                          caster(&split16bitby2),
+                                                          select_splitfunction(caster(&split16bitby2)),
                                                           2))).second );
     SPLITASSERT( rv.insert(make_pair("16bitx4",
                                      splitproperties_type("split16bitby4",
-                                                          caster(&split16bitby4),
+                                                          select_splitfunction(caster(&split16bitby4)),
                                                           4))).second );
     SPLITASSERT( rv.insert(make_pair("8bitx4",
                                      splitproperties_type("split8bitby4",
-                                                          caster(&split8bitby4),
+                                                          select_splitfunction(caster(&split8bitby4)),
                                                           4))).second );
     SPLITASSERT( rv.insert(make_pair("32bitx2",
                                      splitproperties_type("split32bitby2",
-                                                          caster(&split32bitby2),
+                                                          select_splitfunction(caster(&split32bitby2)),
                                                           2))).second );
     SPLITASSERT( rv.insert(make_pair("swap_sign_mag",
                                      splitproperties_type("swap sign/mag",
-                                                          caster(&swap_sign_mag),
+                                                          select_splitfunction(caster(&swap_sign_mag)),
                                                           1))).second );
 
     return rv;
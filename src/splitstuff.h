@@ -27,6 +27,8 @@
 
 #include <jit.h>
 #include <string>
+#include <vector>
+#include <iostream>
 #include <ezexcept.h>
 #include <headersearch.h>
 #include <countedpointer.h>
@@ -34,6 +36,15 @@
 
 DECLARE_EZEXCEPT(spliterror)
 
+// Defined in splitstuff.cc, see fuse_splitfunctions()
+struct splitcascade_type;
+
+// Dynamic channel extractors ("[..]" splitters) can be done in-process,
+// using lookup tables, or by generating C code and having the system's
+// compiler turn it into a shared library. The latter is usually faster
+// but takes seconds to build and needs a compiler on the system.
+enum dce_engine_type { dce_table, dce_compiled };
+
 // For a function to be considered a splitfunction it should have this
 // signature.
 // "The system" will call your function with 16 pointers.
@@ -69,6 +80,19 @@ struct splitproperties_type {
     splitproperties_type(const std::string& nm, splitfunction f,
                          const extractorconfig_type& e, jit_handle h = jit_handle());
 
+    // A table driven dynamic channel extractor. Takes ownership of the
+    // table.
+    splitproperties_type(const std::string& nm, const dce_table_type* t,
+                         const extractorconfig_type& e);
+
+    // A number of splitters fused into one, only valid for the given input
+    // format. Takes ownership of the cascade.
+    splitproperties_type(const std::string& nm, const splitcascade_type* c,
+                         const headersearch_type& inheader);
+
+    // Fused splitters and table driven extractors do not have a function
+    // pointer - use split()
+    // below to do the actual splitting
     splitfunction      fnptr( void ) {
         return impl->fnptr;
     }
@@ -79,6 +103,15 @@ struct splitproperties_type {
         return impl->name;
     }
 
+    // Fused splitters need scratch memory of this many bytes, per thread
+    size_t             scratchsize( void ) const;
+
+    // Split the block into nchunk() pieces at out[0], out[1], ...
+    // 'out' must have 16 entries, as the splitfunction gets 16 pointers.
+    // 'scratch' must point at scratchsize() bytes
+    void               split(void* block, unsigned int blocksize,
+                             unsigned char* const* out, unsigned char* scratch) const;
+
     // Return the resultant header when this split/accumulate is
     // applied to the given input format
     headersearch_type outheader(const headersearch_type& inheader,
@@ -91,6 +124,10 @@ struct splitproperties_type {
                         std::complex<unsigned int> c, jit_handle h);
             spimpl_type(const std::string& nm, splitfunction f,
                         const extractorconfig_type& e, jit_handle h);
+            spimpl_type(const std::string& nm, const dce_table_type* t,
+                        const extractorconfig_type& e);
+            spimpl_type(const std::string& nm, const splitcascade_type* c,
+                        std::complex<unsigned int> n);
             ~spimpl_type();
 
             // In case we were dynamically compiled + loaded - this object 
@@ -99,6 +136,8 @@ struct splitproperties_type {
             jit_handle                        jit;
             const std::string                 name;
             const extractorconfig_type*       config;
+            const dce_table_type*             table;
+            const splitcascade_type*          cascade;
             const std::complex<unsigned int>  nchunk;
             const splitfunction               fnptr;
         };
@@ -109,6 +148,36 @@ struct splitproperties_type {
 
 // Keep a global registry of defined splitfunctions, allow lookup by name.
 // May return NULL / 0 if the indicated splitfunction can't be found
-splitproperties_type find_splitfunction(const std::string& nm);
+// Names that aren't registered are parsed as a dynamic channel extractor
+// definition, which is built using the indicated engine. Extractors are
+// cached by their (canonical) definition so asking for the same one again
+// is cheap.
+splitproperties_type find_splitfunction(const std::string& nm, dce_engine_type engine = dce_table);
+
+// Chaining splitters ("16bitx2+8bitx4") means every stage is a separate
+// step, writing its output to memory for the next step to read back.
+// This function fuses the chain into one splitter, which takes each input
+// frame through all stages in one go. There are two ways of doing that:
+//   * run the stages one after the other on each frame, with the
+//     intermediate results in small, cache-resident, scratch memory
+//   * if all stages only move bits around (which all of ours do), the
+//     whole chain may be expressible as one dynamic channel extractor
+//     (at most 16 channels, input period <= 64 bits), built using 'engine'
+// Both are verified against the chain by feeding test patterns through it
+// and the fastest one is returned.
+// The total number of output chunks can be at most 16 and all stages must
+// use natural accumulation.
+// Returns an empty splitproperties_type (nchunk()==0) if the chain cannot be
+// fused, the caller should then use the individual stages.
+splitproperties_type fuse_splitfunctions(const std::string& nm,
+                                         const std::vector<splitproperties_type>& stages,
+                                         const headersearch_type& inheader,
+                                         dce_engine_type engine = dce_table);
+
+// For each of the dechannelizers that have avx2/avx512 versions, check
+// that all versions the CPU supports produce the same output as the sse
+// version and measure their throughput. Returns false if any of them
+// does not produce the same output.
+bool test_splitfunctions(std::ostream& os);
 
 #endif
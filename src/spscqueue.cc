@@ -0,0 +1,167 @@
+// benchmark the lock-free single producer/single consumer queue
+// Copyright (C) 2007-2008 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.nl
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <spscqueue.h>
+#include <blockpool.h>
+#include <pacer.h>       // for monotonic_ns()
+#include <pthreadcall.h>
+#include <stringutil.h>
+#include <iomanip>
+#include <vector>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+using namespace std;
+
+
+namespace {
+    // Pin the calling thread to the cpu. Negative cpu => leave it to the
+    // scheduler. Returns a description of what happened
+    string pin_to(int cpu) {
+        if( cpu<0 )
+            return "not pinned";
+#ifdef __linux__
+        cpu_set_t   cpus;
+
+        CPU_ZERO( &cpus );
+        CPU_SET( cpu, &cpus );
+        if( ::pthread_setaffinity_np(::pthread_self(), sizeof(cpus), &cpus)==0 )
+            return "cpu " + repr(cpu);
+        return "cpu " + repr(cpu) + " FAILED, not pinned";
+#else
+        return "not pinned (unsupported)";
+#endif
+    }
+
+    // The consumer checks that the sequence numbers in the blocks arrive
+    // in order and none are lost, then drops its reference to the block,
+    // like the last step in a chain does
+    template <typename Queue>
+    struct consumer_type {
+        Queue&    queue;
+        int       cpu;
+        uint64_t  nitem;
+        uint64_t  nbad;
+        string    pinned;
+
+        consumer_type(Queue& q, int c):
+            queue( q ), cpu( c ), nitem( 0 ), nbad( 0 )
+        {}
+
+        static void* run(void* args) {
+            block           b;
+            uint64_t        seqnr;
+            consumer_type*  self = (consumer_type*)args;
+
+            self->pinned = pin_to( self->cpu );
+            while( self->queue.pop(b) ) {
+                ::memcpy(&seqnr, b.iov_base, sizeof(seqnr));
+                if( seqnr!=self->nitem )
+                    self->nbad++;
+                self->nitem++;
+                b = block();
+            }
+            return (void*)0;
+        }
+    };
+
+    template <typename Queue>
+    bool q_run(const char* name, unsigned int qlen, uint64_t nitem, unsigned int bs,
+               int cpu_p, int cpu_c, ostream& os) {
+        Queue                  queue( qlen );
+        pthread_t              tid;
+        blockpool_type         pool( bs, qlen+2 );
+        consumer_type<Queue>   consumer( queue, cpu_c );
+        const string           pinned( pin_to(cpu_p) );
+
+        // Warm up the pool such that we don't time its allocations
+        {
+            vector<block>  tmp;
+            for(unsigned int i=0; i<qlen+2; i++)
+                tmp.push_back( pool.get() );
+        }
+
+        PTHREAD_CALL( ::pthread_create(&tid, 0, &consumer_type<Queue>::run, (void*)&consumer) );
+
+        const uint64_t  t0 = monotonic_ns();
+        for(uint64_t i=0; i<nitem; i++) {
+            block   b = pool.get();
+
+            ::memcpy(b.iov_base, &i, sizeof(i));
+            if( !queue.push(b) )
+                break;
+        }
+        // let the consumer empty the queue before it is told to stop
+        queue.delayed_disable();
+        PTHREAD_CALL( ::pthread_join(tid, 0) );
+        const double    dt = (double)(monotonic_ns() - t0)/1.0e9;
+
+        os << "   " << std::setw(9) << std::left << name << std::right
+           << std::fixed << std::setprecision(2)
+           << std::setw(8) << ((double)consumer.nitem/dt)/1.0e6 << " Mblocks/s  "
+           << std::setw(7) << (dt*1.0e9)/(double)consumer.nitem << " ns/block"
+           << "  [producer " << pinned << ", consumer " << consumer.pinned << "]" << endl;
+
+        if( consumer.nitem!=nitem || consumer.nbad ) {
+            os << "FAIL received " << consumer.nitem << " blocks, " << consumer.nbad << " out of sequence" << endl;
+            return false;
+        }
+        return true;
+    }
+}
+
+bool test_spscqueue(const string& spec, ostream& os) {
+    unsigned long             qlen = 32, mitem = 10, bs = 8192;
+    int                       cpu_p = -1, cpu_c = -1;
+    const vector<string>      parts( ::split(spec, ',') );
+    char*                     eocptr;
+
+    if( parts.size()>0 && !parts[0].empty() )
+        qlen = ::strtoul(parts[0].c_str(), &eocptr, 0);
+    if( parts.size()>1 && !parts[1].empty() )
+        mitem = ::strtoul(parts[1].c_str(), &eocptr, 0);
+    if( parts.size()>2 && !parts[2].empty() )
+        bs = ::strtoul(parts[2].c_str(), &eocptr, 0);
+    if( parts.size()>3 && !parts[3].empty() ) {
+        const vector<string>  cpus( ::split(parts[3], ':') );
+
+        if( cpus.size()!=2 ) {
+            os << "Invalid cpu pinning '" << parts[3] << "' - use <producer cpu>:<consumer cpu>" << endl;
+            return false;
+        }
+        cpu_p = (int)::strtol(cpus[0].c_str(), &eocptr, 0);
+        cpu_c = (int)::strtol(cpus[1].c_str(), &eocptr, 0);
+    }
+    if( qlen==0 || mitem==0 || bs<sizeof(uint64_t) ) {
+        os << "Invalid queue test '" << spec << "'" << endl;
+        return false;
+    }
+    const uint64_t  nitem = (uint64_t)mitem*1000000;
+
+    os << "one producer, one consumer, queue length " << qlen << ", " << nitem << " blocks of "
+       << bs << " bytes, " << ::sysconf(_SC_NPROCESSORS_ONLN) << " cpus online" << endl;
+    return q_run< bqueue<block> >("bqueue", (unsigned int)qlen, nitem, (unsigned int)bs, cpu_p, cpu_c, os) &&
+           q_run< spscqueue<block> >("spscqueue", (unsigned int)qlen, nitem, (unsigned int)bs, cpu_p, cpu_c, os);
+}
@@ -0,0 +1,278 @@
+// lock-free single producer/single consumer queue for threads
+// Copyright (C) 2007-2008 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.nl
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef EVLBI5A_SPSCQUEUE_H
+#define EVLBI5A_SPSCQUEUE_H
+
+#include <bqueue.h>
+#include <sched.h>
+#include <string>
+#include <iostream>
+
+// A bounded ring of 'capacity' elements which supports exactly ONE thread
+// pushing and ONE thread popping. It has the same enable/disable/
+// delayed_disable semantics as bqueue<> (the chain relies on those) but
+// as long as there is room to push or something to pop, push() and pop()
+// don't take a lock, nor do they signal a condition variable.
+//
+// Only when the queue is full (push) or empty (pop) the thread falls back
+// to blocking on a condition variable. The other side only takes the
+// mutex + signals if it sees that someone is actually waiting.
+// Both sides announce what they're doing before they check the state of
+// the other side (followed by a full memory barrier) so no wake up can
+// be missed.
+//
+// disable() must be able to clear the queue. It cannot do that whilst a
+// push() or pop() is in progress - those don't hold a lock so they
+// advertise themselves being busy; disable() waits for both to be done.
+//
+// Element must be default constructible, copyable and assignable.
+// Popped slots are overwritten with a default constructed Element such
+// that e.g. a block's memory goes back to its pool straight away.
+#define SPSC_LOAD(p)      __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define SPSC_STORE(p, v)  __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define SPSC_FENCE()      __atomic_thread_fence(__ATOMIC_SEQ_CST)
+// store + full barrier in one go (on x86 a single xchg, cheaper than mfence)
+#define SPSC_XSTORE(p, v) __atomic_store_n(p, v, __ATOMIC_SEQ_CST)
+
+template <typename Element>
+class spscqueue {
+    public:
+        typedef unsigned int  capacity_type;
+
+        // Create an enabled queue that can hold up to 'cap' elements
+        spscqueue(capacity_type cap):
+            nslot( nonzero(cap)+1 ), ring( new Element[nslot] )
+        {
+            head = tail = 0;
+            push_busy = pop_busy = push_wait = pop_wait = 0;
+            enable_push = enable_pop = 1;
+            PTHREAD_CALL( ::pthread_mutex_init(&mutex, 0) );
+            PTHREAD_CALL( ::pthread_cond_init(&condition_pop, 0) );
+            PTHREAD_CALL( ::pthread_cond_init(&condition_push, 0) );
+        }
+
+        // Disable the queue: threads waiting to push or pop are woken up
+        // and return false. The contents of the queue are discarded
+        void disable( void ) {
+            SPSC_STORE(&enable_push, 0);
+            SPSC_STORE(&enable_pop, 0);
+            SPSC_FENCE();
+            broadcast();
+
+            // Wait for a push() and/or pop() in progress to finish before
+            // we clear the queue
+            while( SPSC_LOAD(&push_busy) || SPSC_LOAD(&pop_busy) )
+                ::sched_yield();
+            clear_ring();
+        }
+
+        // Disallow pushing; popping is allowed until the queue is empty,
+        // at which point popping becomes disabled as well
+        void delayed_disable( void ) {
+            SPSC_STORE(&enable_push, 0);
+            SPSC_FENCE();
+            broadcast();
+        }
+
+        // (re-)enable and clear the queue. Only when no-one is using it!
+        void enable( void ) {
+            clear_ring();
+            SPSC_STORE(&enable_push, 1);
+            SPSC_STORE(&enable_pop, 1);
+            SPSC_FENCE();
+        }
+
+        // push(): only returns false if the queue is disabled.
+        //         Otherwise waits for space to become available.
+        bool push( const Element& b ) {
+            unsigned int  t, nt;
+            bool          did_push = false;
+
+            SPSC_XSTORE(&push_busy, 1);
+
+            t  = tail;
+            nt = next(t);
+            // Full? Then we must wait
+            if( SPSC_LOAD(&enable_push) && nt==SPSC_LOAD(&head) ) {
+                FASTPTHREAD_CALL( ::pthread_mutex_lock(&mutex) );
+                push_wait = 1;
+                SPSC_FENCE();
+                while( SPSC_LOAD(&enable_push) && nt==SPSC_LOAD(&head) )
+                    FASTPTHREAD_CALL( ::pthread_cond_wait(&condition_push, &mutex) );
+                push_wait = 0;
+                FASTPTHREAD_CALL( ::pthread_mutex_unlock(&mutex) );
+            }
+            if( (did_push=(SPSC_LOAD(&enable_push)!=0)) ) {
+                ring[t] = b;
+                SPSC_XSTORE(&tail, nt);
+                // Only need to wake the popper if it is waiting
+                if( SPSC_LOAD(&pop_wait) )
+                    signal(condition_pop);
+            }
+            SPSC_STORE(&push_busy, 0);
+            return did_push;
+        }
+
+        // pop(): Wait indefinitely for something to be present
+        //        in the queue or a queue-cancellation.
+        bool pop( Element& b ) {
+            return this->pop_impl(b, 0)==pop_success;
+        }
+
+        // pop(): Id. but only wait until absolute_time
+        pop_result_type pop( Element& b, const struct timespec& absolute_time ) {
+            return this->pop_impl(b, &absolute_time);
+        }
+
+        ~spscqueue() throw(pthreadexception) {
+            delete [] ring;
+            PTHREAD_CALL( ::pthread_cond_destroy(&condition_pop) );
+            PTHREAD_CALL( ::pthread_cond_destroy(&condition_push) );
+            PTHREAD_CALL( ::pthread_mutex_destroy(&mutex) );
+        }
+
+    private:
+        // Keep the producer's and consumer's indices on separate cache
+        // lines - the whole point is to not have them bounce between the
+        // cores all the time.
+        const unsigned int  nslot;
+        Element* const      ring;
+        char                pad0[64];
+        unsigned int        head;
+        int                 pop_busy;
+        int                 pop_wait;
+        char                pad1[64];
+        unsigned int        tail;
+        int                 push_busy;
+        int                 push_wait;
+        char                pad2[64];
+        int                 enable_push;
+        int                 enable_pop;
+        pthread_cond_t      condition_pop;
+        pthread_cond_t      condition_push;
+        pthread_mutex_t     mutex;
+
+        // no modulo (= integer division) in the fast path
+        inline unsigned int next( unsigned int i ) const {
+            return (++i==nslot) ? 0 : i;
+        }
+
+        static capacity_type nonzero( capacity_type cap ) {
+            if( cap==0 )
+                throw pthreadexception(std::string("spscqueue: capacity must be >0"));
+            return cap;
+        }
+
+        pop_result_type pop_impl( Element& b, const struct timespec* absolute_time ) {
+            int             timed = 0;
+            unsigned int    h;
+            pop_result_type result = pop_disabled;
+
+            SPSC_XSTORE(&pop_busy, 1);
+
+            while( SPSC_LOAD(&enable_pop) ) {
+                h = head;
+                if( h!=SPSC_LOAD(&tail) ) {
+                    b       = ring[h];
+                    ring[h] = Element();
+                    SPSC_XSTORE(&head, next(h));
+                    // Only need to wake the pusher if it is waiting
+                    if( SPSC_LOAD(&push_wait) )
+                        signal(condition_push);
+                    result = pop_success;
+                    break;
+                }
+                // Queue is empty. If pushing is disabled we're done, as
+                // soon as we're sure that there is no push() in flight
+                // that got in just before the delayed_disable()
+                if( SPSC_LOAD(&enable_push)==0 ) {
+                    while( SPSC_LOAD(&push_busy) )
+                        ::sched_yield();
+                    if( head==SPSC_LOAD(&tail) )
+                        SPSC_STORE(&enable_pop, 0);
+                    continue;
+                }
+                if( timed==ETIMEDOUT ) {
+                    result = pop_timeout;
+                    break;
+                }
+                // Nothing to pop, wait until something happens
+                FASTPTHREAD_CALL( ::pthread_mutex_lock(&mutex) );
+                pop_wait = 1;
+                SPSC_FENCE();
+                while( SPSC_LOAD(&enable_pop) && SPSC_LOAD(&enable_push) &&
+                       h==SPSC_LOAD(&tail) && timed!=ETIMEDOUT ) {
+                    if( absolute_time ) {
+                        PTHREAD_TIMEDWAIT( (timed = ::pthread_cond_timedwait(&condition_pop, &mutex, absolute_time)),
+                                           if ( ::pthread_mutex_unlock(&mutex) ) PTINFO(" (in cleanup: mutex unlocking failed)") ; );
+                    } else {
+                        FASTPTHREAD_CALL( ::pthread_cond_wait(&condition_pop, &mutex) );
+                    }
+                }
+                pop_wait = 0;
+                FASTPTHREAD_CALL( ::pthread_mutex_unlock(&mutex) );
+            }
+            SPSC_STORE(&pop_busy, 0);
+            return result;
+        }
+
+        void signal( pthread_cond_t& cond ) {
+            FASTPTHREAD_CALL( ::pthread_mutex_lock(&mutex) );
+            FASTPTHREAD_CALL( ::pthread_cond_signal(&cond) );
+            FASTPTHREAD_CALL( ::pthread_mutex_unlock(&mutex) );
+        }
+
+        void broadcast( void ) {
+            PTHREAD_CALL( ::pthread_mutex_lock(&mutex) );
+            PTHREAD_CALL( ::pthread_cond_broadcast(&condition_push) );
+            PTHREAD_CALL( ::pthread_cond_broadcast(&condition_pop) );
+            PTHREAD_CALL( ::pthread_mutex_unlock(&mutex) );
+        }
+
+        // Only to be called when no push() or pop() is in progress
+        void clear_ring( void ) {
+            for(unsigned int i=0; i<nslot; i++)
+                ring[i] = Element();
+            head = tail = 0;
+            SPSC_FENCE();
+        }
+
+        // do not support copy/assignment
+        spscqueue();
+        spscqueue( const spscqueue<Element>& );
+        const spscqueue<Element>& operator=( const spscqueue<Element>& );
+};
+
+#undef SPSC_LOAD
+#undef SPSC_STORE
+#undef SPSC_FENCE
+#undef SPSC_XSTORE
+
+
+// Pass blocks from a blockpool, each carrying a sequence number, from one
+// thread to another through a bqueue<> and through an spscqueue<> of the
+// same length, report the throughput and check that all blocks arrived in
+// order. 'spec' is
+// "[<queue length>][,<million blocks>][,<block size>][,<cpu>:<cpu>]"
+// (default 32,10,8192, threads not pinned); the optional last field pins
+// the producer and the consumer to the given cpus.
+bool test_spscqueue(const std::string& spec, std::ostream& os);
+
+#endif
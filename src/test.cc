@@ -25,8 +25,11 @@
 #include <map>
 #include <set>
 #include <vector>
+#include <list>
+#include <deque>
 #include <algorithm>
 #include <locale>
+#include <fstream>
 
 // our own stuff
 #include <dosyscall.h>
@@ -52,6 +55,8 @@
 #include <mk6info.h>
 #include <sciprint.h>
 #include <sfxc_binary_command.h>
+#include <blockpool.h>
+#include <cmdworkers.h>
 
 // system headers (for sockets and, basically, everything else :))
 #include <time.h>
@@ -89,27 +94,36 @@ bool is_member(int fd, const fdset_type& fds) {
 
 struct per_rt_data {
     int         owner;     // fd of owner if >=0. If owner goes, then also the runtime
+    bool        busy;      // a command is executing in the background in this runtime
+    bool        doomed;    // delete the runtime as soon as it is not busy anymore
     runtime*    rteptr;
     fdset_type  observers;
 
     per_rt_data(runtime* r):
-        owner( -1 ), rteptr( r )
+        owner( -1 ), busy( false ), doomed( false ), rteptr( r )
     {}
     per_rt_data(runtime* r, int o):
-        owner( o ), rteptr( r )
+        owner( o ), busy( false ), doomed( false ), rteptr( r )
     {}
 };
 
 typedef map<string, per_rt_data> runtimemap_type;
 
 // Per connection (file descriptor) keep track of the echo setting and which
-// runtime it referred to
+// runtime it referred to.
+// Whilst the commands of a line are being processed, we also keep the ones
+// not done yet and the reply so far: processing may have to wait for a
+// command that is executing in the background.
 struct per_fd_data {
-    bool    echo;
-    string  runtime;
+    bool           echo;
+    bool           crlf;      // terminate the reply with \r\n in stead of \n
+    bool           inflight;  // one of our commands executes in the background
+    string         runtime;
+    string         reply;
+    deque<string>  pending;
 
     per_fd_data(bool e):
-        echo( e )
+        echo( e ), crlf( false ), inflight( false )
     {}
 };
 
@@ -187,6 +201,13 @@ void unobserve(int fd, fdmap_type& fdm, runtimemap_type& rtm) {
         if( currtm->second.owner==fd )
             rts_to_erase.push_back( currtm );
     for(erase_type::iterator eraseptr=rts_to_erase.begin(); eraseptr!=rts_to_erase.end(); eraseptr++) {
+        // A command is still executing in it, can't delete it now
+        if( (*eraseptr)->second.busy ) {
+            DEBUG(4, "unobserve: delete runtime " << (*eraseptr)->first << " when its command is done because fd#" << fd << " is gone" << endl);
+            (*eraseptr)->second.owner  = -1;
+            (*eraseptr)->second.doomed = true;
+            continue;
+        }
         DEBUG(4, "unobserve: delete runtime " << (*eraseptr)->first << " because fd#" << fd << " is gone" << endl);
         delete (*eraseptr)->second.rteptr;
         rtm.erase( *eraseptr );
@@ -404,7 +425,8 @@ void Usage( const char* name ) {
                                      mk6_bs(mk6info_type::minBlockSizeMap[true]);
     cout <<
 "Usage: " << name << " [-hned6*] [-m <level>] [-c <card>] [-p <port>] [-S <where>]\n"
-"              [-S <where>] [-f <fmt>] [-B <size>]\n\n"
+"              [-S <where>] [-f <fmt>] [-B <size>] [-M <flags>]\n"
+"              [-j <dir>]\n\n"
 "   -h,--help  this message\n"
 "   -n, --no-buffering\n"
 "              do not 'buffer' - recorded data is NOT put into memory\n"
@@ -436,6 +458,12 @@ void Usage( const char* name ) {
 "              Defaults for the formats: \n"
 "                  vbs: " << vbs_bs << " (" << minbs_print_type(vbs_bs, "Byte") << ")\n"
 "                  mk6: " << mk6_bs << " (" << minbs_print_type(mk6_bs, "Byte") << ")\n"
+"   -M, --pool-memory <flags>\n"
+"              comma separated list of how to allocate memory for the\n"
+"              block pools used in transfers:\n"
+"                 huge  = use 2MB huge pages if available\n"
+"                 local = bind to the NUMA node of the allocating thread\n"
+"              Default: plain memory (see 'memstat?' for usage)\n"
 "   -*, --allow-root\n"
 "              do NOT drop privileges before accepting input\n"
 "              this may be necessary to capture data from\n"
@@ -445,7 +473,16 @@ void Usage( const char* name ) {
 "              recognized formats for <where> are\n"
 "                <where> = [0-9]+ => open TCP server on port <where>\n"
 "                <where> = *      => open UNIX server on path <where>\n"
-"              Default: do not listen for SFXC binary commands\n";
+"              Default: do not listen for SFXC binary commands\n"
+"   -j, --jit-cache <dir>\n"
+"              keep compiled code (trackmask compressors, 'compiled'\n"
+"              dynamic channel extractors) in <dir> and reuse it across\n"
+"              runs; <dir> is created if it does not exist. <dir> must\n"
+"              be owned by the user jive5ab runs as and not be writable\n"
+"              by group or others, cached files likewise.\n"
+"              Default: compile on each use, do not cache\n"
+"              The code can be compiled in advance, see the\n"
+"              '--jit-prewarm' option of the jive5ab-selftest program\n";
     return;
 }
 
@@ -576,6 +613,9 @@ string process_runtime_command( bool qry,
         if ( rt_iter == rtm.end() ) {
             return string("!runtime = 6 : no active runtime '") + rt_name + "' ;";
         }
+        if ( rt_iter->second.busy ) {
+            return string("!runtime = 6 : '") + rt_name + "' is busy executing a command ;";
+        }
 
         if ( fdmptr->second.runtime == rt_name ) {
             // if the runtime to delete is the current one, 
@@ -589,6 +629,175 @@ string process_runtime_command( bool qry,
     return string("!runtime = 0 : ") + fdmptr->second.runtime + " ;"; 
 }
 
+// Execute the pending commands of control connection fdmptr, appending the
+// replies to its reply.
+// Returns true if all were done and the reply can be sent. If false is
+// returned, either a command was handed to the command workers
+// (fdmptr->second.inflight is true) or the next command has to wait for
+// its runtime to finish executing a command in the background.
+bool process_commands( fdmap_type::iterator fdmptr,
+                       runtimemap_type& runtimes,
+                       mk5commandmap_type const& rt0_mk5cmds,
+                       mk5commandmap_type const& generic_mk5cmds,
+                       cmdworkers_type& cmdworkers ) {
+    per_fd_data&  fdd( fdmptr->second );
+
+    while( !fdd.pending.empty() ) {
+        bool                               qry;
+        string                             keyword;
+        const string                       cmd( fdd.pending.front() );
+        vector<string>                     args;
+        string::size_type                  posn;
+        mk5commandmap_type::const_iterator cmdptr;
+
+        fdd.pending.pop_front();
+
+        if( cmd.empty() )
+            continue;
+        DEBUG((fdd.echo?2:10000), "Processing command '" << cmd << "'" << endl);
+
+        // find out if it was a query or not
+        if( (posn=cmd.find_first_of("?="))==string::npos ) {
+            fdd.reply += ("!syntax = 7 : Not a command or query;");
+            continue;
+        }
+        qry     = (cmd[posn]=='?');
+        keyword = ::tolower( cmd.substr(0, posn) );
+        if( keyword.empty() ) {
+            fdd.reply += "!syntax = 7 : No keyword given ;";
+            continue;
+        }
+
+        // now get the arguments, if any
+        // (split everything after '?' or '=' at ':'s and each
+        // element is an argument)
+        args = ::split(cmd.substr(posn+1), ':');
+        // stick the keyword in at the first position
+        args.insert(args.begin(), keyword);
+
+        // see if we know about this specific command
+        try {
+            if( keyword == "runtime" ) {
+                // select a runtime to pass to the functions
+                fdd.reply += process_runtime_command( qry, args, fdmptr, runtimes);
+            } else if( keyword=="echo" ) {
+                // turn command echoing on or off
+                if( qry ) {
+                    ostringstream tmp;
+                    tmp << "!echo? 0 : " << (fdd.echo?"on":"off") << " ;";
+                    fdd.reply += tmp.str();
+                } else if( args.size()!=2 || !(args[1]=="on" || args[1]=="off") ) {
+                    fdd.reply += string("!echo= 8 : expects exactly one parameter 'on' or 'off';") ;
+                } else {
+                    // already verified we have 'on' or 'off'
+                    fdd.echo = (args[1]=="on");
+                    fdd.reply += string("!echo= 0 ;");
+                }
+            } else {
+                mk5commandmap_type const& mk5cmds = ( fdd.runtime==default_runtime ? rt0_mk5cmds : generic_mk5cmds );
+                if( (cmdptr=mk5cmds.find(keyword))==mk5cmds.end() ) {
+                    fdd.reply += (string("!")+keyword+((qry)?('?'):('='))+" 7 : ENOSYS - not implemented ;");
+                    continue;
+                }
+
+                // Check if the runtime we are observing is
+                // still the one when we started observing
+                runtimemap_type::iterator   rt_iter = current_runtime(fdmptr, runtimes);
+
+                if ( rt_iter == runtimes.end() ) {
+                    fdd.reply += string("!")+keyword+" " + QRY(qry) + " 4 : current runtime ('" + fdd.runtime + "') has been deleted;";
+                }
+                else if( rt_iter->second.busy && !cmd_is_fast(keyword, qry) ) {
+                    // Commands for a runtime execute in the order they
+                    // were received, so this one has to wait
+                    DEBUG(4, "fd#" << fdmptr->first << " '" << cmd << "' waits for runtime " << rt_iter->first << endl);
+                    fdd.pending.push_front( cmd );
+                    return false;
+                }
+                else if( cmd_is_slow(keyword, qry) ) {
+                    rt_iter->second.busy = true;
+                    fdd.inflight         = true;
+                    cmdworkers.submit( new cmdjob_type(fdmptr->first, rt_iter->first, rt_iter->second.rteptr,
+                                                       cmdptr->second, qry, args) );
+                    return false;
+                }
+                else {
+                    fdd.reply += execute_mk5cmd(cmdptr->second, qry, args, *rt_iter->second.rteptr);
+                    protect_countdown( *rt_iter->second.rteptr );
+                }
+            }
+        }
+        catch( const exception& e ) {
+            fdd.reply += string("!")+keyword+" " + QRY(qry) + " 4 : " + e.what() + ";";
+        }
+        catch( ... ) {
+            fdd.reply += string("!")+keyword+" " + QRY(qry) + " 4 : unknown exception ;";
+        }
+    }
+    return true;
+}
+
+// Send the reply to the commands of control connection fdmptr (connected
+// to 'peer'). Returns false if the connection failed
+bool send_reply( fdmap_type::iterator fdmptr, string const& peer ) {
+    ssize_t       nwrite;
+    per_fd_data&  fdd( fdmptr->second );
+
+    if( fdd.reply.empty() ) {
+        DEBUG(4, "No command(s) found, no reply sent" << endl);
+        return true;
+    }
+    // processed all commands in the string. send the reply
+    DEBUG((fdd.echo?2:10000), "Reply: " << fdd.reply << endl);
+    // do *not* forget the \r\n ...!
+    // HV: 18-nov-2011 see main() near 'const bool crlf =...';
+    if( fdd.crlf )
+        fdd.reply += "\r\n";
+    else
+        fdd.reply += "\n";
+
+    nwrite = ::write(fdmptr->first, fdd.reply.c_str(), fdd.reply.size());
+    fdd.reply.clear();
+    // if <=0, socket was closed
+    if( nwrite<=0 ) {
+        if( nwrite<0 ) {
+            lastsyserror_type lse;
+            DEBUG(0, "Error on fd#" << fdmptr->first << " [" << peer << "] - " << lse << endl);
+        }
+        return false;
+    }
+    return true;
+}
+
+// Continue processing the commands of control connection fd, which
+// was waiting for a runtime or for a command executing in the background.
+// If all commands are done, send the reply. Connections that fail are
+// closed and forgotten about.
+// Returns true if fd doesn't have to wait anymore
+bool continue_commands( int fd,
+                        fdmap_type& fdmap,
+                        runtimemap_type& runtimes,
+                        fdprops_type& acceptedfds,
+                        mk5commandmap_type const& rt0_mk5cmds,
+                        mk5commandmap_type const& generic_mk5cmds,
+                        cmdworkers_type& cmdworkers ) {
+    fdmap_type::iterator   fdmptr = fdmap.find( fd );
+    fdprops_type::iterator fdptr  = acceptedfds.find( fd );
+
+    EZASSERT2(fdmptr!=fdmap.end() && fdptr!=acceptedfds.end(), bookkeeping,
+              EZINFO("fd#" << fd << " has commands pending but is not in fdmap/acceptedfds administration"));
+
+    if( !process_commands(fdmptr, runtimes, rt0_mk5cmds, generic_mk5cmds, cmdworkers) )
+        return fdmptr->second.inflight;
+
+    if( !send_reply(fdmptr, fdptr->second) ) {
+        ::close( fd );
+        ::unobserve(fd, fdmap, runtimes);
+        acceptedfds.erase( fdptr );
+    }
+    return true;
+}
+
 typedef enum { no_sfxc = 0, lissen_tcp, lissen_unix } sfxc_lissen_type;
 
 // main!
@@ -646,6 +855,7 @@ int main(int argc, char** argv) {
         long int     v;
         S_BANKMODE   bankmode = SS_BANKMODE_NORMAL;
         unsigned int minimum_bs = 0;
+        string       jit_cache;
 
         struct option  longopts[] = {
             { "echo",          no_argument,       NULL, 'e' },
@@ -662,11 +872,13 @@ int main(int argc, char** argv) {
             { "sfxc-port",     required_argument, NULL, 'S' },
             { "min-block-size",required_argument, NULL, 'B' },
             { "allow-root",    no_argument,       NULL, '*' },
+            { "pool-memory",   required_argument, NULL, 'M' },
+            { "jit-cache",     required_argument, NULL, 'j' },
             // Leave this one as last
             { NULL,            0,                 NULL, 0   }
         };
 
-        while( (option=::getopt_long(argc, argv, "nbehdm:c:p:r:6*f:S:B:", longopts, NULL))>=0 ) {
+        while( (option=::getopt_long(argc, argv, "nbehdm:c:p:r:6*f:S:B:M:j:", longopts, NULL))>=0 ) {
             switch( option ) {
                 case '*':
                     // ok .. someone might allow us to run with root privilege!
@@ -820,6 +1032,29 @@ int main(int argc, char** argv) {
                         minimum_bs = (unsigned int)bs;
                     }
                     break;
+                case 'M':
+                    // How to allocate memory for the block pools
+                    {
+                        unsigned int          flags = pool_mem_default;
+                        const vector<string>  parts = ::split(string(optarg), ',', true);
+
+                        for(vector<string>::const_iterator p=parts.begin(); p!=parts.end(); p++) {
+                            if( *p=="huge" )
+                                flags |= pool_mem_hugepage;
+                            else if( *p=="local" )
+                                flags |= pool_mem_local;
+                            else {
+                                cerr << "Unknown pool memory flag '" << *p << "'" << endl
+                                     << "   choose from 'huge' and/or 'local'" << endl;
+                                return -1;
+                            }
+                        }
+                        set_pool_memory_flags( flags );
+                    }
+                    break;
+                case 'j':
+                    jit_cache = optarg;
+                    break;
                 default:
                    cerr << "Unknown option '" << option << "'" << endl;
                    return -1;
@@ -942,6 +1177,11 @@ int main(int argc, char** argv) {
             }
         }
 
+        // Only now set up the JIT cache, we do not want root to own
+        // the cached code
+        if( !jit_cache.empty() )
+            jit_set_cachedir( jit_cache );
+
         if ( xlrdev ) {
             // Now that we have done (1) I/O board detection and (2)
             // have access to the streamstor we can finalize our
@@ -1112,6 +1352,16 @@ int main(int argc, char** argv) {
         // for the other runtimes we always use the generic command map
         generic_mk5cmds = make_generic_commandmap( do_buffering_mapping );
 
+        // The thread that executes the slow commands. Only one: the
+        // commands were written to be executed one at a time and some
+        // keep state in (function) static variables that are shared
+        // between all runtimes.
+        // Control connections that have to wait for a runtime to finish a
+        // command executing in the background are kept in the order they
+        // have to go in
+        cmdworkers_type    cmdworkers( 1 );
+        list<int>          waitingfds;
+
 
         // Goodie! Now set up for accepting incoming command-connections!
         // getsok() will throw if no socket can be created
@@ -1148,6 +1398,8 @@ int main(int argc, char** argv) {
             //      over the same fd. 
             //    * 'sfxcfds' => accepted SFXC DataReader 
             //
+            //    * 'cmddone' => the command workers write on
+            //      this fd when a command they executed has finished
             // 'cmdsockoffs' is the offset into the "struct pollfd fds[]"
             // variable at which the oridnary command connections start.
             // 'cmdsockoffs'+accedptedfds.size() is the extent of the normal
@@ -1157,14 +1409,15 @@ int main(int argc, char** argv) {
             const unsigned int           signalidx    = 1;
             const unsigned int           rotidx       = 2;
             const unsigned int           sfxcidx      = 3;
-            const unsigned int           cmdsockoffs  = 4;
+            const unsigned int           cmddoneidx   = 4;
+            const unsigned int           cmdsockoffs  = 5;
             // we need to fix those values here because the
             // acceptedfds/acceptedsfxcfds may change size below - e.g. if
             // clients made a connection. But those (new) fd's won't be in
             // the current list of fd's
             const unsigned int           n_jive5ab    = acceptedfds.size();
             const unsigned int           n_sfxc       = acceptedsfxcfds.size(); 
-            const unsigned int           nrfds        = 4 + n_jive5ab/*acceptedfds.size()*/ + n_sfxc/*acceptedsfxcfds.size()*/;
+            const unsigned int           nrfds        = 5 + n_jive5ab/*acceptedfds.size()*/ + n_sfxc/*acceptedsfxcfds.size()*/;
             const unsigned int           nrlistenfd   = 2;
             const unsigned int           listenfds[2] = {listenidx, sfxcidx};
             char const * const           names[2]     = {"jive5ab", "sfxc"};
@@ -1194,10 +1447,22 @@ int main(int argc, char** argv) {
             fds[sfxcidx].fd        = sfxcsok;
             fds[sfxcidx].events    = POLLIN|POLLPRI|POLLERR|POLLHUP;
 
-            // Loop over the accepted connections
+            // Position 'cmddoneidx' is where the command workers tell us
+            // they've finished a command
+            fds[cmddoneidx].fd     = cmdworkers.fd();
+            fds[cmddoneidx].events = POLLIN|POLLPRI|POLLERR|POLLHUP;
+
+            // Loop over the accepted connections.
+            // Connections that are still busy processing commands are
+            // not listened to (poll(2) ignores negative fds): we can only
+            // start on their next command(s) when they're done
             for(idx=cmdsockoffs, curfd=acceptedfds.begin();
                 curfd!=acceptedfds.end(); idx++, curfd++ ) {
-                fds[idx].fd     = curfd->first;
+                fdmap_type::const_iterator  fdmptr = fdmap.find( curfd->first );
+                const bool                  busy   = (fdmptr!=fdmap.end() &&
+                                                      (fdmptr->second.inflight || !fdmptr->second.pending.empty()));
+
+                fds[idx].fd     = (busy ? -1 : curfd->first);
                 fds[idx].events = POLLIN|POLLPRI|POLLERR|POLLHUP;
             }
             // And append the accepted SFXC client connections
@@ -1255,6 +1520,49 @@ int main(int argc, char** argv) {
                 break;
             }
 
+            // Collect the commands that finished executing in the
+            // background and continue processing the commands of the
+            // connections they were from. Then, in order, those that were
+            // waiting for a runtime that may now be available
+            if( (events=fds[cmddoneidx].revents)!=0 ) {
+                cmdjoblist_type           jobs( cmdworkers.finished() );
+                list<int>::iterator       firstwaiting = waitingfds.begin();
+
+                DEBUG(5, "cmddone got " << eventor(events) << endl);
+                for(cmdjoblist_type::iterator curjob=jobs.begin(); curjob!=jobs.end(); curjob++) {
+                    cmdjob_type*              job = *curjob;
+                    fdmap_type::iterator      fdmptr = fdmap.find( job->fd );
+                    runtimemap_type::iterator rtmptr = runtimes.find( job->rtname );
+
+                    EZASSERT2(fdmptr!=fdmap.end() && rtmptr!=runtimes.end() && rtmptr->second.rteptr==job->rteptr,
+                              bookkeeping, EZINFO("finished command from fd#" << job->fd << " in runtime '"
+                                                  << job->rtname << "' not in fdmap/runtimemap administration"));
+                    DEBUG(4, "fd#" << job->fd << " '" << job->args[0] << QRY(job->qry) << "' in runtime "
+                             << job->rtname << " finished" << endl);
+
+                    protect_countdown( *job->rteptr );
+                    rtmptr->second.busy = false;
+                    if( rtmptr->second.doomed ) {
+                        DEBUG(4, "main: delete runtime " << rtmptr->first << " because its owner is gone" << endl);
+                        delete rtmptr->second.rteptr;
+                        runtimes.erase( rtmptr );
+                    }
+                    fdmptr->second.inflight  = false;
+                    fdmptr->second.reply    += job->reply;
+                    delete job;
+
+                    // This one goes before the ones that had to wait for it
+                    waitingfds.insert( firstwaiting, fdmptr->first );
+                }
+                for(list<int>::iterator curwait=waitingfds.begin(); curwait!=waitingfds.end(); ) {
+                    if( ::continue_commands(*curwait, fdmap, runtimes, acceptedfds,
+                                            rt0_mk5cmds, generic_mk5cmds, cmdworkers) )
+                        waitingfds.erase( curwait++ );
+                    else
+                        curwait++;
+                }
+            }
+
             // check for new incoming connections
             for(unsigned int itmp=0; itmp<nrlistenfd; itmp++) {
                 const unsigned int fd_idx = listenfds[itmp];
@@ -1383,7 +1691,7 @@ int main(int argc, char** argv) {
                 // if stuff may be read, see what we can make of it
                 if( events&POLLIN ) {
                     char                           linebuf[4096];
-                    ssize_t                        nread, nwrite;
+                    ssize_t                        nread;
 
                     // attempt to read a line
                     nread = ::read(fd, linebuf, sizeof(linebuf));
@@ -1439,9 +1747,7 @@ int main(int argc, char** argv) {
                     // And we need sanitizing variables ...
                     char*                          sptr;
                     char*                          eptr;
-                    string                         reply;
                     vector<string>                 commands;
-                    vector<string>::const_iterator curcmd;
 
                     // HV: 18-nov-2012
                     //     telnet sends \r\n, tstdimino sends a separate \n
@@ -1479,123 +1785,18 @@ int main(int argc, char** argv) {
                     // Even if we did receive only whitespace, we still need to
                     // send back *something*. A single ';' for an empty command should
                     // be just fine
-                    for( curcmd=commands.begin(); curcmd!=commands.end(); curcmd++ ) {
-                        bool                               qry;
-                        string                             keyword;
-                        const string&                      cmd( *curcmd );
-                        vector<string>                     args;
-                        string::size_type                  posn;
-                        mk5commandmap_type::const_iterator cmdptr;
-
-                        if( cmd.empty() )
-                            continue;
-                        DEBUG((fdmptr->second.echo?2:10000), "Processing command '" << cmd << "'" << endl);
-
-                        // find out if it was a query or not
-                        if( (posn=cmd.find_first_of("?="))==string::npos ) {
-                            reply += ("!syntax = 7 : Not a command or query;");
-                            continue;
-                        }
-                        qry     = (cmd[posn]=='?');
-                        keyword = ::tolower( cmd.substr(0, posn) );
-                        if( keyword.empty() ) {
-                            reply += "!syntax = 7 : No keyword given ;";
-                            continue;
-                        }
+                    fdmptr->second.crlf = crlf;
+                    fdmptr->second.pending.assign( commands.begin(), commands.end() );
 
-                        // now get the arguments, if any
-                        // (split everything after '?' or '=' at ':'s and each
-                        // element is an argument)
-                        args = ::split(cmd.substr(posn+1), ':');
-                        // stick the keyword in at the first position
-                        args.insert(args.begin(), keyword);
-
-                        // see if we know about this specific command
-                        try {
-                            if( keyword == "runtime" ) {
-                                // select a runtime to pass to the functions
-                                reply += process_runtime_command( qry, args, fdmptr, runtimes);
-                            } else if( keyword=="echo" ) {
-                                // turn command echoing on or off
-                                if( qry ) {
-                                    ostringstream tmp;
-                                    tmp << "!echo? 0 : " << (fdmptr->second.echo?"on":"off") << " ;";
-                                    reply += tmp.str();
-                                } else if( args.size()!=2 || !(args[1]=="on" || args[1]=="off") ) {
-                                    reply += string("!echo= 8 : expects exactly one parameter 'on' or 'off';") ;
-                                } else {
-                                    // already verified we have 'on' or 'off'
-                                    fdmptr->second.echo = (args[1]=="on");
-                                    reply += string("!echo= 0 ;");
-                                }
-                            } else {
-                                mk5commandmap_type& mk5cmds = ( fdmptr->second.runtime==default_runtime ? rt0_mk5cmds : generic_mk5cmds );
-                                if( (cmdptr=mk5cmds.find(keyword))==mk5cmds.end() ) {
-                                    reply += (string("!")+keyword+((qry)?('?'):('='))+" 7 : ENOSYS - not implemented ;");
-                                    continue;
-                                }
-                                
-                                // Check if the runtime we are observing is
-                                // still the one when we started observing
-                                runtimemap_type::iterator   rt_iter = current_runtime(fdmptr, runtimes);
-
-                                if ( rt_iter == runtimes.end() ) {
-                                    reply += string("!")+keyword+" " + QRY(qry) + " 4 : current runtime ('" + fdmptr->second.runtime + "') has been deleted;";
-                                }
-                                else {
-                                    runtime* rteptr = rt_iter->second.rteptr;
-
-                                    try {
-                                        reply += cmdptr->second(qry, args, *rteptr);
-                                    } 
-                                    catch (...) {
-                                        // do the protect=off bookkeeping
-                                        rteptr->protected_count = max(rteptr->protected_count, 1u) - 1;
-                                        throw;
-                                    }
-                                    // do the protect=off bookkeeping
-                                    rteptr->protected_count = max(rteptr->protected_count, 1u) - 1;
-                                }
-                            }
-                        }
-                        catch( const Error_Code_6_Exception& e) {
-                            reply += string("!")+keyword+" " + QRY(qry) + " 6 : " + e.what() + ";";
-                        }
-                        catch( const Error_Code_8_Exception& e) {
-                            reply += string("!")+keyword+" " + QRY(qry) + " 8 : " + e.what() + ";";
-                        }
-                        catch( const cmdexception& e ) {
-                            reply += string("!")+keyword+" " + QRY(qry) + " 6 : " + e.what() + ";";
-                        }
-                        catch( const exception& e ) {
-                            reply += string("!")+keyword+" " + QRY(qry) + " 4 : " + e.what() + ";";
-                        }
-                        catch( ... ) {
-                            reply += string("!")+keyword+" " + QRY(qry) + " 4 : unknown exception ;";
-                        }
-                    }
-
-                    if( reply.empty() ) {
-                        DEBUG(4, "No command(s) found, no reply sent" << endl);
-                        break;
+                    if( !::process_commands(fdmptr, runtimes, rt0_mk5cmds, generic_mk5cmds, cmdworkers) ) {
+                        // Reply will be sent when the commands are done
+                        if( !fdmptr->second.inflight )
+                            waitingfds.push_back( fd );
+                        continue;
                     }
-                    // processed all commands in the string. send the reply
-                    DEBUG((fdmptr->second.echo?2:10000), "Reply: " << reply << endl);
-                    // do *not* forget the \r\n ...!
-                    // HV: 18-nov-2011 see above near 'const bool crlf =...';
-                    if( crlf )
-                        reply += "\r\n";
-                    else
-                        reply += "\n";
 
-                    nwrite = ::write(fd, reply.c_str(), reply.size());
-                    // if <=0, socket was closed, remove it from the list
-                    if( nwrite<=0 ) {
-                        if( nwrite<0 ) {
-                            lastsyserror_type lse;
-                            DEBUG(0, "Error on fd#" << fdptr->first << " ["
-                                  << fdptr->second << "] - " << lse << endl);
-                        }
+                    // if sending fails, socket was closed, remove it from the list
+                    if( !::send_reply(fdmptr, fdptr->second) ) {
                         ::close( fdptr->first );
                         ::unobserve(fdptr->first, fdmap, runtimes);
                         fdprops.erase( fdptr );
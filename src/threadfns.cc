@@ -36,6 +36,7 @@
 #include <sciprint.h>
 #include <boyer_moore.h>
 #include <mk6info.h>
+#include <pktring.h>
 #include <sse_dechannelizer.h>
 #include <hex.h>
 #include <libudt5ab/udt.h>
@@ -45,6 +46,9 @@
 #include <carrayutil.h>
 #include <auto_array.h>
 #include <countedpointer.h>
+#include <mutex_locker.h>
+#include <zerocopy.h>
+#include <filemap.h>
 
 #include <sstream>
 #include <string>
@@ -54,6 +58,7 @@
 #include <queue>
 #include <list>
 #include <map>
+#include <set>
 #include <stdexcept>
 
 #include <sys/time.h>
@@ -233,8 +238,7 @@ void* delayed_play_fn( void* dplay_args_ptr ) {
 }
 
 string blockpool_memstat_fn(blockpool_type* bp) {
-    bp->show_usecnt();
-    return string("blockpool status");
+    return bp->status() + " : " + pool_memory_status();
 }
 
 void fillpatterngenerator(outq_type<block>* outq, sync_type<fillpatargs>* args) {
@@ -1044,14 +1048,10 @@ void udpsreaderv4(outq_type<block>* outq, sync_type<fdreaderargs>* args) {
 
     // Create a blockpool. If we need blocks we take'm from there
     // HV: 13-11-2013 If blocksize seems too large, do not allocate
-    //                more than ~2GB/turn [which would be ~4 chunks
-    //                for vlbi_streamer mode in 512MB/chunk] or 32 blocks.
-    //                Only go for 2GB per allocation if we 
-    //                *really* have to!
-    const unsigned int  onegig = 1024*1024*1024;
-    const unsigned int  twogig = 2*onegig;
-    const unsigned int  nb = ((onegig/blocksize)<4?(twogig/blocksize):
-                              (blocksize<sensible_blocksize?32:onegig/blocksize));
+    //                32 blocks at a time [vlbi_streamer mode has
+    //                256-512MB/chunk]. The readahead buffer + a couple
+    //                in flight downstream will do.
+    const unsigned int  nb = (blocksize<sensible_blocksize ? 32 : readahead+2);
     SYNCEXEC(args,
              delete network->threadid; network->threadid = new pthread_t(::pthread_self());
              network->pool = new blockpool_type(blocksize, nb));
@@ -2382,7 +2382,88 @@ struct dsm_entry {
         dsm_entry(); // No default c'tor
 };
 
-typedef std::map<datastream_id, dsm_entry> ds_map_type;
+// The per-packet "datastream id -> collection state" lookup. Datastream ids
+// are handed out by datastream_mgmt_type densely, starting from 0, so a
+// vector indexed by datastream id does the job much faster than a
+// std::map. It supports the subset of the std::map interface used in the
+// readers, including the property that iterators remain valid when other
+// elements are inserted or erased.
+class ds_map_type {
+    public:
+        typedef std::pair<const datastream_id, dsm_entry>  value_type;
+
+        class iterator {
+            friend class ds_map_type;
+            public:
+                iterator(): map( 0 ), node( 0 ) {}
+
+                value_type& operator*( void ) const  { return *node; }
+                value_type* operator->( void ) const { return node; }
+                iterator& operator++( void ) {
+                    node = map->next(node->first + 1);
+                    return *this;
+                }
+                iterator operator++( int ) {
+                    iterator  old( *this );
+                    ++(*this);
+                    return old;
+                }
+                bool operator==(iterator const& o) const { return node==o.node; }
+                bool operator!=(iterator const& o) const { return node!=o.node; }
+
+            private:
+                ds_map_type const* map;
+                value_type*        node;
+
+                iterator(ds_map_type const* m, value_type* n): map( m ), node( n ) {}
+        };
+        typedef iterator const_iterator;
+
+        ds_map_type() {}
+
+        iterator begin( void ) const {
+            return iterator(this, this->next(0));
+        }
+        iterator end( void ) const {
+            return iterator(this, 0);
+        }
+        iterator find(datastream_id dsid) const {
+            return iterator(this, (dsid<nodes.size()) ? nodes[dsid] : 0);
+        }
+        std::pair<iterator, bool> insert(value_type const& v) {
+            if( v.first>=nodes.size() )
+                nodes.resize(v.first+1, 0);
+            if( nodes[v.first] )
+                return std::make_pair(iterator(this, nodes[v.first]), false);
+            nodes[v.first] = new value_type(v);
+            return std::make_pair(iterator(this, nodes[v.first]), true);
+        }
+        void erase(iterator p) {
+            nodes[p->first] = 0;
+            delete p.node;
+        }
+
+        ~ds_map_type() {
+            for(nodes_type::iterator p=nodes.begin(); p!=nodes.end(); p++)
+                delete *p;
+        }
+
+    private:
+        friend class iterator;
+        typedef std::vector<value_type*> nodes_type;
+        nodes_type   nodes;
+
+        value_type* next(datastream_id dsid) const {
+            for( ; dsid<nodes.size(); dsid++)
+                if( nodes[dsid] )
+                    return nodes[dsid];
+            return 0;
+        }
+
+        // no copying
+        ds_map_type(ds_map_type const&);
+        ds_map_type const& operator=(ds_map_type const&);
+};
 
 void udpsnorreader_stream(outq_type< tagged<block> >* outq, sync_type<fdreaderargs>* args) {
     uint64_t                  seqnr;
@@ -2686,35 +2767,67 @@ void udpsnorreader_stream(outq_type< tagged<block> >* outq, sync_type<fdreaderar
 }
 
 
-void udpreader_stream(outq_type< tagged<block> >* outq, sync_type<fdreaderargs>* args) {
+// Batched datagram receive ("udpsmm"). Same packet format and semantics as
+// udpsnor (64-bit sequence number prepended, no reordering) but instead of
+// issuing one or two recvmsg(2) calls per datagram we use recvmmsg(2) to
+// pull in up to udpsmm_batch datagrams per system call. The I/O vectors of
+// the batch point at consecutive datagram slots in the block that is
+// currently being filled so the data lands where it should go in one go.
+//
+// Sequence number bookkeeping is shared by the batched and ring readers
+static void handle_sender_seqnr(struct sockaddr_in& sender, uint64_t seqnr,
+                                per_sender_type* per_sender, unsigned int& nSender,
+                                unsigned int const maxSender, int fd, int ackPeriod,
+                                ucounter_type& loscnt) {
+    find_by_sender_type  find_by_sender(&sender);
+    per_sender_type*     endSender( &per_sender[nSender] );
+    per_sender_type*     curSender = std::find_if(&per_sender[0], endSender, find_by_sender);
+    ucounter_type        tmplos;
+
+#ifdef FILA
+    // FiLa10G/Mark5B only sends 32bits of sequence number
+    seqnr = (uint64_t)(*((uint32_t*)(((unsigned char*)&seqnr)+4)));
+#endif
+    // Did we see this sender before?
+    if( curSender==endSender ) {
+        // Room for new sender? If not just ignore the sequence number
+        if( nSender>=maxSender )
+            return;
+        // Ok, first time we see this sender. Initialize
+        per_sender[nSender] = per_sender_type(sender, seqnr);
+        curSender           = &per_sender[nSender];
+        nSender++;
+    }
+    // Let the per-sender handle the psn
+    curSender->handle_seqnr(seqnr, fd, ackPeriod);
+
+    // Aggregate the results
+    tmplos = per_sender[0].loscnt;
+    for(unsigned int i=1; i<nSender; i++)
+        tmplos += per_sender[i].loscnt;
+    loscnt = tmplos;
+}
+
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+
+// Maximum number of datagrams we attempt to receive in one system call
+static const unsigned int   udpsmm_batch = 64;
+
+void udpsmmreader(outq_type<block>* outq, sync_type<fdreaderargs>* args) {
     runtime*                  rteptr = 0;
-    ds_map_type               datastream_state_map;
+    unsigned char*            location;
+    unsigned char*            block_end;
     fdreaderargs*             network = args->userdata;
-    struct sockaddr_in        sender;
-    struct vdif_header        vhdr;
-    find_by_sender_type       find_by_sender(&sender);
     // Keep pakkit stats per sender. Keep at most 8 unique senders?
     per_sender_type           per_sender[8]; 
-    per_sender_type*          curSender;
     unsigned int              nSender = 0;
     const unsigned int        maxSender( sizeof(per_sender)/sizeof(per_sender[0]) );
-    per_sender_type*          endSender( &per_sender[0] );
 
     // We really need a non-null runtime
     rteptr = network ? network->rteptr : 0;
     EZASSERT_NZERO(rteptr, netreaderexception);
 
-    // an (optionally compressed) block of <blocksize> is chopped up in
-    // chunks of <read_size>, optionally compressed into <write_size> and
-    // then put on the network.
-    // We reverse this by reading <write_size> from the network into blocks
-    // of size <read_size> and fill up a block of size <blocksize> before
-    // handing it down the processing chain.
-    // [note: no compression => write_size==read_size, ie this scheme will always work]
-
-    // HV: 13-11-2013 Blocks larger than this size we call "insensible" and we 
-    //                change the readahead + blockpool allocation scheme
-    //                because we might be doing vlbi_streamer style
+    // See udpsnorreader() for the meaning of these
     const unsigned int           sensible_blocksize( 32*1024*1024 );
     const unsigned int           rd_size   = rteptr->sizes[constraints::write_size];
     const unsigned int           wr_size   = rteptr->sizes[constraints::read_size];
@@ -2722,20 +2835,8 @@ void udpreader_stream(outq_type< tagged<block> >* outq, sync_type<fdreaderargs>*
     const unsigned int           n_dg_p_block = blocksize/wr_size;
     const unsigned int           n_zeroes  = (wr_size - rd_size);
     const unsigned char*         zeroes_p  = (n_zeroes ? new unsigned char[n_zeroes] : 0);
-    
-    // Create a blockpool. If we need blocks we take'm from there
-    // HV: 13-11-2013 If blocksize seems too large, do not allocate
-    //                more than two (2) chunks in one go
     const unsigned int           nb = (blocksize<sensible_blocksize?32:2);
 
-    // Before doing anything, make sure that *we* are the one being woken
-    // if something happens on the file descriptor that we're supposed to
-    // be sucking empty!
-    //
-    // 21-Jan-2014 HV: Note to self ... this whole thread signalling thing
-    //                 only works if one actually installs a signal handler
-    //                 for the thread one desires to be woken up should it be
-    //                 signalled!
     install_zig_for_this_thread(SIGUSR1);
     SYNCEXEC(args,
              delete network->threadid;
@@ -2746,215 +2847,962 @@ void udpreader_stream(outq_type< tagged<block> >* outq, sync_type<fdreaderargs>*
     if( zeroes_p )
         ::memset(const_cast<unsigned char*>(zeroes_p), 0x0, n_zeroes);
 
-    // Set up the message - a lot of these fields have known & constant values
-    // The peek and read phase now do different things
-    //  peek: read sender, vdif_header (only the first 16 bytes)
-    //  read: read sender, whole vdif frame
-    // After the peek phase we can compute where the frame data should go.
-    // So only the iov_base of that I/O vector element needs to change
-    // and we an immediately do a full read.
-    struct iovec    iov_p[1], iov_r[1]; 
-    struct msghdr   msg_p, msg_r; 
-
-    // We'd like to know who's sending to us
-    msg_p.msg_name    = msg_r.msg_name    = (void*)&sender;
-    msg_p.msg_namelen = msg_r.msg_namelen = sizeof(sender);
-
-    // no control stuff, nor flags
-    msg_p.msg_control    = msg_r.msg_control    = 0;
-    msg_p.msg_controllen = msg_r.msg_controllen = 0;
-    msg_p.msg_flags      = msg_r.msg_flags      = 0;
-
-    // The size of the parts of the messages are known
-    // and for the sequencenumber, we already know the destination address
-    // For the peek phase everything is fixed
-    iov_p[0].iov_base    = &vhdr;
-    iov_p[0].iov_len     = sizeof(struct vdif_header);
-
-    // For the read phase we know almost everything; the iov_base will be
-    // updated on-the-fly
-    iov_r[0].iov_len     = rd_size;
-
-    // Now initialize the two messages with the correct iovecs
-    msg_p.msg_iovlen     = 1;
-    msg_p.msg_iov        = &iov_p[0];
-    msg_r.msg_iovlen     = 1;
-    msg_r.msg_iov        = &iov_r[0];
+    // Set up the messages. Per datagram we need the sender, the sequence
+    // number and the destination for the data part. Only the latter
+    // changes between batches
+    uint64_t            seqnr[udpsmm_batch];
+    struct sockaddr_in  sender[udpsmm_batch];
+    struct iovec        iov[udpsmm_batch][2];
+    struct mmsghdr      mmsg[udpsmm_batch];
+
+    ::memset(&mmsg[0], 0x0, sizeof(mmsg));
+    for(unsigned int i=0; i<udpsmm_batch; i++) {
+        iov[i][0].iov_base             = &seqnr[i];
+        iov[i][0].iov_len              = sizeof(seqnr[i]);
+        iov[i][1].iov_len              = rd_size;
+        mmsg[i].msg_hdr.msg_name       = (void*)&sender[i];
+        mmsg[i].msg_hdr.msg_namelen    = sizeof(sender[i]);
+        mmsg[i].msg_hdr.msg_iov        = &iov[i][0];
+        mmsg[i].msg_hdr.msg_iovlen     = 2;
+    }
 
     // reset statistics/chain and statistics/evlbi
     RTE3EXEC(*rteptr,
             rteptr->evlbi_stats = evlbi_stats_type();
-            rteptr->statistics.init(args->stepid, "UdpReadStream"),
+            rteptr->statistics.init(args->stepid, "UdpsMMRead"),
             delete [] zeroes_p; delete network->threadid; network->threadid = 0;);
 
-    // Great. We're done setting up. Now let's see if we weren't cancelled
-    // by any chance
     bool   stop;
     SYNCEXEC(args, stop = args->cancelled);
 
     if( stop ) {
         delete [] zeroes_p;
         SYNCEXEC(args, delete network->threadid; network->threadid = 0);
-        DEBUG(0, "udpreader_stream: cancelled before actual start" << endl);
+        DEBUG(0, "udpsmmreader: cancelled before actual start" << endl);
         return;
     }
 
-    // No, we weren't. Now go into our mainloop!
-    DEBUG(0, "udpreader_stream: fd=" << network->fd << " data:" << iov_r[0].iov_len
+    DEBUG(0, "udpsmmreader: fd=" << network->fd << " data:" << rd_size
+            << " total:" << (sizeof(uint64_t) + rd_size)
             << " pkts:" << n_dg_p_block 
+            << " batch:" << udpsmm_batch
             << " avbs: " << network->allow_variable_block_size
             << endl);
 
-    // create references to the statisticscounters -
-    // at least one of the memoryaccesses has been 
-    // removed then (if you do it via pointer
-    // then there's two)
     counter_type&    counter( rteptr->statistics.counter(args->stepid) );
+    ucounter_type&   loscnt( rteptr->evlbi_stats.pkt_lost );
     ucounter_type&   pktcnt( rteptr->evlbi_stats.pkt_in );
+    ucounter_type&   batchcnt( rteptr->evlbi_stats.mmsg_batch );
+    ucounter_type&   batchpkt( rteptr->evlbi_stats.mmsg_pkt );
 
     // inner loop variables
-    const ssize_t         waitpeek    = (ssize_t)(iov_p[0].iov_len);
-    const ssize_t         waitallread = (ssize_t)(iov_r[0].iov_len);
-    datastream_id         dsid;
-    ssize_t               n = waitpeek;
-    netparms_type&        np( network->rteptr->netparms );
-    datastream_mgmt_type& datastreams( rteptr->mk6info.datastreams );
-    ds_map_type::iterator curDS;
+    int            n;
+    unsigned int   nslot, nbatch;
+    block          b = network->pool->get();
+    const ssize_t  waitallread = (ssize_t)(sizeof(uint64_t) + rd_size);
+    netparms_type& np( network->rteptr->netparms );
 
-    // Drop into our tight inner loop
-    while( true ) {
-        // The msg_namelen parameters are value-return fields and may be
-        // modified by recvmsg(3)
-        msg_p.msg_namelen = msg_r.msg_namelen = sizeof(sender);
-        if( (n=::recvmsg(network->fd, &msg_p, MSG_PEEK))!=waitpeek )
-            break;
-       
-        // Since we arrive here we have a VDIF header!
-        // Let's look up the destination tag for this one
-        dsid = datastreams.vdif2stream_id( vhdr.station_id, vhdr.thread_id, sender );
+    location    = (unsigned char*)b.iov_base;
+    block_end   = location + b.iov_len - wr_size; // If location points beyond this we cannot write a packet any more
 
-        // Get current buffer for that datastream id
-        curDS = datastream_state_map.find( dsid );
+    while( true ) {
+        // Never read more datagrams than fit in the current block
+        nslot  = (unsigned int)((block_end - location)/wr_size) + 1;
+        nbatch = std::min(nslot, udpsmm_batch);
 
-        if( curDS==datastream_state_map.end() ) {
-           // first data for this data stream
-           pair<ds_map_type::iterator, bool> insres = datastream_state_map.insert(make_pair(dsid, dsm_entry(network->pool->get())));
-           if( insres.second==false ) {
-               delete [] zeroes_p;
-               THROW_EZEXCEPT(datastreamexception_type, "Failed to add state for newly found data stream #" << dsid);
-           }
-           curDS = insres.first;
+        for(unsigned int i=0; i<nbatch; i++) {
+            iov[i][1].iov_base          = location + i*wr_size;
+            mmsg[i].msg_hdr.msg_namelen = sizeof(sender[i]);
         }
 
-        // Now we can decide where to stick the pakkit
-        dsm_entry&  ds_state( curDS->second );
-
-        iov_r[0].iov_base = ds_state.location;
-
-        if( (n=::recvmsg(network->fd, &msg_r, MSG_WAITALL))!=waitallread )
-            break;
+        // Block until at least one datagram is there, then grab whatever
+        // else is available without blocking
+        if( (n=::recvmmsg(network->fd, &mmsg[0], nbatch, MSG_WAITFORONE, 0))<=0 ) {
+            lastsyserror_type  lse;
+            ostringstream      oss;
 
-        // OK. Packet reading succeeded
-        counter += waitallread;
-        pktcnt++;
+            const unsigned int sz = (unsigned int)(location - (unsigned char*)b.iov_base);
+            if( network->allow_variable_block_size && sz )
+                outq->push(b.sub(0, sz));
 
-        // Write zeroes if necessary
-        (void)(n_zeroes && ::memcpy(ds_state.location+rd_size, zeroes_p, n_zeroes));
+            SYNCEXEC(args, delete network->threadid; network->threadid = 0);
 
-        // Compute location for next pakkit.
-        // Release previous block if filled up [+get a new one to fill up]
-        // Note: we read rd_size and advance by wr_size!
-        ds_state.location += wr_size;
-        if( ds_state.location >= ds_state.end ) {
-            if( outq->push( tagged<block>(dsid, ds_state.b))==false )
+            if( lse.sys_errno==EINTR || lse.sys_errno==EBADF )
                 break;
-            // Remove from the mapping; we'll insert a new one when data for
-            // that data stream next arrives
-            datastream_state_map.erase( curDS );
-        }
-
-        // Do sequence number + ACK processing - possibly
-        curSender = std::find_if(&per_sender[0], endSender, find_by_sender);
-
-        // Did we see this sender before?
-        if( curSender==endSender ) {
-            // Room for new sender?
-            if( nSender>=maxSender )
-                // no. just go on reading nxt pkt
-                continue;
-            // Ok, first time we see this sender. Initialize
-            per_sender[nSender] = per_sender_type(sender, 0);
-            curSender           = &per_sender[nSender];
-            nSender++;
-            endSender           = &per_sender[nSender];
+            delete [] zeroes_p;
+            oss << "::recvmmsg(network->fd, ..., " << nbatch << ", MSG_WAITFORONE) fails - [" << lse << "] (got:" << n << ")";
+            throw syscallexception(oss.str());
         }
+        batchcnt++;
+        batchpkt += (uint64_t)n;
 
-        // Let the per-sender "handle the psn"
-        // there is no PSN in this protocol (just the VDIF frame
-        // as payload) but at least it will (1) count the packets
-        // per sender and (2) send the ACK messages
-        curSender->handle_seqnr(0, network->fd, np.ackPeriod);
-    } 
-
-    // Fall out of loop because of error if n != waitallread or waitpeek,
-    // or normal stop. We just capture errno in case we need it later
-    lastsyserror_type                         lse; // Keep this one FIRST; it captures the value of errno!
+        for(int i=0; i<n; i++) {
+            // udpsnor would have failed on a short read too
+            if( mmsg[i].msg_len!=(unsigned int)waitallread ) {
+                ostringstream  oss;
 
-    // 1a.) Remove ourselves from the environment - our thread is going
-    // to be dead!
-    //
-    //     28Aug2015: I did some follow up. Apparently the Linux
-    //                b*stards interpret the POSIX standards
-    //                somewhat differently - to the point where they
-    //                feel that glibc's pthread_kill() on a thread-id that
-    //                referred to a valid thread but which is not
-    //                alive any more yields a SEGFAULT is
-    //                acceptable. Cf:
-    //                https://sourceware.org/bugzilla/show_bug.cgi?id=4509
-    //                Un-fucking-believable.
-    SYNCEXEC(args, delete network->threadid; network->threadid = 0);
+                SYNCEXEC(args, delete network->threadid; network->threadid = 0);
+                delete [] zeroes_p;
+                oss << "udpsmmreader: datagram " << i << "/" << n << " in batch has wrong size (ask:" << waitallread << " got:" << mmsg[i].msg_len << ")";
+                throw syscallexception(oss.str());
+            }
+            counter += waitallread;
+            pktcnt++;
 
-    // Check if we exited the loop because of a read error
-    if( n!=waitallread && n!=waitpeek ) {
-        // release all partial non-empty blocks still in our cache
-        bool                        queue_ok;
-        ostringstream               oss;
-        ds_map_type::const_iterator ptr;
+            (void)(n_zeroes && ::memcpy(location+rd_size, zeroes_p, n_zeroes));
+            location += wr_size;
 
-        // We don't have to check *if* they are partial blocks; the
-        // fact that they are still in the list *implies* they're
-        // partial! [even if location pointed at the last packet in
-        // the block: it failed to read so the block is not filled :D]
-        //
-        // Also we don't have have to check if there are any bytes to be
-        // pushed because the entry in the datastream_state_map only
-        // exists if any data for that stream came in ...
-        for(ptr=datastream_state_map.begin(), queue_ok = true; ptr!=datastream_state_map.end(); ptr++) {
-            // Fix 1. Check if we need to & are allowed to send a partial block downstream
-            const unsigned int sz = (unsigned int)(ptr->second.location - (unsigned char*)ptr->second.b.iov_base);
-            if( sz && network->allow_variable_block_size ) {
-                if( (queue_ok = outq->push( tagged<block>(ptr->first, ptr->second.b.sub(0, sz)) ))==false )
-                    DEBUG(-1, "udpreader_stream: failed to push " << sz << " bytes downstream (lost)");
-            } else {
-                DEBUG(-1, "udpreader_stream: not allowed to push variable block of size " << sz << " bytes downstream (lost)");
-            }
+            handle_sender_seqnr(sender[i], seqnr[i], &per_sender[0], nSender, maxSender,
+                                network->fd, np.ackPeriod, loscnt);
         }
 
-        // Fix 2. Do not throw on EINTR or EBADF; that is the normal way to
-        //        terminate the reader and should not warrant an
-        //        exception
-        if( lse.sys_errno!=EINTR && lse.sys_errno!=EBADF ) {
-            // Wasn't EINTR/EBADF so now we must throw. Prepare stuff before
-            // actually doing that
-            // 2.) delete local buffers. In c++11 using unique_ptr this
-            // wouldnae be necessary
-            delete [] zeroes_p;
-            oss << "::recvmsg(network->fd, &msg, /*flags*/) fails - [" << lse << "] (ask:" << waitpeek << " or " << waitallread << " got:" << n << ")";
-            throw syscallexception(oss.str());
+        // Release block if filled up [+get a new one to fill up]
+        if( location>block_end ) {
+            if( outq->push(b)==false )
+                break;
+            b         = network->pool->get();
+            location  = (unsigned char*)b.iov_base;
+            block_end = location + b.iov_len - wr_size;
         }
     }
+    SYNCEXEC(args, delete network->threadid; network->threadid = 0);
 
-    // Clean up
+    delete [] zeroes_p;
+    DEBUG(0, "udpsmmreader: stopping" << endl);
+}
+
+// The datastream version. We cannot peek at the VDIF header of each
+// datagram before deciding where it should go so we speculate: the whole
+// batch is received into the block of the data stream that the previous
+// datagram belonged to. Datagrams that turn out to belong to a different
+// data stream ("stragglers") are copied out to their own data stream's
+// block; the following ones are moved down to close the gap. For single
+// thread VDIF, or multi-thread VDIF sent in bursts per thread, no data is
+// copied at all.
+void udpsmmreader_stream(outq_type< tagged<block> >* outq, sync_type<fdreaderargs>* args) {
+    runtime*                  rteptr = 0;
+    ds_map_type               datastream_state_map;
+    fdreaderargs*             network = args->userdata;
+    // Keep pakkit stats per sender. Keep at most 8 unique senders?
+    per_sender_type           per_sender[8]; 
+    unsigned int              nSender = 0;
+    const unsigned int        maxSender( sizeof(per_sender)/sizeof(per_sender[0]) );
+
+    // We really need a non-null runtime
+    rteptr = network ? network->rteptr : 0;
+    EZASSERT_NZERO(rteptr, netreaderexception);
+
+    // See udpsnorreader() for the meaning of these
+    const unsigned int           sensible_blocksize( 32*1024*1024 );
+    const unsigned int           rd_size   = rteptr->sizes[constraints::write_size];
+    const unsigned int           wr_size   = rteptr->sizes[constraints::read_size];
+    const unsigned int           blocksize = rteptr->sizes[constraints::blocksize];
+    const unsigned int           n_dg_p_block = blocksize/wr_size;
+    const unsigned int           n_zeroes  = (wr_size - rd_size);
+    const unsigned char*         zeroes_p  = (n_zeroes ? new unsigned char[n_zeroes] : 0);
+    const unsigned int           nb = (blocksize<sensible_blocksize?32:2);
+
+    // We must be able to look at the VDIF header
+    EZASSERT2(rd_size>=sizeof(struct vdif_header), netreaderexception,
+              EZINFO("udpsmmreader_stream: datagram size " << rd_size << " too small for VDIF header"));
+
+    install_zig_for_this_thread(SIGUSR1);
+    SYNCEXEC(args,
+             delete network->threadid;
+             delete network->pool;
+             network->threadid = new pthread_t( ::pthread_self() );
+             network->pool = new blockpool_type(blocksize, nb));
+
+    if( zeroes_p )
+        ::memset(const_cast<unsigned char*>(zeroes_p), 0x0, n_zeroes);
+
+    uint64_t            seqnr[udpsmm_batch];
+    struct sockaddr_in  sender[udpsmm_batch];
+    struct iovec        iov[udpsmm_batch][2];
+    struct mmsghdr      mmsg[udpsmm_batch];
+
+    ::memset(&mmsg[0], 0x0, sizeof(mmsg));
+    for(unsigned int i=0; i<udpsmm_batch; i++) {
+        iov[i][0].iov_base             = &seqnr[i];
+        iov[i][0].iov_len              = sizeof(seqnr[i]);
+        iov[i][1].iov_len              = rd_size;
+        mmsg[i].msg_hdr.msg_name       = (void*)&sender[i];
+        mmsg[i].msg_hdr.msg_namelen    = sizeof(sender[i]);
+        mmsg[i].msg_hdr.msg_iov        = &iov[i][0];
+        mmsg[i].msg_hdr.msg_iovlen     = 2;
+    }
+
+    // reset statistics/chain and statistics/evlbi
+    RTE3EXEC(*rteptr,
+            rteptr->evlbi_stats = evlbi_stats_type();
+            rteptr->statistics.init(args->stepid, "UdpsMMReadStream"),
+            delete [] zeroes_p; delete network->threadid; network->threadid = 0;);
+
+    bool   stop;
+    SYNCEXEC(args, stop = args->cancelled);
+
+    if( stop ) {
+        delete [] zeroes_p;
+        SYNCEXEC(args, delete network->threadid; network->threadid = 0);
+        DEBUG(0, "udpsmmreader_stream: cancelled before actual start" << endl);
+        return;
+    }
+
+    DEBUG(0, "udpsmmreader_stream: fd=" << network->fd << " data:" << rd_size
+            << " total:" << (sizeof(uint64_t) + rd_size)
+            << " pkts:" << n_dg_p_block 
+            << " batch:" << udpsmm_batch
+            << " avbs: " << network->allow_variable_block_size
+            << endl);
+
+    counter_type&    counter( rteptr->statistics.counter(args->stepid) );
+    ucounter_type&   loscnt( rteptr->evlbi_stats.pkt_lost );
+    ucounter_type&   pktcnt( rteptr->evlbi_stats.pkt_in );
+    ucounter_type&   batchcnt( rteptr->evlbi_stats.mmsg_batch );
+    ucounter_type&   batchpkt( rteptr->evlbi_stats.mmsg_pkt );
+
+    // inner loop variables
+    int                   n = 1;
+    bool                  queue_ok = true;
+    unsigned int          short_dg = 0;
+    unsigned int          nslot, nbatch;
+    const ssize_t         waitallread = (ssize_t)(sizeof(uint64_t) + rd_size);
+    datastream_id         dsid = 0, spec_dsid = 0;
+    netparms_type&        np( network->rteptr->netparms );
+    datastream_mgmt_type& datastreams( rteptr->mk6info.datastreams );
+    ds_map_type::iterator curDS, specDS = datastream_state_map.end();
+
+    while( queue_ok ) {
+        // Make sure we have a block to speculatively receive into
+        if( specDS==datastream_state_map.end() ) {
+            pair<ds_map_type::iterator, bool> insres = datastream_state_map.insert(make_pair(spec_dsid, dsm_entry(network->pool->get())));
+            if( insres.second==false ) {
+                delete [] zeroes_p;
+                THROW_EZEXCEPT(datastreamexception_type, "Failed to add state for data stream #" << spec_dsid);
+            }
+            specDS = insres.first;
+        }
+        dsm_entry&  spec( specDS->second );
+
+        // Never read more datagrams than fit in the speculated block
+        nslot  = (unsigned int)((spec.end - spec.location)/wr_size);
+        nbatch = std::min(nslot, udpsmm_batch);
+
+        for(unsigned int i=0; i<nbatch; i++) {
+            iov[i][1].iov_base          = spec.location + i*wr_size;
+            mmsg[i].msg_hdr.msg_namelen = sizeof(sender[i]);
+        }
+
+        if( (n=::recvmmsg(network->fd, &mmsg[0], nbatch, MSG_WAITFORONE, 0))<=0 )
+            break;
+        batchcnt++;
+        batchpkt += (uint64_t)n;
+
+        // Now sort out where each datagram should have gone.
+        // Datagrams destined for the speculated stream are compacted
+        // towards spec.location
+        for(int i=0; i<n && queue_ok; i++) {
+            unsigned char*            dg = (unsigned char*)iov[i][1].iov_base;
+            struct vdif_header const* vhdr = (struct vdif_header const*)dg;
+
+            if( mmsg[i].msg_len!=(unsigned int)waitallread ) {
+                short_dg = mmsg[i].msg_len;
+                n        = -1;
+                break;
+            }
+            counter += waitallread;
+            pktcnt++;
+
+            dsid = datastreams.vdif2stream_id( vhdr->station_id, vhdr->thread_id, sender[i] );
+
+            if( dsid==specDS->first ) {
+                if( dg!=spec.location )
+                    ::memmove(spec.location, dg, rd_size);
+                (void)(n_zeroes && ::memcpy(spec.location+rd_size, zeroes_p, n_zeroes));
+                spec.location += wr_size;
+            } else {
+                // A straggler. Copy to its own data stream's block
+                curDS = datastream_state_map.find( dsid );
+
+                if( curDS==datastream_state_map.end() ) {
+                   pair<ds_map_type::iterator, bool> insres = datastream_state_map.insert(make_pair(dsid, dsm_entry(network->pool->get())));
+                   if( insres.second==false ) {
+                       delete [] zeroes_p;
+                       THROW_EZEXCEPT(datastreamexception_type, "Failed to add state for newly found data stream #" << dsid);
+                   }
+                   curDS = insres.first;
+                }
+                dsm_entry&  ds_state( curDS->second );
+
+                ::memcpy(ds_state.location, dg, rd_size);
+                (void)(n_zeroes && ::memcpy(ds_state.location+rd_size, zeroes_p, n_zeroes));
+                ds_state.location += wr_size;
+                if( ds_state.location >= ds_state.end ) {
+                    queue_ok = outq->push( tagged<block>(dsid, ds_state.b) );
+                    datastream_state_map.erase( curDS );
+                }
+            }
+            handle_sender_seqnr(sender[i], seqnr[i], &per_sender[0], nSender, maxSender,
+                                network->fd, np.ackPeriod, loscnt);
+        }
+        if( n<0 )
+            break;
+
+        // Last datagram in the batch decides where to speculate next.
+        // spec_dsid==specDS->first if it was a speculation hit
+        spec_dsid = dsid;
+
+        if( spec.location >= spec.end ) {
+            if( queue_ok )
+                queue_ok = outq->push( tagged<block>(specDS->first, spec.b) );
+            datastream_state_map.erase( specDS );
+            specDS = datastream_state_map.end();
+        }
+        if( specDS==datastream_state_map.end() || spec_dsid!=specDS->first )
+            specDS = datastream_state_map.find( spec_dsid );
+    } 
+
+    // Fall out of loop because of error or normal stop.
+    // Capture errno in case we need it later
+    lastsyserror_type                         lse; // Keep this one FIRST; it captures the value of errno!
+
+    SYNCEXEC(args, delete network->threadid; network->threadid = 0);
+
+    // Check if we exited the loop because of a read error
+    if( n<=0 ) {
+        ostringstream               oss;
+        ds_map_type::const_iterator ptr;
+
+        // Release all non-empty blocks still in our cache; they must be
+        // partial
+        for(ptr=datastream_state_map.begin(); queue_ok && ptr!=datastream_state_map.end(); ptr++) {
+            const unsigned int sz = (unsigned int)(ptr->second.location - (unsigned char*)ptr->second.b.iov_base);
+            if( sz==0 )
+                continue;
+            if( network->allow_variable_block_size ) {
+                if( (queue_ok = outq->push( tagged<block>(ptr->first, ptr->second.b.sub(0, sz)) ))==false )
+                    DEBUG(-1, "udpsmmreader_stream: failed to push " << sz << " bytes for stream " << ptr->first << " (lost)" << endl);
+            } else {
+                DEBUG(-1, "udpsmmreader_stream: not allowed to push variable block of size " << sz << " bytes for stream " << ptr->first << " (lost)" << endl);
+            }
+        }
+
+        if( short_dg ) {
+            delete [] zeroes_p;
+            oss << "udpsmmreader_stream: datagram in batch has wrong size (ask:" << waitallread << " got:" << short_dg << ")";
+            throw syscallexception(oss.str());
+        }
+        if( lse.sys_errno!=EINTR && lse.sys_errno!=EBADF ) {
+            delete [] zeroes_p;
+            oss << "::recvmmsg(network->fd, ..., MSG_WAITFORONE) fails - [" << lse << "] (ask:" << waitallread << "/datagram)";
+            throw syscallexception(oss.str());
+        }
+    }
+
+    delete [] zeroes_p;
+    DEBUG(0, "udpsmmreader_stream: done" << endl);
+}
+
+#else // no recvmmsg(2)
+
+void udpsmmreader(outq_type<block>* outq, sync_type<fdreaderargs>* args) {
+    DEBUG(-1, "udpsmmreader: recvmmsg(2) not available on this system, falling back to udpsnor" << endl);
+    udpsnorreader(outq, args);
+}
+
+void udpsmmreader_stream(outq_type< tagged<block> >* outq, sync_type<fdreaderargs>* args) {
+    DEBUG(-1, "udpsmmreader_stream: recvmmsg(2) not available on this system, falling back to udpsnor" << endl);
+    udpsnorreader_stream(outq, args);
+}
+
+#endif
+
+
+// Read UDPS datagrams from a memory mapped kernel packet ring ("udpsring").
+// The UDP socket in network->fd is only kept open to claim the port; the
+// data is taken from the ring, a whole ring block's worth of datagrams at
+// a time, without a system call per datagram. The datagrams must be copied
+// out of the ring into our blocks anyway - downstream expects contiguous
+// blocks of datagram payloads - after which the ring block is immediately
+// returned to the kernel.
+// Semantics are those of udpsnor: no reordering.
+static const int    pktring_poll_ms = 100;
+
+// Get the UDP port + local address the network socket is bound to.
+// Nobody reads from that socket so the kernel would fill up its receive
+// buffer with a copy of the data, for nothing. Shrink the buffer to the
+// minimum the kernel allows (it rounds zero up to that).
+static void fd2portaddr(int fd, unsigned short& port, struct in_addr& local) {
+    int                 rcvbuf = 0;
+    struct sockaddr_in  sin;
+    socklen_t           slen( sizeof(sin) );
+
+    ASSERT_ZERO( ::getsockname(fd, (struct sockaddr*)&sin, &slen) );
+    port  = ntohs(sin.sin_port);
+    local = sin.sin_addr;
+
+    if( ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf))!=0 )
+        DEBUG(-1, "fd2portaddr: failed to shrink receive buffer of fd#" << fd << " - " << evlbi5a::strerror(errno) << endl);
+}
+
+void pktringreader(outq_type<block>* outq, sync_type<fdreaderargs>* args) {
+    bool                      stop;
+    runtime*                  rteptr = 0;
+    unsigned char*            location;
+    unsigned char*            block_end;
+    fdreaderargs*             network = args->userdata;
+    struct in_addr            local;
+    unsigned short            port;
+    pktring_udp_type          dg;
+    // Keep pakkit stats per sender. Keep at most 8 unique senders?
+    per_sender_type           per_sender[8]; 
+    unsigned int              nSender = 0;
+    const unsigned int        maxSender( sizeof(per_sender)/sizeof(per_sender[0]) );
+
+    // We really need a non-null runtime
+    rteptr = network ? network->rteptr : 0;
+    EZASSERT_NZERO(rteptr, netreaderexception);
+
+    // See udpsnorreader() for the meaning of these
+    const unsigned int           sensible_blocksize( 32*1024*1024 );
+    const unsigned int           rd_size   = rteptr->sizes[constraints::write_size];
+    const unsigned int           wr_size   = rteptr->sizes[constraints::read_size];
+    const unsigned int           blocksize = rteptr->sizes[constraints::blocksize];
+    const unsigned int           n_dg_p_block = blocksize/wr_size;
+    const unsigned int           n_zeroes  = (wr_size - rd_size);
+    const unsigned int           nb = (blocksize<sensible_blocksize?32:2);
+    const unsigned int           dg_size   = (unsigned int)(sizeof(uint64_t) + rd_size);
+
+    // Set up the ring before anything else; if this fails there's no
+    // state to clean up
+    fd2portaddr(network->fd, port, local);
+    pktring_type                 ring(port, local);
+
+    install_zig_for_this_thread(SIGUSR1);
+    SYNCEXEC(args,
+             delete network->threadid;
+             delete network->pool;
+             network->threadid = new pthread_t( ::pthread_self() );
+             network->pool = new blockpool_type(blocksize, nb));
+
+    // reset statistics/chain and statistics/evlbi
+    RTE3EXEC(*rteptr,
+            rteptr->evlbi_stats = evlbi_stats_type();
+            rteptr->statistics.init(args->stepid, "PktRingRead"),
+            delete network->threadid; network->threadid = 0;);
+
+    SYNCEXEC(args, stop = args->cancelled);
+
+    if( stop ) {
+        SYNCEXEC(args, delete network->threadid; network->threadid = 0);
+        DEBUG(0, "pktringreader: cancelled before actual start" << endl);
+        return;
+    }
+
+    DEBUG(0, "pktringreader: port=" << port << " data:" << rd_size
+            << " total:" << dg_size
+            << " pkts:" << n_dg_p_block 
+            << " avbs: " << network->allow_variable_block_size
+            << endl);
+
+    counter_type&    counter( rteptr->statistics.counter(args->stepid) );
+    ucounter_type&   loscnt( rteptr->evlbi_stats.pkt_lost );
+    ucounter_type&   pktcnt( rteptr->evlbi_stats.pkt_in );
+    ucounter_type&   disccnt( rteptr->evlbi_stats.pkt_disc );
+
+    // inner loop variables
+    int            r;
+    uint64_t       seqnr;
+    uint64_t       nBlockSeen = 0;
+    block          b = network->pool->get();
+    netparms_type& np( network->rteptr->netparms );
+
+    location    = (unsigned char*)b.iov_base;
+    block_end   = location + b.iov_len - wr_size;
+
+    while( true ) {
+        // Once per ring block (and on every poll time out below) see if
+        // we should stop; a steady stream of datagrams would otherwise
+        // keep us from ever noticing
+        if( ring.blocks()!=nBlockSeen ) {
+            nBlockSeen = ring.blocks();
+            SYNCEXEC(args, stop = (args->cancelled || network->fd==-1));
+            if( stop )
+                break;
+        }
+        if( !ring.next(dg) ) {
+            // Nothing in the ring. Wait for the kernel to hand us a block,
+            // periodically checking wether we should stop
+            if( (r=ring.wait(pktring_poll_ms))<0 ) {
+                lastsyserror_type  lse;
+
+                if( lse.sys_errno==EINTR )
+                    break;
+                SYNCEXEC(args, delete network->threadid; network->threadid = 0);
+                THROW_EZEXCEPT(netreaderexception, "pktringreader: waiting for packet ring fails - " << lse);
+            }
+            if( r==0 ) {
+                SYNCEXEC(args, stop = (args->cancelled || network->fd==-1));
+                if( stop )
+                    break;
+            }
+            continue;
+        }
+        // Datagrams of the wrong size are not fatal: anyone can send
+        // to our port
+        if( dg.len!=dg_size ) {
+            disccnt++;
+            continue;
+        }
+        counter += dg_size;
+        pktcnt++;
+
+        ::memcpy(&seqnr, dg.payload, sizeof(seqnr));
+        ::memcpy(location, dg.payload + sizeof(seqnr), rd_size);
+        (void)(n_zeroes && ::memset(location+rd_size, 0x0, n_zeroes));
+        location += wr_size;
+
+        if( location>block_end ) {
+            if( outq->push(b)==false )
+                break;
+            b         = network->pool->get();
+            location  = (unsigned char*)b.iov_base;
+            block_end = location + b.iov_len - wr_size;
+        }
+        handle_sender_seqnr(dg.sender, seqnr, &per_sender[0], nSender, maxSender,
+                            network->fd, np.ackPeriod, loscnt);
+    }
+    SYNCEXEC(args, delete network->threadid; network->threadid = 0);
+
+    // Push partial block, if allowed
+    const unsigned int sz = (unsigned int)(location - (unsigned char*)b.iov_base);
+    if( network->allow_variable_block_size && sz )
+        outq->push(b.sub(0, sz));
+
+    DEBUG(0, "pktringreader: stopping. kernel dropped " << ring.drops() << " of " << ring.packets() << " packets" << endl);
+}
+
+// Datastream version of the above: the VDIF header can be inspected in the
+// ring before copying the datagram to the block for its data stream
+void pktringreader_stream(outq_type< tagged<block> >* outq, sync_type<fdreaderargs>* args) {
+    bool                      stop;
+    runtime*                  rteptr = 0;
+    ds_map_type               datastream_state_map;
+    fdreaderargs*             network = args->userdata;
+    struct in_addr            local;
+    unsigned short            port;
+    pktring_udp_type          dg;
+    // Keep pakkit stats per sender. Keep at most 8 unique senders?
+    per_sender_type           per_sender[8]; 
+    unsigned int              nSender = 0;
+    const unsigned int        maxSender( sizeof(per_sender)/sizeof(per_sender[0]) );
+
+    // We really need a non-null runtime
+    rteptr = network ? network->rteptr : 0;
+    EZASSERT_NZERO(rteptr, netreaderexception);
+
+    // See udpsnorreader() for the meaning of these
+    const unsigned int           sensible_blocksize( 32*1024*1024 );
+    const unsigned int           rd_size   = rteptr->sizes[constraints::write_size];
+    const unsigned int           wr_size   = rteptr->sizes[constraints::read_size];
+    const unsigned int           blocksize = rteptr->sizes[constraints::blocksize];
+    const unsigned int           n_dg_p_block = blocksize/wr_size;
+    const unsigned int           n_zeroes  = (wr_size - rd_size);
+    const unsigned int           nb = (blocksize<sensible_blocksize?32:2);
+    const unsigned int           dg_size   = (unsigned int)(sizeof(uint64_t) + rd_size);
+
+    // We must be able to look at the VDIF header
+    EZASSERT2(rd_size>=sizeof(struct vdif_header), netreaderexception,
+              EZINFO("pktringreader_stream: datagram size " << rd_size << " too small for VDIF header"));
+
+    fd2portaddr(network->fd, port, local);
+    pktring_type                 ring(port, local);
+
+    install_zig_for_this_thread(SIGUSR1);
+    SYNCEXEC(args,
+             delete network->threadid;
+             delete network->pool;
+             network->threadid = new pthread_t( ::pthread_self() );
+             network->pool = new blockpool_type(blocksize, nb));
+
+    // reset statistics/chain and statistics/evlbi
+    RTE3EXEC(*rteptr,
+            rteptr->evlbi_stats = evlbi_stats_type();
+            rteptr->statistics.init(args->stepid, "PktRingReadStream"),
+            delete network->threadid; network->threadid = 0;);
+
+    SYNCEXEC(args, stop = args->cancelled);
+
+    if( stop ) {
+        SYNCEXEC(args, delete network->threadid; network->threadid = 0);
+        DEBUG(0, "pktringreader_stream: cancelled before actual start" << endl);
+        return;
+    }
+
+    DEBUG(0, "pktringreader_stream: port=" << port << " data:" << rd_size
+            << " total:" << dg_size
+            << " pkts:" << n_dg_p_block 
+            << " avbs: " << network->allow_variable_block_size
+            << endl);
+
+    counter_type&    counter( rteptr->statistics.counter(args->stepid) );
+    ucounter_type&   loscnt( rteptr->evlbi_stats.pkt_lost );
+    ucounter_type&   pktcnt( rteptr->evlbi_stats.pkt_in );
+    ucounter_type&   disccnt( rteptr->evlbi_stats.pkt_disc );
+
+    // inner loop variables
+    int                   r;
+    bool                  queue_ok = true;
+    uint64_t              seqnr;
+    uint64_t              nBlockSeen = 0;
+    datastream_id         dsid;
+    struct vdif_header    vhdr;
+    netparms_type&        np( network->rteptr->netparms );
+    datastream_mgmt_type& datastreams( rteptr->mk6info.datastreams );
+    ds_map_type::iterator curDS;
+
+    while( queue_ok ) {
+        if( ring.blocks()!=nBlockSeen ) {
+            nBlockSeen = ring.blocks();
+            SYNCEXEC(args, stop = (args->cancelled || network->fd==-1));
+            if( stop )
+                break;
+        }
+        if( !ring.next(dg) ) {
+            if( (r=ring.wait(pktring_poll_ms))<0 ) {
+                lastsyserror_type  lse;
+
+                if( lse.sys_errno==EINTR )
+                    break;
+                SYNCEXEC(args, delete network->threadid; network->threadid = 0);
+                THROW_EZEXCEPT(netreaderexception, "pktringreader_stream: waiting for packet ring fails - " << lse);
+            }
+            if( r==0 ) {
+                SYNCEXEC(args, stop = (args->cancelled || network->fd==-1));
+                if( stop )
+                    break;
+            }
+            continue;
+        }
+        if( dg.len!=dg_size ) {
+            disccnt++;
+            continue;
+        }
+        counter += dg_size;
+        pktcnt++;
+
+        ::memcpy(&seqnr, dg.payload, sizeof(seqnr));
+        ::memcpy(&vhdr, dg.payload + sizeof(seqnr), sizeof(vhdr));
+        dsid  = datastreams.vdif2stream_id( vhdr.station_id, vhdr.thread_id, dg.sender );
+        curDS = datastream_state_map.find( dsid );
+
+        if( curDS==datastream_state_map.end() ) {
+           pair<ds_map_type::iterator, bool> insres = datastream_state_map.insert(make_pair(dsid, dsm_entry(network->pool->get())));
+           if( insres.second==false ) {
+               SYNCEXEC(args, delete network->threadid; network->threadid = 0);
+               THROW_EZEXCEPT(datastreamexception_type, "Failed to add state for newly found data stream #" << dsid);
+           }
+           curDS = insres.first;
+        }
+        dsm_entry&  ds_state( curDS->second );
+
+        ::memcpy(ds_state.location, dg.payload + sizeof(seqnr), rd_size);
+        (void)(n_zeroes && ::memset(ds_state.location+rd_size, 0x0, n_zeroes));
+        ds_state.location += wr_size;
+        if( ds_state.location >= ds_state.end ) {
+            queue_ok = outq->push( tagged<block>(dsid, ds_state.b) );
+            datastream_state_map.erase( curDS );
+        }
+        handle_sender_seqnr(dg.sender, seqnr, &per_sender[0], nSender, maxSender,
+                            network->fd, np.ackPeriod, loscnt);
+    }
+    SYNCEXEC(args, delete network->threadid; network->threadid = 0);
+
+    // Release all non-empty blocks still in our cache; they must be partial
+    for(ds_map_type::const_iterator ptr=datastream_state_map.begin(); queue_ok && ptr!=datastream_state_map.end(); ptr++) {
+        const unsigned int sz = (unsigned int)(ptr->second.location - (unsigned char*)ptr->second.b.iov_base);
+        if( sz==0 )
+            continue;
+        if( network->allow_variable_block_size ) {
+            if( (queue_ok = outq->push( tagged<block>(ptr->first, ptr->second.b.sub(0, sz)) ))==false )
+                DEBUG(-1, "pktringreader_stream: failed to push " << sz << " bytes for stream " << ptr->first << " (lost)" << endl);
+        } else {
+            DEBUG(-1, "pktringreader_stream: not allowed to push variable block of size " << sz << " bytes for stream " << ptr->first << " (lost)" << endl);
+        }
+    }
+    DEBUG(0, "pktringreader_stream: done. kernel dropped " << ring.drops() << " of " << ring.packets() << " packets" << endl);
+}
+
+
+void udpreader_stream(outq_type< tagged<block> >* outq, sync_type<fdreaderargs>* args) {
+    runtime*                  rteptr = 0;
+    ds_map_type               datastream_state_map;
+    fdreaderargs*             network = args->userdata;
+    struct sockaddr_in        sender;
+    struct vdif_header        vhdr;
+    find_by_sender_type       find_by_sender(&sender);
+    // Keep pakkit stats per sender. Keep at most 8 unique senders?
+    per_sender_type           per_sender[8]; 
+    per_sender_type*          curSender;
+    unsigned int              nSender = 0;
+    const unsigned int        maxSender( sizeof(per_sender)/sizeof(per_sender[0]) );
+    per_sender_type*          endSender( &per_sender[0] );
+
+    // We really need a non-null runtime
+    rteptr = network ? network->rteptr : 0;
+    EZASSERT_NZERO(rteptr, netreaderexception);
+
+    // an (optionally compressed) block of <blocksize> is chopped up in
+    // chunks of <read_size>, optionally compressed into <write_size> and
+    // then put on the network.
+    // We reverse this by reading <write_size> from the network into blocks
+    // of size <read_size> and fill up a block of size <blocksize> before
+    // handing it down the processing chain.
+    // [note: no compression => write_size==read_size, ie this scheme will always work]
+
+    // HV: 13-11-2013 Blocks larger than this size we call "insensible" and we 
+    //                change the readahead + blockpool allocation scheme
+    //                because we might be doing vlbi_streamer style
+    const unsigned int           sensible_blocksize( 32*1024*1024 );
+    const unsigned int           rd_size   = rteptr->sizes[constraints::write_size];
+    const unsigned int           wr_size   = rteptr->sizes[constraints::read_size];
+    const unsigned int           blocksize = rteptr->sizes[constraints::blocksize];
+    const unsigned int           n_dg_p_block = blocksize/wr_size;
+    const unsigned int           n_zeroes  = (wr_size - rd_size);
+    const unsigned char*         zeroes_p  = (n_zeroes ? new unsigned char[n_zeroes] : 0);
+    
+    // Create a blockpool. If we need blocks we take'm from there
+    // HV: 13-11-2013 If blocksize seems too large, do not allocate
+    //                more than two (2) chunks in one go
+    const unsigned int           nb = (blocksize<sensible_blocksize?32:2);
+
+    // Before doing anything, make sure that *we* are the one being woken
+    // if something happens on the file descriptor that we're supposed to
+    // be sucking empty!
+    //
+    // 21-Jan-2014 HV: Note to self ... this whole thread signalling thing
+    //                 only works if one actually installs a signal handler
+    //                 for the thread one desires to be woken up should it be
+    //                 signalled!
+    install_zig_for_this_thread(SIGUSR1);
+    SYNCEXEC(args,
+             delete network->threadid;
+             delete network->pool;
+             network->threadid = new pthread_t( ::pthread_self() );
+             network->pool = new blockpool_type(blocksize, nb));
+
+    if( zeroes_p )
+        ::memset(const_cast<unsigned char*>(zeroes_p), 0x0, n_zeroes);
+
+    // Set up the message - a lot of these fields have known & constant values
+    // The peek and read phase now do different things
+    //  peek: read sender, vdif_header (only the first 16 bytes)
+    //  read: read sender, whole vdif frame
+    // After the peek phase we can compute where the frame data should go.
+    // So only the iov_base of that I/O vector element needs to change
+    // and we an immediately do a full read.
+    struct iovec    iov_p[1], iov_r[1]; 
+    struct msghdr   msg_p, msg_r; 
+
+    // We'd like to know who's sending to us
+    msg_p.msg_name    = msg_r.msg_name    = (void*)&sender;
+    msg_p.msg_namelen = msg_r.msg_namelen = sizeof(sender);
+
+    // no control stuff, nor flags
+    msg_p.msg_control    = msg_r.msg_control    = 0;
+    msg_p.msg_controllen = msg_r.msg_controllen = 0;
+    msg_p.msg_flags      = msg_r.msg_flags      = 0;
+
+    // The size of the parts of the messages are known
+    // and for the sequencenumber, we already know the destination address
+    // For the peek phase everything is fixed
+    iov_p[0].iov_base    = &vhdr;
+    iov_p[0].iov_len     = sizeof(struct vdif_header);
+
+    // For the read phase we know almost everything; the iov_base will be
+    // updated on-the-fly
+    iov_r[0].iov_len     = rd_size;
+
+    // Now initialize the two messages with the correct iovecs
+    msg_p.msg_iovlen     = 1;
+    msg_p.msg_iov        = &iov_p[0];
+    msg_r.msg_iovlen     = 1;
+    msg_r.msg_iov        = &iov_r[0];
+
+    // reset statistics/chain and statistics/evlbi
+    RTE3EXEC(*rteptr,
+            rteptr->evlbi_stats = evlbi_stats_type();
+            rteptr->statistics.init(args->stepid, "UdpReadStream"),
+            delete [] zeroes_p; delete network->threadid; network->threadid = 0;);
+
+    // Great. We're done setting up. Now let's see if we weren't cancelled
+    // by any chance
+    bool   stop;
+    SYNCEXEC(args, stop = args->cancelled);
+
+    if( stop ) {
+        delete [] zeroes_p;
+        SYNCEXEC(args, delete network->threadid; network->threadid = 0);
+        DEBUG(0, "udpreader_stream: cancelled before actual start" << endl);
+        return;
+    }
+
+    // No, we weren't. Now go into our mainloop!
+    DEBUG(0, "udpreader_stream: fd=" << network->fd << " data:" << iov_r[0].iov_len
+            << " pkts:" << n_dg_p_block 
+            << " avbs: " << network->allow_variable_block_size
+            << endl);
+
+    // create references to the statisticscounters -
+    // at least one of the memoryaccesses has been 
+    // removed then (if you do it via pointer
+    // then there's two)
+    counter_type&    counter( rteptr->statistics.counter(args->stepid) );
+    ucounter_type&   pktcnt( rteptr->evlbi_stats.pkt_in );
+
+    // inner loop variables
+    const ssize_t         waitpeek    = (ssize_t)(iov_p[0].iov_len);
+    const ssize_t         waitallread = (ssize_t)(iov_r[0].iov_len);
+    datastream_id         dsid;
+    ssize_t               n = waitpeek;
+    netparms_type&        np( network->rteptr->netparms );
+    datastream_mgmt_type& datastreams( rteptr->mk6info.datastreams );
+    ds_map_type::iterator curDS;
+
+    // Drop into our tight inner loop
+    while( true ) {
+        // The msg_namelen parameters are value-return fields and may be
+        // modified by recvmsg(3)
+        msg_p.msg_namelen = msg_r.msg_namelen = sizeof(sender);
+        if( (n=::recvmsg(network->fd, &msg_p, MSG_PEEK))!=waitpeek )
+            break;
+       
+        // Since we arrive here we have a VDIF header!
+        // Let's look up the destination tag for this one
+        dsid = datastreams.vdif2stream_id( vhdr.station_id, vhdr.thread_id, sender );
+
+        // Get current buffer for that datastream id
+        curDS = datastream_state_map.find( dsid );
+
+        if( curDS==datastream_state_map.end() ) {
+           // first data for this data stream
+           pair<ds_map_type::iterator, bool> insres = datastream_state_map.insert(make_pair(dsid, dsm_entry(network->pool->get())));
+           if( insres.second==false ) {
+               delete [] zeroes_p;
+               THROW_EZEXCEPT(datastreamexception_type, "Failed to add state for newly found data stream #" << dsid);
+           }
+           curDS = insres.first;
+        }
+
+        // Now we can decide where to stick the pakkit
+        dsm_entry&  ds_state( curDS->second );
+
+        iov_r[0].iov_base = ds_state.location;
+
+        if( (n=::recvmsg(network->fd, &msg_r, MSG_WAITALL))!=waitallread )
+            break;
+
+        // OK. Packet reading succeeded
+        counter += waitallread;
+        pktcnt++;
+
+        // Write zeroes if necessary
+        (void)(n_zeroes && ::memcpy(ds_state.location+rd_size, zeroes_p, n_zeroes));
+
+        // Compute location for next pakkit.
+        // Release previous block if filled up [+get a new one to fill up]
+        // Note: we read rd_size and advance by wr_size!
+        ds_state.location += wr_size;
+        if( ds_state.location >= ds_state.end ) {
+            if( outq->push( tagged<block>(dsid, ds_state.b))==false )
+                break;
+            // Remove from the mapping; we'll insert a new one when data for
+            // that data stream next arrives
+            datastream_state_map.erase( curDS );
+        }
+
+        // Do sequence number + ACK processing - possibly
+        curSender = std::find_if(&per_sender[0], endSender, find_by_sender);
+
+        // Did we see this sender before?
+        if( curSender==endSender ) {
+            // Room for new sender?
+            if( nSender>=maxSender )
+                // no. just go on reading nxt pkt
+                continue;
+            // Ok, first time we see this sender. Initialize
+            per_sender[nSender] = per_sender_type(sender, 0);
+            curSender           = &per_sender[nSender];
+            nSender++;
+            endSender           = &per_sender[nSender];
+        }
+
+        // Let the per-sender "handle the psn"
+        // there is no PSN in this protocol (just the VDIF frame
+        // as payload) but at least it will (1) count the packets
+        // per sender and (2) send the ACK messages
+        curSender->handle_seqnr(0, network->fd, np.ackPeriod);
+    } 
+
+    // Fall out of loop because of error if n != waitallread or waitpeek,
+    // or normal stop. We just capture errno in case we need it later
+    lastsyserror_type                         lse; // Keep this one FIRST; it captures the value of errno!
+
+    // 1a.) Remove ourselves from the environment - our thread is going
+    // to be dead!
+    //
+    //     28Aug2015: I did some follow up. Apparently the Linux
+    //                b*stards interpret the POSIX standards
+    //                somewhat differently - to the point where they
+    //                feel that glibc's pthread_kill() on a thread-id that
+    //                referred to a valid thread but which is not
+    //                alive any more yields a SEGFAULT is
+    //                acceptable. Cf:
+    //                https://sourceware.org/bugzilla/show_bug.cgi?id=4509
+    //                Un-fucking-believable.
+    SYNCEXEC(args, delete network->threadid; network->threadid = 0);
+
+    // Check if we exited the loop because of a read error
+    if( n!=waitallread && n!=waitpeek ) {
+        // release all partial non-empty blocks still in our cache
+        bool                        queue_ok;
+        ostringstream               oss;
+        ds_map_type::const_iterator ptr;
+
+        // We don't have to check *if* they are partial blocks; the
+        // fact that they are still in the list *implies* they're
+        // partial! [even if location pointed at the last packet in
+        // the block: it failed to read so the block is not filled :D]
+        //
+        // Also we don't have have to check if there are any bytes to be
+        // pushed because the entry in the datastream_state_map only
+        // exists if any data for that stream came in ...
+        for(ptr=datastream_state_map.begin(), queue_ok = true; ptr!=datastream_state_map.end(); ptr++) {
+            // Fix 1. Check if we need to & are allowed to send a partial block downstream
+            const unsigned int sz = (unsigned int)(ptr->second.location - (unsigned char*)ptr->second.b.iov_base);
+            if( sz && network->allow_variable_block_size ) {
+                if( (queue_ok = outq->push( tagged<block>(ptr->first, ptr->second.b.sub(0, sz)) ))==false )
+                    DEBUG(-1, "udpreader_stream: failed to push " << sz << " bytes downstream (lost)");
+            } else {
+                DEBUG(-1, "udpreader_stream: not allowed to push variable block of size " << sz << " bytes downstream (lost)");
+            }
+        }
+
+        // Fix 2. Do not throw on EINTR or EBADF; that is the normal way to
+        //        terminate the reader and should not warrant an
+        //        exception
+        if( lse.sys_errno!=EINTR && lse.sys_errno!=EBADF ) {
+            // Wasn't EINTR/EBADF so now we must throw. Prepare stuff before
+            // actually doing that
+            // 2.) delete local buffers. In c++11 using unique_ptr this
+            // wouldnae be necessary
+            delete [] zeroes_p;
+            oss << "::recvmsg(network->fd, &msg, /*flags*/) fails - [" << lse << "] (ask:" << waitpeek << " or " << waitallread << " got:" << n << ")";
+            throw syscallexception(oss.str());
+        }
+    }
+
+    // Clean up
     delete [] zeroes_p;
     DEBUG(0, "udpreader_stream: done" << endl);
 }
@@ -3550,34 +4398,42 @@ void socketreader(outq_type<block>* outq, sync_type<fdreaderargs>* args) {
     network->finished = true;
 }
 
-// read from filedescriptor
-void fdreader(outq_type<block>* outq, sync_type<fdreaderargs>* args) {
+// read from filedescriptor.
+// Regular files are memory mapped and the blocks pushed downstream refer
+// to the mapping directly, which saves copying every byte from the page
+// cache into a pool block. Anything that can't be mapped (sockets, pipes,
+// devices, ...) is read(2) into pool blocks.
+// 'file' is only looked at under the lock or before run was set.
+template <typename T>
+static void fdread(outq_type<block>* outq, sync_type<T>* args, fdreaderargs& file, const char* who) {
     bool                   stop;
     ssize_t                r;
     runtime*               rteptr;
-    fdreaderargs*          file = args->userdata;
 
-    rteptr = file->rteptr;
+    rteptr = file.rteptr;
     RTEEXEC(*rteptr, rteptr->sizes.validate());
     const unsigned int     blocksize = rteptr->sizes[constraints::blocksize];
 
     // wait for the "GO" signal
     args->lock();
-    while( !args->cancelled && !file->run ) {
+    while( !args->cancelled && !file.run ) {
         args->cond_wait();
     }
     stop = args->cancelled;
     args->unlock();
 
     if( stop ) {
-        DEBUG(0, "fdreader: stopsignal caught before actual start" << endl);
+        DEBUG(0, who << ": stopsignal caught before actual start" << endl);
         return;
     }
 
+    filemap_type    filemap(file.fd, blocksize);
+
     SYNCEXEC(args,
-             delete file->threadid;
-             file->threadid = new pthread_t( ::pthread_self() );
-             file->pool = new blockpool_type(blocksize, 16); );
+             delete file.threadid;
+             file.threadid = new pthread_t( ::pthread_self() );
+             if( !filemap.usable() )
+                 file.pool = new blockpool_type(blocksize, 16); );
     install_zig_for_this_thread(SIGUSR1);
     RTEEXEC(*rteptr,
             rteptr->statistics.init(args->stepid, "FdRead"));
@@ -3588,52 +4444,101 @@ void fdreader(outq_type<block>* outq, sync_type<fdreaderargs>* args) {
     RTEEXEC(*rteptr,
             rteptr->transfersubmode.set(connected_flag).set(run_flag));
 
-    DEBUG(0, "fdreader: start reading from fd=" << file->fd << ", " << file->start << "->" << file->end << endl);
+    DEBUG(0, who << ": start reading from fd=" << file.fd << ", " << file.start << "->" << file.end
+             << (filemap.usable() ? " (memory mapped)" : "") << endl);
 
     off_t   fp;
-    ASSERT_POS( fp=::lseek(file->fd, file->start, SEEK_SET) );
-    while( !stop && ((file->end == 0) || (fp < file->end)) ) {
-        block   b = file->pool->get();
-        size_t  n2read = ( (file->end>0) ? (size_t)std::min((off_t)b.iov_len, (file->end - fp)) : b.iov_len );
+    if( filemap.usable() ) {
+        fp = file.start;
+        while( !stop && ((file.end == 0) || (fp < file.end)) ) {
+            size_t  n2read = ( (file.end>0) ? (size_t)std::min((off_t)blocksize, (file.end - fp)) : blocksize );
+            block   b = filemap.get(fp, n2read);
+
+            if( b.iov_len!=blocksize ) {
+                // same rules as for reading: a short block is only
+                // pushed if allowed to
+                bool partial_read = false;
+                if ( b.iov_len>0 ) {
+                    SYNCEXEC( args,
+                              partial_read = file.allow_variable_block_size );
+                }
 
-        // do read data orf the network
-        if( (r=::read(file->fd, b.iov_base, n2read))!=(int)b.iov_len ) {
-            // first check if we have less data than we expect AND
-            // are allowed to push that
-            bool partial_read = false;
-            if ( r>0 ) {
-                SYNCEXEC( args,
-                          partial_read = file->allow_variable_block_size );
-                if ( partial_read ) {
-                    b.iov_len = r;
+                if ( !partial_read ) {
+                    if( b.empty() && errno==0 ) {
+                        DEBUG(-1, who << ": EOF read" << endl);
+                    } else if( b.empty() ) {
+                        DEBUG(-1, who << ": MAP FAILURE - " << evlbi5a::strerror(errno) << endl);
+                    } else {
+                        DEBUG(-1, who << ": unexpected EOF - want " << blocksize << " bytes, got " << b.iov_len << endl);
+                    }
+                    break;
                 }
             }
+            // push it downstream
+            if( outq->push(b)==false )
+                break;
+
+            // update statistics counter
+            counter += b.iov_len;
+            fp      += b.iov_len;
+        }
+    } else {
+        ASSERT_POS( fp=::lseek(file.fd, file.start, SEEK_SET) );
+        while( !stop && ((file.end == 0) || (fp < file.end)) ) {
+            block   b = file.pool->get();
+            size_t  n2read = ( (file.end>0) ? (size_t)std::min((off_t)b.iov_len, (file.end - fp)) : b.iov_len );
+
+            // do read data orf the network
+            if( (r=::read(file.fd, b.iov_base, n2read))!=(int)b.iov_len ) {
+                // first check if we have less data than we expect AND
+                // are allowed to push that
+                bool partial_read = false;
+                if ( r>0 ) {
+                    SYNCEXEC( args,
+                              partial_read = file.allow_variable_block_size );
+                    if ( partial_read ) {
+                        b.iov_len = r;
+                    }
+                }
             
-            if ( !partial_read ) {
-                if( r==0 ) {
-                    DEBUG(-1, "fdreader: EOF read" << endl);
-                } else if( r==-1 ) {
-                    DEBUG(-1, "fdreader: READ FAILURE - " << evlbi5a::strerror(errno) << endl);
-                } else {
-                    DEBUG(-1, "fdreader: unexpected EOF - want " << b.iov_len << " bytes, got " << r << endl);
+                if ( !partial_read ) {
+                    if( r==0 ) {
+                        DEBUG(-1, who << ": EOF read" << endl);
+                    } else if( r==-1 ) {
+                        DEBUG(-1, who << ": READ FAILURE - " << evlbi5a::strerror(errno) << endl);
+                    } else {
+                        DEBUG(-1, who << ": unexpected EOF - want " << b.iov_len << " bytes, got " << r << endl);
+                    }
+                    break;
                 }
-                break;
             }
-        }
-        // push it downstream
-        if( outq->push(b)==false )
-            break;
+            // push it downstream
+            if( outq->push(b)==false )
+                break;
 
-        // update statistics counter
-        counter += b.iov_len;
-        fp      += b.iov_len;
+            // update statistics counter
+            counter += b.iov_len;
+            fp      += b.iov_len;
+        }
     }
-    SYNCEXEC(args, delete file->threadid; file->threadid = 0);
-    DEBUG(0, "fdreader: done " << counter << ", " << byteprint((double)counter, "byte") << endl);
-    file->finished = true;
+    SYNCEXEC(args, delete file.threadid; file.threadid = 0);
+    DEBUG(0, who << ": done " << counter << ", " << byteprint((double)counter, "byte") << endl);
+    file.finished = true;
+}
+
+void fdreader(outq_type<block>* outq, sync_type<fdreaderargs>* args) {
+    fdread(outq, args, *args->userdata, "fdreader");
 }
 
 void fdreader_c(outq_type<block>* outq, sync_type<cfdreaderargs>* args) {
+    // keep the counted pointer alive for as long as we run
+    cfdreaderargs   file = *args->userdata;
+
+    fdread(outq, args, *file, "fdreader_c");
+}
+
+// read from Buf recording (vbs)
+void vbsreader_c(outq_type<block>* outq, sync_type<cfdreaderargs>* args) {
     bool                   stop;
     ssize_t                r;
     runtime*               rteptr;
@@ -3652,17 +4557,14 @@ void fdreader_c(outq_type<block>* outq, sync_type<cfdreaderargs>* args) {
     args->unlock();
 
     if( stop ) {
-        DEBUG(0, "fdreader_c: stopsignal caught before actual start" << endl);
+        DEBUG(0, "vbsreader_c: stopsignal caught before actual start" << endl);
         return;
     }
 
     SYNCEXEC(args,
-             delete file->threadid;
-             file->threadid = new pthread_t( ::pthread_self() );
              file->pool = new blockpool_type(blocksize, 16); );
-    install_zig_for_this_thread(SIGUSR1);
     RTEEXEC(*rteptr,
-            rteptr->statistics.init(args->stepid, "FdRead"));
+            rteptr->statistics.init(args->stepid, "VBSRead"));
 
     counter_type&   counter( rteptr->statistics.counter(args->stepid) );
 
@@ -3670,16 +4572,16 @@ void fdreader_c(outq_type<block>* outq, sync_type<cfdreaderargs>* args) {
     RTEEXEC(*rteptr,
             rteptr->transfersubmode.set(connected_flag).set(run_flag));
 
-    DEBUG(0, "fdreader_c: start reading from fd=" << file->fd << ", " << file->start << "->" << file->end << endl);
+    DEBUG(0, "vbsreader_c: start reading fd#" << file->fd << ", " << file->start << " => " << file->end << endl);
 
     off_t   fp;
-    ASSERT_POS( fp=::lseek(file->fd, file->start, SEEK_SET) );
+    ASSERT_POS( fp=::vbs_lseek(file->fd, file->start, SEEK_SET) );
     while( !stop && ((file->end == 0) || (fp < file->end)) ) {
         block   b = file->pool->get();
         size_t  n2read = ( (file->end>0) ? (size_t)std::min((off_t)b.iov_len, (file->end - fp)) : b.iov_len );
 
         // do read data orf the network
-        if( (r=::read(file->fd, b.iov_base, n2read))!=(int)b.iov_len ) {
+        if( (r=::vbs_read(file->fd, b.iov_base, n2read))!=(int)b.iov_len ) {
             // first check if we have less data than we expect AND
             // are allowed to push that
             bool partial_read = false;
@@ -3693,11 +4595,11 @@ void fdreader_c(outq_type<block>* outq, sync_type<cfdreaderargs>* args) {
             
             if ( !partial_read ) {
                 if( r==0 ) {
-                    DEBUG(-1, "fdreader_c: EOF read" << endl);
+                    DEBUG(-1, "vbsreader_c: EOF read" << endl);
                 } else if( r==-1 ) {
-                    DEBUG(-1, "fdreader_c: READ FAILURE - " << evlbi5a::strerror(errno) << endl);
+                    DEBUG(-1, "vbsreader_c: READ FAILURE - " << evlbi5a::strerror(errno) << endl);
                 } else {
-                    DEBUG(-1, "fdreader_c: unexpected EOF - want " << b.iov_len << " bytes, got " << r << endl);
+                    DEBUG(-1, "vbsreader_c: unexpected EOF - want " << b.iov_len << " bytes, got " << r << endl);
                 }
                 break;
             }
@@ -3710,17 +4612,15 @@ void fdreader_c(outq_type<block>* outq, sync_type<cfdreaderargs>* args) {
         counter += b.iov_len;
         fp      += b.iov_len;
     }
-    SYNCEXEC(args, delete file->threadid; file->threadid = 0);
-    DEBUG(0, "fdreader_c: done " << counter << ", " << byteprint((double)counter, "byte") << endl);
+    DEBUG(0, "vbsreader_c: done " << byteprint((double)counter, "byte") << endl);
     file->finished = true;
 }
 
-// read from Buf recording (vbs)
-void vbsreader_c(outq_type<block>* outq, sync_type<cfdreaderargs>* args) {
+void vbsreader(outq_type<block>* outq, sync_type<fdreaderargs>* args) {
     bool                   stop;
     ssize_t                r;
     runtime*               rteptr;
-    cfdreaderargs          file = *args->userdata;
+    fdreaderargs*          file = args->userdata;
 
     rteptr = file->rteptr;
     RTEEXEC(*rteptr, rteptr->sizes.validate());
@@ -3735,7 +4635,7 @@ void vbsreader_c(outq_type<block>* outq, sync_type<cfdreaderargs>* args) {
     args->unlock();
 
     if( stop ) {
-        DEBUG(0, "vbsreader_c: stopsignal caught before actual start" << endl);
+        DEBUG(0, "vbsreader: stopsignal caught before actual start" << endl);
         return;
     }
 
@@ -3750,7 +4650,7 @@ void vbsreader_c(outq_type<block>* outq, sync_type<cfdreaderargs>* args) {
     RTEEXEC(*rteptr,
             rteptr->transfersubmode.set(connected_flag).set(run_flag));
 
-    DEBUG(0, "vbsreader_c: start reading fd#" << file->fd << ", " << file->start << " => " << file->end << endl);
+    DEBUG(0, "vbsreader: start reading fd#" << file->fd << ", " << file->start << " => " << file->end << endl);
 
     off_t   fp;
     ASSERT_POS( fp=::vbs_lseek(file->fd, file->start, SEEK_SET) );
@@ -3773,11 +4673,11 @@ void vbsreader_c(outq_type<block>* outq, sync_type<cfdreaderargs>* args) {
             
             if ( !partial_read ) {
                 if( r==0 ) {
-                    DEBUG(-1, "vbsreader_c: EOF read" << endl);
+                    DEBUG(-1, "vbsreader: EOF read" << endl);
                 } else if( r==-1 ) {
-                    DEBUG(-1, "vbsreader_c: READ FAILURE - " << evlbi5a::strerror(errno) << endl);
+                    DEBUG(-1, "vbsreader: READ FAILURE - " << evlbi5a::strerror(errno) << endl);
                 } else {
-                    DEBUG(-1, "vbsreader_c: unexpected EOF - want " << b.iov_len << " bytes, got " << r << endl);
+                    DEBUG(-1, "vbsreader: unexpected EOF - want " << b.iov_len << " bytes, got " << r << endl);
                 }
                 break;
             }
@@ -3790,86 +4690,96 @@ void vbsreader_c(outq_type<block>* outq, sync_type<cfdreaderargs>* args) {
         counter += b.iov_len;
         fp      += b.iov_len;
     }
-    DEBUG(0, "vbsreader_c: done " << byteprint((double)counter, "byte") << endl);
+    DEBUG(0, "vbsreader: done " << byteprint((double)counter, "byte") << endl);
     file->finished = true;
 }
 
-void vbsreader(outq_type<block>* outq, sync_type<fdreaderargs>* args) {
+// The zero-copy readers. They do not read anything: they cut the
+// [start, end) of the file into blocksize sized ranges and leave it to
+// the writer to have the kernel send them. Since producing a range costs
+// next to nothing, the reader is ahead of the writer by (at most) the
+// length of the queue between them.
+// 'file' is only looked at under the lock or before run was set.
+template <typename T>
+static void rangereader(outq_type<filerange>* outq, sync_type<T>* args, fdreaderargs& file,
+                        bool vbs, const char* who, const char* statname) {
     bool                   stop;
-    ssize_t                r;
-    runtime*               rteptr;
-    fdreaderargs*          file = args->userdata;
+    runtime*               rteptr = file.rteptr;
 
-    rteptr = file->rteptr;
     RTEEXEC(*rteptr, rteptr->sizes.validate());
     const unsigned int     blocksize = rteptr->sizes[constraints::blocksize];
 
     // wait for the "GO" signal
     args->lock();
-    while( !args->cancelled && !file->run ) {
+    while( !args->cancelled && !file.run ) {
         args->cond_wait();
     }
     stop = args->cancelled;
     args->unlock();
 
     if( stop ) {
-        DEBUG(0, "vbsreader: stopsignal caught before actual start" << endl);
+        DEBUG(0, who << ": stopsignal caught before actual start" << endl);
         return;
-    }
-
-    SYNCEXEC(args,
-             file->pool = new blockpool_type(blocksize, 16); );
-    RTEEXEC(*rteptr,
-            rteptr->statistics.init(args->stepid, "VBSRead"));
-
-    counter_type&   counter( rteptr->statistics.counter(args->stepid) );
-
-    // update submode flags
-    RTEEXEC(*rteptr,
-            rteptr->transfersubmode.set(connected_flag).set(run_flag));
-
-    DEBUG(0, "vbsreader: start reading fd#" << file->fd << ", " << file->start << " => " << file->end << endl);
-
-    off_t   fp;
-    ASSERT_POS( fp=::vbs_lseek(file->fd, file->start, SEEK_SET) );
-    while( !stop && ((file->end == 0) || (fp < file->end)) ) {
-        block   b = file->pool->get();
-        size_t  n2read = ( (file->end>0) ? (size_t)std::min((off_t)b.iov_len, (file->end - fp)) : b.iov_len );
-
-        // do read data orf the network
-        if( (r=::vbs_read(file->fd, b.iov_base, n2read))!=(int)b.iov_len ) {
-            // first check if we have less data than we expect AND
-            // are allowed to push that
-            bool partial_read = false;
-            if ( r>0 ) {
-                SYNCEXEC( args,
-                          partial_read = file->allow_variable_block_size );
-                if ( partial_read ) {
-                    b.iov_len = r;
-                }
-            }
-            
-            if ( !partial_read ) {
-                if( r==0 ) {
-                    DEBUG(-1, "vbsreader: EOF read" << endl);
-                } else if( r==-1 ) {
-                    DEBUG(-1, "vbsreader: READ FAILURE - " << evlbi5a::strerror(errno) << endl);
-                } else {
-                    DEBUG(-1, "vbsreader: unexpected EOF - want " << b.iov_len << " bytes, got " << r << endl);
-                }
+    }
+
+    RTEEXEC(*rteptr,
+            rteptr->statistics.init(args->stepid, statname));
+
+    counter_type&   counter( rteptr->statistics.counter(args->stepid) );
+
+    // update submode flags
+    RTEEXEC(*rteptr,
+            rteptr->transfersubmode.set(connected_flag).set(run_flag));
+
+    // The normal readers read until EOF if no end was given; we must
+    // know where to stop up front
+    off_t   end = file.end;
+    if( end==0 ) {
+        if( vbs ) {
+            const off_t  current = ::vbs_lseek(file.fd, 0, SEEK_CUR);
+
+            ASSERT_POS( end=::vbs_lseek(file.fd, 0, SEEK_END) );
+            ::vbs_lseek(file.fd, current, SEEK_SET);
+        } else {
+            ASSERT_POS( end=file.get_file_size() );
+        }
+    }
+    DEBUG(0, who << ": start sending fd#" << file.fd << ", " << file.start << " => " << end << " using sendfile(2)" << endl);
+
+    off_t   fp = file.start;
+    while( fp<end ) {
+        size_t  n = (size_t)std::min((off_t)blocksize, end - fp);
+
+        // Only send a partial block at the end if allowed to
+        if( n<blocksize ) {
+            bool partial;
+
+            SYNCEXEC(args, partial = file.allow_variable_block_size);
+            if( !partial ) {
+                DEBUG(-1, who << ": not sending last " << n << " bytes - want " << blocksize << endl);
                 break;
             }
         }
-        // push it downstream
-        if( outq->push(b)==false )
+        if( outq->push(filerange(file.fd, vbs, fp, n))==false )
             break;
 
         // update statistics counter
-        counter += b.iov_len;
-        fp      += b.iov_len;
+        counter += n;
+        fp      += n;
     }
-    DEBUG(0, "vbsreader: done " << byteprint((double)counter, "byte") << endl);
-    file->finished = true;
+    DEBUG(0, who << ": done " << byteprint((double)counter, "byte") << endl);
+    file.finished = true;
+}
+
+void fdrangereader(outq_type<filerange>* outq, sync_type<fdreaderargs>* args) {
+    rangereader(outq, args, *args->userdata, false, "fdrangereader", "FdRead");
+}
+
+void vbsrangereader_c(outq_type<filerange>* outq, sync_type<cfdreaderargs>* args) {
+    // keep the counted pointer alive for as long as we run
+    cfdreaderargs  file = *args->userdata;
+
+    rangereader(outq, args, *file, true, "vbsrangereader_c", "VBSRead");
 }
 
 void udtreader(outq_type<block>* outq, sync_type<fdreaderargs>* args) {
@@ -4099,6 +5009,10 @@ void netreader(outq_type<block>* outq, sync_type<fdreaderargs>* args) {
         udpsreader(outq, args);
     else if( proto=="udpsnor" )
         udpsnorreader(outq, args);
+    else if( proto=="udpsmm" )
+        udpsmmreader(outq, args);
+    else if( proto=="udpsring" )
+        pktringreader(outq, args);
     else if( proto=="udp" )
         udpreader(outq, args);
     else if( proto=="udt" )
@@ -4179,7 +5093,7 @@ void netreader_stream(outq_type< tagged<block> >* outq, sync_type<fdreaderargs>*
     const string           protocol = network->netparms.get_protocol();
     scopedfd               acceptedfd(protocol);
     // Currently supported implementations
-    const string           supported[] = {"udpsnor", "udps", "udp" };
+    const string           supported[] = {"udpsnor", "udpsmm", "udpsring", "udps", "udp" };
 
     EZASSERT2( find_element(protocol, supported), netreaderexception,
                EZINFO("stream-based reading not (yet) supported on protocol " << protocol) );
@@ -4276,6 +5190,10 @@ void netreader_stream(outq_type< tagged<block> >* outq, sync_type<fdreaderargs>*
     // and delegate to appropriate reader
     if( protocol=="udps" || protocol=="udpsnor" )
         udpsnorreader_stream(outq, args);
+    else if( protocol=="udpsmm" )
+        udpsmmreader_stream(outq, args);
+    else if( protocol=="udpsring" )
+        pktringreader_stream(outq, args);
     else if( protocol=="udp" )
         udpreader_stream(outq, args);
 #if 0
@@ -4836,6 +5754,90 @@ void sfxcwriter(inq_type<block>* inq, sync_type<fdreaderargs>* args) {
 
 
 
+// The zero-copy counterpart of netwriter<block> for tcp and itcp. The
+// bytes of each file range are moved from the page cache to the socket by
+// the kernel and never touch user space.
+void netsendfile(inq_type<filerange>* inq, sync_type<fdreaderargs>* args) {
+    bool              stop = false;
+    runtime*          rteptr;
+    uint64_t          nbyte = 0;
+    fdreaderargs*     network = args->userdata;
+    const string      proto   = network->netparms.get_protocol();
+
+    rteptr = network->rteptr;
+    ASSERT_COND(rteptr!=0);
+    // We do not do the accepting (yet); we only get selected for the
+    // protocols where net_client() made the connection
+    ASSERT2_COND( network->doaccept==false && (proto=="tcp" || proto=="itcp"),
+                  SCINFO("netsendfile: protocol " << proto << " not supported") );
+
+    // register our threadid so we can be woken up from a blocking
+    // sendfile(2) if the socket gets closed under our feet
+    install_zig_for_this_thread(SIGUSR1);
+    SYNCEXEC(args,
+             stop              = args->cancelled;
+             delete network->threadid;
+             network->threadid = new pthread_t(::pthread_self()));
+
+    if( stop ) {
+        DEBUG(0, "netsendfile: got stopsignal before actually starting" << endl);
+        SYNCEXEC(args, delete network->threadid; network->threadid=0);
+        return;
+    }
+
+    RTEEXEC(*rteptr,
+            rteptr->transfersubmode.clr(wait_flag).set(connected_flag);
+            rteptr->statistics.init(args->stepid, "FdWrite"));
+    counter_type&  counter = rteptr->statistics.counter(args->stepid);
+
+    if( proto=="itcp" )
+        write_itcp_id(network);
+
+    DEBUG(0, "netsendfile: writing to fd=" << network->fd << endl);
+
+    filerange   r;
+    while( inq->pop(r) ) {
+        ssize_t  n;
+
+        if( r.vbs ) {
+            // vbs_sendfile() sends from the current position in the
+            // recording; normally the ranges are consecutive and this
+            // is a no-op
+            if( ::vbs_lseek(r.fd, r.offset, SEEK_SET)!=r.offset )
+                n = -1;
+            else
+                n = ::vbs_sendfile(network->fd, r.fd, r.len);
+        } else {
+            off_t  o = r.offset;
+
+            n = ::sendfile_range(network->fd, r.fd, &o, r.len);
+        }
+        if( n!=(ssize_t)r.len ) {
+            lastsyserror_type lse;
+            DEBUG(0, "netsendfile: fail to send " << r.len << " bytes from fd#" << r.fd << " @" << r.offset << " "
+                     << lse << " (only " << n << " sent)" << endl);
+            break;
+        }
+        nbyte   += (uint64_t)n;
+        counter += n;
+    }
+    // Like fdwriter: shutdown for writing and wait for the other end to
+    // close as well
+    if( ::shutdown(network->fd, SHUT_WR)==0 ) {
+        char    c;
+        if( ::read(network->fd, &c, 1) ) {}
+    }
+    SYNCEXEC(args, delete network->threadid; network->threadid = 0);
+
+    DEBUG(0, "netsendfile: stopping. wrote "
+             << nbyte << " (" << byteprint((double)nbyte,"byte") << ")"
+             << endl);
+    network->finished = true;
+
+    RTEEXEC(*rteptr,
+            rteptr->transfersubmode.clr( connected_flag ) );
+}
+
 // Write to the streamstor FIFO
 void fifowriter(inq_type<block>* inq, sync_type<runtime*>* args) {
     // hi-water mark. If FIFOlen>=this value, do NOT
@@ -5439,7 +6441,9 @@ void framefilter(inq_type<tagged<frame> >* inq, outq_type<tagged<frame> >* outq,
                 // need to resync. Check if the frame for the current tag's
                 // time stamp is an integer multiple of the output frame
                 // duration
-                if( (tf.item.frametime.tv_subsecond / ffargs.framelength).denominator()!=1 ) {
+                uint64_t   fn;
+
+                if( !subsecond2framenumber(tf.item.frametime.tv_subsecond, ffargs.framelength, fn) ) {
                     // If we are synced, this is bad news because apparently
                     // we lost a (couple of) frame(s) because we end up at
                     // an incompatible time stamp [not multiple of VDIF
@@ -5967,6 +6971,15 @@ fdreaderargs* net_client(networkargs net) {
     return rv;
 }
 
+// An itcp stream starts with "id: <itcp_id>" and an empty line
+void write_itcp_id(fdreaderargs* network) {
+    string   itcp_id_buffer( "id: " + network->rteptr->itcp_id );
+
+    itcp_id_buffer.push_back('\0');
+    itcp_id_buffer.push_back('\0');
+    ASSERT_COND( ::write(network->fd, itcp_id_buffer.c_str(), itcp_id_buffer.size()) == (ssize_t)itcp_id_buffer.size() );
+}
+
 struct modal {
     modal(int m) :
         mode(m)
@@ -6121,6 +7134,10 @@ fdreaderargs* open_vbs(string recname, runtime* runtimeptr) {
 
     // Pick the file descriptor that succesfully opened
     fd = fd1ok ? fd1 : fd2;
+
+    // Playback should go as fast as the disks allow
+    if( runtimeptr->mk6info.readahead )
+        ASSERT_ZERO( ::vbs_readahead(fd, runtimeptr->mk6info.readahead) );
 #if 0
     // Now we can (try to) open the recording and get the length by seeking
     // to the end. Do not forget to put file pointer back at start doofus!
@@ -6203,6 +7220,13 @@ void close_filedescriptor(fdreaderargs* fdreader) {
 
 // ..
 
+filerange::filerange():
+    fd( -1 ), vbs( false ), offset( 0 ), len( 0 )
+{}
+filerange::filerange(int f, bool v, off_t o, size_t l):
+    fd( f ), vbs( v ), offset( o ), len( l )
+{}
+
 frame::frame() :
     frametype( fmt_unknown ), ntrack( 0 )
 { }
@@ -6508,17 +7532,16 @@ splitterargs::splitterargs(runtime* rteptr,
                            const headersearch_type& inhdr,
                            unsigned int nacc):
     rte( rteptr ),
-    pool( 0 ),
+    pool( 0 ), state( 0 ),
     inputhdr( inhdr ),
     outputhdr( sp.outheader(inputhdr, nacc) ),
     splitprops( sp ),
     ch_len( inputhdr.payloadsize*outputhdr.ntrack / inputhdr.ntrack ),
-    naccumulate( outputhdr.payloadsize/ch_len )
+    naccumulate( outputhdr.payloadsize/ch_len ),
+    nthread( 1 )
 { ASSERT_NZERO(rteptr); }
 
-splitterargs::~splitterargs() {
-    delete pool;
-}
+// splitterargs::~splitterargs() is defined below, with splitter_state
 
 
 reframe_args::reframe_args(uint16_t sid, const samplerate_type& br,
@@ -6561,57 +7584,66 @@ multifdargs::~multifdargs() {
             delete *curfd;
 }
 
-multifdrdargs* multinetopener(runtime* rte/*, unsigned int n*/) {
-#if 0
+multifdrdargs* multinetopener(runtime* rte, unsigned int n) {
     fdqueue_type  fdqueue;
 
-    while( n-- )
-        fdqueue.push( net_server(networkargs(rte, true)) );
+    EZASSERT2(n>0, netreaderexception, EZINFO("multinetopener: need at least one socket"));
+    try {
+        while( n-- )
+            fdqueue.push( net_server(networkargs(rte, true)) );
+    }
+    catch( ... ) {
+        // Don't leak the sockets we did manage to open
+        while( !fdqueue.empty() ) {
+            fdreaderargs*   fdr = fdqueue.front();
+
+            fdqueue.pop();
+            ::close_filedescriptor( fdr );
+            delete fdr;
+        }
+        throw;
+    }
+
+    // Reset the evlbi statistics here, before any of the reader threads
+    // is started; if one of the readers did it, the counts of the ones
+    // that started before it would be lost
+    rte->evlbi_stats = evlbi_stats_type();
     return new multifdrdargs(rte, fdqueue);
-#endif
-    return new multifdrdargs(rte);
 }
 
-multifdrdargs::multifdrdargs(runtime* rte/*, fdqueue_type const& fdq*/):
-    multifdargs(rte, rte->netparms)/*, fdqueue( fdq )*/
+rdstats_type::rdstats_type():
+    bytes( 0 ), pkt_in( 0 ), pkt_lost( 0 )
 {}
-multifdrdargs::~multifdrdargs() {
-#if 0
-    // any fdreaderargs* still left in the stack are unaccounted for;
-    // the others have been added to our base class' fdreaderlist
-    while( fdqueue.size() ) {
-        ::close_filedescriptor( fdqueue.front() );
-        fdqueue.pop();
+
+multifdrdargs::multifdrdargs(runtime* rte, fdqueue_type const& fdq):
+    multifdargs(rte, rte->netparms), fdqueue( fdq )
+{
+    // Put all of them in the base class' list of readers immediately such
+    // that the multirdcloser() can close all of them, also the ones that
+    // no reader thread has picked up (yet). The base class d'tor deletes
+    // them.
+    fdqueue_type    tmp( fdqueue );
+    while( !tmp.empty() ) {
+        fdreaders.push_back( tmp.front() );
+        tmp.pop();
     }
-#endif
 }
+multifdrdargs::~multifdrdargs() {}
 
 void multifdreader(outq_type<block>* oq, sync_type<multifdrdargs>* args) {
     DEBUG(1, "multifdreader[" << ::pthread_self() << "]: starting" << std::endl);
     bool                    stop;
-#if 0
     fdreaderargs*           myFD( 0 );
-#endif
     multifdrdargs*          mfd( args->userdata );
-    fdreaderargs*           myFD = net_server(networkargs(mfd->rteptr, true));
 
-    if( myFD==0 ) {
-        DEBUG(-1, "multifdreader[" << ::pthread_self() << "]: failed to create file descriptor?!" << std::endl);
-        return;
-    }
-#if 0 
     SYNCEXEC(args, stop = args->cancelled;
                    if( !stop && !mfd->fdqueue.empty() ) {
                         myFD = mfd->fdqueue.front(); mfd->fdqueue.pop();
-                        mfd->fdreaders.push_back( myFD );
                     });
-#endif
-    SYNCEXEC(args, stop = args->cancelled; mfd->fdreaders.push_back(myFD); );
 
-    if( stop /*|| myFD==0*/ ) {
-        DEBUG(1, "multifdreader[" << ::pthread_self() << "]: cancelled before beginning" << std::endl);
-        //DEBUG(1, "multifdreader[" << ::pthread_self() << "]: terminating before begin - "
-        //         << (stop ? "cancelled" : (myFD==0 ? "no more filedescriptors" : "WUT?")));
+    if( stop || myFD==0 ) {
+        DEBUG(1, "multifdreader[" << ::pthread_self() << "]: terminating before begin - "
+                 << (stop ? "cancelled" : "no more filedescriptors") << std::endl);
         return;
     }
 
@@ -6635,6 +7667,214 @@ void multifdreader(outq_type<block>* oq, sync_type<multifdrdargs>* args) {
     }
     DEBUG(1, "multifdreader[" << ::pthread_self() << "]: terminating" << std::endl);
 }
+
+// Sum the statistics of all parallel readers and publish them.
+// Must be called WITHOUT the lock held: the sum is taken under the step's
+// lock, the runtime is updated under the runtime's lock. Never hold both:
+// command handlers take them in the opposite order.
+static void publish_rdstats(sync_type<multifdrdargs>* args) {
+    multifdrdargs*                   mfd( args->userdata );
+    runtime*                         rteptr( mfd->rteptr );
+    rdstats_type                     total;
+    rdstatslist_type::const_iterator ptr;
+
+    SYNCEXEC(args,
+             for(ptr=mfd->rdstats.begin(); ptr!=mfd->rdstats.end(); ptr++) {
+                 total.bytes    += ptr->bytes;
+                 total.pkt_in   += ptr->pkt_in;
+                 total.pkt_lost += ptr->pkt_lost;
+             });
+    RTEEXEC(*rteptr,
+            rteptr->evlbi_stats.pkt_in   = total.pkt_in;
+            rteptr->evlbi_stats.pkt_lost = total.pkt_lost;
+            rteptr->statistics.counter(args->stepid) = (int64_t)total.bytes);
+}
+
+// Multi-queue version of udpsnorreader_stream/udpreader_stream. Meant to
+// be run with >1 thread; each thread claims one of the sockets opened by
+// multinetopener(). Because all of those are bound to the same port with
+// SO_REUSEPORT the kernel shards the incoming flows over them by hashing
+// the sender's address + port, so the datagrams from one sender always
+// arrive at the same reader. This means that the per-sender sequence
+// number (loss) bookkeeping can be done per reader and the results can
+// just be added up.
+// Each reader has its own blockpool and keeps its own per-datastream
+// blocks; the output queue is where the tagged blocks of all readers
+// merge before they go to (mk6_)chunkmaker_stream. Just like "udpsnor" no
+// attempt at reordering is made.
+void multifdreader_stream(outq_type< tagged<block> >* outq, sync_type<multifdrdargs>* args) {
+    bool                      stop;
+    uint64_t                  seqnr = 0;
+    multifdrdargs*            mfd( args->userdata );
+    runtime*                  rteptr( mfd->rteptr );
+    fdreaderargs*             network( 0 );
+    rdstats_type*             mystats( 0 );
+    ds_map_type               datastream_state_map;
+    vdif_demux_type           dscache;
+    struct sockaddr_in        sender;
+    struct vdif_header        vhdr;
+    // Keep pakkit stats per sender. Keep at most 8 unique senders?
+    per_sender_type           per_sender[8]; 
+    unsigned int              nSender = 0;
+    const unsigned int        maxSender( sizeof(per_sender)/sizeof(per_sender[0]) );
+    const string              proto( mfd->netparms.get_protocol() );
+    // udps and udpsnor have the 64-bit sequence number, plain udp has not
+    const bool                seqnr_p( proto.find("udps")!=string::npos );
+
+    EZASSERT2(seqnr_p || proto=="udp", netreaderexception,
+              EZINFO("multifdreader_stream: protocol " << proto << " not supported"));
+
+    // See udpsnorreader_stream() for an explanation of these
+    const unsigned int           sensible_blocksize( 32*1024*1024 );
+    const unsigned int           rd_size   = rteptr->sizes[constraints::write_size];
+    const unsigned int           wr_size   = rteptr->sizes[constraints::read_size];
+    const unsigned int           blocksize = rteptr->sizes[constraints::blocksize];
+    const unsigned int           n_zeroes  = (wr_size - rd_size);
+    const unsigned int           nb = (blocksize<sensible_blocksize?32:2);
+    // Publish our statistics every this many packets
+    const unsigned int           publish_every = 16;
+
+    // Claim a socket + install our thread id in there such that the
+    // multirdcloser() can signal us. The statistics were reset by
+    // multinetopener(), before any of us started.
+    install_zig_for_this_thread(SIGUSR1);
+    SYNCEXEC(args,
+             stop = args->cancelled;
+             if( !stop && !mfd->fdqueue.empty() ) {
+                 network = mfd->fdqueue.front(); mfd->fdqueue.pop();
+                 network->threadid = new pthread_t( ::pthread_self() );
+                 network->pool     = new blockpool_type(blocksize, nb);
+                 mfd->rdstats.push_back( rdstats_type() );
+                 mystats = &mfd->rdstats.back();
+             });
+
+    if( stop || network==0 ) {
+        DEBUG(0, "multifdreader_stream[" << ::pthread_self() << "]: terminating before begin - "
+                 << (stop ? "cancelled" : "no more filedescriptors") << endl);
+        return;
+    }
+
+    // Creating the chain statistics entry only does something for the
+    // first reader; it does not reset the counter if it already exists
+    RTEEXEC(*rteptr, rteptr->statistics.init(args->stepid, "MultiUdpReadStream"));
+
+    auto_array<unsigned char> zeroes( n_zeroes ? new unsigned char[n_zeroes] : 0 );
+    if( n_zeroes )
+        ::memset(&zeroes[0], 0x0, n_zeroes);
+
+    // See udpsnorreader_stream() - peek at the [sequence number +] VDIF
+    // header to find out which data stream the frame belongs to, then
+    // read the whole datagram in the right place
+    struct iovec    iov_p[2], iov_r[2]; 
+    struct msghdr   msg_p, msg_r; 
+
+    msg_p.msg_name       = msg_r.msg_name       = (void*)&sender;
+    msg_p.msg_namelen    = msg_r.msg_namelen    = sizeof(sender);
+    msg_p.msg_control    = msg_r.msg_control    = 0;
+    msg_p.msg_controllen = msg_r.msg_controllen = 0;
+    msg_p.msg_flags      = msg_r.msg_flags      = 0;
+
+    iov_p[0].iov_base    = iov_r[0].iov_base    = &seqnr;
+    iov_p[0].iov_len     = iov_r[0].iov_len     = sizeof(seqnr);
+    iov_p[1].iov_base    = &vhdr;
+    iov_p[1].iov_len     = sizeof(struct vdif_header);
+    iov_r[1].iov_len     = rd_size;
+
+    // Plain udp: skip the sequence number iovec
+    msg_p.msg_iov        = &iov_p[seqnr_p ? 0 : 1];
+    msg_p.msg_iovlen     = (seqnr_p ? 2 : 1);
+    msg_r.msg_iov        = &iov_r[seqnr_p ? 0 : 1];
+    msg_r.msg_iovlen     = (seqnr_p ? 2 : 1);
+
+    DEBUG(0, "multifdreader_stream[" << ::pthread_self() << "]: fd=" << network->fd << " data:" << rd_size
+             << " seqnr:" << seqnr_p << " avbs: " << network->allow_variable_block_size << endl);
+
+    const ssize_t         waitpeek    = (ssize_t)((seqnr_p ? sizeof(seqnr) : 0) + sizeof(struct vdif_header));
+    const ssize_t         waitallread = (ssize_t)((seqnr_p ? sizeof(seqnr) : 0) + rd_size);
+    ssize_t               n = waitpeek;
+    unsigned int          npublish = publish_every;
+    datastream_mgmt_type& datastreams( rteptr->mk6info.datastreams );
+    datastream_id         dsid;
+    ds_map_type::iterator curDS;
+
+    while( true ) {
+        msg_p.msg_namelen = msg_r.msg_namelen = sizeof(sender);
+        if( (n=::recvmsg(network->fd, &msg_p, MSG_PEEK))!=waitpeek )
+            break;
+
+        // The datastream administration is shared between all readers
+        // (and not thread safe) so keep a local flat copy of the lookups;
+        // only VDIF keys not seen before by this reader need the lock
+        if( (dsid=dscache.find(vhdr.station_id, vhdr.thread_id, sender))==vdif_demux_type::noStream ) {
+            SYNCEXEC(args, dsid = datastreams.vdif2stream_id(vhdr.station_id, vhdr.thread_id, sender));
+            dscache.insert( vdif_key(vhdr.station_id, vhdr.thread_id, sender), dsid );
+        }
+
+        if( (curDS=datastream_state_map.find(dsid))==datastream_state_map.end() ) {
+           pair<ds_map_type::iterator, bool> insres = datastream_state_map.insert(make_pair(dsid, dsm_entry(network->pool->get())));
+           if( insres.second==false )
+               THROW_EZEXCEPT(datastreamexception_type, "Failed to add state for newly found data stream #" << dsid);
+           curDS = insres.first;
+        }
+        dsm_entry&  ds_state( curDS->second );
+
+        iov_r[1].iov_base = ds_state.location;
+        if( (n=::recvmsg(network->fd, &msg_r, MSG_WAITALL))!=waitallread )
+            break;
+
+        mystats->bytes += waitallread;
+        mystats->pkt_in++;
+
+        (void)(n_zeroes && ::memcpy(ds_state.location+rd_size, &zeroes[0], n_zeroes));
+
+        ds_state.location += wr_size;
+        if( ds_state.location >= ds_state.end ) {
+            if( outq->push( tagged<block>(curDS->first, ds_state.b))==false )
+                break;
+            datastream_state_map.erase( curDS );
+        }
+
+        if( seqnr_p ) {
+            ucounter_type   lost;
+            handle_sender_seqnr(sender, seqnr, per_sender, nSender, maxSender,
+                                network->fd, network->netparms.ackPeriod, lost);
+            mystats->pkt_lost = lost;
+        }
+
+        if( --npublish==0 ) {
+            publish_rdstats(args);
+            npublish = publish_every;
+        }
+    }
+    lastsyserror_type   lse; // Keep this one FIRST; it captures the value of errno!
+
+    // We're going to be dead soon - remove our thread id, see
+    // udpsnorreader_stream() why this is important
+    SYNCEXEC(args, delete network->threadid; network->threadid = 0);
+    publish_rdstats(args);
+
+    if( n!=waitallread && n!=waitpeek ) {
+        ds_map_type::const_iterator ptr;
+
+        // Send partial blocks downstream, if allowed
+        for(ptr=datastream_state_map.begin(); ptr!=datastream_state_map.end(); ptr++) {
+            const unsigned int sz = (unsigned int)(ptr->second.location - (unsigned char*)ptr->second.b.iov_base);
+            if( sz && network->allow_variable_block_size ) {
+                if( outq->push( tagged<block>(ptr->first, ptr->second.b.sub(0, sz)) )==false )
+                    DEBUG(-1, "multifdreader_stream: failed to push " << sz << " bytes for stream " << ptr->first << " (lost)" << endl);
+            } else {
+                DEBUG(-1, "multifdreader_stream: not allowed to push variable block of size " << sz << " bytes for stream " << ptr->first << " (lost)" << endl);
+            }
+        }
+        if( lse.sys_errno!=EINTR && lse.sys_errno!=EBADF ) {
+            ostringstream   oss;
+            oss << "multifdreader_stream: ::recvmsg(network->fd, &msg, /*flags*/) fails - [" << lse << "] (ask:"
+                << waitpeek << " or " << waitallread << " got:" << n << ")";
+            throw syscallexception(oss.str());
+        }
+    }
+    DEBUG(0, "multifdreader_stream[" << ::pthread_self() << "]: done" << endl);
+}
     
 
 // Chunkdest-Map: maps chunkid (uint) => destination (string)
@@ -6757,15 +7997,34 @@ void header_stripper( inq_type<tagged<frame> >* inq, outq_type<tagged<frame> >*
 // N output frames with tags Z[0], Z[1], ... , Z[N-1]
 // where Z[n] == splitterargs.outputtag(X, n)
 
-// state for each incoming tag X
+// The splitter can be run by >1 thread: the threads take turns in popping
+// a frame from the input queue and figuring out in which integration (and
+// where in there) the split data must go. Then they split in parallel.
+// An integration is sent downstream as soon as the last of its frames is
+// split and all older integrations of the same tag have been sent. So
+// different tags do not wait for each other - just like with a single
+// splitter thread - and each output tag gets its frames in order.
+// Pushing downstream is done without holding the state lock; one thread at
+// a time pushes for a given tag and it also takes care of integrations of
+// that tag that other threads complete in the mean time.
+//
+// An integration that doesn't complete (its tag stopped coming in) would
+// hold on to its blocks forever. Once per second of data the integrations
+// being filled are checked; the ones more than 'staleIntegration' seconds
+// behind are thrown away.
+static const time_t  staleIntegration = 2;
+
+// state for each integration of incoming tag X
 struct tag_state {
     block               tagblock[16];
-    unsigned int        fcount;
+    unsigned int        tag;
+    unsigned int        fcount;   // how many frames assigned to this integration
+    unsigned int        ndone;    // how many of those have been split
     unsigned char*      chunk[16];
     highrestime_type    out_ts;
 
-    tag_state( blockpool_type* bp, unsigned int nch ):
-        fcount( 0 )
+    tag_state( blockpool_type* bp, unsigned int nch, unsigned int t ):
+        tag( t ), fcount( 0 ), ndone( 0 )
     {
         for(unsigned  int tmpt=0; tmpt<nch; tmpt++) {
             tagblock[tmpt] = bp->get();
@@ -6777,14 +8036,53 @@ struct tag_state {
     tag_state();
 };
 
-void coalescing_splitter( inq_type<tagged<frame> >* inq, outq_type<tagged<frame> >* outq, sync_type<splitterargs>* args) {
-    typedef std::map<unsigned int,tag_state> tag_state_map_type;
+struct splitter_state {
+    // integration number (order of creation) => integration
+    typedef std::map<uint64_t, tag_state>     integration_map_type;
+    // tag => number of the integration currently being filled for it
+    typedef std::map<unsigned int, uint64_t>  filling_map_type;
+    typedef std::set<unsigned int>            tagset_type;
+
+    // 'popmutex' serializes popping + assigning frames to integrations,
+    // 'mutex' protects the rest. If both are needed, popmutex first.
+    pthread_mutex_t      popmutex;
+    pthread_mutex_t      mutex;
+    bool                 synced;
+    bool                 stop;
+    uint64_t             seqnr;
+    time_t               purge_sec;  // data second of the last stale check
+    integration_map_type integrations;
+    filling_map_type     filling;
+    tagset_type          pushing;    // tags some thread is pushing for
+
+    splitter_state():
+        synced( false ), stop( false ), seqnr( 0 ), purge_sec( 0 )
+    {
+        PTHREAD_CALL( ::pthread_mutex_init(&popmutex, 0) );
+        PTHREAD_CALL( ::pthread_mutex_init(&mutex, 0) );
+    }
+
+    ~splitter_state() {
+        ::pthread_mutex_destroy(&mutex);
+        ::pthread_mutex_destroy(&popmutex);
+    }
+
+    private:
+        splitter_state(splitter_state const&);
+        splitter_state const& operator=(splitter_state const&);
+};
+
+splitterargs::~splitterargs() {
+    // integrations that never completed still hold blocks from the pool
+    delete state;
+    delete pool;
+}
 
-    bool                 cancel;
+void coalescing_splitter( inq_type<tagged<frame> >* inq, outq_type<tagged<frame> >* outq, sync_type<splitterargs>* args) {
+    bool                 first = false;
     splitterargs*        splitargs = args->userdata;
     runtime*             rteptr    = (splitargs?splitargs->rte:0);
-    tagged<frame>        tf;
-    tag_state_map_type   tagstatemap;
+    splitter_state*      state     = 0;
     splitproperties_type splitprops = splitargs->splitprops;
 
     // Assert we have arguments
@@ -6804,107 +8102,208 @@ void coalescing_splitter( inq_type<tagged<frame> >* inq, outq_type<tagged<frame>
     //const unsigned int       naccumulate  = outputsize/ch_len;
     //const unsigned int       naccumulate  = (nchunk * outputsize) / inputheader.payloadsize;
     const unsigned int&      naccumulate  = splitargs->naccumulate;
-    const splitfunction      splitfn      = splitprops.fnptr();
+    // Fused splitters need some memory for their intermediate results
+    vector<unsigned char>    scratch( splitprops.scratchsize() );
+    unsigned char*           scratchptr   = (scratch.empty() ? 0 : &scratch[0]);
 
-    // Before crashing, at least tell what we think we're doing
-    DEBUG(-1, "coalescing_splitter: starting up" << endl <<
-              "    expect " << inputheader << endl <<
-              "    payload [" << inputheader.payloadsize << "bytes] split into " << nchunk << " pieces" << endl <<
-              "    accumulating " << naccumulate << " frames" << endl <<
-              "    producing " << outputheader << endl);
+    // Mark K's sse-dechannelizing routines write past the end of the chunk,
+    // into the next frame's slot. With >1 thread that frame may already
+    // have been split, so then we split into private memory and copy
+    const unsigned int       stagestride  = ch_len + 64;
+    const bool               staged       = (splitargs->nthread>1);
+    vector<unsigned char>    stage( staged ? nchunk*stagestride : 0 );
 
     // We must prepare our blockpool depending on which data we expect to be
     // getting.
     // Mark K's sse-dechannelizing routines access 16 bytes past the end.
-    // So we add extra bytes to the end
+    // So we add extra bytes to the end.
+    // Only the first thread of this step creates the shared stuff
     SYNCEXEC(args,
-             blkpool = splitargs->pool = new blockpool_type(outputsize+16, nchunk));
-
-    RTEEXEC(*rteptr,
-            rteptr->statistics.init(args->stepid, splitprops.name(), 0));
-    counter_type&   counter( rteptr->statistics.counter(args->stepid) );
-
-
-    // Wait for an integral second boundary (or cancel) - only if it's real
-    // data! [we take the inputheader to be valid as a signal for that]
-    // With fill pattern we just wait for the first block to arrive since
-    // most likely there won't be a valid timestamp in there anyway
-    while( (cancel=(inq->pop(tf)==false))==false && inputheader.valid() &&
-           tf.item.frametime.tv_subsecond!=0 ) { };
-
-    if( cancel ) {
-        DEBUG(-1, "coalescing_splitter: cancelled whilst waiting for integral second boundary" << endl);
-        return;
+             if( splitargs->state==0 ) {
+                 first            = true;
+                 splitargs->pool  = new blockpool_type(outputsize+16, nchunk);
+                 splitargs->state = new splitter_state();
+             }
+             blkpool = splitargs->pool; state = splitargs->state);
+
+    if( first ) {
+        // Before crashing, at least tell what we think we're doing
+        DEBUG(-1, "coalescing_splitter: starting up" << endl <<
+                  "    expect " << inputheader << endl <<
+                  "    payload [" << inputheader.payloadsize << "bytes] split into " << nchunk << " pieces" << endl <<
+                  "    accumulating " << naccumulate << " frames" << endl <<
+                  "    producing " << outputheader << endl);
+        RTEEXEC(*rteptr,
+                rteptr->statistics.init(args->stepid, splitprops.name(), 0));
     }
+    counter_type&   counter( rteptr->statistics.counter(args->stepid) );
 
-    // *now* we can start doing stuff!
-    do {
-        if( !(tf.item.frametype==inputheader.frameformat &&
-              ((inputheader.framesize>0 && tf.item.framedata.iov_len==inputheader.framesize) ||
-              (tf.item.framedata.iov_len==inputheader.payloadsize)) )  ) {
-            DEBUG(-1, "coalescing_splitter: expect " << inputheader
-                      << " got " << tf.item.ntrack << " x " <<
-                      tf.item.frametype << endl);
-            break;
-        }
+    while( true ) {
         // OH NOES! SOME DATA CAME IN!
         // First of all, find the correct 'integration' -
         // we split <nchunk> blocks of each incoming <tag>
         // into <nchunk> different pieces. After having processed
         // <nchunk> frames of a particular tag, we send them
         // onwards downstream, potentially re-tagging them
-        unsigned char**               chunk;
-        tag_state_map_type::iterator  curtag;
-       
-        if( (curtag=tagstatemap.find(tf.tag))==tagstatemap.end() ) {
-            // first time we see this tag - get a new integration state
-            pair<tag_state_map_type::iterator, bool> insres;
-            insres = tagstatemap.insert( make_pair(tf.tag, tag_state(blkpool, nchunk)) );
-            ASSERT2_COND(insres.second,
-                         SCINFO("Failed to insert new state for splitting into for tag #" << tf.tag));
-            curtag = insres.first;
-
-            // remember the time of the first frame
-            curtag->second.out_ts = tf.item.frametime;
-        }
-
-        // Everything has been precomputed so we can get going right away
-        tag_state&      tagstate( curtag->second );
-
-        chunk = tagstate.chunk;
-        splitfn((unsigned char*)tf.item.framedata.iov_base + inputheader.payloadoffset,
-                inputheader.payloadsize,
-                chunk[0], chunk[1], chunk[2], chunk[3],
-                chunk[4], chunk[5], chunk[6], chunk[7], 
-                chunk[8], chunk[9], chunk[10], chunk[11], 
-                chunk[12], chunk[13], chunk[14], chunk[15]);
-
-        // If we need to do another iteration, increment the pointers
-        if( (++tagstate.fcount)<naccumulate ) {
-            for(unsigned int tmpt=0; tmpt<nchunk; tmpt++)
-                chunk[tmpt] += ch_len;
-            continue;
-        }
+        bool           done = false;
+        tag_state*     tagstate = 0;
+        tagged<frame>  tf;
+        unsigned char* chunk[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+        {
+            mutex_locker  poplock( state->popmutex );
+
+            if( (done=(inq->pop(tf)==false))==false && !state->synced ) {
+                // Wait for an integral second boundary (or cancel) - only if it's real
+                // data! [we take the inputheader to be valid as a signal for that]
+                // With fill pattern we just wait for the first block to arrive since
+                // most likely there won't be a valid timestamp in there anyway
+                while( inputheader.valid() && tf.item.frametime.tv_subsecond!=0 &&
+                       (done=(inq->pop(tf)==false))==false ) { };
+                if( done )
+                    DEBUG(-1, "coalescing_splitter: cancelled whilst waiting for integral second boundary" << endl);
+                state->synced = true;
+            }
+            if( done )
+                break;
 
-        // Ok now push the dechannelized frames onward
-        block*       tagblock = tagstate.tagblock;
-        unsigned int j;
-        for(j=0; j<nchunk; j++)
-            if( outq->push( tagged<frame>(curtag->first*nchunk + j,
-                                          frame(outputheader.frameformat, outputheader.ntrack, tagstate.out_ts,
-                                                tagblock[j].sub(0, outputsize))) )==false )
+            if( !(tf.item.frametype==inputheader.frameformat &&
+                  ((inputheader.framesize>0 && tf.item.framedata.iov_len==inputheader.framesize) ||
+                  (tf.item.framedata.iov_len==inputheader.payloadsize)) )  ) {
+                DEBUG(-1, "coalescing_splitter: expect " << inputheader
+                          << " got " << tf.item.ntrack << " x " <<
+                          tf.item.frametype << endl);
+                mutex_locker  statelock( state->mutex );
+                state->stop = true;
                 break;
+            }
 
-        if( j<nchunk ) {
-            DEBUG(-1, "coalescing_splitter: failed to push channelized data. stopping." << endl);
-            break;
+            mutex_locker                                   statelock( state->mutex );
+            splitter_state::filling_map_type::iterator     curtag;
+            splitter_state::integration_map_type::iterator curint;
+
+            // Another thread may have decided we're done
+            if( state->stop )
+                break;
+
+            // Once per second of data throw away integrations that are
+            // not going to complete: those still being filled, as long as
+            // no-one is splitting into them
+            if( tf.item.frametime.tv_sec!=state->purge_sec ) {
+                state->purge_sec = tf.item.frametime.tv_sec;
+
+                for(splitter_state::filling_map_type::iterator f=state->filling.begin(); f!=state->filling.end(); ) {
+                    curint = state->integrations.find( f->second );
+
+                    if( curint->second.ndone==curint->second.fcount &&
+                        tf.item.frametime.tv_sec > curint->second.out_ts.tv_sec + staleIntegration ) {
+                        DEBUG(-1, "coalescing_splitter: dropping incomplete integration of tag " << f->first << " ("
+                                  << curint->second.fcount << " of " << naccumulate << " frames)" << endl);
+                        state->integrations.erase( curint );
+                        state->filling.erase( f++ );
+                    } else {
+                        f++;
+                    }
+                }
+            }
+
+            if( (curtag=state->filling.find(tf.tag))==state->filling.end() ) {
+                // first time we see this tag - get a new integration state
+                pair<splitter_state::integration_map_type::iterator, bool> insres;
+
+                insres = state->integrations.insert( make_pair(state->seqnr, tag_state(blkpool, nchunk, tf.tag)) );
+                ASSERT2_COND(insres.second,
+                             SCINFO("Failed to insert new state for splitting into for tag #" << tf.tag));
+                curint = insres.first;
+                curtag = state->filling.insert( make_pair(tf.tag, state->seqnr++) ).first;
+
+                // remember the time of the first frame
+                curint->second.out_ts = tf.item.frametime;
+            } else {
+                curint = state->integrations.find( curtag->second );
+            }
+
+            // Everything has been precomputed so we can work out where
+            // this frame's data should go
+            tagstate = &curint->second;
+            for(unsigned int tmpt=0; tmpt<nchunk; tmpt++)
+                chunk[tmpt] = tagstate->chunk[tmpt] + tagstate->fcount * ch_len;
+
+            // If this was the last frame of this integration, the next
+            // frame with this tag starts a new one
+            if( (++tagstate->fcount)==naccumulate )
+                state->filling.erase( curtag );
         }
-        counter += nchunk*outputsize;
 
-        // And reset for the next iteration - ie erase the integration for
-        // the current tag
-        tagstatemap.erase(curtag);
-    } while( inq->pop(tf) );
+        unsigned char* dst[16];
+
+        for(unsigned int tmpt=0; tmpt<16; tmpt++)
+            dst[tmpt] = (staged && tmpt<nchunk) ? &stage[tmpt*stagestride] : chunk[tmpt];
+
+        splitprops.split((unsigned char*)tf.item.framedata.iov_base + inputheader.payloadoffset,
+                         inputheader.payloadsize, dst, scratchptr);
+
+        if( staged )
+            for(unsigned int tmpt=0; tmpt<nchunk; tmpt++)
+                ::memcpy(chunk[tmpt], dst[tmpt], ch_len);
+
+        // If this was the last frame of the integration, push the
+        // dechannelized frames onward - together with the ones of the same
+        // tag that completed before, but had to wait for an older one.
+        // If another thread is already pushing for this tag, it will pick
+        // ours up too.
+        const unsigned int  tag = tagstate->tag;
+        vector<tag_state>   ready;
+        bool                stop;
+
+        PTHREAD_CALL( ::pthread_mutex_lock(&state->mutex) );
+        if( (++tagstate->ndone)==naccumulate && state->pushing.insert(tag).second ) {
+            while( !state->stop ) {
+                // Take out the oldest complete integrations for this tag
+                splitter_state::integration_map_type::iterator  curint = state->integrations.begin();
+
+                ready.clear();
+                while( true ) {
+                    while( curint!=state->integrations.end() && curint->second.tag!=tag )
+                        curint++;
+                    if( curint==state->integrations.end() || curint->second.ndone!=naccumulate )
+                        break;
+                    ready.push_back( curint->second );
+                    state->integrations.erase( curint++ );
+                }
+                if( ready.empty() )
+                    break;
+
+                // Downstream may block; don't hold up the other threads
+                PTHREAD_CALL( ::pthread_mutex_unlock(&state->mutex) );
+                unsigned int                      j = nchunk;
+                uint64_t                          npushed = 0;
+                vector<tag_state>::const_iterator oldest;
+                for(oldest=ready.begin(); oldest!=ready.end() && j==nchunk; oldest++) {
+                    block const* tagblock = oldest->tagblock;
+                    for(j=0; j<nchunk; j++)
+                        if( outq->push( tagged<frame>(oldest->tag*nchunk + j,
+                                                      frame(outputheader.frameformat, outputheader.ntrack, oldest->out_ts,
+                                                            tagblock[j].sub(0, outputsize))) )==false )
+                            break;
+                    if( j==nchunk )
+                        npushed += nchunk*outputsize;
+                }
+                PTHREAD_CALL( ::pthread_mutex_lock(&state->mutex) );
+                counter += npushed;
+
+                if( j<nchunk ) {
+                    DEBUG(-1, "coalescing_splitter: failed to push channelized data. stopping." << endl);
+                    state->stop = true;
+                }
+            }
+            state->pushing.erase( tag );
+        }
+        stop = state->stop;
+        PTHREAD_CALL( ::pthread_mutex_unlock(&state->mutex) );
+        if( stop )
+            break;
+    }
     DEBUG(2, "coalescing_splitter: done " << endl);
 }
 
@@ -7031,12 +8430,12 @@ void reframe_to_vdif(inq_type<tagged<frame> >* inq, outq_type<tagged<miniblockli
         //         This would support "x samples per y second" where y != 1
         const subsecond_type vdif_framelen   = 8*output_size / (tf.item.ntrack * bitrate);
         const subsecond_type vdif_framerate  = 1/vdif_framelen;
-        const subsecond_type first_fn        = time.tv_subsecond / vdif_framelen;
+        uint64_t             first_fn;
 
-        EZASSERT2(first_fn.denominator()==1, reframeexception,
+        EZASSERT2(subsecond2framenumber(time.tv_subsecond, vdif_framelen, first_fn), reframeexception,
              EZINFO("data time stamp " << time << " not representable as frame number using frame length " << vdif_framelen));
 
-        for(uint64_t dfn=first_fn.numerator(), pos=0;
+        for(uint64_t dfn=first_fn, pos=0;
                 !stop && (pos+output_size)<=last;
                 dfn++, pos+=output_size) {
             block          vdifh( pool->get() );
@@ -95,6 +95,20 @@ struct frame {
     frame(format_type tp, unsigned int n, const highrestime_type& ft, block data);
 };
 
+// A stretch of bytes of an open file or FlexBuff/Mark6 recording.
+// The zero-copy transfers pass these around instead of blocks: the reader
+// only says what to send and the writer has the kernel move the bytes
+// from the page cache to the socket.
+struct filerange {
+    int     fd;
+    bool    vbs;      // 'fd' was opened by libvbs
+    off_t   offset;
+    size_t  len;
+
+    filerange();
+    filerange(int f, bool v, off_t o, size_t l);
+};
+
 template <typename T>
 struct tagged {
     T            item;
@@ -126,9 +140,13 @@ void fdreader(outq_type<block>*, sync_type<fdreaderargs>* );
 void fdreader_c(outq_type<block>*, sync_type<cfdreaderargs>* );
 void vbsreader(outq_type<block>*, sync_type<fdreaderargs>* );
 void vbsreader_c(outq_type<block>*, sync_type<cfdreaderargs>* );
+// zero-copy versions: produce ranges in stead of reading the data
+void fdrangereader(outq_type<filerange>*, sync_type<fdreaderargs>* );
+void vbsrangereader_c(outq_type<filerange>*, sync_type<cfdreaderargs>* );
 void netreader(outq_type<block>*, sync_type<fdreaderargs>*);
 void netreader_stream(outq_type< tagged<block> >*, sync_type<fdreaderargs>*);
 void multifdreader(outq_type<block>*, sync_type<multifdrdargs>*);
+void multifdreader_stream(outq_type< tagged<block> >*, sync_type<multifdrdargs>*);
 
 // steps
 
@@ -162,6 +180,10 @@ void diskwriter(inq_type<block>*);
 //void fdwriter(inq_type<block>*, sync_type<fdreaderargs>*);
 void sfxcwriter(inq_type<block>*, sync_type<fdreaderargs>*);
 
+// Sends the file ranges over an already connected tcp/itcp socket using
+// sendfile(2). See zerocopy_transfer().
+void netsendfile(inq_type<filerange>*, sync_type<fdreaderargs>*);
+
 // a checker. checks received data against expected pattern
 // (use 'fill2net' + 'net2check')
 void checker(inq_type<block>*, sync_type<fillpatargs>*);
@@ -474,6 +496,10 @@ struct framefilterargs_type {
 };
 
 
+// Shared state of all threads running the same coalescing_splitter step;
+// defined in threadfns.cc
+struct splitter_state;
+
 // 'fname' will be used to look up the actual
 // splitfunction (+properties), see splitstuff.h
 // the tag-chunk will be called with the incoming
@@ -500,11 +526,14 @@ struct framefilterargs_type {
 struct splitterargs {
     runtime*             rte;
     blockpool_type*      pool;
+    splitter_state*      state;
     headersearch_type    inputhdr;
     headersearch_type    outputhdr;
     splitproperties_type splitprops;
     const unsigned int   ch_len;
     const unsigned int   naccumulate;
+    // how many threads will run the splitter step (default 1)
+    unsigned int         nthread;
 
     // The splitter needs to know the splittingroutine
     // and the input-dataformat [described by 'inhdr'].
@@ -515,7 +544,7 @@ struct splitterargs {
                  const headersearch_type& inhdr,
                  unsigned int nacc = splitproperties_type::natural_accumulation);
 
-    // deletes blockpool (not rte)
+    // deletes blockpool and splitter state (not rte)
     ~splitterargs();
 };
 
@@ -568,12 +597,28 @@ struct multifdargs {
 };
 
 // When doing multiple fd readers we have a stack of fdreaderargs*
-// and each reader pops one off and adds to base class' fdreaders list
+// and each reader pops one off. They are already in the base class'
+// fdreaders list such that multirdcloser() can close all of them, even
+// the ones no reader thread has claimed yet.
 typedef std::queue<fdreaderargs*> fdqueue_type;
+
+// Each parallel reader keeps its own statistics; only the reader itself
+// writes to its entry. The sum over all readers is what gets published in
+// the runtime's evlbi statistics and the chain's byte counter.
+struct rdstats_type {
+    uint64_t    bytes;
+    uint64_t    pkt_in;
+    uint64_t    pkt_lost;
+
+    rdstats_type();
+};
+typedef std::list<rdstats_type> rdstatslist_type;
+
 struct multifdrdargs: public multifdargs {
-    //fdqueue_type    fdqueue;
+    fdqueue_type     fdqueue;
+    rdstatslist_type rdstats;
 
-    multifdrdargs(runtime* rte/*, fdqueue_type const& fdq*/);
+    multifdrdargs(runtime* rte, fdqueue_type const& fdq);
     virtual ~multifdrdargs();
 };
 
@@ -617,8 +662,10 @@ struct reframe_args {
 
 multifdargs*   multiopener( multidestparms mdp );
 multifdargs*   multifileopener( multidestparms mdp );
-// Opens n identical sockets based on rte->netparms
-multifdrdargs* multinetopener( runtime* rte/*, unsigned int n*/);
+// Opens n identical sockets based on rte->netparms. For UDP this relies
+// on SO_REUSEPORT (see getsok.cc) to let the kernel distribute the
+// incoming flows over the sockets
+multifdrdargs* multinetopener( runtime* rte, unsigned int n );
 void           multicloser( multifdargs* );
 void           multirdcloser( multifdrdargs* );
 
@@ -653,6 +700,9 @@ void           header_stripper(inq_type<tagged<frame> >*, outq_type<tagged<frame
 // need to stop
 fdreaderargs* net_server(networkargs net);
 fdreaderargs* net_client(networkargs net);
+
+// Write the id that an itcp stream starts with to the (connected) socket
+void write_itcp_id(fdreaderargs* network);
 fdreaderargs* open_file(std::string fnam, runtime* r = 0);
 fdreaderargs* open_sfxc_socket(std::string fnam, runtime* r = 0);
 fdreaderargs* open_vbs(std::string recnam, runtime* runtimeptr); // not optional runtime ptr!
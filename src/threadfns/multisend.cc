@@ -21,8 +21,12 @@
 #include <mk5_exception.h>
 #include <evlbidebug.h>
 #include <sciprint.h>
+#include <stringutil.h>
 #include <getsok.h>
 #include <mk6info.h>
+#include <recording_catalog.h>
+#include <directwriter.h>
+#include <pacer.h>     // for monotonic_ns()
 #include <getsok_udt.h>
 #include <threadutil.h>
 #include <auto_array.h>
@@ -35,6 +39,8 @@
 #include <ftw.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <inttypes.h>
 #include <pthread.h>
 #include <signal.h>
@@ -122,13 +128,108 @@ multireadargs::~multireadargs() {
         delete pool->second;
 }
 
+///////////////////////////////////////////////////////////////////
+//          mk6_indexrecord_type
+///////////////////////////////////////////////////////////////////
+mk6_indexrecord_type::mk6_indexrecord_type(string const& p):
+    path( p ), pos( (int64_t)sizeof(mk6_file_header) ), ok( true )
+{}
+
 ///////////////////////////////////////////////////////////////////
 //          multifileargs
 ///////////////////////////////////////////////////////////////////
 
 multifileargs::multifileargs(runtime* ptr, filelist_type fl, mark6_vars_type mk6):
-    listlength( fl.size() ), rteptr( ptr ), filelist( fl ), mk6vars( mk6 )
-{ EZASSERT2_NZERO(rteptr, cmdexception, EZINFO("null pointer runtime!")) }
+    listlength( fl.size() ), rteptr( ptr ), filelist( fl ), mk6vars( mk6 ),
+    directio( ptr ? ptr->mk6info.directio : false ), nPicked( 0 )
+{
+    EZASSERT2_NZERO(rteptr, cmdexception, EZINFO("null pointer runtime!"));
+
+    // Each recording starts with a clean slate: a disk that was slow in a
+    // previous recording (busy with something else, being rebuilt) may be
+    // fine now. The runtime's copy is what "disk_stats?" shows so start
+    // that afresh as well.
+    for(filelist_type::const_iterator mp=filelist.begin(); mp!=filelist.end(); mp++)
+        diskstats.insert( make_pair(*mp, mountpoint_stats_type()) );
+    RTEEXEC(*rteptr,
+            for(filelist_type::const_iterator mp=filelist.begin(); mp!=filelist.end(); mp++)
+                rteptr->mk6info.diskstats[*mp] = mountpoint_stats_type(); );
+}
+
+// Tunables for the scheduler:
+//  weight of the newest measurement in the moving average
+//  mountpoints need at least this many chunks written before we judge them
+//  demote if slower than this fraction of the average of the others
+//  promote again if faster than this fraction (hysteresis)
+//  every this many chunks a demoted mountpoint, if free, gets one to see
+//  if it has recovered
+static const double   rateWeight      = 0.2;
+static const uint64_t minChunkJudged  = 4;
+static const double   demoteFraction  = 0.5;
+static const double   promoteFraction = 0.75;
+static const uint64_t probeInterval   = 16;
+
+string multifileargs::next_mountpoint( void ) {
+    string                  rv;
+    filelist_type::iterator mp;
+    // Normally look for the first healthy mountpoint, but now and again
+    // for a demoted one: it must be written to to find out if it's
+    // better now
+    const bool              probe = ((++nPicked % probeInterval)==0);
+
+    for(mp=filelist.begin(); mp!=filelist.end(); mp++) {
+        mountpointstats_type::const_iterator p = diskstats.find(*mp);
+        if( (p!=diskstats.end() && p->second.demoted)==probe )
+            break;
+    }
+    // Only demoted mountpoints available; better to use one of those
+    // than to wait and fall behind. Or, when probing, none of the
+    // demoted ones is free
+    if( mp==filelist.end() )
+        mp = filelist.begin();
+    rv = *mp;
+    filelist.erase( mp );
+    return rv;
+}
+
+mountpoint_stats_type const& multifileargs::chunk_written(string const& mp, uint64_t nbyte, double dt) {
+    unsigned int           nOther = 0;
+    double                 sumOther = 0.0;
+    mountpoint_stats_type& st = diskstats[mp];
+    const double           rate = (dt>0.0) ? (double)nbyte/dt : st.avgRate;
+
+    st.nChunk++;
+    st.nByte       += nbyte;
+    st.tWrite      += dt;
+    st.lastLatency  = dt;
+    st.avgRate      = (st.nChunk==1) ? rate : (rateWeight*rate + (1.0-rateWeight)*st.avgRate);
+
+    if( st.nChunk<minChunkJudged )
+        return st;
+
+    // Compare to the average of the other mountpoints that we know enough of
+    for(mountpointstats_type::const_iterator p=diskstats.begin(); p!=diskstats.end(); p++) {
+        if( p->first==mp || p->second.nChunk<minChunkJudged )
+            continue;
+        nOther++;
+        sumOther += p->second.avgRate;
+    }
+    if( nOther==0 )
+        return st;
+
+    const double avgOther = sumOther/nOther;
+
+    if( !st.demoted && st.avgRate<demoteFraction*avgOther ) {
+        st.demoted = true;
+        st.nDemoted++;
+        DEBUG(-1, "parallelwriter: demoting mountpoint " << mp << " - " << byteprint(st.avgRate, "byte/s") << " vs "
+                  << byteprint(avgOther, "byte/s") << " average" << endl);
+    } else if( st.demoted && st.avgRate>=promoteFraction*avgOther ) {
+        st.demoted = false;
+        DEBUG(-1, "parallelwriter: mountpoint " << mp << " back to normal - " << byteprint(st.avgRate, "byte/s") << endl);
+    }
+    return st;
+}
 
 multifileargs::~multifileargs() {
     // delete all memory pools
@@ -137,9 +238,34 @@ multifileargs::~multifileargs() {
     // close all files
     for(fdmap_type::iterator curfd=fdmap.begin(); curfd!=fdmap.end(); curfd++)
         if( curfd->second>=0 ) {
+            struct stat                 st;
+            dwmap_type::iterator        dwptr  = dwmap.find( curfd->first );
+            mk6_indexmap_type::iterator idxptr = mk6index.find( curfd->first );
+
+            // With direct I/O there may still be data staged
+            if( dwptr!=dwmap.end() ) {
+                if( dwptr->second->finish()!=0 ) {
+                    DEBUG(-1, "multifileargs: failed to flush " << curfd->first << " - " << evlbi5a::strerror(errno) << endl);
+                    if( idxptr!=mk6index.end() )
+                        idxptr->second.ok = false;
+                }
+                delete dwptr->second;
+                dwmap.erase( dwptr );
+            }
+            // Only write the index if all blocks made it to this file
+            // and we know what the file looks like after the last write
+            const bool                  doIndex = (idxptr!=mk6index.end() && idxptr->second.ok &&
+                                                   ::fstat(curfd->second, &st)==0);
+
             DEBUG(3, "Closing fd#" << curfd->second << " [" << curfd->first << "]" << endl);
             ::close( curfd->second );
+
+            if( doIndex && !write_mk6_index(idxptr->second.path, st, idxptr->second.index) )
+                DEBUG(-1, "multifileargs: failed to write Mark6 index for " << idxptr->second.path << endl);
         }
+    // Writers for files that never made it into fdmap
+    for(dwmap_type::iterator dwptr=dwmap.begin(); dwptr!=dwmap.end(); dwptr++)
+        delete dwptr->second;
 }
 
 ///////////////////////////////////////////////////////////////////
@@ -187,6 +313,13 @@ rsyncinitargs::~rsyncinitargs() {
     }
 }
 
+///////////////////////////////////////////////////////////////////
+//         parallelsenderargs
+///////////////////////////////////////////////////////////////////
+parallelsenderargs::parallelsenderargs(networkargs na, bool p):
+    netargs( na ), persistent( p )
+{}
+
 ////////////  file descriptor operations
 DECLARE_EZEXCEPT(udtexcept)
 DEFINE_EZEXCEPT(udtexcept)
@@ -324,8 +457,10 @@ struct chunkLocationMaker {
     }
 };
 
-// Use the find_recordingchunks() from mountpoints.h [it's multithreaded!]
-// afterwards we transform the entries into a chunklist_type
+// find_recordingchunks() from mountpoint.h looks the chunks up in the
+// recording catalog (recording_catalog.h); only mountpoints that can't be
+// watched for changes are listed on the spot. Afterwards we transform the
+// entries into a chunklist_type
 chunklist_type get_chunklist(string scan, const mountpointlist_type& mountpoints) {
     filelist_type   chunks = find_recordingchunks(scan, mountpoints);
     chunklist_type  rv;
@@ -760,20 +895,55 @@ void parallelreader(outq_type<chunk_type>* outq, sync_type<multifileargs>* args)
 ///////////////////// Parallelsender  ////////////////////
 //////////////////////////////////////////////////////////
 
+// Per connection throughput of the parallel sender/reader are kept in
+// the runtime such that "conn_stats?" can show them.
+// Returns the number of the new connection
+static unsigned int conn_open(runtime* rteptr, const string& peer) {
+    unsigned int  id;
+
+    RTEEXEC(*rteptr,
+            id = (rteptr->connstats.empty() ? 0 : rteptr->connstats.rbegin()->first + 1);
+            rteptr->connstats[id] = connstats_type(peer) );
+    return id;
+}
+
+// Account for a chunk sent/received over connection 'id' and return the
+// updated statistics
+static connstats_type conn_chunk(runtime* rteptr, unsigned int id, uint64_t nbyte) {
+    const double    now = (double)monotonic_ns()/1.0e9;
+    connstats_type  rv;
+
+    RTEEXEC(*rteptr,
+            connstatsmap_type::iterator p = rteptr->connstats.find(id);
+            // "conn_stats=reset" may have removed it
+            if( p!=rteptr->connstats.end() ) {
+                p->second.nChunk++;
+                p->second.nByte += nbyte;
+                p->second.tLast  = now;
+                rv = p->second;
+            } );
+    return rv;
+}
+
 // Only support TCP and UDT at the moment
 // maybe multinetargs?
-void parallelsender(inq_type<chunk_type>* inq, sync_type<networkargs>* args) {
+void parallelsender(inq_type<chunk_type>* inq, sync_type<parallelsenderargs>* args) {
     // the idea is to pop an item, open a new client connection and blurt
-    // out the data
+    // out the data. In persistent mode the connection is only opened for
+    // the first item and kept open until we're done
     int                rv;
     char               dummy[16];
     runtime*           rteptr  = 0;
     chunk_type         chunk;
-    const networkargs& np( *args->userdata );
+    const networkargs& np( args->userdata->netargs );
+    const bool         persistent( args->userdata->persistent );
     fdoperations_type  fdops( np.netparms.get_protocol() );
     const bool         is_udt( np.netparms.get_protocol() == "udt" );
+    fdreaderargs*      conn = 0;
+    unsigned int       connid = 0;
+    connstats_type     connstats;
 
-    DEBUG(4, "parallelsender[" << ::pthread_self() << "] starting" << endl);
+    DEBUG(4, "parallelsender[" << ::pthread_self() << "] starting" << (persistent ? " [persistent]" : "") << endl);
 
     // Arrange for performance counter
     EZASSERT2_NZERO((rteptr = np.rteptr), cmdexception, EZINFO("null-pointer for runtime?"));
@@ -788,31 +958,37 @@ void parallelsender(inq_type<chunk_type>* inq, sync_type<networkargs>* args) {
     // Our main loop!
     while( inq->pop(chunk) ) {
         DEBUG(3, "parallelsender[" << ::pthread_self() << "] processing " << chunk.tag.fileName << endl);
-        // open new connection to wherever we're supposed to send to
+        // open new connection to wherever we're supposed to send to,
+        // unless we still have one
         int            ipd    = ipd_ns( np.netparms );
         unsigned int   ntries = 0;
         kvmap_type     hdr;
-        fdreaderargs*  conn = 0;
         ostringstream  streamIds;
 
-        while( conn==0 ) {
-            try {
-                conn = net_client( np );
-            }
-            catch( exception const& e ) {
-                EZASSERT2(++ntries<5, cmdexception, EZINFO("parallelsender: " << e.what()));
-                ::sleep( 1 );
+        if( conn==0 ) {
+            while( conn==0 ) {
+                try {
+                    conn = net_client( np );
+                }
+                catch( exception const& e ) {
+                    EZASSERT2(++ntries<5, cmdexception, EZINFO("parallelsender: " << e.what()));
+                    ::sleep( 1 );
+                }
             }
-        }
+            connid    = conn_open(rteptr, np.netparms.host + ":" + repr(np.netparms.get_port()));
+            connstats = connstats_type();
 
-        if( np.netparms.get_protocol().find("tcp")==string::npos ) {
-            EZASSERT2(ipd>=0, cmdexception, EZINFO("An IPD of <0 (" << ipd << ") is unacceptable"));
-            fdops.set_ipd(conn->fd, ipd);
+            if( np.netparms.get_protocol().find("tcp")==string::npos ) {
+                EZASSERT2(ipd>=0, cmdexception, EZINFO("An IPD of <0 (" << ipd << ") is unacceptable"));
+                fdops.set_ipd(conn->fd, ipd);
+            }
         }
 
         // Make the meta data
         hdr.set( "fileName", chunk.tag.fileName );
         hdr.set( "fileSize", chunk.tag.fileSize );
+        if( persistent )
+            hdr.set( "persistent", 1 );
 
         size_t         sz;
         const string   streamId( hdr.toBinary() );
@@ -841,18 +1017,46 @@ void parallelsender(inq_type<chunk_type>* inq, sync_type<networkargs>* args) {
                         loscnt += ti.pktSndLoss);
             }
         }
+        connstats = conn_chunk(rteptr, connid, (uint64_t)(chunk.item.iov_len - sz));
+        DEBUG(3, "parallelsender[" << ::pthread_self() << "] done processing " << chunk.tag.fileName << endl);
+        chunk.item = block();
+
+        // In persistent mode keep the connection open for the next
+        // chunk, unless sending this one failed
+        if( persistent && sz==0 )
+            continue;
+
         // Ok, wait for remote side to acknowledge (or close the sokkit)
         // The read fails anyway even if the remote side did send something
         // (using UDT). The UDT lib is krappy!
         DEBUG(3, "parallelsender[" << ::pthread_self() << "] wait for remote" << endl);
         fdops.read(conn->fd, &dummy[0], 16, 0);
 
-        DEBUG(3, "parallelsender[" << ::pthread_self() << "] closing file" << endl);
+        DEBUG(3, "parallelsender[" << ::pthread_self() << "] closing connection" << endl);
+        DEBUG(2, "parallelsender[" << ::pthread_self() << "] connection " << connstats << endl);
         // Done! Close file and lose memory resource!
         fdops.close( conn->fd );
-        chunk.item = block();
         delete conn;
-        DEBUG(3, "parallelsender[" << ::pthread_self() << "] done processing " << chunk.tag.fileName << endl);
+        conn = 0;
+    }
+
+    // If we still have a connection open we're in persistent mode; tell
+    // the other side we're done and wait for it to close the connection
+    if( conn ) {
+        kvmap_type    hdr;
+
+        hdr.set( "endOfStream", 1 );
+        const string  eos( hdr.toBinary() );
+
+        if( fdops.write(conn->fd, eos.c_str(), (ssize_t)eos.size(), 0)==(ssize_t)eos.size() ) {
+            DEBUG(3, "parallelsender[" << ::pthread_self() << "] wait for remote" << endl);
+            fdops.read(conn->fd, &dummy[0], 16, 0);
+        } else {
+            DEBUG(-1, "parallelsender[" << ::pthread_self() << "] failed to send end-of-stream - " << evlbi5a::strerror(errno) << endl);
+        }
+        DEBUG(2, "parallelsender[" << ::pthread_self() << "] connection " << connstats << endl);
+        fdops.close( conn->fd );
+        delete conn;
     }
     DEBUG(4, "parallelsender[" << ::pthread_self() << "] done " << byteprint((double)counter, "byte") << endl);
 }
@@ -935,169 +1139,200 @@ void parallelnetreader(outq_type<chunk_type>* outq, sync_type<multinetargs>* arg
 
             DEBUG(3, "parallelnetreader[" << ::pthread_self() << "] incoming fd#" << incoming->first << " (" << incoming->second << ")" << endl);
 
-            // First read the metadata:
-            id_values.fromBinary( read_itcp_header(incoming->first, fdops) );
-
-            // Assert we have the correct ones
-            nmptr = id_values.find("fileName");
-            szptr = id_values.find("fileSize");
-            rqptr = id_values.find("requestRsync");
-            psptr = id_values.find("payloadSize");
-
-            // We must have either nmptr/szptr or rsync/payload, nothing else
-            const bool   conds[4] = { nmptr!=id_values.end(), szptr!=id_values.end(),
-                                      rqptr!=id_values.end(), psptr!=id_values.end() };
-
-            EZASSERT2( (conds[0] && conds[1] && !(conds[2] || conds[3])) ||
-                       (conds[2] && conds[3] && !(conds[0] || conds[1])),
-                       cmdexception, EZINFO("Inconsistent request!") )
-
-            //
-            //   Two major modes of operation, depending on what 'message'
-            //   came in
-            //      nmptr + szptr?  => someone sending a file chunk
-            //                         suck socket empty and blast to disk
-            //      rqptr + psptr?  => someone sending a "request for rsync"
-            //                         compile list of files we already have
-            //                         and send diff list (the shortest one)
-            //
-            if( conds[0] ) {
-                int             rv;
-                uint32_t        n2read;
-                unsigned char*  ptr;
-                // Major mode 1: someone sent a chunk
-                EZASSERT2( ::sscanf(szptr->second.c_str(), "%" SCNu32, &sz)==1, cmdexception,
-                           EZINFO("Failed to parse file size from meta data '" << szptr->second << "'") );
-
-                DEBUG(4, "parallelnetreader[" << ::pthread_self() << "] " << nmptr->second << " (" << szptr->second << " bytes)" << endl);
-
-                // Now it's about time to start reading the file's contents
-#if 0
-                // Messing with the memory pool might be better done
-                // by one thread at a time ...
-                SYNCEXEC(args,
-                    // Look up size in mempool and get a block
-                    mempoolptr = mnaptr->mempool.find( sz );
-
-                    if( mempoolptr==mnaptr->mempool.end() ) 
-                        mempoolptr = mnaptr->mempool.insert(
-                            make_pair(sz,
-                                      new blockpool_type((unsigned int)sz,
-                                                         std::max((unsigned int)1, (unsigned int)(1.0e9/sz)))
-                                      )).first;
-                    );
-                b = mempoolptr->second->get();
-#endif
-                block    b( (size_t)sz );
-
-                ptr    = (unsigned char*)b.iov_base;
-                n2read = sz;
-                while( n2read ) {
-                    const ssize_t  n = min((ssize_t)n2read, (ssize_t)(2*1024*1024));
-
-                    rv = fdops.read(incoming->first, ptr, n, 0);
+            // A persistent sender sends any number of chunks over this
+            // connection, followed by an "endOfStream" header. Other
+            // senders send exactly one message per connection.
+            bool               persistent = false;
+            const unsigned int connid = conn_open(rteptr, incoming->second);
+            connstats_type     connstats;
+
+            do {
+                // First read the metadata. A persistent sender that goes
+                // away in between chunks is not fatal
+                try {
+                    id_values.fromBinary( read_itcp_header(incoming->first, fdops) );
+                }
+                catch( ... ) {
+                    if( !persistent )
+                        throw;
+                    DEBUG(-1, "parallelnetreader[" << ::pthread_self() << "] connection closed without end-of-stream" << endl);
+                    break;
+                }
 
-                    if( rv!=n ) {
-                        DEBUG(-1, "parallelnetreader[" << ::pthread_self() << "] " << nmptr->second << " failed to read " << n << " bytes after " << (sz-n2read) << " bytes" << endl);
-                        break;
-                    }
-                    ptr    += n;
-                    n2read -= n;
-                    RTEEXEC(*rteptr, counter += n);
-                    if( is_udt && UDT::perfmon(incoming->first, &ti, true)==0 ) {
-                        RTEEXEC(*rteptr,
-                                pktcnt += ti.pktRecv;
-                                loscnt += ti.pktRcvLoss);
-                    }
+                if( id_values.find("endOfStream")!=id_values.end() ) {
+                    DEBUG(3, "parallelnetreader[" << ::pthread_self() << "] end-of-stream" << endl);
+                    break;
                 }
 
-                // Failure to push implies we should stop!
-                // As does failure to read the whole chunk
-                uint32_t    bsn = extract_file_seq_no(nmptr->second);
-                EZASSERT2(bsn!=(uint32_t)-1, cmdexception, EZINFO(" Failed to extract sequence number from " << nmptr->second));
+                // Assert we have the correct ones
+                nmptr = id_values.find("fileName");
+                szptr = id_values.find("fileSize");
+                rqptr = id_values.find("requestRsync");
+                psptr = id_values.find("payloadSize");
 
-                if( n2read || outq->push( chunk_type(filemetadata(nmptr->second, (off_t)b.iov_len, bsn), b) )==false )
-                    done = true;
+                // We must have either nmptr/szptr or rsync/payload, nothing else
+                const bool   conds[4] = { nmptr!=id_values.end(), szptr!=id_values.end(),
+                                          rqptr!=id_values.end(), psptr!=id_values.end() };
 
-                // already release our refcount on the block
-                b = block();
+                EZASSERT2( (conds[0] && conds[1] && !(conds[2] || conds[3])) ||
+                           (conds[2] && conds[3] && !(conds[0] || conds[1])),
+                           cmdexception, EZINFO("Inconsistent request!") )
 
                 //
-                //  End of Major mode 1/file chunk
+                //   Two major modes of operation, depending on what 'message'
+                //   came in
+                //      nmptr + szptr?  => someone sending a file chunk
+                //                         suck socket empty and blast to disk
+                //      rqptr + psptr?  => someone sending a "request for rsync"
+                //                         compile list of files we already have
+                //                         and send diff list (the shortest one)
                 //
-            } else {
-                //  Major mode 2: rsync request
-                char        dummy;
-
-                EZASSERT2( ::sscanf(psptr->second.c_str(), "%" SCNu32, &sz)==1, cmdexception,
-                           EZINFO("Failed to parse size from meta data '" << psptr->second << "'") );
-
-                DEBUG(4, "parallelnetreader[" << ::pthread_self() << "] rsync request '" << rqptr->second << "' (" << psptr->second << " bytes payload)" << endl);
-
-                auto_array<char> flist( new char[sz] );
-                ASSERT_COND( fdops.read(incoming->first, &flist[0], (size_t)sz)==(ssize_t)sz );
-
-                // Create a file list from what we received
-                vector<string>           remote_lst = ::split(string(&flist[0], sz), '\0', true);
-                //set<string>      remote_set(remote_lst.begin(), remote_lst.end());
-                chunklist_type           fl = get_chunklist( rqptr->second, rteptr->mk6info.mountpoints );
-                set<string>              local_set;
-                vector<string>           have, have_not;
-
-                // Create the set of local files
-                for( chunklist_type::const_iterator fptr=fl.begin(); fptr!=fl.end(); fptr++ ) 
-                    local_set.insert( fptr->relative_path );
-
-                DEBUG(4, "parallelnetreader[" << ::pthread_self() << "] rsync request / remote list length " << remote_lst.size() << endl);
-                DEBUG(4, "parallelnetreader[" << ::pthread_self() << "] rsync request / find " << local_set.size() << " files local" << endl);
-
-                // Have to fucking brute force this!
-                inset<set<string> >      have_local(local_set);
-                vector<string>::iterator f, l;
-
-                for(vector<string>::iterator ptr=remote_lst.begin(); ptr!=remote_lst.end(); ptr++)
-                    if( have_local(*ptr) )
-                        have.push_back(*ptr);
-                    else
-                        have_not.push_back(*ptr);
-
-                // already clear out the meta data header
-                id_values.clear();
-
-                if( have.size()<have_not.size() ) {
-                    // We have less files than we need. Set the list
-                    // boundaries (of the file names we must transfer) and
-                    // indicate that these are the files we HAVE
-                    f = have.begin();
-                    l = have.end();
-                    id_values.set( "listType", "have" );
+                if( conds[0] ) {
+                    int             rv;
+                    uint32_t        n2read;
+                    unsigned char*  ptr;
+                    // Major mode 1: someone sent a chunk
+                    EZASSERT2( ::sscanf(szptr->second.c_str(), "%" SCNu32, &sz)==1, cmdexception,
+                               EZINFO("Failed to parse file size from meta data '" << szptr->second << "'") );
+
+                    DEBUG(4, "parallelnetreader[" << ::pthread_self() << "] " << nmptr->second << " (" << szptr->second << " bytes)" << endl);
+
+                    // Now it's about time to start reading the file's contents
+#if 0
+                    // Messing with the memory pool might be better done
+                    // by one thread at a time ...
+                    SYNCEXEC(args,
+                        // Look up size in mempool and get a block
+                        mempoolptr = mnaptr->mempool.find( sz );
+
+                        if( mempoolptr==mnaptr->mempool.end() ) 
+                            mempoolptr = mnaptr->mempool.insert(
+                                make_pair(sz,
+                                          new blockpool_type((unsigned int)sz,
+                                                             std::max((unsigned int)1, (unsigned int)(1.0e9/sz)))
+                                          )).first;
+                        );
+                    b = mempoolptr->second->get();
+#endif
+                    block    b( (size_t)sz );
+
+                    ptr    = (unsigned char*)b.iov_base;
+                    n2read = sz;
+                    while( n2read ) {
+                        const ssize_t  n = min((ssize_t)n2read, (ssize_t)(2*1024*1024));
+
+                        rv = fdops.read(incoming->first, ptr, n, 0);
+
+                        if( rv!=n ) {
+                            DEBUG(-1, "parallelnetreader[" << ::pthread_self() << "] " << nmptr->second << " failed to read " << n << " bytes after " << (sz-n2read) << " bytes" << endl);
+                            break;
+                        }
+                        ptr    += n;
+                        n2read -= n;
+                        RTEEXEC(*rteptr, counter += n);
+                        if( is_udt && UDT::perfmon(incoming->first, &ti, true)==0 ) {
+                            RTEEXEC(*rteptr,
+                                    pktcnt += ti.pktRecv;
+                                    loscnt += ti.pktRcvLoss);
+                        }
+                    }
+
+                    // Failure to push implies we should stop!
+                    // As does failure to read the whole chunk
+                    uint32_t    bsn = extract_file_seq_no(nmptr->second);
+                    EZASSERT2(bsn!=(uint32_t)-1, cmdexception, EZINFO(" Failed to extract sequence number from " << nmptr->second));
+
+                    if( n2read || outq->push( chunk_type(filemetadata(nmptr->second, (off_t)b.iov_len, bsn), b) )==false )
+                        done = true;
+
+                    // Does the sender have more chunks for us on this
+                    // connection?
+                    persistent = (id_values.find("persistent")!=id_values.end());
+                    connstats = conn_chunk(rteptr, connid, (uint64_t)(sz - n2read));
+
+                    // already release our refcount on the block
+                    b = block();
+
+                    //
+                    //  End of Major mode 1/file chunk
+                    //
                 } else {
-                    // Ok we need to transfer the list of files we *need*
-                    f = have_not.begin();
-                    l = have_not.end();
-                    id_values.set( "listType", "need" );
-                }
+                    //  Major mode 2: rsync request
+                    char        dummy;
+
+                    EZASSERT2( ::sscanf(psptr->second.c_str(), "%" SCNu32, &sz)==1, cmdexception,
+                               EZINFO("Failed to parse size from meta data '" << psptr->second << "'") );
+
+                    DEBUG(4, "parallelnetreader[" << ::pthread_self() << "] rsync request '" << rqptr->second << "' (" << psptr->second << " bytes payload)" << endl);
+
+                    auto_array<char> flist( new char[sz] );
+                    ASSERT_COND( fdops.read(incoming->first, &flist[0], (size_t)sz)==(ssize_t)sz );
+
+                    // Create a file list from what we received
+                    vector<string>           remote_lst = ::split(string(&flist[0], sz), '\0', true);
+                    //set<string>      remote_set(remote_lst.begin(), remote_lst.end());
+                    chunklist_type           fl = get_chunklist( rqptr->second, rteptr->mk6info.mountpoints );
+                    set<string>              local_set;
+                    vector<string>           have, have_not;
+
+                    // Create the set of local files
+                    for( chunklist_type::const_iterator fptr=fl.begin(); fptr!=fl.end(); fptr++ ) 
+                        local_set.insert( fptr->relative_path );
+
+                    DEBUG(4, "parallelnetreader[" << ::pthread_self() << "] rsync request / remote list length " << remote_lst.size() << endl);
+                    DEBUG(4, "parallelnetreader[" << ::pthread_self() << "] rsync request / find " << local_set.size() << " files local" << endl);
+
+                    // Have to fucking brute force this!
+                    inset<set<string> >      have_local(local_set);
+                    vector<string>::iterator f, l;
+
+                    for(vector<string>::iterator ptr=remote_lst.begin(); ptr!=remote_lst.end(); ptr++)
+                        if( have_local(*ptr) )
+                            have.push_back(*ptr);
+                        else
+                            have_not.push_back(*ptr);
+
+                    // already clear out the meta data header
+                    id_values.clear();
+
+                    if( have.size()<have_not.size() ) {
+                        // We have less files than we need. Set the list
+                        // boundaries (of the file names we must transfer) and
+                        // indicate that these are the files we HAVE
+                        f = have.begin();
+                        l = have.end();
+                        id_values.set( "listType", "have" );
+                    } else {
+                        // Ok we need to transfer the list of files we *need*
+                        f = have_not.begin();
+                        l = have_not.end();
+                        id_values.set( "listType", "need" );
+                    }
 
-                // Now we can construct the message payload
-                ostringstream   os;
+                    // Now we can construct the message payload
+                    ostringstream   os;
 
-                for(vector<string>::iterator p=f; p!=l; p++)
-                    os << *p << '\0';
-                const string    pay = os.str();
+                    for(vector<string>::iterator p=f; p!=l; p++)
+                        os << *p << '\0';
+                    const string    pay = os.str();
 
-                // Set the payload size in the message header
-                id_values.set( "rsyncReplySz", pay.size() );
+                    // Set the payload size in the message header
+                    id_values.set( "rsyncReplySz", pay.size() );
 
-                // Now we can send back the full message, header first, then
-                // payload
-                const string    hdr = id_values.toBinary();
-                fdops.write(incoming->first, hdr.c_str(), hdr.size());
-                fdops.write(incoming->first, pay.c_str(), pay.size());
+                    // Now we can send back the full message, header first, then
+                    // payload
+                    const string    hdr = id_values.toBinary();
+                    fdops.write(incoming->first, hdr.c_str(), hdr.size());
+                    fdops.write(incoming->first, pay.c_str(), pay.size());
 
-                // Do a dummy read - keep the sokkit open until remote end
-                // has had a chance to read all the dataz
-                fdops.read(incoming->first, &dummy, 1);
-            }
+                    // Do a dummy read - keep the sokkit open until remote end
+                    // has had a chance to read all the dataz
+                    fdops.read(incoming->first, &dummy, 1);
+                }
+            } while( persistent && !done );
+
+            if( connstats.nChunk )
+                DEBUG(2, "parallelnetreader[" << ::pthread_self() << "] connection from " << incoming->second << ": " << connstats << endl);
 
             // Ok we're done with this filedescriptor, go back to monitoring
             // network->fd
@@ -1253,10 +1488,8 @@ void parallelwriter(inq_type<chunk_type>* inq, sync_type<multifileargs>* args) {
             while( (listlength=mfaptr->listlength)>0 && mfaptr->filelist.empty() )
                 args->cond_wait();
 
-            if( mfaptr->filelist.size()>0 ) {
-                mountpoint = mfaptr->filelist.front();
-                mfaptr->filelist.pop_front();
-            }
+            if( mfaptr->filelist.size()>0 )
+                mountpoint = mfaptr->next_mountpoint();
             args->unlock();
 
             // If we were unsuccesfull in getting a mount point
@@ -1288,11 +1521,16 @@ void parallelwriter(inq_type<chunk_type>* inq, sync_type<multifileargs>* args) {
             mp_seen.insert( mountpoint );
 
             // Ok, we have location to write to
+            struct timespec      t0, t1;
             int                  fd = -1, eno = 0;
             ssize_t              rv;
             uint64_t             bytes_written = 0;
             const string         fn = mountpoint + "/" + chunk.tag.fileName;
             fdmap_type::iterator fdptr;
+            dwmap_type::iterator dwptr;
+            directwriter_type*   dw = 0;
+
+            ::clock_gettime(CLOCK_MONOTONIC, &t0);
 
             // When doing mk6 emulation, check if the file descriptor for
             // the current mountpoint is already open
@@ -1300,6 +1538,8 @@ void parallelwriter(inq_type<chunk_type>* inq, sync_type<multifileargs>* args) {
                 SYNCEXEC(args,
                         if( (fdptr = mfaptr->fdmap.find(mountpoint))!=mfaptr->fdmap.end() )
                             fd = fdptr->second;
+                        if( (dwptr = mfaptr->dwmap.find(mountpoint))!=mfaptr->dwmap.end() )
+                            dw = dwptr->second;
                         )
             }
 
@@ -1320,16 +1560,38 @@ void parallelwriter(inq_type<chunk_type>* inq, sync_type<multifileargs>* args) {
                 ASSERT2_ZERO( mk6info_type::fchown_fn(fd, mk6info_type::real_user_id, -1),
                               SCINFO("Failed to change ownership of newly created file " <<fn) );
 
+                // Direct I/O requested? If we can't get the writer we
+                // can still write the file the normal way
+                if( mfaptr->directio ) {
+                    try {
+                        dw = new directwriter_type(fd);
+                    }
+                    catch( const std::exception& e ) {
+                        DEBUG(-1, "parallelwriter: no direct I/O for " << fn << " - " << e.what() << endl);
+                        dw = 0;
+                    }
+                }
+
                 if( mk6 ) {
                     // If Mark6, we better write the file header. Because we *have*
                     // a chunk, we *know* what the size of the chunks are going to be
                     ssize_t         nw;
                     mk6_file_header fh( chunk.item.iov_len, mk6vars.packet_format, mk6vars.packet_size );
 
-                    if( (nw=::write(fd, &fh, sizeof(mk6_file_header)))!=(ssize_t)sizeof(mk6_file_header) ) {
+                    if( (nw=(dw ? dw->write(&fh, sizeof(mk6_file_header)) :
+                                  ::write(fd, &fh, sizeof(mk6_file_header))))!=(ssize_t)sizeof(mk6_file_header) ) {
                         MARK_MOUNTPOINT_BAD("Failed to write Mark6 file header - " << fn << " - " << evlbi5a::strerror(errno) << endl)
+                        // Nobody knows about this file yet; don't leave
+                        // it, nor its writer, lying around
+                        delete dw;
+                        ::close( fd );
+                        ::unlink( fn.c_str() );
                         continue;
                     }
+                    // Mark6 files stay open so their writers must be kept
+                    if( dw ) {
+                        SYNCEXEC(args, mfaptr->dwmap[mountpoint] = dw);
+                    }
                 }
             }
 
@@ -1340,7 +1602,8 @@ void parallelwriter(inq_type<chunk_type>* inq, sync_type<multifileargs>* args) {
 
                 // If we fail to write, remember to error code and make sure
                 // that the system does not try to write the chunk data.
-                if( (nw=::write(fd, &wb, sizeof(mk6_wb_header_v2)))!=(ssize_t)sizeof(mk6_wb_header_v2) ) {
+                if( (nw=(dw ? dw->write(&wb, sizeof(mk6_wb_header_v2)) :
+                              ::write(fd, &wb, sizeof(mk6_wb_header_v2))))!=(ssize_t)sizeof(mk6_wb_header_v2) ) {
                     eno           = errno;
                     bytes_written = chunk.item.iov_len;
                 }
@@ -1350,8 +1613,12 @@ void parallelwriter(inq_type<chunk_type>* inq, sync_type<multifileargs>* args) {
         
             // Dump contents into file, save errno
             while ( bytes_written < chunk.item.iov_len ) {
-                rv  = ::write(fd, ((char*)chunk.item.iov_base) + bytes_written, 
-                              chunk.item.iov_len - bytes_written);
+                if( dw )
+                    rv = dw->write(((char*)chunk.item.iov_base) + bytes_written,
+                                   chunk.item.iov_len - bytes_written);
+                else
+                    rv = ::write(fd, ((char*)chunk.item.iov_base) + bytes_written, 
+                                 chunk.item.iov_len - bytes_written);
                 if ( rv <= 0 ) {
                     eno = errno;
                     break;
@@ -1362,10 +1629,20 @@ void parallelwriter(inq_type<chunk_type>* inq, sync_type<multifileargs>* args) {
             }
             DEBUG(4, "    parallelwriter[" << ::pthread_self() << "] result " << (bytes_written==(uint64_t)chunk.item.iov_len) << endl);
             // close file already [unless we're emulating Mark6 mode]
+            // but not before the staged data is written
             if( !mk6 ) {
+                if( dw ) {
+                    if( dw->finish()!=0 && bytes_written==(uint64_t)chunk.item.iov_len ) {
+                        eno           = errno;
+                        bytes_written = 0;
+                    }
+                    delete dw;
+                    dw = 0;
+                }
                 ::close( fd );
                 fd = -1;
             }
+            ::clock_gettime(CLOCK_MONOTONIC, &t1);
 
             // Now inspect how well it went
             written = (bytes_written==(uint64_t)chunk.item.iov_len);
@@ -1377,12 +1654,45 @@ void parallelwriter(inq_type<chunk_type>* inq, sync_type<multifileargs>* args) {
                 if( !mk6 && ::unlink( fn.c_str() )!=0 ) {
                     DEBUG(-1, "  oh and also failed to unlink(2) " << fn << endl);
                 }
+                // The Mark6 file now has a partial block in it; the index
+                // would be lying. Make sure the file (and its writer, if
+                // any) is closed at the end, also if it was only just
+                // opened.
+                if( mk6 ) {
+                    SYNCEXEC(args,
+                        mfaptr->fdmap.insert(make_pair(mountpoint, fd));
+                        mk6_indexmap_type::iterator idxptr = mfaptr->mk6index.find(mountpoint);
+                        if( idxptr!=mfaptr->mk6index.end() )
+                            idxptr->second.ok = false; );
+                }
             } else {
                 // Writing to file finished succesfully, now put back
                 // mountpoint on the list and wake up only one waiter
+                // For Mark6 also register where this block ended up
+                // Update the mountpoint's statistics and make them
+                // available to the outside world
+                mountpoint_stats_type  stats;
+                const double           dt = (double)(t1.tv_sec - t0.tv_sec) + ((double)t1.tv_nsec - t0.tv_nsec)/1.0e9;
+
                 SYNCEXEC(args,
+                    stats = mfaptr->chunk_written(mountpoint, (uint64_t)chunk.item.iov_len, dt);
                     mfaptr->filelist.push_back(mountpoint); args->cond_signal();
-                    mfaptr->fdmap.insert(make_pair(mountpoint, fd)) );
+                    mfaptr->fdmap.insert(make_pair(mountpoint, fd));
+                    if( mk6 ) {
+                        mk6_indexmap_type::iterator idxptr = mfaptr->mk6index.find(mountpoint);
+                        mk6_index_entry             entry;
+
+                        if( idxptr==mfaptr->mk6index.end() )
+                            idxptr = mfaptr->mk6index.insert(make_pair(mountpoint, mk6_indexrecord_type(fn))).first;
+                        entry.blocknum = (int32_t)chunk.tag.chunkSequenceNr;
+                        entry.wb_size  = (int32_t)(chunk.item.iov_len + sizeof(mk6_wb_header_v2));
+                        entry.offset   = idxptr->second.pos;
+                        idxptr->second.index.push_back( entry );
+                        idxptr->second.pos += entry.wb_size;
+                    } );
+                RTEEXEC(*mfaptr->rteptr, mfaptr->rteptr->mk6info.diskstats[mountpoint] = stats);
+                // Saves the recording catalog having to find out
+                catalog_add(mountpoint, chunk.tag.fileName, (off_t)chunk.item.iov_len);
             }
         }
         // If we did not manage to write this chunk anywhere, we might as
@@ -115,6 +115,30 @@ struct multireadargs {
 // Map from mountpoint => file descriptor
 typedef std::map<std::string, int> fdmap_type;
 
+// When recording Mark6 we keep track of where each block went in the file
+// on each mountpoint. When the file is closed this is written out as index
+// (see mk6info.h) such that opening the scan later doesn't need to read
+// every write block header.
+struct mk6_indexrecord_type {
+    std::string     path;   // the Mark6 file
+    int64_t         pos;    // where the next write block header will go
+    bool            ok;     // false after a failed write: index unusable
+    mk6_index_type  index;
+
+    mk6_indexrecord_type(std::string const& p);
+
+    private:
+        mk6_indexrecord_type();
+};
+// Map from mountpoint => index
+typedef std::map<std::string, mk6_indexrecord_type> mk6_indexmap_type;
+
+// With direct I/O each open file has a writer that holds the staged data.
+// Map from mountpoint => writer (only for Mark6, FlexBuff files are
+// written + closed in one go)
+struct directwriter_type;
+typedef std::map<std::string, directwriter_type*> dwmap_type;
+
 // Mark6 info
 struct mark6_vars_type {
     const bool                            mk6;
@@ -157,10 +181,28 @@ struct multifileargs {
     size_t            listlength;
     runtime*          rteptr;
     fdmap_type        fdmap;
+    dwmap_type        dwmap;
+    mk6_indexmap_type mk6index;
     mempool_type      mempool;
     filelist_type     filelist;
     mark6_vars_type   mk6vars;
     threadfdlist_type threadlist;
+    // Copied from runtime's mk6info at construction
+    const bool        directio;
+    // Write performance of the mountpoints in filelist during this
+    // recording; copied into runtime's mk6info after each chunk
+    mountpointstats_type diskstats;
+    // How many times next_mountpoint() was called
+    uint64_t          nPicked;
+
+    // The mountpoint scheduler. Both must be called with the lock held.
+    // next_mountpoint() removes the mountpoint it returns from filelist.
+    // Mountpoints that are demoted (much slower than the others) are only
+    // returned if no other mountpoint is available, or, once every so
+    // many chunks, to measure if they have recovered.
+    // chunk_written() updates the statistics and (de)motes the mountpoint.
+    std::string                  next_mountpoint( void );
+    mountpoint_stats_type const& chunk_written(std::string const& mp, uint64_t nbyte, double dt);
 
     ~multifileargs();
 };
@@ -224,6 +266,15 @@ struct rsyncinitargs {
     ~rsyncinitargs();
 };
 
+struct parallelsenderargs {
+    networkargs         netargs;
+    // if true, each sender keeps one connection open and sends all of its
+    // chunks over it instead of opening a new connection per chunk
+    bool                persistent;
+
+    parallelsenderargs(networkargs na, bool p);
+};
+
 // Compile the list of files to read. Make sure we strip across 
 // the file systems
 
@@ -250,11 +301,19 @@ void parallelreader2(inq_type<chunk_location>*, outq_type<chunk_type>*, sync_typ
 
 // For each popped item a new connection will be opened; i.e. the
 // blocks will be transferred in parallel.
-void parallelsender(inq_type<chunk_type>*, sync_type<networkargs>*);
+// In persistent mode each sender opens one connection and sends the
+// chunks over it back-to-back, each prefixed by its meta data, which is
+// marked "persistent" such that the parallelnetreader knows to expect
+// more. After the last chunk an "endOfStream" header is sent.
+// This saves connection set up and TCP slow-start per chunk, which, on
+// high latency links, may take up a considerable part of the time it
+// takes to transfer a chunk.
+void parallelsender(inq_type<chunk_type>*, sync_type<parallelsenderargs>*);
 
 
 // >1 parallel net reader should be active, each does an "accept()" on
 // the server and sucks the data out of the listen socket.
+// Handles both one-chunk-per-connection and persistent senders.
 void parallelnetreader(outq_type<chunk_type>*, sync_type<multinetargs>*);
 
 // For each popped item, open a new file and dump the contents.
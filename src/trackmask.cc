@@ -25,6 +25,7 @@
 #include <errno.h>  // ...
 #include <limits.h> // INT_MAX
 #include <string.h> // ::strerror(3)
+#include <sys/time.h> // ::gettimeofday()
 #include <stdint.h> // [u]int<N>_t typedefs
 
 // for sort()
@@ -32,6 +33,7 @@
 #include <iterator>  //  ...
 #include <sstream>
 #include <fstream>
+#include <iomanip>
 #include <set>
 
 // own includes
@@ -208,7 +210,7 @@ ostream& operator<<(ostream& os, const step_type& s) {
 // a solution is a series of steps + some bookkeeping for keeping track
 // of its quality
 solution_type::solution_type():
-    q_value( 0 ), full_cycle( true ),
+    q_value( 0 ), full_cycle( true ), packing( false ),
     mask_in( trackmask_empty ), mask_out( trackmask_empty ), trackmask( trackmask_empty ),
     n_dstinc( 0 ), n_srcdec( 0 ), n_bits_moved( 0 )
 {}
@@ -220,11 +222,38 @@ solution_type::solution_type(data_type bitstokeep) {
 }
 
 solution_type::solution_type(data_type bitstomove, data_type bitstokeep):
-    q_value( 0 ), full_cycle( bitstomove==bitstokeep ),
+    q_value( 0 ), full_cycle( bitstomove==bitstokeep ), packing( false ),
     mask_in( bitstomove ), mask_out( bitstokeep ), trackmask( bitstokeep ),
     n_dstinc( 0 ), n_srcdec( 0 ), n_bits_moved( 0 )
 {}
 
+// The packed solution compresses every <cycle> input words into exactly
+// <compressed_cycle> output words: with k bits kept per 64 bit word that
+// is 64/gcd(64, k) input words in k/gcd(64,k) output words.
+solution_type solution_type::packed_solution(data_type bitstokeep) {
+    solution_type      rv;
+    const unsigned int nkeep = count_bits(bitstokeep);
+    unsigned int       a, b;
+
+    ASSERT2_COND( nkeep>0 && nkeep<(unsigned int)nbit,
+                  SCINFO("cannot pack " << hex_t(bitstokeep) << " - need at least one and at most "
+                         << nbit-1 << " bits to keep") );
+    // a = gcd(nbit, nkeep)
+    for(a=nbit, b=nkeep; b!=0; ) {
+        const unsigned int t = a%b;
+        a = b;
+        b = t;
+    }
+
+    rv.packing   = true;
+    rv.mask_in   = trackmask_empty;
+    rv.mask_out  = trackmask_full;
+    rv.trackmask = bitstokeep;
+    rv.n_dstinc  = nkeep/a;
+    rv.n_srcdec  = (nbit-nkeep)/a;
+    return rv;
+}
+
 bool solution_type::complete( void ) const {
     return (mask_in==trackmask_empty && (full_cycle?(mask_out==trackmask_full):true));
 }
@@ -235,6 +264,10 @@ unsigned int solution_type::outputsize( unsigned int insize ) const {
     // if our duty-cycle == 0, we're doomed!
     ASSERT_COND( complete() && dutycycle>0 );
 
+    // packed: the last output word may be partially filled
+    if( packing )
+        return (unsigned int)(((uint64_t)insize*n_dstinc + dutycycle - 1)/dutycycle);
+
     unsigned int               opsize = (insize/dutycycle) * n_dstinc;
     unsigned int               remain = (insize%dutycycle);
     steps_type::const_iterator curstep;
@@ -275,6 +308,11 @@ unsigned int solution_type::inputsize( unsigned int outsize ) const {
     ASSERT_COND( dutycycle>0 );
     ASSERT_COND( n_dstinc>0 );
 
+    // packed: the most words that fit in outsize words [and compress into
+    // exactly outsize words]
+    if( packing )
+        return (unsigned int)(((uint64_t)outsize*dutycycle)/n_dstinc);
+
     // each dutycycle amount of inputwords yields n_dstinc of ouputwords so
     // we can easily figure out how many times we can completely do this and
     // how many outputwords remain
@@ -559,6 +597,8 @@ ostream& operator<<(ostream& os, const solution_type& s) {
 
     os << "K: " << hex_t(s.trackmask) << endl
        << "   " << s.summary() << endl;
+    if( s.packed() )
+        os << "   packed: " << s.cycle() << " words => " << s.compressed_cycle() << " words" << endl;
     if( !s.complete() ) {
         os << " In :" << hex_t(s.mask_in) << endl
            << " Out:" << hex_t(s.mask_out) << endl;
@@ -1081,11 +1121,200 @@ string generate_code(const solution_type& solution, const unsigned int numwords,
     return code.str();
 }
 
+//
+//  The packer for packed solutions
+//
+
+// Append the nkeep low bits of 'v' to the bitstream, flush the accumulator
+// to 'out' when it's full. Note: nkeep<64 since a trackmask with all bits
+// set is "no trackmask". Written such that the compiler can do it without
+// branches; the bits that don't fit anymore are "(v >> 1) >> (63-accbits)"
+// which is well defined for accbits==0 too.
+static inline void append_bits(data_type v, const unsigned int nkeep,
+                               data_type& acc, unsigned int& accbits, data_type*& out) {
+    const unsigned int n = accbits + nkeep;
+
+    acc  |= (v << accbits);
+    *out  = acc;
+    if( n>=64 ) {
+        out++;
+        acc = ((v >> 1) >> (63-accbits));
+    }
+    accbits = (n & 63);
+}
+
+// Get the nkeep bits starting at 'bitpos' from the bitstream
+static inline data_type get_bits(const data_type* p, const uint64_t bitpos, const unsigned int nkeep) {
+    const uint64_t     w   = bitpos / 64;
+    const unsigned int off = (unsigned int)(bitpos % 64);
+    data_type          v   = (p[w] >> off);
+
+    if( off+nkeep>64 )
+        v |= (p[w+1] << (64-off));
+    return v & ((((data_type)1) << nkeep) - 1);
+}
+
+static inline data_type restore_magnitude(const data_type v, const data_type mask,
+                                          const int signmagdistance) {
+    if( signmagdistance>0 )
+        return v | ((v >> signmagdistance) & ~mask);
+    if( signmagdistance<0 )
+        return v | ((v << -signmagdistance) & ~mask);
+    return v;
+}
+
+// the bit-by-bit versions of pext/pdep for building the tables
+static unsigned int pext8(unsigned int v, unsigned int m) {
+    unsigned int rv = 0;
+    for(unsigned int bit=0, n=0; bit<8; bit++)
+        if( m & (0x1<<bit) )
+            rv |= (((v>>bit) & 0x1) << n++);
+    return rv;
+}
+static unsigned int pdep8(unsigned int v, unsigned int m) {
+    unsigned int rv = 0;
+    for(unsigned int bit=0, n=0; bit<8; bit++)
+        if( m & (0x1<<bit) )
+            rv |= (((v>>n++) & 0x1) << bit);
+    return rv;
+}
+
+#if defined(__x86_64__) && (defined(__clang__) || __GNUC__>=5)
+#include <immintrin.h>
+
+#define BMI2_FN __attribute__((target("bmi2")))
+
+static bool have_bmi2( void ) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("bmi2");
+}
+
+BMI2_FN static data_type* compress_bmi2(data_type* p, const unsigned int nword,
+                                        const data_type mask, const unsigned int nkeep) {
+    data_type*   out = p;
+    data_type    acc = 0;
+    unsigned int accbits = 0;
+
+    for(unsigned int i=0; i<nword; i++)
+        append_bits(_pext_u64(p[i], mask), nkeep, acc, accbits, out);
+    if( accbits )
+        *out++ = acc;
+    return out;
+}
+
+BMI2_FN static void decompress_bmi2(data_type* p, const unsigned int nword,
+                                    const data_type mask, const unsigned int nkeep,
+                                    const int signmagdistance) {
+    uint64_t  bitpos = (uint64_t)nword * nkeep;
+
+    // work backwards such that we can do it in-place
+    for(unsigned int i=nword; i>0; ) {
+        bitpos -= nkeep;
+        i--;
+        p[i] = restore_magnitude(_pdep_u64(get_bits(p, bitpos, nkeep), mask), mask, signmagdistance);
+    }
+}
+
+#else
+
+static bool have_bmi2( void ) {
+    return false;
+}
+static data_type* compress_bmi2(data_type* p, const unsigned int, const data_type, const unsigned int) {
+    return p;
+}
+static void decompress_bmi2(data_type*, const unsigned int, const data_type, const unsigned int, const int) {
+}
+
+#endif
+
+bitpacker_type::bitpacker_type(const data_type trackmask, const unsigned int numwords,
+                               const int smd, const bool allowBMI2):
+    mask( trackmask ), nkeep( count_bits(trackmask) ), nword( numwords ),
+    ncompressed( (unsigned int)(((uint64_t)numwords*nkeep + 63)/64) ),
+    signmagdistance( smd ), useBMI2( allowBMI2 && have_bmi2() ), nbyte( 0 )
+{
+    ASSERT2_COND( nkeep>0 && nkeep<(unsigned int)::nbit,
+                  SCINFO("cannot pack " << hex_t(trackmask) << " - need at least one and at most "
+                         << ::nbit-1 << " bits to keep") );
+
+    // Build the tables for the portable version
+    for(unsigned int b=0, offset=0; b<sizeof(data_type); b++) {
+        const unsigned int mb = (unsigned int)((mask >> (8*b)) & 0xff);
+        const unsigned int nb = count_bits(mb);
+
+        if( mb==0 )
+            continue;
+        byteidx[nbyte]  = b;
+        shift[nbyte]    = offset;
+        bytemask[nbyte] = (((data_type)1) << nb) - 1;
+        for(unsigned int v=0; v<256; v++) {
+            gather[nbyte][v]  = ((data_type)pext8(v, mb)) << offset;
+            scatter[nbyte][v] = ((data_type)pdep8(v, mb)) << (8*b);
+        }
+        offset += nb;
+        nbyte++;
+    }
+    DEBUG(2, "bitpacker: " << hex_t(mask) << " " << nword << " => " << ncompressed << " words using "
+             << (useBMI2 ? "BMI2" : "lookup tables") << endl);
+}
+
+bool bitpacker_type::bmi2( void ) const {
+    return useBMI2;
+}
+
+data_type* bitpacker_type::compress(data_type* p) const {
+    return (useBMI2 ? compress_bmi2(p, nword, mask, nkeep) : compress_portable(p));
+}
+
+data_type* bitpacker_type::decompress(data_type* p) const {
+    if( useBMI2 )
+        decompress_bmi2(p, nword, mask, nkeep, signmagdistance);
+    else
+        decompress_portable(p);
+    return p + ncompressed;
+}
+
+data_type* bitpacker_type::compress_portable(data_type* p) const {
+    data_type*   out = p;
+    data_type    acc = 0;
+    unsigned int accbits = 0;
+
+    for(unsigned int i=0; i<nword; i++) {
+        const data_type w = p[i];
+        data_type       v = 0;
+
+        for(unsigned int j=0; j<nbyte; j++)
+            v |= gather[j][ (w >> (8*byteidx[j])) & 0xff ];
+        append_bits(v, nkeep, acc, accbits, out);
+    }
+    if( accbits )
+        *out++ = acc;
+    return out;
+}
+
+data_type* bitpacker_type::decompress_portable(data_type* p) const {
+    uint64_t  bitpos = (uint64_t)nword * nkeep;
+
+    for(unsigned int i=nword; i>0; ) {
+        bitpos -= nkeep;
+        i--;
+
+        const data_type v = get_bits(p, bitpos, nkeep);
+        data_type       w = 0;
+
+        for(unsigned int j=0; j<nbyte; j++)
+            w |= scatter[j][ (v >> shift[j]) & bytemask[j] ];
+        p[i] = restore_magnitude(w, mask, signmagdistance);
+    }
+    return p + ncompressed;
+}
+
 //
 // Bringing it all together
 //
 compressor_type::compressor_type() :
-    lastmask( trackmask_empty ), blocksize( 0 ),
+    packer( 0 ), lastmask( trackmask_empty ), blocksize( 0 ),
     compress_fn( (fptr_type)0 ),
     decompress_fn( (fptr_type)0 ),
     lastsignmagdistance( 0 ) {
@@ -1093,7 +1322,7 @@ compressor_type::compressor_type() :
 }
 compressor_type::compressor_type(const data_type trackmask, const unsigned int numwords,
                                  const int signmagdistance) :
-    lastmask( trackmask_empty ), blocksize( 0 ),
+    packer( 0 ), lastmask( trackmask_empty ), blocksize( 0 ),
     compress_fn( (fptr_type)0  ),
     decompress_fn( (fptr_type)0 ),
     lastsignmagdistance( 0 ) {
@@ -1108,7 +1337,7 @@ compressor_type::compressor_type(const data_type trackmask, const unsigned int n
 }
 compressor_type::compressor_type(const solution_type& solution, const unsigned int numwords,
                                  const bool cmprem, const int signmagdistance) :
-    lastmask( trackmask_empty ), blocksize( 0 ),
+    packer( 0 ), lastmask( trackmask_empty ), blocksize( 0 ),
     compress_fn( (fptr_type)0 ),
     decompress_fn( (fptr_type)0 ),
     lastsignmagdistance( 0 ) {
@@ -1116,12 +1345,20 @@ compressor_type::compressor_type(const solution_type& solution, const unsigned i
 }
 
 data_type* compressor_type::compress(data_type* p) const {
+    if( packer )
+        return packer->compress(p);
     return (compress_fn?compress_fn(p):(p+blocksize));
 }
 data_type* compressor_type::decompress(data_type* p) const {
+    if( packer )
+        return packer->decompress(p);
     return (decompress_fn?decompress_fn(p):(p+blocksize));
 }
 
+compressor_type::~compressor_type() {
+    delete packer;
+}
+
 
 // "cmp" = compressed. indicates wether the size as indicated by 'numwords'
 // is the size after compression or before. it is necessary for the
@@ -1138,10 +1375,18 @@ void compressor_type::do_it(const solution_type& solution, const unsigned int nu
 
     compress_fn = decompress_fn = (fptr_type)0 ;
     blocksize   = numwords;
+    delete packer;
+    packer      = 0;
 
     if( !solution )
         return;
 
+    // packed solutions don't need code
+    if( solution.packed() ) {
+        packer = new bitpacker_type(solution.mask(), numwords, signmagdistance);
+        return;
+    }
+
     // generate, compile + load the compress/decompress library
     tmphandle = jit_c_compile( generate_code(solution, numwords, cmprem, signmagdistance) );
     
@@ -1157,3 +1402,102 @@ void compressor_type::do_it(const solution_type& solution, const unsigned int nu
     return;
 }
 
+
+
+//
+//  Compare the solver's solution + generated code against the packer
+//
+static double now( void ) {
+    struct timeval  tv;
+    ::gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec/1.0e6;
+}
+
+// Compress + decompress 'nchunk' chunks of 'numwords' each,
+// return the amount of seconds it took or -1 if the data did not survive
+template <typename Compressor>
+static double time_compressor(const Compressor& c, const data_type mask, const unsigned int numwords,
+                              const unsigned int ncompressed, const vector<data_type>& data) {
+    const unsigned int nchunk = data.size()/numwords;
+    vector<data_type>  work( data );
+    double             t0;
+
+    t0 = now();
+    for(unsigned int i=0; i<nchunk; i++)
+        if( c.compress(&work[i*numwords])!=&work[i*numwords]+ncompressed )
+            return -1.0;
+    for(unsigned int i=0; i<nchunk; i++)
+        if( c.decompress(&work[i*numwords])!=&work[i*numwords]+ncompressed )
+            return -1.0;
+    t0 = now() - t0;
+
+    for(unsigned int i=0; i<nchunk*numwords; i++)
+        if( (work[i] & mask)!=(data[i] & mask) )
+            return -1.0;
+    return t0;
+}
+
+bool test_compressors(const data_type trackmask, std::ostream& os) {
+    // chunks that would fit in a jumbo frame
+    const unsigned int  numwords = 1024;
+    const unsigned int  nchunk   = 2048;
+    vector<data_type>   data( numwords*nchunk );
+    uint32_t            lcg = 0x2545f491;
+    double              t0, t;
+    bool                ok = true;
+
+    for(unsigned int i=0; i<data.size(); i++) {
+        data[i] = 0;
+        for(unsigned int b=0; b<sizeof(data_type); b++) {
+            lcg     = lcg*1664525 + 1013904223;
+            data[i] = (data[i] << 8) | (lcg >> 24);
+        }
+    }
+
+    os << "trackmask " << hex_t(trackmask) << ", " << count_bits(trackmask) << " bits/word, "
+       << numwords << " words/chunk" << endl;
+
+    // The solver + code generator
+    t0 = now();
+    const solution_type  solution( solve(trackmask) );
+    t  = now();
+    os << "   solver:   " << std::fixed << std::setprecision(3) << (t - t0) << "s to solve, ";
+    if( !solution.complete() ) {
+        os << "no solution" << endl;
+        ok = false;
+    } else {
+        const compressor_type  compiled(solution, numwords, false, 0);
+
+        os << (now() - t) << "s to compile, ";
+        t = time_compressor(compiled, trackmask, numwords, solution.outputsize(numwords), data);
+        if( t<0 ) {
+            os << "DATA NOT RESTORED" << endl;
+            ok = false;
+        } else {
+            os << std::setprecision(0) << (8.0*data.size()/t)/1.0e6 << " MB/s" << endl;
+        }
+    }
+
+    // The packer, with and without BMI2
+    for(unsigned int bmi=0; bmi<2; bmi++) {
+        t0 = now();
+        const solution_type   packed( solution_type::packed_solution(trackmask) );
+        const bitpacker_type  packer(trackmask, numwords, 0, bmi==1);
+
+        t = now() - t0;
+        os << "   packed" << (bmi ? "/BMI2" : "/LUT ") << ": ";
+        if( bmi==1 && !packer.bmi2() ) {
+            os << "not supported" << endl;
+            continue;
+        }
+        os << std::setprecision(6) << t << "s to set up, ";
+        t = time_compressor(packer, trackmask, numwords, packed.outputsize(numwords), data);
+        if( t<0 ) {
+            os << "DATA NOT RESTORED" << endl;
+            ok = false;
+        } else {
+            os << std::setprecision(0) << (8.0*data.size()/t)/1.0e6 << " MB/s" << endl;
+        }
+    }
+    return ok;
+}
@@ -177,6 +177,18 @@ struct solution_type {
     // Typically used for searching partial solutions.
     solution_type(data_type bitstomove, data_type intoword);
 
+    // A packed solution has no steps: the bits to keep are gathered from
+    // each word and appended to a contiguous bitstream (see bitpacker_type
+    // below). It needs no solving nor code generation so it is available
+    // immediately. NOTE: the compressed data layout is different from that
+    // of a stepwise solution so both ends of a transfer must use the same
+    // kind.
+    static solution_type packed_solution(data_type bitstokeep);
+
+    inline bool packed( void ) const {
+        return packing;
+    }
+
     // return the current state of the solution
     inline data_type  source( void ) const {
         return mask_in;
@@ -191,7 +203,7 @@ struct solution_type {
     // (aka source/dest) masks are NOT at their default value. Fact of the
     // matter is that "no steps" => "it don't do nuttin'" ...
     inline operator bool( void ) const {
-        return (steps.size()>0);
+        return (packing || steps.size()>0);
     }
 
     // the compressionfactor: number of outputwords over total number of
@@ -259,6 +271,7 @@ struct solution_type {
         // a solution goes in a number of steps from mask-in to mask-out
         int         q_value;
         bool        full_cycle;
+        bool        packing;
         data_type   mask_in;
         data_type   mask_out;
         data_type   trackmask;
@@ -291,6 +304,52 @@ std::string generate_code(const solution_type& solution, const unsigned int numw
                           const bool cmprem, const int signmagdistance);
 
 
+// The engine for packed solutions: compress a block of words in-place by
+// gathering the bits in the trackmask from each word into a contiguous
+// bitstream, least significant bit first; decompression scatters them
+// back (and optionally restores the magnitude bits). Uses PEXT/PDEP if
+// the CPU has BMI2 [and we're allowed to], byte-wise lookup tables if not.
+struct bitpacker_type {
+    bitpacker_type(const data_type trackmask, const unsigned int numwords,
+                   const int signmagdistance, const bool allowBMI2 = true);
+
+    // Same semantics as the generated code: both return a pointer
+    // one-past the last compressed word
+    data_type* compress(data_type* p) const;
+    data_type* decompress(data_type* p) const;
+
+    // Wether or not this one uses the BMI2 instructions
+    bool       bmi2( void ) const;
+
+    private:
+        data_type    mask;
+        unsigned int nkeep;       // number of bits kept per word
+        unsigned int nword;       // uncompressed size in words
+        unsigned int ncompressed; // compressed size in words
+        int          signmagdistance;
+        bool         useBMI2;
+
+        // Portable versions: for each byte in the mask that has bits to
+        // keep, the gathered bits of all 256 values of the input byte,
+        // shifted to where they end up in the compressed word, and the
+        // reverse
+        unsigned int nbyte;
+        unsigned int byteidx[8];
+        unsigned int shift[8];
+        data_type    bytemask[8];
+        data_type    gather[8][256];
+        data_type    scatter[8][256];
+
+        data_type*   compress_portable(data_type* p) const;
+        data_type*   decompress_portable(data_type* p) const;
+};
+
+// Compress + decompress random data with the solver's solution and a
+// packed one and compare the time it takes to get them set up and
+// running. Returns false if either fails to reproduce the data.
+bool test_compressors(const data_type trackmask, std::ostream& os);
+
+
 // this is a struct meant for bookeeping rather than for other means - it
 // acts as high-level interface tying all "implementation details" together.
 struct compressor_type {
@@ -317,6 +376,8 @@ struct compressor_type {
     data_type* compress(data_type* p) const;
     data_type* decompress(data_type* p) const;
 
+    ~compressor_type();
+
 
     private:
         // prohibit copying
@@ -328,12 +389,13 @@ struct compressor_type {
                                   const bool cmprem, const int signmagdistance);
 
         // told you: the bookkeeping stuff
-        jit_handle   handle;
-        data_type    lastmask;
-        unsigned int blocksize;
-        fptr_type    compress_fn;
-        fptr_type    decompress_fn;
-        int          lastsignmagdistance;
+        jit_handle      handle;
+        bitpacker_type* packer;
+        data_type       lastmask;
+        unsigned int    blocksize;
+        fptr_type       compress_fn;
+        fptr_type       decompress_fn;
+        int             lastsignmagdistance;
 };
 
 
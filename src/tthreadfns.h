@@ -31,6 +31,8 @@
 #include <threadutil.h>
 #include <getsok.h>
 #include <getsok_udt.h>
+#include <pacer.h>
+#include <zerocopy.h>
 #include <boyer_moore.h>
 #include <libudt5ab/udt.h>
 
@@ -425,6 +427,18 @@ void fdwriter(inq_type<T>* inq, sync_type<fdreaderargs>* args) {
 
     DEBUG(0, "fdwriter: writing to fd=" << network->fd << std::endl);
 
+    // Optionally let the kernel send straight from the blocks; it keeps
+    // them referenced until the kernel is done with them
+    zerocopy_writer_type*  zc = 0;
+
+    if( network->netparms.zerocopy ) {
+        zc = new zerocopy_writer_type(network->fd, "fdwriter");
+        if( !zc->enabled() ) {
+            delete zc;
+            zc = 0;
+        }
+    }
+
     uint64_t bytes_in_cache = 0;
     // blind copy of incoming data to outgoing filedescriptor
     while( true ) {
@@ -446,8 +460,18 @@ void fdwriter(inq_type<T>* inq, sync_type<fdreaderargs>* args) {
             cptr->iov_len   = bptr->iov_len;
             bcnt           += (ssize_t)bptr->iov_len;
         }
+        if( zc ) {
+            for( bptr=b.begin(), nchunk=0; bptr!=b.end() && nchunk<16; bptr++, nchunk++ )
+                zc->add( *bptr );
+            if( !zc->write() ) {
+                lastsyserror_type lse;
+                DEBUG(0, "fdwriter: fail to send " << bcnt << " bytes with MSG_ZEROCOPY " << lse << std::endl);
+                break;
+            }
+            rv = (ssize_t)bcnt;
+        }
         // DO NOT ENTER A BLOCKING SYSTEMCALL WITH A LOCK HELD!
-        if( (rv=::writev(network->fd, chunks, nchunk))!=(ssize_t)bcnt ) {
+        else if( (rv=::writev(network->fd, chunks, nchunk))!=(ssize_t)bcnt ) {
             lastsyserror_type lse;
             DEBUG(0, "fdwriter: fail to write " << bcnt << " bytes "
                      << lse << " (only " << rv << " written, nchunk=" << nchunk << ")" << std::endl);
@@ -467,6 +491,13 @@ void fdwriter(inq_type<T>* inq, sync_type<fdreaderargs>* args) {
             bytes_in_cache = 0;
         }
     }
+    // Before anything else, the kernel must let go of our blocks
+    if( zc ) {
+        zc->drain();
+        DEBUG(1, "fdwriter: " << zc->nsend() << " MSG_ZEROCOPY sends, of which " << zc->ncopied()
+                 << " were copied by the kernel after all" << std::endl);
+        delete zc;
+    }
     // Issue a shutdown for writing - we know we're not going to write data
     // anymore. Also issue a read - wait until the other end has closed as
     // well. In case the sokkit was already geclosed, this finishes
@@ -610,15 +641,10 @@ template <typename T>
 void udpswriter(inq_type<T>* inq, sync_type<fdreaderargs>* args) {
     int                    oldipd = -300;
     bool                   stop = false;
-    ssize_t                ntosend;
     runtime*               rteptr;
     uint64_t               seqnr;
     uint64_t               nbyte = 0;
-    struct iovec           iovect[2];
     fdreaderargs*          network = args->userdata;
-    struct msghdr          msg;
-    struct ::timeval       sop;
-    struct ::timeval       now;
     const netparms_type&   np( network->rteptr->netparms );
 
     rteptr = network->rteptr;
@@ -649,154 +675,67 @@ void udpswriter(inq_type<T>* inq, sync_type<fdreaderargs>* args) {
     // is strictly monotonically increasing.
     seqnr = (uint64_t)evlbi5a::random();
 
-    // Initialize stuff that will not change (sizes, some adresses etc)
-    msg.msg_name       = 0;
-    msg.msg_namelen    = 0;
-    msg.msg_iov        = &iovect[0];
-    msg.msg_iovlen     = sizeof(iovect)/sizeof(struct iovec);
-    msg.msg_control    = 0;
-    msg.msg_controllen = 0;
-    msg.msg_flags      = 0;
-
-    // part of the iovec can also be filled in [ie: the header]
-    iovect[0].iov_base = &seqnr;
-    iovect[0].iov_len  = sizeof(seqnr);
-    // we always send datagrams of size datagramsize
-    iovect[1].iov_len  = wr_size;
-
-    // Can precompute how many bytes should be sent in a sendmsg call
-    ntosend = iovect[0].iov_len + iovect[1].iov_len;
+    // Each datagram is the sequence number followed by wr_size bytes of
+    // data
+    const ssize_t          ntosend = sizeof(seqnr) + wr_size;
+    udp_sender_type        sender(network->fd, "udpswriter");
 
     DEBUG(0, "udpswriter: first sequencenr=" << seqnr
              << " fd=" << network->fd
              << " n2write=" << ntosend << std::endl);
-    // send out any incoming blocks out over the network
-    // initialize "start-of-packet" to "now()". the sendloop
-    // waits with sending as long as "now()" is not later than
-    // "start-of-packet". by forcing that condition to true here the
-    // first packet will be sent immediately.
-    // by doing it like this - having a time-of-send outside the
-    // major loop and pre-computing when to send the next packet
-    // (if any) - we get, hopefully, an even nicer behaved sending
-    // function: it is more of an absolute timing now than a 
-    // relative one ("wait ipd microseconds after you sent the
-    // previous one"), which was the previous implementation.
-#if 0
-    typedef std::map<int,unsigned int> histogram_type;
-    int              delta;
-    histogram_type   hist;
-    struct ::timeval last;
-#endif
-    ::gettimeofday(&sop, 0);
-#if 0
-    last = sop;
-#endif
+    // send out any incoming blocks out over the network.
+    // the sender paces the datagrams according to the ipd, which is
+    // in units of nanoseconds. Sending is done on an absolute time
+    // schedule ("datagram #n is due at t0 + n * ipd") rather than
+    // a relative one ("wait ipd after you sent the previous one"); it
+    // uses the monotonic clock so system time adjustments don't
+    // influence it.
+    // Datagrams are handed to the kernel in small batches; the sender
+    // is flushed at the end of each block since it does not copy the
+    // data.
     while( !stop ) {
         T b;
         if ( !inq->pop(b) ) {
             break;
         }
-        const int                  ipd( ipd_us(np) );
+        const int                  ipd( ipd_ns(np) );
         typename T::const_iterator bptr;
 
+        if( ipd!=oldipd ) {
+            DEBUG(0, "udpswriter: switch to ipd=" << ipd << "ns [set=" << ipd_set_ns(np) << "ns, " <<
+                    "theoretical=" << theoretical_ipd_ns(np) << "ns]" << std::endl);
+            oldipd = ipd;
+        }
+        sender.set_ipd( ipd );
+
         // Loop over all blocks in the popped item
-        for(bptr=b.begin(); bptr!=b.end(); bptr++) {
+        for(bptr=b.begin(); !stop && bptr!=b.end(); bptr++) {
             unsigned char*       ptr = (unsigned char*)bptr->iov_base;
             const unsigned char* eptr = (ptr + bptr->iov_len);
-            if( ipd!=oldipd ) {
-                DEBUG(0, "udpswriter: switch to ipd=" << ipd << " [set=" << ipd_set_us(np) << ", " <<
-                        "theoretical=" << theoretical_ipd_us(np) << "]" << std::endl);
-                oldipd = ipd;
-            }
+
             while( (ptr+wr_size)<=eptr ) {
-                // iovect[].iov_base is of the "void*" persuasion.
-                // we would've liked to use thattaone directly but
-                // because of its void-pointerishness we cannot
-                // (can't do pointer arith on "void*").
-                iovect[1].iov_base = ptr;
-
-                // at this point, wait until the current time
-                // is at least "start-of-packet" [and ipd >0 that is].
-                // in fact we delay sending of the packet until it is time to send it.
-                while( ipd>0 ) {
-                    ::gettimeofday(&now, 0);
-                    // Because of a problem with gettimeofday going back
-                    // under certain circumstances (https://lkml.org/lkml/2007/8/23/96)
-                    // we have to be suspicious of timejumps > 3600 seconds.
-                    // Technically we have a problem here since it can take
-                    // a non-zero amount of time between staring this
-                    // function (initializing 'start-of-packet', "sop")
-                    // immediately before the loop and the arrival of actual
-                    // data (the ".pop()" method is blocking - it could wait
-                    // a LOOOONG time before someone actually switches on
-                    // the dataflow!).
-                    // According to the lkml.org bug report the jump is
-                    // typically > 4000 seconds into the future so if we
-                    // give the system an hour .. that should be good
-                    // enough.
-                    // The fix: if the time diff > 3600 seconds, do a second
-                    // gettimeofday. If after that the time is *still* in
-                    // the future, it most likely actually *IS*, ie the
-                    // ".pop()" took a looooong time ;-)
-
-                    // Do the test in two steps since we can't really be
-                    // sure of what type the .tv_sec member is other than
-                    // being integral
-                    if( now.tv_sec>sop.tv_sec &&
-                        now.tv_sec - sop.tv_sec > 3600 )
-                            ::gettimeofday(&now, 0);
-                    if( now.tv_sec>sop.tv_sec )
-                        break;
-                    if( now.tv_sec<sop.tv_sec )
-                        continue;
-                    if( now.tv_usec>=sop.tv_usec )
-                        break;
-                }
-                if( ::sendmsg(network->fd, &msg, MSG_EOR)!=ntosend ) {
+                if( !sender.send(&seqnr, sizeof(seqnr), ptr, wr_size) ) {
                     DEBUG(-1, "udpswriter: failed to send " << ntosend << " bytes - " <<
                             evlbi5a::strerror(errno) << " (" << errno << ")" << std::endl);
                     stop = true;
                     break;
                 }
-#if 0
-                delta = ((int)now.tv_sec - (int)last.tv_sec)*1000000 + (int)now.tv_usec - (int)last.tv_usec;
-                hist[delta]++;
-                last = now;
-#endif
-
-                // update loopvariables.
-                // only update send-time of next packet if ipd>0
-                if( ipd>0 ) {
-                    sop          = now;
-                    sop.tv_usec += ipd;
-                    if( sop.tv_usec>=1000000 ) {
-                        sop.tv_sec  += 1;
-                        sop.tv_usec -= 1000000;
-                    }
-                }
                 ptr     += wr_size;
                 nbyte   += wr_size;
                 counter += ntosend;
                 seqnr++;
             }
         }
+        if( !stop && !sender.flush() ) {
+            DEBUG(-1, "udpswriter: failed to send " << ntosend << " bytes - " <<
+                    evlbi5a::strerror(errno) << " (" << errno << ")" << std::endl);
+            stop = true;
+        }
     }
     SYNCEXEC(args, delete network->threadid; network->threadid=0);
     DEBUG(0, "udpswriter: stopping. wrote "
              << nbyte << " (" << byteprint((double)nbyte, "byte") << ")"
              << std::endl);
-#if 0
-    histogram_type::const_iterator  cur;
-    for(cur=hist.begin(); cur!=hist.end(); cur++)
-        ::printf("%4d ", cur->first);
-    ::printf("\n");
-    for(size_t i=0; i<hist.size(); i++)
-        ::printf("----");
-    ::printf("\n");
-    for(cur=hist.begin(); cur!=hist.end(); cur++)
-        ::printf("%4d ", cur->second);
-    ::printf("\n");
-#endif
     network->finished = true;
 }
 
@@ -815,8 +754,7 @@ void vtpwriter(inq_type<T>* inq, sync_type<fdreaderargs>* args) {
     struct iovec           iovect[17];
     fdreaderargs*          network = args->userdata;
     struct msghdr          msg;
-    struct ::timeval       sop;
-    struct ::timeval       now;
+    pacer_type             pacer;
     const netparms_type&   np( network->rteptr->netparms );
 
     rteptr = network->rteptr;
@@ -868,26 +806,19 @@ void vtpwriter(inq_type<T>* inq, sync_type<fdreaderargs>* args) {
 
     DEBUG(0, "vtpwriter: first sequencenr=" << seqnr
              << " fd=" << network->fd << std::endl);
-    // send out any incoming blocks out over the network
-    // initialize "start-of-packet" to "now()". the sendloop
-    // waits with sending as long as "now()" is not later than
-    // "start-of-packet". by forcing that condition to true here the
-    // first packet will be sent immediately.
-    // by doing it like this - having a time-of-send outside the
-    // major loop and pre-computing when to send the next packet
-    // (if any) - we get, hopefully, an even nicer behaved sending
-    // function: it is more of an absolute timing now than a 
-    // relative one ("wait ipd microseconds after you sent the
-    // previous one"), which was the previous implementation.
-    ::gettimeofday(&sop, 0);
+    // send out any incoming blocks out over the network.
+    // each block is one datagram; the pacer releases them on an absolute
+    // time schedule ("datagram #n is due at t0 + n * ipd") with
+    // nanosecond resolution ipd.
     while( !stop && inq->pop(b) ) {
-        const int                  ipd( ipd_us(np) );
+        const int                  ipd( ipd_ns(np) );
         struct iovec*              cptr = &iovect[1];
         typename T::const_iterator bptr;
 
         if( ipd!=oldipd ) {
-            DEBUG(0, "vtpwriter: switch to ipd=" << ipd << " [set=" << ipd_set_us(np) << ", " <<
-                     "theoretical=" << theoretical_ipd_us(np) << "]" << std::endl);
+            DEBUG(0, "vtpwriter: switch to ipd=" << ipd << "ns [set=" << ipd_set_ns(np) << "ns, " <<
+                     "theoretical=" << theoretical_ipd_ns(np) << "ns]" << std::endl);
+            pacer.set_ipd( ipd );
             oldipd = ipd;
         }
         msg.msg_iovlen = 1;
@@ -898,18 +829,8 @@ void vtpwriter(inq_type<T>* inq, sync_type<fdreaderargs>* args) {
             ntosend        += bptr->iov_len;
         }
 
-        // at this point, wait until the current time
-        // is at least "start-of-packet" [and ipd >0 that is].
-        // in fact we delay sending of the packet until it is time to send it.
-        while( ipd>0 ) {
-            ::gettimeofday(&now, 0);
-            if( now.tv_sec>sop.tv_sec )
-                break;
-            if( now.tv_sec<sop.tv_sec )
-                continue;
-            if( now.tv_usec>=sop.tv_usec )
-                break;
-        }
+        // wait until it is time to send this one
+        pacer.wait( 1 );
 
         if( ::sendmsg(network->fd, &msg, MSG_EOR)!=ntosend ) {
             DEBUG(-1, "vtpwriter: failed to send " << ntosend << " bytes - " <<
@@ -917,17 +838,8 @@ void vtpwriter(inq_type<T>* inq, sync_type<fdreaderargs>* args) {
             stop = true;
             break;
         }
-        if( ipd>0 ) {
-            sop          = now;
-            sop.tv_usec += ipd;
-            if( sop.tv_usec>=1000000 ) {
-                sop.tv_sec  += 1;
-                sop.tv_usec -= 1000000;
-            }
-        }
 
         // update loopvariables.
-        // only update send-time of next packet if ipd>0
         nbyte   += ntosend;
         counter += ntosend;
         seqnr++;
@@ -951,8 +863,6 @@ void udpwriter(inq_type<T>* inq, sync_type<fdreaderargs>* args) {
     struct iovec           iovect[17];
 #endif
     fdreaderargs*          network = args->userdata;
-    struct ::timeval       sop;
-    struct ::timeval       now;
 #if 0
     struct msghdr          msg;
 #endif
@@ -994,23 +904,26 @@ void udpwriter(inq_type<T>* inq, sync_type<fdreaderargs>* args) {
 
     DEBUG(0, "udpwriter: writing to fd=" << network->fd << " wr:" << pktsize << std::endl);
     // any block we pop we put out in chunks of pktsize, honouring the ipd
-    ::gettimeofday(&sop, 0);
+    // (see udpswriter)
+    udp_sender_type  sender(network->fd, "udpwriter");
+
     while( !stop ) {
         T b;
         if ( !inq->pop(b) ) {
             break;
         }
-        const int                  ipd( ipd_us(np) );
+        const int                  ipd( ipd_ns(np) );
 #if 0
         unsigned int               io_bytes = 0, io = 0;
 #endif
         typename T::const_iterator bptr;
 
         if( ipd!=oldipd ) {
-            DEBUG(0, "udpwriter: switch to ipd=" << ipd << " [set=" << ipd_set_us(np) << ", " <<
-                     "theoretical=" << theoretical_ipd_us(np) << "]" << std::endl);
+            DEBUG(0, "udpwriter: switch to ipd=" << ipd << "ns [set=" << ipd_set_ns(np) << "ns, " <<
+                     "theoretical=" << theoretical_ipd_ns(np) << "ns]" << std::endl);
             oldipd = ipd;
         }
+        sender.set_ipd( ipd );
 #if 0
         // This is crappy loop: we have to loop over blocks and fill
         // the struct iovec at the same time. We send 'pktsize' bytes
@@ -1034,43 +947,17 @@ void udpwriter(inq_type<T>* inq, sync_type<fdreaderargs>* args) {
             }
         }
 #endif
-        for( bptr=b.begin(); bptr!=b.end(); bptr++ ) {
+        for( bptr=b.begin(); !stop && bptr!=b.end(); bptr++ ) {
             unsigned char*       ptr = (unsigned char*)bptr->iov_base;
             const unsigned char* eptr = (const unsigned char*)(ptr + bptr->iov_len);
             
             while( (ptr+pktsize)<=eptr ) {
-                // at this point, wait until the current time
-                // is at least "start-of-packet" [and ipd >0 that is].
-                // in fact we delay sending of the packet until it is time to send it.
-                while( ipd>0 ) {
-                    ::gettimeofday(&now, 0);
-                    // Need to take care of kernel bug - see below
-                    // comment in "udpswriter()" function
-                    if( now.tv_sec>sop.tv_sec &&
-                        now.tv_sec - sop.tv_sec > 3600 )
-                            ::gettimeofday(&now, 0);
-                    if( now.tv_sec>sop.tv_sec )
-                        break;
-                    if( now.tv_sec<sop.tv_sec )
-                        continue;
-                    if( now.tv_usec>=sop.tv_usec )
-                        break;
-                }
-
-                if( ::write(network->fd, ptr, pktsize)!=(int)pktsize ) {
+                if( !sender.send(0, 0, ptr, pktsize) ) {
                     lastsyserror_type lse;
                     DEBUG(0, "udpwriter: fail to write " << pktsize << " bytes " << lse << std::endl);
                     stop = true;
                     break;
                 }
-                if( ipd>0 ) {
-                    sop          = now;
-                    sop.tv_usec += ipd;
-                    if( sop.tv_usec>=1000000 ) {
-                        sop.tv_sec  += 1;
-                        sop.tv_usec -= 1000000;
-                    }
-                }
                 nbyte   += pktsize;
                 ptr     += pktsize;
                 counter += pktsize;
@@ -1079,6 +966,11 @@ void udpwriter(inq_type<T>* inq, sync_type<fdreaderargs>* args) {
                 DEBUG(-1, "udpwriter: internal constraint problem - block is not multiple of pkt\n"
                         <<"           block:" << bptr->iov_len << " pkt:" << pktsize << std::endl);
         }
+        if( !stop && !sender.flush() ) {
+            lastsyserror_type lse;
+            DEBUG(0, "udpwriter: fail to write " << pktsize << " bytes " << lse << std::endl);
+            stop = true;
+        }
     }
     SYNCEXEC(args, delete network->threadid; network->threadid=0);
     DEBUG(0, "udpwriter: stopping. wrote "
@@ -1190,16 +1082,13 @@ void netwriter(inq_type<T>* inq, sync_type<fdreaderargs>* args) {
     else if( proto=="itcp" ) {
         // write the itcp id into the stream before falling to the normal
         // tcp writer
-        std::string   itcp_id_buffer( "id: " + network->rteptr->itcp_id );
         pthread_t     my_tid( ::pthread_self() );
         pthread_t*    old_tid  = 0;
 
         SYNCEXEC(args, old_tid = network->threadid; network->threadid = &my_tid);
         install_zig_for_this_thread(SIGUSR1);
 
-        itcp_id_buffer.push_back('\0');
-        itcp_id_buffer.push_back('\0');
-        ASSERT_COND( ::write(network->fd, itcp_id_buffer.c_str(), itcp_id_buffer.size()) == (ssize_t)itcp_id_buffer.size() );
+        write_itcp_id(network);
 
         uninstall_zig_for_this_thread(SIGUSR1);
         SYNCEXEC(args, network->threadid = old_tid);
@@ -1400,6 +1289,9 @@ void multiwriter( inq_type<tagged<T> >* inq, sync_type<multifdargs>* args) {
 
                 userdata->fd        = cd->second;
                 userdata->rteptr    = args->userdata->rteptr;
+                // netwriter dispatches on the protocol in here, so only
+                // take over what fdwriter needs
+                userdata->netparms.zerocopy = args->userdata->netparms.zerocopy;
                 userdata->doaccept  = (proto=="rtcp") /* - would require support in multiopener as well! 
                                                            HV: 03-Dec-2013 multiopener has it now */;
 
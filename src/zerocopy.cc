@@ -0,0 +1,517 @@
+// implementation
+// Copyright (C) 2007-2013 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.nl
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <zerocopy.h>
+#include <blockpool.h>
+#include <dosyscall.h>
+#include <evlbidebug.h>
+#include <mutex_locker.h>
+#include <pacer.h>       // for monotonic_ns()
+#include <pthreadcall.h>
+#include <stringutil.h>
+#include <threadutil.h>  // for evlbi5a::strerror()
+
+#include <algorithm>
+#include <iomanip>
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#if defined(__linux__)
+    #include <sys/sendfile.h>
+    #define ZEROCOPY_SENDFILE 1
+#endif
+// MSG_ZEROCOPY appeared in Linux 4.14
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    #include <linux/errqueue.h>
+    #define ZEROCOPY_MSG 1
+#endif
+
+using namespace std;
+
+
+bool sendfile_in_kernel( void ) {
+#ifdef ZEROCOPY_SENDFILE
+    return true;
+#else
+    return false;
+#endif
+}
+
+#ifdef ZEROCOPY_SENDFILE
+
+ssize_t sendfile_range(int out_fd, int in_fd, off_t* offset, size_t count) {
+    size_t  nsent = 0;
+
+    // sendfile(2) on a socket may return having sent only part of what
+    // was asked for, so loop until done
+    while( nsent<count ) {
+        const ssize_t  r = ::sendfile(out_fd, in_fd, offset, count - nsent);
+
+        if( r<=0 ) {
+            // r==0 => EOF on in_fd
+            if( r<0 && nsent==0 )
+                return -1;
+            break;
+        }
+        nsent += (size_t)r;
+    }
+    return (ssize_t)nsent;
+}
+
+#else
+
+ssize_t sendfile_range(int out_fd, int in_fd, off_t* offset, size_t count) {
+    char    buf[65536];
+    size_t  nsent = 0;
+
+    while( nsent<count ) {
+        const ssize_t  nr = ::pread(in_fd, buf, std::min(sizeof(buf), count - nsent), *offset);
+        ssize_t        nw = 0;
+
+        if( nr<=0 ) {
+            if( nr<0 && nsent==0 )
+                return -1;
+            break;
+        }
+        while( nw<nr ) {
+            const ssize_t  w = ::write(out_fd, buf + nw, (size_t)(nr - nw));
+
+            if( w<=0 )
+                return (nsent + nw) ? (ssize_t)(nsent + nw) : -1;
+            nw      += w;
+            *offset += w;
+        }
+        nsent += (size_t)nw;
+    }
+    return (ssize_t)nsent;
+}
+
+#endif
+
+
+//
+//   MSG_ZEROCOPY
+//
+zerocopy_writer_type::pending_type::pending_type(uint32_t s):
+    seqno( s ), done( false )
+{}
+
+zerocopy_writer_type::zerocopy_writer_type(int f, const string& w):
+    fd( f ), who( w ), zc( false ), seqno( 0 ), nsent( 0 ), ncopy( 0 )
+{
+#ifdef ZEROCOPY_MSG
+    int                      one = 1;
+    int                      type = 0;
+    socklen_t                tlen = sizeof(type);
+    struct sockaddr_storage  addr;
+    socklen_t                alen = sizeof(addr);
+
+    // Only for tcp; files, unix sockets and udp are written normally
+    if( ::getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &tlen)!=0 || type!=SOCK_STREAM ||
+        ::getsockname(fd, (struct sockaddr*)&addr, &alen)!=0 ||
+        (addr.ss_family!=AF_INET && addr.ss_family!=AF_INET6) ) {
+        DEBUG(2, who << ": not a tcp socket, not using MSG_ZEROCOPY" << endl);
+    } else if( ::setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one))==0 ) {
+        zc = true;
+        DEBUG(2, who << ": sending with MSG_ZEROCOPY" << endl);
+    } else {
+        DEBUG(-1, who << ": cannot set SO_ZEROCOPY, sending normally - " << evlbi5a::strerror(errno) << endl);
+    }
+#else
+    DEBUG(-1, who << ": MSG_ZEROCOPY not available on this system, sending normally" << endl);
+#endif
+}
+
+bool zerocopy_writer_type::enabled( void ) const {
+    return zc;
+}
+
+void zerocopy_writer_type::add(const block& b) {
+    current.push_back( b );
+}
+
+uint64_t zerocopy_writer_type::nsend( void ) const {
+    return nsent;
+}
+
+uint64_t zerocopy_writer_type::ncopied( void ) const {
+    return ncopy;
+}
+
+bool zerocopy_writer_type::write( void ) {
+    ssize_t        r;
+    size_t         todo = 0;
+    unsigned int   niov = 0;
+    struct iovec   iov[max_blocks];
+    struct iovec*  iovptr = &iov[0];
+
+    for(vector<block>::const_iterator p=current.begin(); p!=current.end() && niov<max_blocks; p++, niov++) {
+        iov[niov].iov_base = p->iov_base;
+        iov[niov].iov_len  = p->iov_len;
+        todo              += p->iov_len;
+    }
+
+    if( !zc ) {
+        r = ::writev(fd, iov, niov);
+        current.clear();
+        return r==(ssize_t)todo;
+    }
+
+#ifdef ZEROCOPY_MSG
+    struct msghdr  msg;
+
+    ::memset(&msg, 0, sizeof(msg));
+    while( todo ) {
+        // Don't let too many sends (and their blocks) pile up
+        while( pending.size()>=max_pending )
+            if( !this->reap(5000) ) {
+                this->hold_current();
+                return false;
+            }
+
+        msg.msg_iov    = iovptr;
+        msg.msg_iovlen = niov;
+        if( (r=::sendmsg(fd, &msg, MSG_ZEROCOPY))<=0 ) {
+            // The pinned pages count against the socket's optmem limit;
+            // if we run out, wait for some to be released
+            if( r<0 && errno==ENOBUFS && !pending.empty() && this->reap(5000) )
+                continue;
+            this->hold_current();
+            return false;
+        }
+        pending.push_back( pending_type(seqno++) );
+        nsent++;
+        todo -= (size_t)r;
+
+        // Skip what was sent, in case it wasn't everything
+        while( r>0 && niov ) {
+            if( (size_t)r<iovptr->iov_len ) {
+                iovptr->iov_base  = (unsigned char*)iovptr->iov_base + r;
+                iovptr->iov_len  -= (size_t)r;
+                break;
+            }
+            r -= (ssize_t)iovptr->iov_len;
+            iovptr++;
+            niov--;
+        }
+        // Pick up whatever completed already
+        this->reap(0);
+    }
+    this->hold_current();
+    this->reap(0);
+#endif
+    return true;
+}
+
+// The last send for the current blocks keeps them alive; also when not all
+// of them could be sent: the ones that were may still be in flight.
+// The blocks are added to what that send holds already, it may be one of
+// a previous write(). If nothing is pending, the kernel is done with all
+// of it.
+void zerocopy_writer_type::hold_current( void ) {
+    if( !pending.empty() )
+        pending.back().blocks.insert(pending.back().blocks.end(), current.begin(), current.end());
+    current.clear();
+}
+
+bool zerocopy_writer_type::reap(int timeout_ms) {
+#ifdef ZEROCOPY_MSG
+    if( pending.empty() )
+        return true;
+
+    // The error queue becoming readable is signalled as POLLERR, which
+    // is always reported
+    if( timeout_ms>0 ) {
+        struct pollfd  pfd;
+
+        pfd.fd      = fd;
+        pfd.events  = 0;
+        pfd.revents = 0;
+        const int  r = ::poll(&pfd, 1, timeout_ms);
+
+        if( r==0 )
+            errno = ETIMEDOUT;
+        if( r<=0 )
+            return false;
+    }
+
+    // When asked to wait, something must have completed; the socket may
+    // also wake us up because the other side hung up
+    unsigned int  ncompletion = 0;
+
+    while( true ) {
+        union {
+            size_t          align;   // what cmsghdr needs
+            unsigned char   buf[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+        }                       ctl;
+        struct msghdr           msg;
+        struct cmsghdr*         cm;
+
+        ::memset(&msg, 0, sizeof(msg));
+        msg.msg_control    = &ctl.buf[0];
+        msg.msg_controllen = sizeof(ctl.buf);
+
+        if( ::recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT)<0 ) {
+            if( errno!=EAGAIN && errno!=EWOULDBLOCK )
+                return false;
+            if( timeout_ms>0 && ncompletion==0 ) {
+                errno = EPIPE;
+                return false;
+            }
+            return true;
+        }
+
+        for(cm=CMSG_FIRSTHDR(&msg); cm!=0; cm=CMSG_NXTHDR(&msg, cm)) {
+            if( !((cm->cmsg_level==SOL_IP && cm->cmsg_type==IP_RECVERR) ||
+                  (cm->cmsg_level==SOL_IPV6 && cm->cmsg_type==IPV6_RECVERR)) )
+                continue;
+
+            struct sock_extended_err  serr;
+
+            ::memcpy(&serr, CMSG_DATA(cm), sizeof(serr));
+            if( serr.ee_origin!=SO_EE_ORIGIN_ZEROCOPY ) {
+                DEBUG(-1, who << ": unexpected message on error queue - " << evlbi5a::strerror(serr.ee_errno) << endl);
+                continue;
+            }
+            // sends [ee_info, ee_data] have completed
+            ncompletion++;
+            if( serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED )
+                ncopy += (uint64_t)(serr.ee_data - serr.ee_info) + 1;
+            for(uint32_t s=serr.ee_info; !pending.empty(); s++) {
+                const uint32_t  idx = s - pending.front().seqno;
+
+                if( idx<pending.size() )
+                    pending[idx].done = true;
+                if( s==serr.ee_data )
+                    break;
+            }
+        }
+        // Release everything up to the first send still in flight
+        while( !pending.empty() && pending.front().done )
+            pending.pop_front();
+    }
+#else
+    (void)timeout_ms;
+    return true;
+#endif
+}
+
+bool zerocopy_writer_type::drain(int timeout_ms) {
+    while( !pending.empty() ) {
+        if( !this->reap(timeout_ms) ) {
+            DEBUG(-1, who << ": gave up waiting for " << pending.size() << " zero-copy send(s) to complete - "
+                      << evlbi5a::strerror(errno) << endl);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Blocks of sends whose completion never came. The kernel may still be
+// reading from them so they can never be reused: keep them referenced
+// forever, out of their pool. Leaking memory beats sending garbage.
+static pthread_mutex_t       limbo_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<block>*   limbo       = 0;
+
+zerocopy_writer_type::~zerocopy_writer_type() {
+    if( this->drain() )
+        return;
+
+    size_t          nblock = 0;
+    mutex_locker    lck( limbo_mutex );
+
+    if( limbo==0 )
+        limbo = new std::vector<block>();
+    for(pending_list::const_iterator p=pending.begin(); p!=pending.end(); p++) {
+        limbo->insert(limbo->end(), p->blocks.begin(), p->blocks.end());
+        nblock += p->blocks.size();
+    }
+    DEBUG(-1, who << ": keeping " << nblock << " block(s) of unfinished zero-copy sends out of circulation" << endl);
+}
+
+
+//
+//   Benchmark
+//
+namespace {
+    struct zc_receiver_type {
+        int           fd;
+        unsigned int  blocksize;
+        uint64_t      nblock;
+        uint64_t      nbad;
+        uint64_t      nbyte;
+    };
+
+    // Read all blocks and check that block #i is filled with 'i'
+    void* zc_receiver(void* arg) {
+        zc_receiver_type*     rcv = (zc_receiver_type*)arg;
+        const unsigned int    nword = rcv->blocksize/sizeof(uint64_t);
+        std::vector<uint64_t> buf( nword );
+
+        for(uint64_t i=0; i<rcv->nblock; i++) {
+            if( ::recv(rcv->fd, &buf[0], rcv->blocksize, MSG_WAITALL)!=(ssize_t)rcv->blocksize )
+                break;
+            rcv->nbyte += rcv->blocksize;
+            for(unsigned int w=0; w<nword; w++)
+                if( buf[w]!=i ) {
+                    rcv->nbad++;
+                    break;
+                }
+        }
+        return (void*)0;
+    }
+
+    double thread_cpu( void ) {
+        struct timespec  ts;
+
+        ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return (double)ts.tv_sec + (double)ts.tv_nsec/1.0e9;
+    }
+
+    // connected loopback tcp socket pair
+    void zc_socketpair(int& snd, int& rcv) {
+        int                 lsn;
+        struct sockaddr_in  sa;
+        socklen_t           salen = sizeof(sa);
+
+        ::memset(&sa, 0, sizeof(sa));
+        sa.sin_family      = AF_INET;
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        sa.sin_port        = 0;
+        ASSERT_POS( lsn=::socket(AF_INET, SOCK_STREAM, 0) );
+        ASSERT_ZERO( ::bind(lsn, (const struct sockaddr*)&sa, sizeof(sa)) );
+        ASSERT_ZERO( ::listen(lsn, 1) );
+        ASSERT_ZERO( ::getsockname(lsn, (struct sockaddr*)&sa, &salen) );
+        ASSERT_POS( snd=::socket(AF_INET, SOCK_STREAM, 0) );
+        ASSERT_ZERO( ::connect(snd, (const struct sockaddr*)&sa, sizeof(sa)) );
+        ASSERT_POS( rcv=::accept(lsn, 0, 0) );
+        ::close(lsn);
+    }
+
+    bool zc_run(bool zerocopy, unsigned int blocksize, uint64_t nblock, std::ostream& os) {
+        int                    snd, rcvfd;
+        double                 cpu = 0.0;
+        uint64_t               nsend = 0, ncopy = 0;
+        pthread_t              rcvthread;
+        blockpool_type*        pool = new blockpool_type(blocksize, 8);
+        zc_receiver_type       rcv;
+        const unsigned int     nword = blocksize/sizeof(uint64_t);
+
+        zc_socketpair(snd, rcvfd);
+        rcv.fd        = rcvfd;
+        rcv.blocksize = blocksize;
+        rcv.nblock    = nblock;
+        rcv.nbad      = 0;
+        rcv.nbyte     = 0;
+        PTHREAD_CALL( ::pthread_create(&rcvthread, 0, zc_receiver, (void*)&rcv) );
+
+        zerocopy_writer_type*  zc = (zerocopy ? new zerocopy_writer_type(snd, "test_zerocopy") : 0);
+        const uint64_t         t0 = monotonic_ns();
+
+        if( zc && !zc->enabled() ) {
+            os << "   zerocopy  not available on this system" << endl;
+            delete zc;
+            zc = 0;
+        }
+
+        for(uint64_t i=0; i<nblock; i++) {
+            block       b = pool->get();
+            uint64_t*   wp = (uint64_t*)b.iov_base;
+
+            // A block that's still in use by the kernel must not come
+            // back from the pool, overwriting it would show up at the
+            // receiver
+            for(unsigned int w=0; w<nword; w++)
+                wp[w] = i;
+
+            bool          ok;
+            const double  c0 = thread_cpu();
+
+            if( zc ) {
+                zc->add( b );
+                ok = zc->write();
+            } else {
+                ok = (::write(snd, b.iov_base, b.iov_len)==(ssize_t)b.iov_len);
+            }
+            cpu += thread_cpu() - c0;
+            if( !ok ) {
+                os << "FAIL send - " << evlbi5a::strerror(errno) << endl;
+                break;
+            }
+        }
+        if( zc ) {
+            const double  c0 = thread_cpu();
+            zc->drain();
+            cpu  += thread_cpu() - c0;
+            nsend = zc->nsend();
+            ncopy = zc->ncopied();
+            delete zc;
+        }
+
+        PTHREAD_CALL( ::pthread_join(rcvthread, 0) );
+        const double  dt = (double)(monotonic_ns() - t0)/1.0e9;
+        const double  gb = (double)rcv.nbyte/1.0e9;
+
+        os << "   " << std::setw(9) << std::left << (zerocopy ? "zerocopy" : "write") << std::right
+           << std::fixed << std::setprecision(2)
+           << std::setw(7) << (gb*8)/dt << " Gbps  "
+           << std::setw(6) << cpu/gb << " s CPU/GB";
+        if( zerocopy )
+            os << "  " << nsend << " sends, " << ncopy << " copied by kernel";
+        os << endl << "      " << pool->status() << endl;
+        ::close(snd);
+        ::close(rcvfd);
+        delete pool;
+
+        if( rcv.nbyte!=(uint64_t)blocksize*nblock || rcv.nbad ) {
+            os << "FAIL received " << rcv.nbyte << " bytes, " << rcv.nbad << " corrupted blocks" << endl;
+            return false;
+        }
+        return true;
+    }
+}
+
+bool test_zerocopy(const string& spec, ostream& os) {
+    unsigned long             blocksize = 1048576, mbyte = 2048;
+    const vector<string>      parts( ::split(spec, ',') );
+    char*                     eocptr;
+
+    if( parts.size()>0 && !parts[0].empty() )
+        blocksize = ::strtoul(parts[0].c_str(), &eocptr, 0);
+    if( parts.size()>1 && !parts[1].empty() )
+        mbyte = ::strtoul(parts[1].c_str(), &eocptr, 0);
+    if( blocksize<sizeof(uint64_t) || blocksize%sizeof(uint64_t) || mbyte==0 ) {
+        os << "Invalid zero-copy test '" << spec << "'" << endl;
+        return false;
+    }
+    const uint64_t  nblock = std::max((uint64_t)1, (uint64_t)mbyte*1048576/blocksize);
+
+    os << "tcp over loopback, " << nblock << " blocks of " << blocksize << " bytes" << endl;
+    return zc_run(false, (unsigned int)blocksize, nblock, os) &&
+           zc_run(true, (unsigned int)blocksize, nblock, os);
+}
@@ -0,0 +1,132 @@
+// move file data to a socket without copying it through user space
+// Copyright (C) 2007-2013 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.nl
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef JIVE5A_ZEROCOPY_H
+#define JIVE5A_ZEROCOPY_H
+
+#include <block.h>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Send 'count' bytes from file 'in_fd', starting at '*offset', to
+// (stream) socket 'out_fd'. '*offset' is updated, the file pointer of
+// 'in_fd' is not touched.
+//
+// Where the system has sendfile(2) the data goes from the page cache
+// straight to the socket, otherwise it is pread(2)/write(2) through a
+// buffer.
+//
+// Returns the number of bytes sent, which is less than 'count' on EOF or
+// when an error (or signal) interrupted the transfer after something was
+// sent already. Returns -1 if nothing was sent due to an error (errno set).
+ssize_t sendfile_range(int out_fd, int in_fd, off_t* offset, size_t count);
+
+// Is sendfile_range() done by the kernel on this system?
+bool    sendfile_in_kernel( void );
+
+
+// Transmit blocks over a tcp socket using MSG_ZEROCOPY: the kernel sends
+// straight from our memory in stead of copying it into the socket buffer
+// first. The catch is that the memory may not be touched until the
+// kernel says it is done with it. Therefore the blocks sent are kept
+// referenced - and thus out of their blockpool - until the completion
+// notification for them has been read from the socket's error queue.
+//
+// Where MSG_ZEROCOPY is not available, or the socket refuses SO_ZEROCOPY,
+// enabled() returns false and write() is a plain writev(2).
+class zerocopy_writer_type {
+    public:
+        // write() waits for the kernel to catch up if this many sends are
+        // still awaiting their completion
+        static const unsigned int max_pending = 256;
+        // max number of blocks per write()
+        static const unsigned int max_blocks  = 16;
+
+        // 'who' is used for logging
+        zerocopy_writer_type(int fd, const std::string& who);
+
+        bool      enabled( void ) const;
+
+        // Add a block to the next write()
+        void      add(const block& b);
+
+        // Send all blocks add()ed since the previous write(). Returns
+        // false if that failed, errno is set
+        bool      write( void );
+
+        // Wait until the kernel is done with everything that was sent.
+        // Gives up if nothing completes for 'timeout_ms'; returns false
+        // in that case. The blocks of unfinished sends stay referenced,
+        // also by the d'tor: the kernel may still read from them
+        bool      drain(int timeout_ms = 5000);
+
+        // How many sends were done and how many of those the kernel
+        // ended up copying after all (e.g. over loopback)
+        uint64_t  nsend( void ) const;
+        uint64_t  ncopied( void ) const;
+
+        // drain()s
+        ~zerocopy_writer_type();
+
+    private:
+        // One entry per sendmsg(2); the blocks are attached to the last
+        // send for them
+        struct pending_type {
+            uint32_t            seqno;
+            bool                done;
+            std::vector<block>  blocks;
+
+            pending_type(uint32_t s);
+        };
+        typedef std::deque<pending_type> pending_list;
+
+        int                 fd;
+        std::string         who;
+        bool                zc;
+        uint32_t            seqno;
+        uint64_t            nsent;
+        uint64_t            ncopy;
+        std::vector<block>  current;
+        pending_list        pending;
+
+        // Process the completion notifications on the error queue. With
+        // timeout_ms>0 wait that long for one to arrive. Returns false on
+        // error or timeout
+        bool      reap(int timeout_ms);
+
+        // Attach the blocks in 'current' to the last send
+        void      hold_current( void );
+
+        // no copying/assignment
+        zerocopy_writer_type(const zerocopy_writer_type&);
+        const zerocopy_writer_type& operator=(const zerocopy_writer_type&);
+};
+
+
+// Send data over a loopback tcp connection, once using plain writev(2) and
+// once with MSG_ZEROCOPY, report throughput and CPU usage of the sender
+// and check that the data arrived intact. 'spec' is
+// "[<blocksize>][,<megabytes>]" (default 1048576,2048).
+bool test_zerocopy(const std::string& spec, std::ostream& os);
+
+#endif